@@ -6,43 +6,89 @@
 #include "third_party/stb/stb_image.h" 
 #include "third_party/gli/gli.hpp"
 
+#include <memory>
+#include <cstring>
+
 using namespace avl;
 
+struct stbi_deleter { void operator()(uint8_t * p) const { stbi_image_free(p); } };
+
+// Decoded 8-bit image, still in the buffer stb_image allocated
+struct decoded_image
+{
+    int width{ 0 }, height{ 0 }, channels{ 0 };
+    std::unique_ptr<uint8_t, stbi_deleter> pixels;
+    size_t size_bytes() const { return size_t(width) * size_t(height) * size_t(channels); }
+};
+
+// Safe to call from any thread: flipping is done here rather than through stb_image's global flag
+inline decoded_image decode_image(const uint8_t * encoded, const size_t length, const bool flip = false)
+{
+    decoded_image img;
+    img.pixels.reset(stbi_load_from_memory(encoded, (int)length, &img.width, &img.height, &img.channels, 0));
+    if (!img.pixels) throw std::runtime_error(std::string("image decode failed: ") + stbi_failure_reason());
+
+    if (flip)
+    {
+        const size_t stride = size_t(img.width) * img.channels;
+        std::vector<uint8_t> row(stride);
+        for (int y = 0; y < img.height / 2; ++y)
+        {
+            uint8_t * a = img.pixels.get() + stride * y;
+            uint8_t * b = img.pixels.get() + stride * (img.height - 1 - y);
+            std::memcpy(row.data(), a, stride);
+            std::memcpy(a, b, stride);
+            std::memcpy(b, row.data(), stride);
+        }
+    }
+    return img;
+}
+
+inline decoded_image decode_image(const std::vector<uint8_t> & encoded, const bool flip = false)
+{
+    return decode_image(encoded.data(), encoded.size(), flip);
+}
+
 inline std::vector<uint8_t> load_image_data(const std::string & path)
 {
-    auto binaryFile = read_file_binary(path);
-
-    int width, height, nBytes;
-    auto data = stbi_load_from_memory(binaryFile.data(), (int)binaryFile.size(), &width, &height, &nBytes, 0);
-    std::vector<uint8_t> d(width * height * nBytes);
-    std::memcpy(d.data(), data, nBytes * width * height);
-    stbi_image_free(data);
-    return d;
+    mapped_file file(path);
+    decoded_image img = decode_image(file.data(), file.size());
+    return std::vector<uint8_t>(img.pixels.get(), img.pixels.get() + img.size_bytes());
 }
 
 // fixme - these functions belong in a gl-xyz.hpp file
 
+// Sized internal format and pixel format for an 8-bit image with `channels` components
+inline void image_gl_format(const int channels, GLenum & internalFormat, GLenum & format)
+{
+    switch (channels)
+    {
+        case 1: internalFormat = GL_R8; format = GL_RED; break;
+        case 2: internalFormat = GL_RG8; format = GL_RG; break;
+        case 3: internalFormat = GL_RGB8; format = GL_RGB; break;
+        case 4: internalFormat = GL_RGBA8; format = GL_RGBA; break;
+        default: throw std::runtime_error("unsupported number of channels");
+    }
+}
+
+// Blocking: decodes and uploads on the calling thread. See GlTextureStreamer for the asynchronous path.
 inline GlTexture2D load_image(const std::string & path, bool flip = false)
 {
-    auto binaryFile = avl::read_file_binary(path);
+    mapped_file file(path);
+    decoded_image img = decode_image(file.data(), file.size(), flip);
 
-    if (flip) stbi_set_flip_vertically_on_load(1);
-    else stbi_set_flip_vertically_on_load(0);
+    GLenum internalFormat, format;
+    image_gl_format(img.channels, internalFormat, format);
 
-    int width, height, nBytes;
-    auto data = stbi_load_from_memory(binaryFile.data(), (int)binaryFile.size(), &width, &height, &nBytes, 0);
+    GLint alignment;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
     GlTexture2D tex;
-    switch (nBytes)
-    {
-        case 1: tex.setup(width, height, GL_RED, GL_RED, GL_UNSIGNED_BYTE, data, true); break;
-        case 2: tex.setup(width, height, GL_RED, GL_RED, GL_UNSIGNED_SHORT, data, true); break;
-        case 3: tex.setup(width, height, GL_RGB, GL_RGB, GL_UNSIGNED_BYTE, data, true); break;
-        case 4: tex.setup(width, height, GL_RGBA, GL_RGBA, GL_UNSIGNED_BYTE, data, true); break;
-        default: throw std::runtime_error("unsupported number of channels");
-    }
+    tex.setup(img.width, img.height, internalFormat, format, GL_UNSIGNED_BYTE, img.pixels.get(), true);
     tex.set_name(path);
-    stbi_image_free(data);
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
     return tex;
 }
 
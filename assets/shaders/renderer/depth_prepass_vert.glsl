@@ -9,6 +9,8 @@ layout(location = 5) in vec3 inBitangent;
 
 void main()
 {
-    vec4 worldPosition = u_modelMatrix * vec4(inPosition, 1.0);
-    gl_Position = u_viewProjMatrix * worldPosition;
+    vec4 worldPosition = u_objects[gl_DrawIDARB].modelMatrix * vec4(inPosition, 1.0);
+    const int viewIndex = VIEW_INDEX;
+    gl_Position = u_views[viewIndex].viewProjMatrix * worldPosition;
+    ROUTE_TO_VIEW(viewIndex);
 }
\ No newline at end of file
@@ -21,6 +21,8 @@ in vec3 v_normal;
 in vec2 v_texcoord;
 in vec3 v_tangent;
 in vec3 v_bitangent;
+flat in float v_receive_shadow;
+flat in int v_view_index;
 
 // Material Uniforms
 uniform float u_roughness = 1;
@@ -209,7 +211,7 @@ void main()
     float alphaRoughness = roughness * roughness;
 
     // View direction
-    vec3 V = normalize(u_eyePos.xyz - v_world_position);
+    vec3 V = normalize(u_views[v_view_index].eyePos.xyz - v_world_position);
     float NdotV = abs(dot(N, V)) + 0.001;
 
     vec3 F0 = vec3(u_specularLevel);
@@ -256,7 +258,7 @@ void main()
         float shadowTerm = 1.0;
         #ifdef ENABLE_SHADOWS
         shadowTerm = calculate_csm_coefficient(s_csmArray, biased_pos, v_view_space_position, u_cascadesMatrix, u_cascadesPlane, debugShadowCascadeColor);
-        shadowVisibility = 1.0 - ((shadowTerm  * NdotL) * u_shadowOpacity * u_receiveShadow);
+        shadowVisibility = 1.0 - ((shadowTerm  * NdotL) * u_shadowOpacity * v_receive_shadow);
         #endif
 
         vec3 diffuseContrib, specContrib;
@@ -13,17 +13,24 @@ out vec3 v_view_space_position;
 out vec2 v_texcoord;
 out vec3 v_tangent;
 out vec3 v_bitangent;
+flat out float v_receive_shadow;
+flat out int v_view_index;
 
 uniform vec2 u_texCoordScale = vec2(1, 1);
 
 void main()
 {
-    vec4 worldPosition = u_modelMatrix * vec4(inPosition, 1.0);
-    gl_Position = u_viewProjMatrix * worldPosition;
-    v_view_space_position = (u_modelViewMatrix * vec4(inPosition, 1.0)).xyz;
-    v_normal = normalize((u_modelMatrixIT * vec4(inNormal, 0)).xyz);
+    ObjectData object = u_objects[gl_DrawIDARB];
+    vec4 worldPosition = object.modelMatrix * vec4(inPosition, 1.0);
+    const int viewIndex = VIEW_INDEX;
+    gl_Position = u_views[viewIndex].viewProjMatrix * worldPosition;
+    v_view_space_position = (u_views[viewIndex].viewMatrix * worldPosition).xyz;
+    v_normal = normalize((object.modelMatrixIT * vec4(inNormal, 0)).xyz);
     v_world_position = worldPosition.xyz;
     v_texcoord = inTexCoord * u_texCoordScale;
-    v_tangent = (u_modelMatrixIT * vec4(inTangent, 0)).xyz;
-    v_bitangent = (u_modelMatrixIT * vec4(inBitangent, 0)).xyz;
+    v_tangent = (object.modelMatrixIT * vec4(inTangent, 0)).xyz;
+    v_bitangent = (object.modelMatrixIT * vec4(inBitangent, 0)).xyz;
+    v_receive_shadow = object.receiveShadow;
+    v_view_index = viewIndex;
+    ROUTE_TO_VIEW(viewIndex);
 }
\ No newline at end of file
@@ -0,0 +1,30 @@
+#version 450 core
+
+// Dual-filter downsample: one level of the chain into the next, all views at once (z = view)
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+uniform sampler2DArray s_source;
+layout(rgba16f, binding = 0) uniform writeonly image2DArray u_output;
+
+uniform int u_sourceLevel;
+
+void main()
+{
+    ivec3 size = imageSize(u_output);
+    ivec3 p = ivec3(gl_GlobalInvocationID);
+    if (any(greaterThanEqual(p, size))) return;
+
+    vec2 texel = 1.0 / vec2(textureSize(s_source, u_sourceLevel).xy);
+    vec2 uv = (vec2(p.xy) + 0.5) / vec2(size.xy);
+    float layer = float(p.z);
+    float lod = float(u_sourceLevel);
+
+    vec3 c = textureLod(s_source, vec3(uv, layer), lod).rgb * 4.0;
+    c += textureLod(s_source, vec3(uv + vec2(-texel.x, -texel.y), layer), lod).rgb;
+    c += textureLod(s_source, vec3(uv + vec2( texel.x, -texel.y), layer), lod).rgb;
+    c += textureLod(s_source, vec3(uv + vec2(-texel.x,  texel.y), layer), lod).rgb;
+    c += textureLod(s_source, vec3(uv + vec2( texel.x,  texel.y), layer), lod).rgb;
+
+    imageStore(u_output, p, vec4(c * (1.0 / 8.0), 1.0));
+}
@@ -0,0 +1,67 @@
+#version 450 core
+
+// First level of the bloom chain: exposes the scene with the adapted exposure, downsamples to half
+// resolution and keeps only what is above the (soft) threshold. Taps are weighted by 1 / (1 + luma)
+// so single bright pixels don't turn into flickering blobs.
+
+#define LUMINANCE_HISTORY 64
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+layout(std430, binding = 3) buffer LuminanceState
+{
+    float u_adaptedLuminance;
+    float u_autoExposure;
+    uint u_historyIndex;
+    float u_pad;
+    float u_history[LUMINANCE_HISTORY];
+};
+
+uniform sampler2D s_texColor;
+layout(rgba16f, binding = 0) uniform writeonly image2DArray u_output;
+
+uniform int u_layer;
+uniform float u_exposure;
+uniform float u_threshold;
+uniform float u_knee;
+
+float luma(vec3 rgb)
+{
+    return dot(vec3(0.2126729, 0.7151522, 0.0721750), rgb);
+}
+
+vec3 karis_weighted(vec3 c, inout float weightSum)
+{
+    float w = 1.0 / (1.0 + luma(c));
+    weightSum += w;
+    return c * w;
+}
+
+void main()
+{
+    ivec2 size = imageSize(u_output).xy;
+    ivec2 p = ivec2(gl_GlobalInvocationID.xy);
+    if (any(greaterThanEqual(p, size))) return;
+
+    vec2 texel = 1.0 / vec2(textureSize(s_texColor, 0));
+    vec2 uv = (vec2(p) + 0.5) / vec2(size);
+
+    float weightSum = 0.0;
+    vec3 c = karis_weighted(textureLod(s_texColor, uv, 0).rgb, weightSum) * 4.0;
+    weightSum *= 4.0;
+    c += karis_weighted(textureLod(s_texColor, uv + vec2(-texel.x, -texel.y), 0).rgb, weightSum);
+    c += karis_weighted(textureLod(s_texColor, uv + vec2( texel.x, -texel.y), 0).rgb, weightSum);
+    c += karis_weighted(textureLod(s_texColor, uv + vec2(-texel.x,  texel.y), 0).rgb, weightSum);
+    c += karis_weighted(textureLod(s_texColor, uv + vec2( texel.x,  texel.y), 0).rgb, weightSum);
+    c /= weightSum;
+
+    c *= u_autoExposure * u_exposure;
+
+    // Quadratic knee below the threshold
+    float brightness = max(c.r, max(c.g, c.b));
+    float soft = clamp(brightness - u_threshold + u_knee, 0.0, 2.0 * u_knee);
+    soft = (soft * soft) / (4.0 * u_knee + 0.0001);
+    c *= max(soft, brightness - u_threshold) / max(brightness, 0.0001);
+
+    imageStore(u_output, ivec3(p, u_layer), vec4(c, 1.0));
+}
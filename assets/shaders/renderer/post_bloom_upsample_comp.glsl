@@ -0,0 +1,40 @@
+#version 450 core
+
+// Dual-filter upsample: the coarser level is tent-filtered up and blended with the matching level of the
+// downsample chain. u_radius (0..1) controls how much of the wide glow is carried towards the finer levels.
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+uniform sampler2DArray s_source;
+uniform sampler2DArray s_detail;
+layout(rgba16f, binding = 0) uniform writeonly image2DArray u_output;
+
+uniform int u_sourceLevel;
+uniform int u_detailLevel;
+uniform float u_radius;
+
+void main()
+{
+    ivec3 size = imageSize(u_output);
+    ivec3 p = ivec3(gl_GlobalInvocationID);
+    if (any(greaterThanEqual(p, size))) return;
+
+    vec2 texel = 1.0 / vec2(textureSize(s_source, u_sourceLevel).xy);
+    vec2 uv = (vec2(p.xy) + 0.5) / vec2(size.xy);
+    float layer = float(p.z);
+    float lod = float(u_sourceLevel);
+
+    vec3 c = textureLod(s_source, vec3(uv + vec2(-2.0 * texel.x, 0.0), layer), lod).rgb;
+    c += textureLod(s_source, vec3(uv + vec2( 2.0 * texel.x, 0.0), layer), lod).rgb;
+    c += textureLod(s_source, vec3(uv + vec2(0.0, -2.0 * texel.y), layer), lod).rgb;
+    c += textureLod(s_source, vec3(uv + vec2(0.0,  2.0 * texel.y), layer), lod).rgb;
+    c += textureLod(s_source, vec3(uv + vec2(-texel.x, -texel.y), layer), lod).rgb * 2.0;
+    c += textureLod(s_source, vec3(uv + vec2( texel.x, -texel.y), layer), lod).rgb * 2.0;
+    c += textureLod(s_source, vec3(uv + vec2(-texel.x,  texel.y), layer), lod).rgb * 2.0;
+    c += textureLod(s_source, vec3(uv + vec2( texel.x,  texel.y), layer), lod).rgb * 2.0;
+    c *= (1.0 / 12.0);
+
+    vec3 detail = textureLod(s_detail, vec3(uv, layer), float(u_detailLevel)).rgb;
+
+    imageStore(u_output, p, vec4(mix(detail, c, u_radius), 1.0));
+}
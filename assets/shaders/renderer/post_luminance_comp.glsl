@@ -0,0 +1,76 @@
+#version 450 core
+
+// Average scene luminance in a single dispatch of a single workgroup. Each thread takes an 8x8 block of a
+// 128x128 sampling grid per view, the block sums are reduced in shared memory and the first thread adapts
+// the result against last frame's value. Everything stays in the storage buffer for the later stages.
+
+#define MAX_VIEWS 2
+#define LUMINANCE_HISTORY 64
+
+layout(local_size_x = 16, local_size_y = 16) in;
+
+layout(std430, binding = 3) buffer LuminanceState
+{
+    float u_adaptedLuminance;
+    float u_autoExposure;
+    uint u_historyIndex;
+    float u_pad;
+    float u_history[LUMINANCE_HISTORY];
+};
+
+uniform sampler2D s_texColor[MAX_VIEWS];
+uniform int u_viewCount;
+uniform float u_deltaTime;
+uniform float u_adaptationRate;
+uniform float u_middleGrey;
+uniform vec2 u_exposureRange;
+
+shared float s_sum[256];
+
+float luma(vec3 rgb)
+{
+    return dot(vec3(0.2126729, 0.7151522, 0.0721750), rgb);
+}
+
+void main()
+{
+    uint tid = gl_LocalInvocationIndex;
+    vec2 base = vec2(gl_LocalInvocationID.xy * 8u);
+
+    float sum = 0.0;
+    for (int v = 0; v < u_viewCount; ++v)
+    {
+        for (int y = 0; y < 8; ++y)
+        {
+            for (int x = 0; x < 8; ++x)
+            {
+                vec2 uv = (base + vec2(x, y) + 0.5) / 128.0;
+                sum += log(max(luma(textureLod(s_texColor[v], uv, 0).rgb), 0.0001));
+            }
+        }
+    }
+    s_sum[tid] = sum;
+
+    memoryBarrierShared();
+    barrier();
+
+    for (uint stride = 128u; stride > 0u; stride >>= 1)
+    {
+        if (tid < stride) s_sum[tid] += s_sum[tid + stride];
+        memoryBarrierShared();
+        barrier();
+    }
+
+    if (tid == 0u)
+    {
+        float avg = exp(s_sum[0] / float(128 * 128 * u_viewCount));
+
+        // Frame-rate independent exponential adaptation
+        float adapted = u_adaptedLuminance + (avg - u_adaptedLuminance) * (1.0 - exp(-u_deltaTime * u_adaptationRate));
+
+        u_adaptedLuminance = adapted;
+        u_autoExposure = clamp(u_middleGrey / max(adapted, 0.0001), u_exposureRange.x, u_exposureRange.y);
+        u_history[u_historyIndex % uint(LUMINANCE_HISTORY)] = avg;
+        u_historyIndex = u_historyIndex + 1u;
+    }
+}
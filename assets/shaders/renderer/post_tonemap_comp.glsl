@@ -0,0 +1,48 @@
+#version 450 core
+
+// Adds the bloom chain to the scene, applies the adapted exposure and tonemaps in place
+
+#define LUMINANCE_HISTORY 64
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+layout(std430, binding = 3) buffer LuminanceState
+{
+    float u_adaptedLuminance;
+    float u_autoExposure;
+    uint u_historyIndex;
+    float u_pad;
+    float u_history[LUMINANCE_HISTORY];
+};
+
+layout(rgba8, binding = 0) uniform image2D u_sceneColor;
+uniform sampler2DArray s_bloom;
+
+uniform int u_layer;
+uniform float u_exposure;
+uniform float u_bloomIntensity;
+
+vec3 aces_film_tonemap(vec3 x)
+{
+    float a = 2.51;
+    float b = 0.03;
+    float c = 2.43;
+    float d = 0.59;
+    float e = 0.14;
+    return clamp((x*(a*x+b))/(x*(c*x+d)+e), 0, 1);
+}
+
+void main()
+{
+    ivec2 size = imageSize(u_sceneColor);
+    ivec2 p = ivec2(gl_GlobalInvocationID.xy);
+    if (any(greaterThanEqual(p, size))) return;
+
+    vec2 uv = (vec2(p) + 0.5) / vec2(size);
+
+    vec3 rgb = imageLoad(u_sceneColor, p).rgb * (u_autoExposure * u_exposure);
+    rgb += textureLod(s_bloom, vec3(uv, float(u_layer)), 0.0).rgb * u_bloomIntensity; // already exposed by the prefilter
+    rgb = aces_film_tonemap(rgb);
+
+    imageStore(u_sceneColor, p, vec4(rgb, 1.0));
+}
@@ -1,4 +1,16 @@
 #version 450
+#extension GL_ARB_shader_draw_parameters : require
+
+// Single-pass stereo: every draw is instanced once per view and the vertex stage sends
+// instance i to viewport i, so both eyes are rasterized from one submission.
+#ifdef SINGLE_PASS_STEREO
+    #extension GL_ARB_shader_viewport_layer_array : require
+    #define VIEW_INDEX (gl_InstanceID % MAX_VIEWS)
+    #define ROUTE_TO_VIEW(i) gl_ViewportIndex = (i)
+#else
+    #define VIEW_INDEX 0
+    #define ROUTE_TO_VIEW(i)
+#endif
 
 #define saturate(x) clamp(x, 0.0, 1.0)
 #define PI 3.1415926535897932384626433832795
@@ -8,6 +20,7 @@
 
 const int MAX_POINT_LIGHTS = 4;
 const int NUM_CASCADES = 2;
+const int MAX_VIEWS = 2;
 
 struct DirectionalLight
 {
@@ -37,17 +50,28 @@ layout(binding = 0, std140) uniform PerScene
     float u_cascadesFar[NUM_CASCADES];
 };
 
+struct ViewData
+{
+    mat4 viewMatrix;
+    mat4 viewProjMatrix;
+    vec4 eyePos;
+};
+
+// Only the first entry is used unless SINGLE_PASS_STEREO is defined
 layout(binding = 1, std140) uniform PerView
 {
-    mat4 u_viewMatrix;
-    mat4 u_viewProjMatrix;
-    vec4 u_eyePos;
+    ViewData u_views[MAX_VIEWS];
+};
+
+struct ObjectData
+{
+    mat4 modelMatrix;
+    mat4 modelMatrixIT;
+    float receiveShadow;
 };
 
-layout(binding = 2, std140) uniform PerObject
+// One entry per draw of a (multi-)draw call, indexed by gl_DrawIDARB in the vertex stage
+layout(binding = 2, std430) readonly buffer PerObject
 {
-    mat4 u_modelMatrix;
-    mat4 u_modelMatrixIT;
-    mat4 u_modelViewMatrix;
-    float u_receiveShadow;
+    ObjectData u_objects[];
 };
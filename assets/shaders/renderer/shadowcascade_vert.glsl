@@ -1,9 +1,9 @@
-#version 450
+#include "renderer_common.glsl"
 
 layout(location = 0) in vec3 inPosition;
-uniform mat4 u_modelShadowMatrix;
+uniform mat4 u_cascadeViewProjMatrix;
 
 void main()
 {
-    gl_Position = u_modelShadowMatrix * vec4(inPosition, 1);
+    gl_Position = u_cascadeViewProjMatrix * (u_objects[gl_DrawIDARB].modelMatrix * vec4(inPosition, 1));
 }
\ No newline at end of file
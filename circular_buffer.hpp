@@ -6,66 +6,295 @@
 #define circular_buffer_h
 
 #include <type_traits>
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
 #include "math-core.hpp"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define AVL_CIRCULAR_BUFFER_SSE 1
+#endif
+
 using namespace avl;
 
+// A contiguous run of elements, as handed out by `CircularBuffer::get_spans()`
 template <typename T>
-class CircularBuffer
+struct buffer_span
 {
+    T * data{ nullptr };
+    size_t count{ 0 };
+    T * begin() const { return data; }
+    T * end() const { return data + count; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+};
 
-    std::vector<T> buffer;
+///////////////////////////////////
+//   Reductions over a raw span  //
+///////////////////////////////////
 
-    size_t bufferSize { 0 };
-    size_t numValues { 0 };
+namespace circular_buffer_detail
+{
+    // Four independent accumulators so the generic versions vectorize (and don't serialize on one register)
+    template<typename T, typename R>
+    inline R reduce_sum(const T * p, const size_t n, R init)
+    {
+        R s0 = init, s1 = R(), s2 = R(), s3 = R();
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) { s0 += R(p[i]); s1 += R(p[i + 1]); s2 += R(p[i + 2]); s3 += R(p[i + 3]); }
+        for (; i < n; ++i) s0 += R(p[i]);
+        return (s0 + s1) + (s2 + s3);
+    }
 
-    size_t readIndex { 0 };
-    size_t writeIndex { 0 };
+    template<typename T>
+    inline double reduce_squared_deviation(const T * p, const size_t n, const double mean, double init)
+    {
+        double s0 = init, s1 = 0, s2 = 0, s3 = 0;
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            const double d0 = double(p[i]) - mean, d1 = double(p[i + 1]) - mean, d2 = double(p[i + 2]) - mean, d3 = double(p[i + 3]) - mean;
+            s0 += d0 * d0; s1 += d1 * d1; s2 += d2 * d2; s3 += d3 * d3;
+        }
+        for (; i < n; ++i) { const double d = double(p[i]) - mean; s0 += d * d; }
+        return (s0 + s1) + (s2 + s3);
+    }
 
-    bool init { false };
+    template<typename T>
+    inline T reduce_min(const T * p, const size_t n, T init)
+    {
+        for (size_t i = 0; i < n; ++i) init = std::min(init, p[i]);
+        return init;
+    }
 
-    void init_from(const CircularBuffer & rhs)
+    template<typename T>
+    inline T reduce_max(const T * p, const size_t n, T init)
     {
-        init = rhs.init;
-        bufferSize = rhs.bufferSize;
-        numValues = rhs.numValues;
-        buffer.resize(rhs.bufferSize);
-        for(size_t i=0; i < rhs.bufferSize; i++) buffer[i] = rhs.buffer[i];
-        readIndex = rhs.readIndex;
-        writeIndex = rhs.writeIndex;
+        for (size_t i = 0; i < n; ++i) init = std::max(init, p[i]);
+        return init;
     }
 
-public:
-        
-    CircularBuffer() { }
-        
-    CircularBuffer(size_t newSize) { resize(newSize); }
-        
-    CircularBuffer(const CircularBuffer & rhs)
+#if defined(AVL_CIRCULAR_BUFFER_SSE)
+
+    inline double hsum(const __m128d v) { return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v))); }
+
+    // Floats are widened to double in pairs so long windows don't lose precision
+    inline double reduce_sum(const float * p, const size_t n, double init)
+    {
+        __m128d a0 = _mm_setzero_pd(), a1 = _mm_setzero_pd();
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            const __m128 v = _mm_loadu_ps(p + i);
+            a0 = _mm_add_pd(a0, _mm_cvtps_pd(v));
+            a1 = _mm_add_pd(a1, _mm_cvtps_pd(_mm_movehl_ps(v, v)));
+        }
+        double s = init + hsum(_mm_add_pd(a0, a1));
+        for (; i < n; ++i) s += p[i];
+        return s;
+    }
+
+    inline double reduce_sum(const double * p, const size_t n, double init)
     {
-        if (rhs.init) init_from(rhs);
+        __m128d a0 = _mm_setzero_pd(), a1 = _mm_setzero_pd();
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            a0 = _mm_add_pd(a0, _mm_loadu_pd(p + i));
+            a1 = _mm_add_pd(a1, _mm_loadu_pd(p + i + 2));
+        }
+        double s = init + hsum(_mm_add_pd(a0, a1));
+        for (; i < n; ++i) s += p[i];
+        return s;
     }
-        
-    CircularBuffer & operator= (const CircularBuffer & rhs)
+
+    inline double reduce_squared_deviation(const float * p, const size_t n, const double mean, double init)
     {
-        if (this != &rhs)
+        const __m128d m = _mm_set1_pd(mean);
+        __m128d a0 = _mm_setzero_pd(), a1 = _mm_setzero_pd();
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            const __m128 v = _mm_loadu_ps(p + i);
+            const __m128d d0 = _mm_sub_pd(_mm_cvtps_pd(v), m);
+            const __m128d d1 = _mm_sub_pd(_mm_cvtps_pd(_mm_movehl_ps(v, v)), m);
+            a0 = _mm_add_pd(a0, _mm_mul_pd(d0, d0));
+            a1 = _mm_add_pd(a1, _mm_mul_pd(d1, d1));
+        }
+        double s = init + hsum(_mm_add_pd(a0, a1));
+        for (; i < n; ++i) { const double d = double(p[i]) - mean; s += d * d; }
+        return s;
+    }
+
+    inline float reduce_min(const float * p, const size_t n, float init)
+    {
+        __m128 a = _mm_set1_ps(init);
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) a = _mm_min_ps(a, _mm_loadu_ps(p + i));
+        a = _mm_min_ps(a, _mm_movehl_ps(a, a));
+        a = _mm_min_ss(a, _mm_shuffle_ps(a, a, 1));
+        float r = _mm_cvtss_f32(a);
+        for (; i < n; ++i) r = std::min(r, p[i]);
+        return r;
+    }
+
+    inline float reduce_max(const float * p, const size_t n, float init)
+    {
+        __m128 a = _mm_set1_ps(init);
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) a = _mm_max_ps(a, _mm_loadu_ps(p + i));
+        a = _mm_max_ps(a, _mm_movehl_ps(a, a));
+        a = _mm_max_ss(a, _mm_shuffle_ps(a, a, 1));
+        float r = _mm_cvtss_f32(a);
+        for (; i < n; ++i) r = std::max(r, p[i]);
+        return r;
+    }
+
+#endif
+
+    //////////////////////////////////////////
+    //   Windowed moments, updated per put  //
+    //////////////////////////////////////////
+
+    // Types without a notion of mean/variance carry no statistics
+    template<typename T, typename Enable = void>
+    struct window_moments
+    {
+        static const bool enabled = false;
+        void clear() {}
+        void add(const T &) {}
+        void remove(const T &) {}
+        void rebuild(buffer_span<const T>, buffer_span<const T>) {}
+    };
+
+    // Welford's update run forwards for new samples and backwards for evicted ones. Accumulates in double.
+    template<typename T>
+    struct window_moments<T, typename std::enable_if<std::is_arithmetic<T>::value>::type>
+    {
+        static const bool enabled = true;
+        size_t n{ 0 };
+        double mean{ 0 }, m2{ 0 };
+
+        void clear() { n = 0; mean = m2 = 0; }
+
+        void add(const T & v)
+        {
+            const double x = double(v), d = x - mean;
+            mean += d / double(++n);
+            m2 += d * (x - mean);
+        }
+
+        void remove(const T & v)
+        {
+            if (n <= 1) { clear(); return; }
+            const double x = double(v), d = x - mean;
+            mean -= d / double(--n);
+            m2 = std::max(0.0, m2 - d * (x - mean));
+        }
+
+        void rebuild(buffer_span<const T> a, buffer_span<const T> b)
+        {
+            n = a.count + b.count;
+            if (!n) { clear(); return; }
+            mean = reduce_sum(b.data, b.count, reduce_sum(a.data, a.count, 0.0)) / double(n);
+            m2 = reduce_squared_deviation(b.data, b.count, mean, reduce_squared_deviation(a.data, a.count, mean, 0.0));
+        }
+
+        double variance() const { return n ? m2 / double(n) : 0.0; }
+    };
+
+    // linalg vectors keep a mean vector and a co-moment matrix, which gives the covariance in O(1)
+    template<typename S, int M>
+    struct window_moments<linalg::vec<S, M>, typename std::enable_if<std::is_floating_point<S>::value>::type>
+    {
+        typedef linalg::vec<S, M> vec_t;
+        typedef linalg::mat<S, M, M> mat_t;
+
+        static const bool enabled = true;
+        size_t n{ 0 };
+        vec_t mean;
+        mat_t comoment;
+
+        void clear() { n = 0; mean = vec_t(); comoment = mat_t(); }
+
+        void add(const vec_t & x)
+        {
+            const vec_t d = x - mean;
+            mean += d / S(++n);
+            comoment += outerprod(d, x - mean);
+        }
+
+        void remove(const vec_t & x)
+        {
+            if (n <= 1) { clear(); return; }
+            const vec_t d = x - mean;
+            mean -= d / S(--n);
+            comoment -= outerprod(d, x - mean);
+        }
+
+        void rebuild(buffer_span<const vec_t> a, buffer_span<const vec_t> b)
         {
             clear();
-            if (rhs.init) init_from(rhs);
+            for (auto & x : a) add(x);
+            for (auto & x : b) add(x);
         }
-        return *this;
+
+        mat_t covariance() const { return n ? comoment / S(n) : mat_t(); }
+    };
+}
+
+///////////////////////
+//   CircularBuffer  //
+///////////////////////
+
+// Keeps the last `size` values. Storage is rounded up to a power of two so that indexing is a mask
+// rather than a modulo, and the contents are exposed as (at most) two contiguous spans, oldest first.
+// For arithmetic types and float vectors, mean/variance (and covariance for vectors) are maintained as
+// values are pushed and evicted; they are recomputed from the spans once per storage lap to cancel drift.
+template <typename T>
+class CircularBuffer
+{
+    typedef circular_buffer_detail::window_moments<T> moments_t;
+
+    std::vector<T> buffer;
+
+    size_t bufferSize { 0 };    // window length requested by the user
+    size_t mask { 0 };          // buffer.size() - 1
+    size_t numValues { 0 };
+    size_t head { 0 };          // free-running count of puts
+    size_t evictions { 0 };
+
+    bool init { false };
+
+    moments_t moments;
+
+    size_t physical(const size_t index) const { return (head - numValues + index) & mask; }
+
+    static size_t round_up_pow2(size_t v)
+    {
+        size_t p = 1;
+        while (p < v) p <<= 1;
+        return p;
     }
-        
-    ~CircularBuffer() { if (init) clear(); }
-        
-    // Safe - bounds check with wrap-around
-    inline T & operator[](const size_t & index) { return buffer[(readIndex + index) % bufferSize]; }
-    inline const T & operator[](const size_t & index) const { return buffer[(readIndex + index) % bufferSize]; }
-    
-    // Unsafe - no bounds checking, direct index
-    inline T & operator()(const size_t & index) { return buffer[index]; }
+
+public:
+
+    CircularBuffer() { }
+
+    CircularBuffer(size_t newSize) { resize(newSize); }
+
+    CircularBuffer(const CircularBuffer & rhs) = default;
+    CircularBuffer & operator= (const CircularBuffer & rhs) = default;
+    CircularBuffer(CircularBuffer && rhs) = default;
+    CircularBuffer & operator= (CircularBuffer && rhs) = default;
+
+    // Oldest first, wraps around. Read-only: writes go through `set` so the statistics stay current.
+    inline const T & operator[](const size_t & index) const { return buffer[physical(index)]; }
+
+    // Unsafe - no bounds checking, direct index into storage
     inline const T & operator()(const size_t & index) const { return buffer[index]; }
-        
+
     bool resize(const size_t newSize) { return resize(newSize, T()); }
 
     bool is_initialized() const { return init; }
@@ -75,136 +304,181 @@ public:
     size_t get_maximum_size() const { return init ? bufferSize : 0; }
 
     size_t get_current_size() const { return init ? numValues : 0; }
-        
+
     bool resize(const size_t newSize, const T & defaultValue)
     {
         clear();
-        if (newSize == 0) return false; 
+        if (newSize == 0) return false;
         bufferSize = newSize;
-        buffer.resize(bufferSize, defaultValue);
-        numValues = 0;
-        readIndex = 0;
-        writeIndex = 0;
+        buffer.assign(round_up_pow2(newSize), defaultValue);
+        mask = buffer.size() - 1;
         init = true;
         return true;
     }
-        
+
     bool put(const T & value)
     {
         if (!init) return false;
-        
-        buffer[writeIndex] = value; // Add the value to the buffer
-            
-        writeIndex++;
-        writeIndex = writeIndex % bufferSize;
-            
-        // Check if the buffer is full
-        if (++numValues > bufferSize)
+
+        if (numValues == bufferSize)
         {
-            numValues = bufferSize;
-            readIndex++; // Only update the read pointer if the buffer has been filled
-            readIndex = readIndex % bufferSize;
+            // The oldest value drops out of the window; its slot may be reused later
+            moments.remove(buffer[physical(0)]);
+            numValues--;
+            if (moments_t::enabled && ++evictions >= buffer.size())
+            {
+                evictions = 0;
+                buffer[head & mask] = value;
+                head++;
+                numValues++;
+                rebuild_statistics();
+                return true;
+            }
         }
-            
+
+        buffer[head & mask] = value;
+        head++;
+        numValues++;
+        moments.add(value);
         return true;
     }
-        
+
+    // Replaces the value `index` places from the oldest, updating the running statistics
+    void set(const size_t index, const T & value)
+    {
+        if (index >= get_current_size()) throw std::out_of_range("sample not in buffer");
+        T & slot = buffer[physical(index)];
+        moments.remove(slot);
+        slot = value;
+        moments.add(value);
+    }
+
+    // Fills the whole window with `value`, leaving the buffer full
     bool reinitialize_values(const T & value)
     {
         if (!init) return false;
-        for (size_t i=0; i < bufferSize; i++) buffer[i] = value;
+        std::fill(buffer.begin(), buffer.end(), value);
+        numValues = bufferSize;
+        head = bufferSize;
+        evictions = 0;
+        rebuild_statistics();
         return true;
     }
-        
+
     void reset()
     {
         numValues = 0;
-        readIndex = 0;
-        writeIndex = 0;
+        head = 0;
+        evictions = 0;
+        moments.clear();
     }
-        
+
     void clear()
     {
-        numValues = 0;
-        readIndex = 0;
-        writeIndex = 0;
+        reset();
+        bufferSize = 0;
+        mask = 0;
         buffer.clear();
         init = false;
     }
-        
+
+    // The current contents, oldest first, as two contiguous runs (the second is empty unless the window wraps)
+    std::pair<buffer_span<const T>, buffer_span<const T>> get_spans() const
+    {
+        buffer_span<const T> a, b;
+        if (!init || !numValues) return{ a, b };
+        const size_t start = physical(0);
+        a.data = buffer.data() + start;
+        a.count = std::min(numValues, buffer.size() - start);
+        b.data = buffer.data();
+        b.count = numValues - a.count;
+        return{ a, b };
+    }
+
+    // Copies the current contents, oldest first, into `out` (room for get_current_size() values). No allocation.
+    void copy_to(T * out) const
+    {
+        auto s = get_spans();
+        out = std::copy(s.first.begin(), s.first.end(), out);
+        std::copy(s.second.begin(), s.second.end(), out);
+    }
+
     std::vector<T> get_data_as_vector() const
     {
         if (!init) throw std::runtime_error("buffer not initialized");
-        std::vector<T> data(bufferSize);
-        for (size_t i=0; i < bufferSize; i++) data[i] = (*this)[i];
+        std::vector<T> data(numValues);
+        if (numValues) copy_to(data.data());
         return data;
     }
-        
-    // get_last(0) would return the last pushed sample
+
+    // get_last(0) would return the last pushed sample; `samplesAgo` must be less than get_current_size()
     T get_last(size_t samplesAgo) const
     {
         if (!init) throw std::runtime_error("buffer not initialized");
-        return buffer[(readIndex - samplesAgo - 1 + get_current_size()) % get_current_size()];
+        if (samplesAgo >= numValues) throw std::out_of_range("sample not in buffer");
+        return buffer[(head - samplesAgo - 1) & mask];
+    }
+
+    // Recomputes the running statistics from the current contents
+    void rebuild_statistics()
+    {
+        auto s = get_spans();
+        moments.rebuild(s.first, s.second);
     }
-    
+
+    const moments_t & get_moments() const { return moments; }
 };
 
 /////////////////////////////////////////////////
 //    Helper Functions for Numeric Analytics   //
 /////////////////////////////////////////////////
 
-// template<typename = typename std::enable_if<std::is_arithmetic<T>::value, T>::type>
-
 template<typename T, typename = typename std::enable_if<std::is_arithmetic<T>::value, T>::type>
 T compute_min(const CircularBuffer<T> & b)
 {
-    T min = std::numeric_limits<T>::max();
-    for (size_t i = 0; i < b.get_current_size(); i++) if (b[i] < min) min = b[i];
-    return min;
+    auto s = b.get_spans();
+    T min = circular_buffer_detail::reduce_min(s.first.data, s.first.count, std::numeric_limits<T>::max());
+    return circular_buffer_detail::reduce_min(s.second.data, s.second.count, min);
 }
 
 template<typename T, typename = typename std::enable_if<std::is_arithmetic<T>::value, T>::type>
 T compute_max(const CircularBuffer<T> & b)
 {
-    T max = std::numeric_limits<T>::min();
-    for (size_t i = 0; i < b.get_current_size(); i++) if (buffer[i] > max) max = buffer[i];
-    return max;
+    auto s = b.get_spans();
+    T max = circular_buffer_detail::reduce_max(s.first.data, s.first.count, std::numeric_limits<T>::lowest());
+    return circular_buffer_detail::reduce_max(s.second.data, s.second.count, max);
 }
 
 template<typename T, typename = typename std::enable_if<std::is_arithmetic<T>::value, T>::type>
 T compute_median(const CircularBuffer<T> & b)
 {
     auto vec = b.get_data_as_vector();
-    std::sort(vec.begin(), vec.end());
-    T median = vec[int(vec.size()) / 2];
-    return median;
+    std::nth_element(vec.begin(), vec.begin() + vec.size() / 2, vec.end());
+    return vec[vec.size() / 2];
 }
 
+// O(1): maintained as values are pushed
 template<typename T, typename = typename std::enable_if<std::is_arithmetic<T>::value, T>::type>
 T compute_mean(const CircularBuffer<T> & b)
 {
-    T sum = {};
-    for (size_t i = 0; i < b.get_current_size(); i++) sum += b[i];
-    return sum / static_cast<T>(b.get_current_size());
+    return static_cast<T>(b.get_moments().mean);
 }
 
+// Population variance, O(1)
 template<typename T, typename = typename std::enable_if<std::is_arithmetic<T>::value, T>::type>
 T compute_variance(const CircularBuffer<T> & b)
 {
-    T mean = compute_mean(b);
-    T sum = T();
-    for (size_t i = 0; i < b.get_current_size(); i++) sum += pow(b[i] - mean, 2);
-    return (sum / T(b.get_current_size()));
+    return static_cast<T>(b.get_moments().variance());
 }
 
 template<typename T, typename = typename std::enable_if<std::is_arithmetic<T>::value, T>::type>
-T compute_std_dev(const CircularBuffer<T> & b) 
+T compute_std_dev(const CircularBuffer<T> & b)
 {
-    return sqrt(compute_variance(b));
+    return static_cast<T>(std::sqrt(b.get_moments().variance()));
 }
 
 template<typename T, typename = typename std::enable_if<std::is_arithmetic<T>::value, T>::type>
-double compute_confidence(const CircularBuffer<T> & b) 
+double compute_confidence(const CircularBuffer<T> & b)
 {
     const double c = 0.48 - 0.1 * log(compute_std_dev(b));
     return clamp(c, 0.0, 1.0) * (double) b.get_current_size() / (double) b.get_maximum_size();
@@ -213,37 +487,10 @@ double compute_confidence(const CircularBuffer<T> & b)
 // https://manialabs.wordpress.com/2012/08/06/covariance-matrices-with-a-practical-example/
 // http://www.cse.psu.edu/~rtc12/CSE586Spring2010/lectures/pcaLectureShort_6pp.pdf
 // https://en.wikipedia.org/wiki/Sample_mean_and_covariance#Sample_covariance
-// tl;dr: use on pointclouds (as first step to PCA) or IMU data
+// tl;dr: use on pointclouds (as first step to PCA) or IMU data. O(1): maintained as values are pushed.
 inline linalg::aliases::float3x3 compute_covariance_matrix(const CircularBuffer<linalg::aliases::float3> & b)
 {
-    linalg::aliases::float3 mean;
-
-    float3 sum = {};
-    for (size_t i = 0; i < b.get_current_size(); i++) sum += b[i];
-    sum /= float3(b.get_current_size());
-
-    linalg::aliases::float3x3 total;
-
-    for (int i = 0; i < b.get_current_size(); i++) 
-    {
-        total[0][0] += (b[i].x - mean.x) * (b[i].x - mean.x);
-        total[1][0] += (b[i].y - mean.y) * (b[i].x - mean.x);
-        total[2][0] += (b[i].z - mean.z) * (b[i].x - mean.x);
-        total[1][1] += (b[i].y - mean.y) * (b[i].y - mean.y);
-        total[2][1] += (b[i].z - mean.z) * (b[i].y - mean.y);
-        total[2][2] += (b[i].z - mean.z) * (b[i].z - mean.z);
-    }
-    total[0][1] = total[1][0];
-    total[0][2] = total[2][0];
-    total[1][2] = total[2][1];
-    for (auto i = 0; i < 3; ++i)
-    {
-        for (auto j = 0; j < 3; ++j)
-        {
-            total[i][j] /= (float) b.get_current_size();
-        }
-    }
-    return total;
+    return b.get_moments().covariance();
 }
 
 // https://statistics.laerd.com/statistical-guides/pearson-correlation-coefficient-statistical-guide.php
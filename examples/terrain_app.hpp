@@ -26,10 +26,13 @@ constexpr const char basic_frag[] = R"(#version 330
 struct CameraPathFollower
 {
     std::vector<float4x4> parallelTransportFrames;
+    SplinePath path{ spline_basis::bezier };
 
+    // Frames are spaced by arc length so playback runs at a constant speed
     void compute(std::array<Pose, 4> & controlPoints)
     {
-        parallelTransportFrames = make_parallel_transport_frame_bezier(controlPoints, 128);
+        path.set_control_points({ controlPoints[0].position, controlPoints[1].position, controlPoints[2].position, controlPoints[3].position });
+        parallelTransportFrames = make_parallel_transport_frame_path(path, 128);
     }
 
     float4x4 get_transform(const size_t idx) const
@@ -61,6 +64,7 @@ struct CameraPathFollower
     void reset()
     {
         parallelTransportFrames.clear();
+        path.clear();
     }
 };
 
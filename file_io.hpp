@@ -2,38 +2,206 @@
 #define file_io_h
 
 #include <exception>
+#include <stdexcept>
 #include <vector>
 #include <string>
 #include <fstream>
+#include <iostream>
 #include <streambuf>
+#include <memory>
+#include <cstdio>
+#include <cstdint>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+
+#include "mpmc_blocking_queue.hpp"
+
+#if defined(_WIN32)
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#else
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
 
 namespace avl
 {
-    
-    inline std::vector<uint8_t> read_file_binary(const std::string pathToFile)
-    {
-        FILE * f = fopen(pathToFile.c_str(), "rb");
-        
-        if (!f) throw std::runtime_error("file not found");
-        
-        fseek(f, 0, SEEK_END);
-        size_t lengthInBytes = ftell(f);
-        fseek(f, 0, SEEK_SET);
-        
-        std::vector<uint8_t> fileBuffer(lengthInBytes);
-        
-        size_t elementsRead = fread(fileBuffer.data(), 1, lengthInBytes, f);
-        
-        if (elementsRead == 0 || fileBuffer.size() < 4) throw std::runtime_error("error reading file or file too small");
-        
-        fclose(f);
+
+    namespace file_io_detail
+    {
+        struct file_closer { void operator()(FILE * f) const { if (f) fclose(f); } };
+        typedef std::unique_ptr<FILE, file_closer> unique_file;
+
+        inline unique_file open_for_read(const std::string & pathToFile)
+        {
+            unique_file f(fopen(pathToFile.c_str(), "rb"));
+            if (!f) throw std::runtime_error("file not found: " + pathToFile);
+            return f;
+        }
+
+        inline size_t file_length(FILE * f, const std::string & pathToFile)
+        {
+            if (fseek(f, 0, SEEK_END) != 0) throw std::runtime_error("could not seek: " + pathToFile);
+            const long length = ftell(f);
+            if (length < 0) throw std::runtime_error("could not determine length: " + pathToFile);
+            fseek(f, 0, SEEK_SET);
+            return size_t(length);
+        }
+
+        // Reads exactly `length` bytes into `dst`, looping over short reads
+        inline void read_exact(FILE * f, void * dst, const size_t length, const std::string & pathToFile)
+        {
+            size_t total = 0;
+            while (total < length)
+            {
+                const size_t n = fread(static_cast<uint8_t *>(dst) + total, 1, length - total, f);
+                if (n == 0) throw std::runtime_error("error reading file: " + pathToFile);
+                total += n;
+            }
+        }
+    }
+
+    // Heap buffer that is not zero-filled before the read overwrites it (unlike std::vector<uint8_t>(n))
+    class file_buffer
+    {
+        std::unique_ptr<uint8_t[]> bytes;
+        size_t length{ 0 };
+    public:
+        file_buffer() = default;
+        explicit file_buffer(const size_t size) : bytes(size ? new uint8_t[size] : nullptr), length(size) {}
+
+        uint8_t * data() { return bytes.get(); }
+        const uint8_t * data() const { return bytes.get(); }
+        size_t size() const { return length; }
+        bool empty() const { return length == 0; }
+        const uint8_t * begin() const { return bytes.get(); }
+        const uint8_t * end() const { return bytes.get() + length; }
+    };
+
+    // Read-only memory mapped view of a whole file. The OS pages it in on demand and it can be shared
+    // between threads without copying. Empty files map to a null view of size zero.
+    class mapped_file
+    {
+        const uint8_t * ptr{ nullptr };
+        size_t length{ 0 };
+
+    #if defined(_WIN32)
+        HANDLE mapping{ nullptr };
+    #endif
+
+        void unmap()
+        {
+        #if defined(_WIN32)
+            if (ptr) UnmapViewOfFile(ptr);
+            if (mapping) CloseHandle(mapping);
+            mapping = nullptr;
+        #else
+            if (ptr) munmap(const_cast<uint8_t *>(ptr), length);
+        #endif
+            ptr = nullptr;
+            length = 0;
+        }
+
+    public:
+
+        mapped_file() = default;
+
+        explicit mapped_file(const std::string & pathToFile)
+        {
+        #if defined(_WIN32)
+            HANDLE file = CreateFileA(pathToFile.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+            if (file == INVALID_HANDLE_VALUE) throw std::runtime_error("file not found: " + pathToFile);
+
+            LARGE_INTEGER size;
+            if (!GetFileSizeEx(file, &size)) { CloseHandle(file); throw std::runtime_error("could not determine length: " + pathToFile); }
+            length = size_t(size.QuadPart);
+
+            if (length > 0)
+            {
+                mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+                if (mapping) ptr = static_cast<const uint8_t *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+            }
+            CloseHandle(file); // the mapping keeps its own reference
+
+            if (length > 0 && !ptr) { unmap(); throw std::runtime_error("could not map file: " + pathToFile); }
+        #else
+            const int fd = open(pathToFile.c_str(), O_RDONLY);
+            if (fd < 0) throw std::runtime_error("file not found: " + pathToFile);
+
+            struct stat st;
+            if (fstat(fd, &st) != 0) { close(fd); throw std::runtime_error("could not determine length: " + pathToFile); }
+            length = size_t(st.st_size);
+
+            if (length > 0)
+            {
+                void * p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (p == MAP_FAILED) { close(fd); length = 0; throw std::runtime_error("could not map file: " + pathToFile); }
+                madvise(p, length, MADV_SEQUENTIAL);
+                ptr = static_cast<const uint8_t *>(p);
+            }
+            close(fd); // the mapping outlives the descriptor
+        #endif
+        }
+
+        mapped_file(const mapped_file &) = delete;
+        mapped_file & operator = (const mapped_file &) = delete;
+
+        mapped_file(mapped_file && r) { *this = std::move(r); }
+        mapped_file & operator = (mapped_file && r)
+        {
+            if (this != &r)
+            {
+                unmap();
+                std::swap(ptr, r.ptr);
+                std::swap(length, r.length);
+            #if defined(_WIN32)
+                std::swap(mapping, r.mapping);
+            #endif
+            }
+            return *this;
+        }
+
+        ~mapped_file() { unmap(); }
+
+        const uint8_t * data() const { return ptr; }
+        size_t size() const { return length; }
+        bool empty() const { return length == 0; }
+        const uint8_t * begin() const { return ptr; }
+        const uint8_t * end() const { return ptr + length; }
+    };
+
+    // Single allocation, single read, no zero-fill
+    inline file_buffer read_file_buffer(const std::string & pathToFile)
+    {
+        auto f = file_io_detail::open_for_read(pathToFile);
+        file_buffer buffer(file_io_detail::file_length(f.get(), pathToFile));
+        file_io_detail::read_exact(f.get(), buffer.data(), buffer.size(), pathToFile);
+        return buffer;
+    }
+
+    inline std::vector<uint8_t> read_file_binary(const std::string & pathToFile)
+    {
+        auto f = file_io_detail::open_for_read(pathToFile);
+        std::vector<uint8_t> fileBuffer(file_io_detail::file_length(f.get(), pathToFile));
+        file_io_detail::read_exact(f.get(), fileBuffer.data(), fileBuffer.size(), pathToFile);
         return fileBuffer;
     }
-    
+
+    // Binary read; line endings are left as they are on disk
     inline std::string read_file_text(const std::string & pathToFile)
     {
-        std::ifstream t(pathToFile.c_str());
-        std::string str ((std::istreambuf_iterator<char>(t)), std::istreambuf_iterator<char>());
+        auto f = file_io_detail::open_for_read(pathToFile);
+        std::string str(file_io_detail::file_length(f.get(), pathToFile), '\0');
+        if (!str.empty()) file_io_detail::read_exact(f.get(), &str[0], str.size(), pathToFile);
         return str;
     }
 
@@ -44,6 +212,101 @@ namespace avl
         t.close();
     }
 
+    // Reads whole files on a small pool of threads. Several reads are in flight at once, which is what
+    // hides latency on SSDs and network drives. The completion callback runs on the worker thread that
+    // performed the read; hand the buffer to a queue if it has to be consumed elsewhere (e.g. the GL thread).
+    class async_file_reader
+    {
+    public:
+
+        struct result
+        {
+            uint64_t id{ 0 };
+            std::string path;
+            file_buffer buffer;
+            std::string error;  // empty on success
+        };
+
+        typedef std::function<void(result && r)> completion;
+
+    private:
+
+        struct request
+        {
+            uint64_t id;
+            std::string path;
+            completion onComplete;
+        };
+
+        // A request stays pending until its callback has returned or thrown
+        struct in_flight_guard
+        {
+            std::atomic<size_t> & count;
+            ~in_flight_guard() { --count; }
+        };
+
+        MPMCBlockingQueue<request> requests;
+        std::vector<std::thread> workers;
+        std::atomic<uint64_t> nextId{ 1 };
+        std::atomic<size_t> inFlight{ 0 };
+
+        void worker_loop()
+        {
+            request r;
+            while (requests.wait_and_consume(r))
+            {
+                in_flight_guard guard{ inFlight };
+                result res;
+                res.id = r.id;
+                res.path = r.path;
+                try { res.buffer = read_file_buffer(res.path); }
+                catch (const std::exception & e) { res.error = e.what(); }
+                if (!r.onComplete) continue;
+
+                // An exception escaping here would take the whole process down with the worker
+                try { r.onComplete(std::move(res)); }
+                catch (const std::exception & e) { if (onCallbackError) onCallbackError(r.path, e.what()); }
+                catch (...) { if (onCallbackError) onCallbackError(r.path, "unknown exception"); }
+            }
+        }
+
+    public:
+
+        // Runs on the worker thread when a completion callback throws; the reader carries on with the next request.
+        // Replace it before issuing reads.
+        std::function<void(const std::string & path, const std::string & error)> onCallbackError = [](const std::string & path, const std::string & error)
+        {
+            std::cerr << "file read callback failed: " << path << " (" << error << ")" << std::endl;
+        };
+
+        // Defaults to a handful of threads: file reads block in the kernel, not on the CPU
+        explicit async_file_reader(size_t threadCount = 0)
+        {
+            if (threadCount == 0) threadCount = std::max<size_t>(2, std::min<size_t>(4, std::thread::hardware_concurrency()));
+            for (size_t i = 0; i < threadCount; ++i) workers.emplace_back(&async_file_reader::worker_loop, this);
+        }
+
+        // Pending reads are still completed before the workers exit
+        ~async_file_reader()
+        {
+            requests.close();
+            for (auto & t : workers) t.join();
+        }
+
+        async_file_reader(const async_file_reader &) = delete;
+        async_file_reader & operator = (const async_file_reader &) = delete;
+
+        uint64_t read(const std::string & path, completion onComplete)
+        {
+            const uint64_t id = nextId++;
+            ++inFlight;
+            requests.produce(request{ id, path, std::move(onComplete) });
+            return id;
+        }
+
+        size_t pending() const { return inFlight.load(); }
+    };
+
 }
 
 #endif // file_io_h
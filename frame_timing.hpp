@@ -0,0 +1,115 @@
+#pragma once
+
+#ifndef frame_timing_hpp
+#define frame_timing_hpp
+
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+#include <atomic>
+
+namespace avl
+{
+
+    // Frame-time distribution over the last `windowSize` frames. Samples land in fixed-width buckets
+    // (`bucketWidth` ms, with one overflow bucket past `maxMs`), so percentiles are exact to one bucket
+    // and evicting the oldest frame is a single decrement. A hitch is a frame longer than `hitchFactor`
+    // times the window's median at the time it was added.
+    class FrameTimeHistogram
+    {
+        float bucketWidth;
+        float maxMs;
+        float hitchFactor;
+        std::vector<uint32_t> buckets;
+        std::vector<uint16_t> window;   // bucket index of each frame in the window, ring ordered
+        size_t next{ 0 };
+        size_t count{ 0 };
+        uint64_t totalFrames{ 0 };
+        uint64_t totalHitches{ 0 };
+        uint32_t windowHitches{ 0 };
+        std::vector<uint8_t> hitchFlags; // parallel to `window`
+        float last{ 0 };
+
+        uint16_t bucket_of(const float ms) const
+        {
+            const float b = std::max(ms, 0.f) / bucketWidth;
+            return uint16_t(std::min(b, float(buckets.size() - 1)));
+        }
+
+    public:
+
+        FrameTimeHistogram(const size_t windowSize = 600, const float bucketWidth = 0.25f, const float maxMs = 100.f, const float hitchFactor = 2.f)
+            : bucketWidth(bucketWidth), maxMs(maxMs), hitchFactor(hitchFactor), buckets(size_t(maxMs / bucketWidth) + 1, 0),
+              window(std::max<size_t>(windowSize, 1)), hitchFlags(std::max<size_t>(windowSize, 1)) { }
+
+        void put(const float ms)
+        {
+            const bool hitch = count >= 8 && ms > hitchFactor * compute_percentile(0.5);
+
+            if (count == window.size())
+            {
+                buckets[window[next]]--;
+                windowHitches -= hitchFlags[next];
+            }
+            else count++;
+
+            const uint16_t b = bucket_of(ms);
+            buckets[b]++;
+            window[next] = b;
+            hitchFlags[next] = hitch;
+            next = (next + 1) % window.size();
+
+            windowHitches += hitch;
+            totalHitches += hitch;
+            totalFrames++;
+            last = ms;
+        }
+
+        void clear()
+        {
+            std::fill(buckets.begin(), buckets.end(), 0);
+            next = count = 0;
+            totalFrames = totalHitches = 0;
+            windowHitches = 0;
+            last = 0;
+        }
+
+        // Upper edge of the bucket holding the q-th frame of the window, in milliseconds
+        float compute_percentile(const double q) const
+        {
+            if (count == 0) return 0.f;
+            const uint64_t rank = std::min<uint64_t>(count - 1, uint64_t(q * double(count)));
+            uint64_t seen = 0;
+            for (size_t i = 0; i < buckets.size(); ++i)
+            {
+                seen += buckets[i];
+                if (seen > rank) return std::min(float(i + 1) * bucketWidth, maxMs);
+            }
+            return maxMs;
+        }
+
+        float get_last() const { return last; }
+        size_t num_frames() const { return count; }
+        uint32_t window_hitches() const { return windowHitches; }
+        uint64_t total_hitches() const { return totalHitches; }
+        uint64_t total_frames() const { return totalFrames; }
+        float get_bucket_width() const { return bucketWidth; }
+        const std::vector<uint32_t> & get_buckets() const { return buckets; }
+    };
+
+    // Per-frame timings collected by GLFWApp::main_loop, all in milliseconds.
+    // frame: start-to-start interval. cpu: update + draw on the main thread, excluding pacing.
+    // gpu: GL work from the start of on_draw to swap_buffers(), reported a few frames late. Only collected
+    // once GLFWApp::set_gpu_timing(true) has been called.
+    struct FrameTimings
+    {
+        FrameTimeHistogram frame;
+        FrameTimeHistogram cpu;
+        FrameTimeHistogram gpu;
+        std::atomic<uint64_t> fixedSteps{ 0 };          // on_fixed_update calls so far
+        std::atomic<uint64_t> droppedFixedSteps{ 0 };   // steps skipped after falling too far behind
+    };
+
+} // end namespace avl
+
+#endif // end frame_timing_hpp
@@ -0,0 +1,273 @@
+#pragma once
+
+#ifndef decal_geometry_hpp
+#define decal_geometry_hpp
+
+#include "math-core.hpp"
+#include "geometry.hpp"
+
+#include <vector>
+#include <algorithm>
+#include <thread>
+
+// Decal mesh generation, kept free of GL so that it can be tested and benchmarked on its own
+
+struct DecalVertex
+{
+    float3 v, n;
+    DecalVertex(float3 v, float3 n) : v(v), n(n) {}
+    DecalVertex() {}
+};
+
+// A triangle clipped by the six faces of the projector box gains at most one vertex per plane
+struct DecalPolygon
+{
+    DecalVertex vertices[9];
+    int count = 0;
+};
+
+// Sutherland-Hodgman against the plane dot(v, axis) <= size. Writes into `out`, never allocates.
+inline void clip_polygon(const DecalPolygon & in, DecalPolygon & out, const float3 & axis, const float size)
+{
+    out.count = 0;
+    if (in.count == 0) return;
+
+    const DecalVertex * prev = &in.vertices[in.count - 1];
+    float dPrev = dot(prev->v, axis) - size;
+
+    for (int i = 0; i < in.count; ++i)
+    {
+        const DecalVertex & cur = in.vertices[i];
+        const float dCur = dot(cur.v, axis) - size;
+
+        if ((dPrev <= 0.f) != (dCur <= 0.f))
+        {
+            const float s = dPrev / (dPrev - dCur);
+            out.vertices[out.count++] = DecalVertex(prev->v + s * (cur.v - prev->v), prev->n + s * (cur.n - prev->n));
+        }
+        if (dCur <= 0.f) out.vertices[out.count++] = cur;
+
+        prev = &cur;
+        dPrev = dCur;
+    }
+}
+
+// Median-split bounding volume hierarchy over the faces of a mesh, in the mesh's local space. Build it once
+// per geometry and reuse it for every decal placed on that mesh.
+struct DecalBVH
+{
+    struct Node
+    {
+        Bounds3D bounds;
+        uint32_t first;     // leaf: offset into `faces`; interior: index of the left child, with the right child after it
+        uint32_t count;     // number of faces in a leaf, zero for interior nodes
+    };
+
+    std::vector<Node> nodes;
+    std::vector<uint32_t> faces;
+
+    DecalBVH() {}
+
+    explicit DecalBVH(const Geometry & mesh, const uint32_t leafSize = 8)
+    {
+        const uint32_t numFaces = static_cast<uint32_t>(mesh.faces.size());
+        if (numFaces == 0) return;
+
+        std::vector<Bounds3D> faceBounds(numFaces);
+        std::vector<float3> centroids(numFaces);
+        parallel_for(0, numFaces, 16384, [&](size_t b, size_t e)
+        {
+            for (size_t i = b; i < e; ++i)
+            {
+                const uint3 & f = mesh.faces[i];
+                const float3 & v0 = mesh.vertices[f.x], & v1 = mesh.vertices[f.y], & v2 = mesh.vertices[f.z];
+                faceBounds[i] = Bounds3D(linalg::min(v0, linalg::min(v1, v2)), linalg::max(v0, linalg::max(v1, v2)));
+                centroids[i] = (v0 + v1 + v2) / 3.f;
+            }
+        });
+
+        faces.resize(numFaces);
+        for (uint32_t i = 0; i < numFaces; ++i) faces[i] = i;
+        nodes.reserve(2 * (numFaces / leafSize + 1));
+
+        struct pending { uint32_t node, begin, end; };
+        std::vector<pending> stack;
+
+        nodes.push_back({});
+        stack.push_back({ 0, 0, numFaces });
+
+        while (!stack.empty())
+        {
+            const pending p = stack.back();
+            stack.pop_back();
+
+            Bounds3D bounds = faceBounds[faces[p.begin]], centroidBounds(centroids[faces[p.begin]], centroids[faces[p.begin]]);
+            for (uint32_t i = p.begin + 1; i < p.end; ++i)
+            {
+                bounds.surround(faceBounds[faces[i]]);
+                centroidBounds.surround(centroids[faces[i]]);
+            }
+            nodes[p.node].bounds = bounds;
+
+            const uint32_t axis = centroidBounds.maximum_extent();
+            if (p.end - p.begin <= leafSize || centroidBounds.size()[axis] <= 0.f)
+            {
+                nodes[p.node].first = p.begin;
+                nodes[p.node].count = p.end - p.begin;
+                continue;
+            }
+
+            const uint32_t mid = p.begin + (p.end - p.begin) / 2;
+            std::nth_element(faces.begin() + p.begin, faces.begin() + mid, faces.begin() + p.end, [&](uint32_t a, uint32_t b)
+            {
+                return centroids[a][axis] < centroids[b][axis];
+            });
+
+            // Siblings are allocated together so an interior node only needs the index of its left child
+            const uint32_t left = static_cast<uint32_t>(nodes.size());
+            const uint32_t right = left + 1;
+            nodes.push_back({});
+            nodes.push_back({});
+            nodes[p.node].first = left;
+            nodes[p.node].count = 0;
+            stack.push_back({ right, mid, p.end });
+            stack.push_back({ left, p.begin, mid });
+        }
+    }
+
+    // Appends every face whose bounds may overlap the box of `halfExtents` centered on the origin of `meshToBox`.
+    // Tests the three box axes and the three mesh axes, which is conservative but rejects almost everything.
+    void query(const float4x4 & meshToBox, const float3 & halfExtents, std::vector<uint32_t> & candidates) const
+    {
+        if (nodes.empty()) return;
+
+        const float3x3 rotation = { meshToBox.x.xyz(), meshToBox.y.xyz(), meshToBox.z.xyz() };
+        const float3x3 absRotation = { abs(rotation.x), abs(rotation.y), abs(rotation.z) };
+
+        // The box's own extent in mesh space, for the mesh-axis tests
+        const float4x4 boxToMesh = inverse(meshToBox);
+        const float3 boxCenter = boxToMesh.w.xyz();
+        const float3 boxReach = mul(float3x3{ abs(boxToMesh.x.xyz()), abs(boxToMesh.y.xyz()), abs(boxToMesh.z.xyz()) }, halfExtents);
+
+        uint32_t stack[64];
+        int top = 0;
+        stack[top++] = 0;
+
+        while (top > 0)
+        {
+            const Node & node = nodes[stack[--top]];
+            const float3 c = node.bounds.center(), e = node.bounds.size() * 0.5f;
+
+            if (any(greater(abs(c - boxCenter), e + boxReach))) continue;
+            if (any(greater(abs(mul(rotation, c) + meshToBox.w.xyz()), halfExtents + mul(absRotation, e)))) continue;
+
+            if (node.count > 0) candidates.insert(candidates.end(), faces.begin() + node.first, faces.begin() + node.first + node.count);
+            else
+            {
+                stack[top++] = node.first + 1;
+                stack[top++] = node.first;
+            }
+        }
+    }
+};
+
+// Clips the faces in [begin, end) of `candidates` against the projector box and appends them to `decal`
+// as triangle fans. Positions are written in world space, since decals are drawn with an identity model matrix.
+inline void append_decal_faces(const Geometry & mesh, const std::vector<uint32_t> & candidates, const size_t begin, const size_t end,
+    const float4x4 & meshToBox, const float4x4 & boxToWorld, const float4 & normalRotation, const float3 & dimensions, Geometry & decal)
+{
+    const float3 halfExtents = dimensions * 0.5f;
+    const float3 axes[6] = { { 1, 0, 0 },{ -1, 0, 0 },{ 0, 1, 0 },{ 0, -1, 0 },{ 0, 0, 1 },{ 0, 0, -1 } };
+
+    DecalPolygon polygons[2];
+
+    for (size_t i = begin; i < end; ++i)
+    {
+        const uint3 & f = mesh.faces[candidates[i]];
+
+        DecalPolygon * in = &polygons[0];
+        DecalPolygon * out = &polygons[1];
+        in->count = 3;
+        for (int j = 0; j < 3; ++j)
+        {
+            in->vertices[j] = DecalVertex(mul(meshToBox, float4(mesh.vertices[f[j]], 1)).xyz(), mesh.normals[f[j]]);
+        }
+
+        for (int p = 0; p < 6 && in->count > 0; ++p)
+        {
+            clip_polygon(*in, *out, axes[p], std::abs(dot(halfExtents, axes[p])));
+            std::swap(in, out);
+        }
+
+        if (in->count < 3) continue;
+
+        const uint32_t base = static_cast<uint32_t>(decal.vertices.size());
+        for (int k = 0; k < in->count; ++k)
+        {
+            const DecalVertex & a = in->vertices[k];
+
+            // Projected coordinates are the texture coordinates
+            decal.texcoord0.push_back(float2(0.5f + (a.v.x / dimensions.x), 0.5f + (a.v.y / dimensions.y)));
+            decal.vertices.push_back(mul(boxToWorld, float4(a.v, 1)).xyz());
+            decal.normals.push_back(qrot(normalRotation, a.n));
+        }
+        for (int k = 1; k + 1 < in->count; ++k) decal.faces.emplace_back(base, base + k, base + k + 1);
+    }
+}
+
+// http://blog.wolfire.com/2009/06/how-to-project-decals/
+// `pose` places the mesh in the world and `cubePose` the projector box. Only faces the BVH reports near the box
+// are clipped, and large candidate sets are clipped in parallel.
+inline Geometry make_decal_geometry(const Geometry & mesh, const DecalBVH & bvh, const Pose & pose, const Pose & cubePose, const float3 & dimensions)
+{
+    assert(mesh.normals.size() > 0);
+
+    const float4x4 meshToBox = (cubePose.inverse() * pose).matrix();
+    const float4x4 boxToWorld = cubePose.matrix();
+
+    std::vector<uint32_t> candidates;
+    bvh.query(meshToBox, dimensions * 0.5f, candidates);
+
+    const size_t grain = 4096;
+    const size_t maxChunks = std::max<size_t>(1, std::thread::hardware_concurrency());
+    const size_t numChunks = std::min(maxChunks, std::max<size_t>(1, candidates.size() / grain));
+
+    if (numChunks == 1)
+    {
+        Geometry decal;
+        append_decal_faces(mesh, candidates, 0, candidates.size(), meshToBox, boxToWorld, pose.orientation, dimensions, decal);
+        return decal;
+    }
+
+    // One output per chunk, concatenated in order so the result matches the serial path
+    const size_t chunkSize = (candidates.size() + numChunks - 1) / numChunks;
+    std::vector<Geometry> parts(numChunks);
+    parallel_for(0, numChunks, 1, [&](size_t b, size_t e)
+    {
+        for (size_t c = b; c < e; ++c)
+        {
+            const size_t first = c * chunkSize, last = std::min(candidates.size(), first + chunkSize);
+            append_decal_faces(mesh, candidates, first, last, meshToBox, boxToWorld, pose.orientation, dimensions, parts[c]);
+        }
+    });
+
+    Geometry decal;
+    size_t numVertices = 0, numFaces = 0;
+    for (const auto & p : parts) { numVertices += p.vertices.size(); numFaces += p.faces.size(); }
+    decal.vertices.reserve(numVertices);
+    decal.normals.reserve(numVertices);
+    decal.texcoord0.reserve(numVertices);
+    decal.faces.reserve(numFaces);
+
+    for (const auto & p : parts)
+    {
+        const uint32_t base = static_cast<uint32_t>(decal.vertices.size());
+        decal.vertices.insert(decal.vertices.end(), p.vertices.begin(), p.vertices.end());
+        decal.normals.insert(decal.normals.end(), p.normals.begin(), p.normals.end());
+        decal.texcoord0.insert(decal.texcoord0.end(), p.texcoord0.begin(), p.texcoord0.end());
+        for (const auto & f : p.faces) decal.faces.push_back(f + uint3(base));
+    }
+    return decal;
+}
+
+#endif // end decal_geometry_hpp
@@ -33,6 +33,8 @@ shader_workbench::shader_workbench() : GLFWApp(1200, 800, "Geometric Decals")
     m.mesh = "torus-mesh";
     meshes.push_back(std::move(m));
 
+    for (auto & mesh : meshes) meshBVHs.emplace_back(mesh.geom.get());
+
     gizmo.reset(new GlGizmo());
 
     cam.look_at({ 0, 2.f, 2.f }, { 0, 0.0f, -.1f });
@@ -60,36 +62,42 @@ void shader_workbench::on_input(const InputEvent & event)
     {
         if (event.value[0] == GLFW_MOUSE_BUTTON_LEFT)
         {
+            auto worldRay = cam.get_world_ray(event.cursor, float2(event.windowSize));
+
+            // Place the projector on the nearest surface under the cursor
+            RaycastResult nearest(false, std::numeric_limits<float>::max(), {});
             for (auto & model : meshes)
             {
-                auto worldRay = cam.get_world_ray(event.cursor, float2(event.windowSize));
-
                 RaycastResult rc = model.raycast(worldRay);
+                if (rc.hit && rc.distance < nearest.distance) nearest = rc;
+            }
 
-                if (rc.hit)
-                {
-                    float3 position = worldRay.calculate_position(rc.distance);
-                    float3 target = (rc.normal * float3(10, 10, 10)) + position;
+            if (nearest.hit)
+            {
+                float3 position = worldRay.calculate_position(nearest.distance);
+                float3 target = (nearest.normal * float3(10, 10, 10)) + position;
 
-                    Pose box;
+                Pose box;
 
-                    // Option A: Camera to mesh (orientation artifacts, better uv projection across hard surfaces)
-                    if (projType == PROJECTION_TYPE_CAMERA)
-                    {
-                        box = Pose(cam.get_pose().orientation, position);
-                    }
+                // Option A: Camera to mesh (orientation artifacts, better uv projection across hard surfaces)
+                if (projType == PROJECTION_TYPE_CAMERA)
+                {
+                    box = Pose(cam.get_pose().orientation, position);
+                }
 
-                    // Option B: Normal to mesh (uv issues)
-                    else if (projType == PROJECTION_TYPE_NORMAL)
-                    {
-                        box = look_at_pose_rh(position, target);
-                    }
+                // Option B: Normal to mesh (uv issues)
+                else if (projType == PROJECTION_TYPE_NORMAL)
+                {
+                    box = look_at_pose_rh(position, target);
+                }
 
-                    Geometry newDecalGeometry = make_decal_geometry(model.geom.get(), {}, box, float3(0.5f));
-                    decals.push_back(make_mesh_from_geometry(newDecalGeometry));
+                // The box may straddle several meshes; the BVH query rejects the rest at their root
+                for (size_t i = 0; i < meshes.size(); ++i)
+                {
+                    Geometry newDecalGeometry = make_decal_geometry(meshes[i].geom.get(), meshBVHs[i], meshes[i].get_pose(), box, float3(0.5f));
+                    if (!newDecalGeometry.faces.empty()) decals.push_back(make_mesh_from_geometry(newDecalGeometry));
                 }
             }
-
         }
     }
 
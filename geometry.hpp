@@ -2,6 +2,7 @@
 #define geometry_hpp
 
 #include "math-core.hpp"
+#include "util.hpp"
 #include "../lib-model-io/model-io.hpp"
 
 using namespace avl;
@@ -23,139 +24,220 @@ inline Bounds3D compute_bounds(const Geometry & g)
     return bounds;
 }
 
-// Lengyel, Eric. "Computing Tangent Space Basis Vectors for an Arbitrary Mesh".
-// Terathon Software 3D Graphics Library, 2001.
-inline void compute_tangents(Geometry & g)
+// Maps every vertex to the lowest-index vertex within `epsilon` of it, visiting vertices in index order.
+// Positions are bucketed into a grid with cells of size `epsilon` and sorted by cell, so each vertex only
+// compares against the 27 cells around it instead of the whole mesh.
+inline std::vector<uint32_t> weld_vertices(const std::vector<float3> & vertices, const float epsilon)
 {
-    g.tangents.resize(g.vertices.size());
-    g.bitangents.resize(g.vertices.size());
+    const uint32_t count = static_cast<uint32_t>(vertices.size());
+    const float invCell = 1.f / epsilon;
+    const float epsilon2 = epsilon * epsilon;
 
-    // Each face
-    for (size_t i = 0; i < g.faces.size(); ++i)
+    auto cell_of = [invCell](const float3 & p)
     {
-        uint3 face = g.faces[i];
-
-        const float3 & v0 = g.vertices[face.x];
-        const float3 & v1 = g.vertices[face.y];
-        const float3 & v2 = g.vertices[face.z];
+        return int3((int)std::floor(p.x * invCell), (int)std::floor(p.y * invCell), (int)std::floor(p.z * invCell));
+    };
 
-        const float2 & w0 = g.texcoord0[face.x];
-        const float2 & w1 = g.texcoord0[face.y];
-        const float2 & w2 = g.texcoord0[face.z];
-
-        float x1 = v1.x - v0.x;
-        float x2 = v2.x - v0.x;
-        float y1 = v1.y - v0.y;
-        float y2 = v2.y - v0.y;
-        float z1 = v1.z - v0.z;
-        float z2 = v2.z - v0.z;
+    // Coordinates wrap at 21 bits; far-apart cells that alias only cost an extra distance test
+    auto pack = [](const int x, const int y, const int z)
+    {
+        return (uint64_t(x & 0x1FFFFF) << 42) | (uint64_t(y & 0x1FFFFF) << 21) | uint64_t(z & 0x1FFFFF);
+    };
 
-        float s1 = w1.x - w0.x;
-        float s2 = w2.x - w0.x;
-        float t1 = w1.y - w0.y;
-        float t2 = w2.y - w0.y;
+    std::vector<std::pair<uint64_t, uint32_t>> sorted(count);
+    parallel_for(0, count, 16384, [&](size_t b, size_t e)
+    {
+        for (size_t i = b; i < e; ++i)
+        {
+            const int3 c = cell_of(vertices[i]);
+            sorted[i] = { pack(c.x, c.y, c.z), static_cast<uint32_t>(i) };
+        }
+    });
+    std::sort(sorted.begin(), sorted.end());
 
-        float r = (s1 * t2 - s2 * t1);
+    std::vector<uint32_t> remap(count, UINT32_MAX);
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        if (remap[i] != UINT32_MAX) continue;
+        remap[i] = i;
 
-        if (r != 0.0f) r = 1.0f / r;
+        const int3 c = cell_of(vertices[i]);
+        for (int dz = -1; dz <= 1; ++dz)
+        for (int dy = -1; dy <= 1; ++dy)
+        for (int dx = -1; dx <= 1; ++dx)
+        {
+            const uint64_t key = pack(c.x + dx, c.y + dy, c.z + dz);
+            auto it = std::lower_bound(sorted.begin(), sorted.end(), std::make_pair(key, 0u));
+            for (; it != sorted.end() && it->first == key; ++it)
+            {
+                const uint32_t j = it->second;
+                if (j > i && remap[j] == UINT32_MAX && length2(vertices[j] - vertices[i]) < epsilon2) remap[j] = i;
+            }
+        }
+    }
+    return remap;
+}
 
-        // Tangent in the S direction
-        const float3 tangent((t2 * x1 - t1 * x2) * r, (t2 * y1 - t1 * y2) * r, (t2 * z1 - t1 * z2) * r);
+// Vertex-to-corner adjacency in CSR form: the corners (face * 3 + k) touching vertex v are
+// corners[offsets[v]] .. corners[offsets[v + 1] - 1]. Corner vertices are looked up through `remap`.
+inline void build_vertex_corner_adjacency(const std::vector<uint3> & faces, const std::vector<uint32_t> & remap, std::vector<uint32_t> & offsets, std::vector<uint32_t> & corners)
+{
+    offsets.assign(remap.size() + 1, 0);
+    corners.resize(faces.size() * 3);
 
-        // Accumulate
-        g.tangents[face.x] += tangent;
-        g.tangents[face.y] += tangent;
-        g.tangents[face.z] += tangent;
+    for (const auto & f : faces)
+    {
+        offsets[remap[f.x] + 1]++;
+        offsets[remap[f.y] + 1]++;
+        offsets[remap[f.z] + 1]++;
     }
+    for (size_t v = 0; v < remap.size(); ++v) offsets[v + 1] += offsets[v];
 
-    // Tangents
-    for (size_t i = 0; i < g.vertices.size(); ++i)
+    std::vector<uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+    for (uint32_t i = 0; i < faces.size(); ++i)
     {
-        const float3 normal = g.normals[i];
-        const float3 tangent = g.tangents[i];
+        corners[cursor[remap[faces[i].x]]++] = i * 3 + 0;
+        corners[cursor[remap[faces[i].y]]++] = i * 3 + 1;
+        corners[cursor[remap[faces[i].z]]++] = i * 3 + 2;
+    }
+}
 
-        // Gram-Schmidt orthogonalize
-        g.tangents[i] = (tangent - normal * dot(normal, tangent));
+// Per-vertex tangent frames following the MikkTSpace construction: each face's UV-space tangent and bitangent
+// are projected into the tangent plane of the corner normal and accumulated weighted by the corner angle;
+// the bitangent is rebuilt as cross(n, t) with the handedness of the accumulated bitangent. Vertices are never
+// welded here, so UV seams stay sharp. Requires normals; without texcoords an arbitrary orthonormal basis is produced.
+inline void compute_tangents(Geometry & g)
+{
+    const size_t numVerts = g.vertices.size();
+    g.tangents.resize(numVerts);
+    g.bitangents.resize(numVerts);
 
-        const float len = length(g.tangents[i]);
+    if (g.normals.size() != numVerts) return;
 
-        if (len > 0.0f) g.tangents[i] = g.tangents[i] / (float)sqrt(len);
+    if (g.texcoord0.size() != numVerts)
+    {
+        for (size_t i = 0; i < numVerts; ++i)
+        {
+            const float3 n = g.normals[i];
+            const float3 axis = std::abs(n.x) < 0.9f ? float3(1, 0, 0) : float3(0, 1, 0);
+            g.tangents[i] = safe_normalize(axis - n * dot(n, axis));
+            g.bitangents[i] = cross(n, g.tangents[i]);
+        }
+        return;
     }
 
-    // Bitangents 
-    for (size_t i = 0; i < g.vertices.size(); ++i)
+    // Angle-weighted, normal-projected contribution of every corner
+    std::vector<float3> cornerTangents(g.faces.size() * 3), cornerBitangents(g.faces.size() * 3);
+    parallel_for(0, g.faces.size(), 4096, [&](size_t b, size_t e)
     {
-        g.bitangents[i] = safe_normalize(cross(g.normals[i], g.tangents[i]));
-    }
-}
+        for (size_t i = b; i < e; ++i)
+        {
+            const uint3 face = g.faces[i];
+            const uint32_t idx[3] = { face.x, face.y, face.z };
 
-inline void compute_normals(Geometry & g, bool smooth = true)
-{
-    constexpr double NORMAL_EPSILON = 0.0001;
+            const float3 e1 = g.vertices[face.y] - g.vertices[face.x];
+            const float3 e2 = g.vertices[face.z] - g.vertices[face.x];
+            const float2 d1 = g.texcoord0[face.y] - g.texcoord0[face.x];
+            const float2 d2 = g.texcoord0[face.z] - g.texcoord0[face.x];
 
-    g.normals.resize(g.vertices.size());
+            // Mikk keeps the sign of the UV area so mirrored charts get a flipped bitangent
+            const float area = d1.x * d2.y - d2.x * d1.y;
+            const float sign = area < 0.f ? -1.f : 1.f;
+            const float3 faceTangent = safe_normalize((e1 * d2.y - e2 * d1.y) * sign);
+            const float3 faceBitangent = safe_normalize((e2 * d1.x - e1 * d2.x) * sign);
 
-    for (auto & n : g.normals) n = float3(0, 0, 0);
+            for (int k = 0; k < 3; ++k)
+            {
+                const float3 n = g.normals[idx[k]];
+                const float3 p = g.vertices[idx[k]];
+                const float3 ea = safe_normalize((g.vertices[idx[(k + 1) % 3]] - p) - n * dot(n, g.vertices[idx[(k + 1) % 3]] - p));
+                const float3 eb = safe_normalize((g.vertices[idx[(k + 2) % 3]] - p) - n * dot(n, g.vertices[idx[(k + 2) % 3]] - p));
+                const float angle = std::acos(clamp(dot(ea, eb), -1.f, 1.f));
+
+                cornerTangents[i * 3 + k] = safe_normalize(faceTangent - n * dot(n, faceTangent)) * angle;
+                cornerBitangents[i * 3 + k] = safe_normalize(faceBitangent - n * dot(n, faceBitangent)) * angle;
+            }
+        }
+    });
 
-    std::vector<uint32_t> uniqueVertIndices(g.vertices.size(), 0);
-    if (smooth)
+    std::vector<uint32_t> identity(numVerts), offsets, corners;
+    for (uint32_t i = 0; i < numVerts; ++i) identity[i] = i;
+    build_vertex_corner_adjacency(g.faces, identity, offsets, corners);
+
+    parallel_for(0, numVerts, 8192, [&](size_t b, size_t e)
     {
-        for (uint32_t i = 0; i < uniqueVertIndices.size(); ++i)
+        for (size_t v = b; v < e; ++v)
         {
-            if (uniqueVertIndices[i] == 0)
+            float3 t, bt;
+            for (uint32_t c = offsets[v]; c < offsets[v + 1]; ++c)
             {
-                uniqueVertIndices[i] = i + 1;
-                const float3 v0 = g.vertices[i];
-                for (auto j = i + 1; j < g.vertices.size(); ++j)
-                {
-                    const float3 v1 = g.vertices[j];
-                    if (length2(v1 - v0) < NORMAL_EPSILON)
-                    {
-                        uniqueVertIndices[j] = uniqueVertIndices[i];
-                    }
-                }
+                t += cornerTangents[corners[c]];
+                bt += cornerBitangents[corners[c]];
             }
+
+            // Gram-Schmidt orthogonalize
+            const float3 n = g.normals[v];
+            g.tangents[v] = safe_normalize(t - n * dot(n, t));
+            const float handedness = dot(cross(n, g.tangents[v]), bt) < 0.f ? -1.f : 1.f;
+            g.bitangents[v] = cross(n, g.tangents[v]) * handedness;
         }
-    }
+    });
+}
 
-    uint32_t idx0, idx1, idx2;
-    for (size_t i = 0; i < g.faces.size(); ++i)
-    {
-        const auto & f = g.faces[i];
+inline void compute_normals(Geometry & g, bool smooth = true)
+{
+    constexpr float NORMAL_EPSILON = 0.0001f;
 
-        idx0 = (smooth) ? uniqueVertIndices[f.x] - 1 : f.x;
-        idx1 = (smooth) ? uniqueVertIndices[f.y] - 1 : f.y;
-        idx2 = (smooth) ? uniqueVertIndices[f.z] - 1 : f.z;
+    const size_t numVerts = g.vertices.size();
 
-        const float3 v0 = g.vertices[idx0];
-        const float3 v1 = g.vertices[idx1];
-        const float3 v2 = g.vertices[idx2];
+    // With smoothing, coincident vertices share one normal accumulated on the lowest-index copy
+    std::vector<uint32_t> remap;
+    if (smooth) remap = weld_vertices(g.vertices, std::sqrt(NORMAL_EPSILON));
+    else
+    {
+        remap.resize(numVerts);
+        for (uint32_t i = 0; i < numVerts; ++i) remap[i] = i;
+    }
 
-        float3 e0 = v1 - v0;
-        float3 e1 = v2 - v0;
-        float3 e2 = v2 - v1;
+    std::vector<float3> faceNormals(g.faces.size());
+    parallel_for(0, g.faces.size(), 4096, [&](size_t b, size_t e)
+    {
+        for (size_t i = b; i < e; ++i)
+        {
+            const auto & f = g.faces[i];
+            const float3 e0 = g.vertices[f.y] - g.vertices[f.x];
+            const float3 e1 = g.vertices[f.z] - g.vertices[f.x];
+            const float3 e2 = g.vertices[f.z] - g.vertices[f.y];
 
-        if (length2(e0) < NORMAL_EPSILON) continue;
-        if (length2(e1) < NORMAL_EPSILON) continue;
-        if (length2(e2) < NORMAL_EPSILON) continue;
+            if (length2(e0) < NORMAL_EPSILON || length2(e1) < NORMAL_EPSILON || length2(e2) < NORMAL_EPSILON) faceNormals[i] = float3(0, 0, 0);
+            else faceNormals[i] = safe_normalize(cross(e0, e1));
+        }
+    });
 
-        const float3 n = safe_normalize(cross(e0, e1));
+    std::vector<uint32_t> offsets, corners;
+    build_vertex_corner_adjacency(g.faces, remap, offsets, corners);
 
-        g.normals[f.x] += n;
-        g.normals[f.y] += n;
-        g.normals[f.z] += n;
+    g.normals.resize(numVerts);
 
-        // Copy normals for non-unique verts
-        if (smooth)
+    parallel_for(0, numVerts, 8192, [&](size_t b, size_t e)
+    {
+        for (size_t v = b; v < e; ++v)
         {
-            for (uint32_t i = 0; i < g.vertices.size(); ++i)
-            {
-                g.normals[i] = g.normals[uniqueVertIndices[i] - 1];
-            }
+            if (remap[v] != v) continue;
+            float3 n;
+            for (uint32_t c = offsets[v]; c < offsets[v + 1]; ++c) n += faceNormals[corners[c] / 3];
+            g.normals[v] = safe_normalize(n);
         }
-    }
+    });
 
-    for (auto & n : g.normals) n = safe_normalize(n);
+    // Copy normals for non-unique verts
+    if (smooth)
+    {
+        parallel_for(0, numVerts, 8192, [&](size_t b, size_t e)
+        {
+            for (size_t v = b; v < e; ++v) g.normals[v] = g.normals[remap[v]];
+        });
+    }
 }
 
 inline void rescale_geometry(Geometry & g, float radius = 1.0f)
@@ -161,11 +161,12 @@ typedef GlObject<GlTransformFeedbacksFactory> GlTransformFeedbacksObject;
 
 struct GlBuffer : public GlBufferObject
 {
-    GLsizeiptr size;
+    GLsizeiptr size{ 0 };
+    uint32_t revision{ 0 }; // bumped by every upload through this object, so copies of the contents can tell they are stale
     GlBuffer() {}
-    void set_buffer_data(const GLsizeiptr s, const GLvoid * data, const GLenum usage) { this->size = s; glNamedBufferDataEXT(*this, size, data, usage);  }
+    void set_buffer_data(const GLsizeiptr s, const GLvoid * data, const GLenum usage) { this->size = s; ++revision; glNamedBufferDataEXT(*this, size, data, usage);  }
     void set_buffer_data(const std::vector<GLubyte> & bytes, const GLenum usage) { set_buffer_data(bytes.size(), bytes.data(), usage); }
-    void set_buffer_sub_data(const GLsizeiptr s, const GLintptr offset, const GLvoid * data) { glNamedBufferSubDataEXT(*this, offset, s, data);  }
+    void set_buffer_sub_data(const GLsizeiptr s, const GLintptr offset, const GLvoid * data) { ++revision; glNamedBufferSubDataEXT(*this, offset, s, data);  }
     void set_buffer_sub_data(const std::vector<GLubyte> & bytes, const GLintptr offset, const GLenum usage) { set_buffer_sub_data(bytes.size(), offset, bytes.data()); }
 };
 
@@ -528,6 +529,16 @@ public:
 //   GlMesh   //
 ////////////////
 
+// Layout mandated by glMultiDrawElementsIndirect
+struct GlDrawElementsIndirectCommand
+{
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
 class GlMesh
 {
     GlVertexArrayObject vao;
@@ -581,8 +592,23 @@ public:
         }
     }
 
+    // Issues `drawCount` commands of type GlDrawElementsIndirectCommand read from `commands` starting at `offset`
+    void draw_elements_indirect(const GlBuffer & commands, GLsizei drawCount, GLintptr offset = 0) const
+    {
+        if (vertexBuffer.size && indexCount && drawCount)
+        {
+            glBindVertexArray(vao);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commands);
+            glMultiDrawElementsIndirect(drawMode, indexType, (const GLvoid *) offset, drawCount, sizeof(GlDrawElementsIndirectCommand));
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+            glBindVertexArray(0);
+        }
+    }
+
     void set_vertex_data(GLsizeiptr size, const GLvoid * data, GLenum usage) { vertexBuffer.set_buffer_data(size, data, usage); }
     GlBuffer & get_vertex_data_buffer() { return vertexBuffer; };
+    const GlBuffer & get_vertex_data_buffer() const { return vertexBuffer; };
 
     void set_instance_data(GLsizeiptr size, const GLvoid * data, GLenum usage) { instanceBuffer.set_buffer_data(size, data, usage); }
 
@@ -595,6 +621,12 @@ public:
         indexCount = count;
     }
     GlBuffer & get_index_data_buffer() { return indexBuffer; };
+    const GlBuffer & get_index_data_buffer() const { return indexBuffer; };
+
+    GLenum get_draw_mode() const { return drawMode; }
+    GLenum get_index_type() const { return indexType; }
+    GLsizei get_index_count() const { return indexCount; }
+    GLsizei get_vertex_stride() const { return vertexStride; }
 
     void set_attribute(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const GLvoid * offset)
     {
@@ -634,7 +666,6 @@ public:
 #endif // end gl_api_hpp
 
 // Todo: supported extensions
-// Todo: glMultiDrawElementsIndirect
 // Todo: occlusionQuery
 // Todo: timerQuery
 // Todo: blit/multisample?
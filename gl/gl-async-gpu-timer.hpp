@@ -6,82 +6,124 @@
 #include "gl-api.hpp"
 #include "util.hpp"
 
-class GlGpuTimer
+// Frame-indexed ring of GL_TIMESTAMP queries. Each frame writes into its own slot; a slot is read back
+// right before it gets reused, `latency - 1` frames after it was issued, at which point the driver has
+// almost always retired it. Timestamps (unlike GL_TIME_ELAPSED) can be freely nested and interleaved.
+class GlTimestampQueryPool
 {
-    struct query_timer
-    {
-        GLuint query;
-        bool active;
-    };
+    uint32_t capacity;
+    uint32_t latency;
+    std::vector<GLuint> queries;    // latency * capacity
+    std::vector<uint32_t> counts;   // queries written per slot
+    uint64_t frame{ 0 };
 
-    GLsync sync;
-    size_t activeIdx;
-    std::vector<query_timer> queries;
+    GlTimestampQueryPool(const GlTimestampQueryPool &) = delete;
+    GlTimestampQueryPool & operator = (const GlTimestampQueryPool &) = delete;
 
 public:
 
-    GlGpuTimer()  { }
+    static const uint32_t InvalidQuery = 0xFFFFFFFF;
 
-    ~GlGpuTimer()
+    GlTimestampQueryPool(const uint32_t capacityPerFrame = 512, const uint32_t latency = 3) : capacity(capacityPerFrame), latency(std::max(latency, 2u)), counts(std::max(latency, 2u), 0) { }
+
+    ~GlTimestampQueryPool()
     {
-        for (size_t i = 0; i < queries.size(); ++i)
-        {
-            glDeleteQueries(1, &queries[i].query);
-        }
+        shutdown();
     }
 
-    void start()
+    // Deletes the queries; the pool recreates them on the next `timestamp()`. Must be called while the context
+    // is still current for pools that outlive it (e.g. in a static).
+    void shutdown()
     {
-        activeIdx = queries.size();
+        if (queries.size()) glDeleteQueries((GLsizei) queries.size(), queries.data());
+        queries.clear();
+        std::fill(counts.begin(), counts.end(), 0);
+    }
 
-        // Reuse inactive queries
-        for (size_t i = 0; i < queries.size(); ++i)
-        {
-            if (queries[i].active == false)
-            {
-                activeIdx = i;
-                queries[i].active = true;
-                break;
-            }
-        }
-        
-        // Generate new query
-        if (activeIdx == queries.size())
+    uint64_t frame_index() const { return frame; }
+    uint32_t current_slot() const { return frame % latency; }
+    uint32_t oldest_slot() const { return (frame + 1) % latency; } // the slot reused by the next `advance()`
+    uint32_t size(const uint32_t slot) const { return counts[slot]; }
+
+    // Issues a timestamp into the current frame's slot. Returns its index within the slot, or InvalidQuery if full.
+    uint32_t timestamp()
+    {
+        if (queries.empty())
         {
-            query_timer qt;
-            glCreateQueries(GL_TIME_ELAPSED, 1, &qt.query);
-            qt.active = true;
-            queries.push_back(qt);
+            queries.resize(capacity * latency);
+            glCreateQueries(GL_TIMESTAMP, (GLsizei) queries.size(), queries.data());
         }
 
-        glBeginQuery(GL_TIME_ELAPSED, queries[activeIdx].query);
+        const uint32_t slot = current_slot();
+        if (counts[slot] >= capacity) return InvalidQuery;
+        glQueryCounter(queries[slot * capacity + counts[slot]], GL_TIMESTAMP);
+        return counts[slot]++;
     }
 
-    void stop()
+    // Timestamps retire in order, so the slot is complete once its last query is available
+    bool ready(const uint32_t slot) const
     {
-        glEndQuery(GL_TIME_ELAPSED);
+        if (counts[slot] == 0) return true;
+        GLint available = 0;
+        glGetQueryObjectiv(queries[slot * capacity + counts[slot] - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+        return available == GL_TRUE;
     }
 
-    double elapsed_ms()
+    // GPU time in nanoseconds; only valid once `ready(slot)` returns true
+    uint64_t get(const uint32_t slot, const uint32_t index) const
     {
-        double timer_elapsed = 0;
-        for (size_t i = 0; i < queries.size(); ++i)
+        GLuint64 result = 0;
+        glGetQueryObjectui64v(queries[slot * capacity + index], GL_QUERY_RESULT, &result);
+        return result;
+    }
+
+    // Moves to the next frame. Any unread results in `oldest_slot()` are discarded.
+    void advance()
+    {
+        frame++;
+        counts[current_slot()] = 0;
+    }
+};
+
+// Measures a single start/stop interval per frame. `elapsed_ms` reports the most recent interval that has
+// retired on the GPU, which lags a few frames behind the CPU but never blocks the pipeline. `start` returns
+// whether it read a new interval; when it didn't, `elapsed_ms` still holds an older one.
+class GlGpuTimer
+{
+    GlTimestampQueryPool pool{ 2, 4 };
+    double lastElapsed{ 0 };
+    bool running{ false };
+
+public:
+
+    bool start()
+    {
+        // Pick up the interval that is about to be overwritten, if it has completed
+        bool read = false;
+        const uint32_t oldest = pool.oldest_slot();
+        if (pool.size(oldest) == 2 && pool.ready(oldest))
         {
-            if (queries[i].active == true)
-            {
-                uint64_t elapsed = 0;
-                glGetQueryObjectui64v(queries[i].query, GL_QUERY_RESULT_NO_WAIT, &elapsed);
-                if (!elapsed)
-                    continue;
-
-                timer_elapsed = elapsed * 1E-6f; // convert into milliseconds
-                queries[i].active = false;
-            }
+            lastElapsed = (pool.get(oldest, 1) - pool.get(oldest, 0)) * 1e-6; // convert into milliseconds
+            read = true;
         }
 
-        return timer_elapsed;
+        pool.advance();
+        pool.timestamp();
+        running = true;
+        return read;
     }
 
+    void stop()
+    {
+        if (!running) return;
+        pool.timestamp();
+        running = false;
+    }
+
+    double elapsed_ms() const
+    {
+        return lastElapsed;
+    }
 };
 
 #endif // end timer_gl_gpu_h
@@ -0,0 +1,317 @@
+#pragma once
+
+#ifndef gl_frame_capture_hpp
+#define gl_frame_capture_hpp
+
+#include "gl-api.hpp"
+#include "math-common.hpp"
+#include "mpmc_blocking_queue.hpp"
+#include "stb/stb_image_write.h"
+
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <functional>
+
+enum class capture_format
+{
+    png,    // deflate, slow to encode; fine for single screenshots
+    tga,    // run-length encoded, cheap enough for image sequences
+    raw     // one uncompressed stream file of frame records (see raw_frame_header)
+};
+
+// Record header for capture_format::raw. Each record is followed by width * height * 4 bytes of
+// top-down RGBA8 pixels.
+struct raw_frame_header
+{
+    uint32_t magic{ 0x4D415246 }; // 'FRAM'
+    uint32_t width{ 0 }, height{ 0 }, channels{ 4 };
+    uint64_t frameIndex{ 0 };
+    double timestamp{ 0 };
+};
+
+// One finished readback on its way to disk
+struct captured_frame
+{
+    std::vector<uint8_t> pixels;    // bottom-up, as read
+    avl::int2 size;
+    capture_format format;
+    std::string path;               // file to write, or the stream for raw
+    uint64_t frameIndex;
+    double timestamp;
+};
+
+// The CPU side of GlFrameCapture, run on its worker thread: flips each frame to top-down and encodes it.
+// Raw records are appended to one stream file, opened by the first record and closed by `end_stream()`.
+class frame_capture_writer
+{
+    FILE * stream{ nullptr };
+
+public:
+
+    frame_capture_writer() = default;
+    ~frame_capture_writer() { end_stream(); }
+
+    frame_capture_writer(const frame_capture_writer &) = delete;
+    frame_capture_writer & operator = (const frame_capture_writer &) = delete;
+
+    // Flips RGBA8 rows in place
+    static void flip_rows(std::vector<uint8_t> & pixels, const avl::int2 size)
+    {
+        const size_t stride = size_t(size.x) * 4;
+        std::vector<uint8_t> row(stride);
+        for (int y = 0; y < size.y / 2; ++y)
+        {
+            uint8_t * a = pixels.data() + stride * y;
+            uint8_t * b = pixels.data() + stride * (size.y - 1 - y);
+            std::memcpy(row.data(), a, stride);
+            std::memcpy(a, b, stride);
+            std::memcpy(b, row.data(), stride);
+        }
+    }
+
+    // Leaves `f.pixels` top-down
+    bool write(captured_frame & f)
+    {
+        flip_rows(f.pixels, f.size);
+
+        bool ok = true;
+        switch (f.format)
+        {
+            case capture_format::png: ok = stbi_write_png(f.path.c_str(), f.size.x, f.size.y, 4, f.pixels.data(), f.size.x * 4) != 0; break;
+            case capture_format::tga: ok = stbi_write_tga(f.path.c_str(), f.size.x, f.size.y, 4, f.pixels.data()) != 0; break;
+            case capture_format::raw:
+            {
+                if (!stream) stream = fopen(f.path.c_str(), "wb");
+                if (!stream) { ok = false; break; }
+                raw_frame_header h;
+                h.width = f.size.x;
+                h.height = f.size.y;
+                h.frameIndex = f.frameIndex;
+                h.timestamp = f.timestamp;
+                ok = fwrite(&h, sizeof(h), 1, stream) == 1 && fwrite(f.pixels.data(), 1, f.pixels.size(), stream) == f.pixels.size();
+                break;
+            }
+        }
+        if (!ok) std::cerr << "frame capture: could not write " << f.path << std::endl;
+        return ok;
+    }
+
+    void end_stream()
+    {
+        if (stream) { fclose(stream); stream = nullptr; }
+    }
+};
+
+// Reads the default framebuffer back without stalling the render thread. `capture()` issues glReadPixels into
+// one of a ring of pixel pack buffers and fences it; `update()` copies any readback the GPU has finished out of
+// its buffer and hands it to a worker thread, which flips, encodes and writes the file. A single worker keeps
+// raw stream records in frame order.
+// Recording captures every frame. When the GPU or the writer falls behind, recording frames are dropped (and
+// counted) rather than stalling the frame loop; one-off png/tga screenshots are always written.
+class GlFrameCapture
+{
+    static const int RingSize = 3;
+    static const size_t MaxQueuedFrames = 8;
+
+    struct slot
+    {
+        GlBuffer pbo;
+        GLsync fence{ nullptr };
+        bool keep{ false };             // a one-off screenshot, never dropped
+        captured_frame pending;
+    };
+
+    slot ring[RingSize];
+    int head{ 0 };      // next slot to read into
+    int inFlight{ 0 };  // slots awaiting readback, oldest at (head - inFlight)
+    avl::int2 ringSize{ 0, 0 };
+
+    MPMCBlockingQueue<captured_frame> jobs;
+    std::thread worker;
+    std::atomic<size_t> queued{ 0 };
+
+    std::mutex poolMutex;
+    std::vector<std::vector<uint8_t>> pool;
+
+    std::string recordingPath;
+    capture_format recordingFormat{ capture_format::raw };
+    uint64_t recordedFrames{ 0 };
+    std::atomic<uint64_t> droppedFrames{ 0 };
+
+    frame_capture_writer writer; // owned by the worker
+
+    std::vector<uint8_t> acquire_buffer(const size_t bytes)
+    {
+        std::vector<uint8_t> b;
+        {
+            std::lock_guard<std::mutex> guard(poolMutex);
+            if (!pool.empty()) { b = std::move(pool.back()); pool.pop_back(); }
+        }
+        b.resize(bytes);
+        return b;
+    }
+
+    void release_buffer(std::vector<uint8_t> && b)
+    {
+        std::lock_guard<std::mutex> guard(poolMutex);
+        if (pool.size() < MaxQueuedFrames) pool.push_back(std::move(b));
+    }
+
+    void worker_loop()
+    {
+        captured_frame f;
+        while (jobs.wait_and_consume(f))
+        {
+            if (f.pixels.empty())
+            {
+                // Marks the end of a raw recording
+                writer.end_stream();
+                continue;
+            }
+            writer.write(f);
+            release_buffer(std::move(f.pixels));
+            --queued;
+        }
+        writer.end_stream();
+    }
+
+    // Moves a finished readback to the worker. With `wait`, blocks until the GPU is done with it. Recording
+    // frames are dropped when the worker is behind; screenshots are queued regardless.
+    bool retire_oldest(const bool wait)
+    {
+        if (inFlight == 0) return false;
+        slot & s = ring[(head - inFlight + RingSize) % RingSize];
+
+        const GLenum status = glClientWaitSync(s.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? GL_TIMEOUT_IGNORED : 0);
+        if (status == GL_TIMEOUT_EXPIRED) return false;
+        glDeleteSync(s.fence);
+        s.fence = nullptr;
+        --inFlight;
+
+        const size_t bytes = size_t(s.pending.size.x) * s.pending.size.y * 4;
+        if (queued.load() >= MaxQueuedFrames && !wait && !s.keep)
+        {
+            ++droppedFrames;
+            return true;
+        }
+
+        s.pending.pixels = acquire_buffer(bytes);
+        if (const void * mapped = glMapNamedBufferRangeEXT(s.pbo, 0, bytes, GL_MAP_READ_BIT))
+        {
+            std::memcpy(s.pending.pixels.data(), mapped, bytes);
+            glUnmapNamedBufferEXT(s.pbo);
+            ++queued;
+            jobs.produce(std::move(s.pending));
+        }
+        s.pending = captured_frame();
+        s.keep = false;
+        return true;
+    }
+
+    void resize_ring(const avl::int2 size)
+    {
+        while (retire_oldest(true)) {}
+        for (auto & s : ring) s.pbo.set_buffer_data(GLsizeiptr(size.x) * size.y * 4, nullptr, GL_STREAM_READ);
+        ringSize = size;
+    }
+
+public:
+
+    // The worker starts only once every member it touches is constructed
+    GlFrameCapture() { worker = std::thread(&GlFrameCapture::worker_loop, this); }
+
+    // Finishes outstanding readbacks and lets the worker write everything queued. Requires a current context.
+    ~GlFrameCapture()
+    {
+        while (retire_oldest(true)) {}
+        jobs.close();
+        worker.join();
+    }
+
+    GlFrameCapture(const GlFrameCapture &) = delete;
+    GlFrameCapture & operator = (const GlFrameCapture &) = delete;
+
+    // Reads `size` pixels of the currently bound read framebuffer. `path` is the output file, or the stream for raw.
+    void capture(const avl::int2 size, const capture_format format, const std::string & path, const uint64_t frameIndex = 0, const double timestamp = 0)
+    {
+        if (size.x <= 0 || size.y <= 0) return;
+        if (size != ringSize) resize_ring(size);
+
+        // Ring is full: drop if the oldest readback is not done yet, unless this is a one-off screenshot
+        const bool keep = format != capture_format::raw && recordingPath.empty();
+        if (inFlight == RingSize && !retire_oldest(keep))
+        {
+            ++droppedFrames;
+            return;
+        }
+
+        slot & s = ring[head];
+        s.keep = keep;
+        s.pending.size = size;
+        s.pending.format = format;
+        s.pending.path = path;
+        s.pending.frameIndex = frameIndex;
+        s.pending.timestamp = timestamp;
+
+        GLint alignment;
+        glGetIntegerv(GL_PACK_ALIGNMENT, &alignment);
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, s.pbo);
+        glReadPixels(0, 0, size.x, size.y, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        glPixelStorei(GL_PACK_ALIGNMENT, alignment);
+
+        s.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        head = (head + 1) % RingSize;
+        ++inFlight;
+    }
+
+    // Call once per frame on the GL thread. Never blocks.
+    void update()
+    {
+        while (retire_oldest(false)) {}
+    }
+
+    // `path` is a stream file for raw, or a prefix for numbered png/tga images
+    void begin_recording(const std::string & path, const capture_format format = capture_format::raw)
+    {
+        end_recording();
+        recordingPath = path;
+        recordingFormat = format;
+        recordedFrames = 0;
+        droppedFrames = 0;
+    }
+
+    void end_recording()
+    {
+        if (recordingPath.empty()) return;
+        while (retire_oldest(true)) {}
+        if (recordingFormat == capture_format::raw) jobs.produce(captured_frame());
+        recordingPath.clear();
+    }
+
+    bool is_recording() const { return !recordingPath.empty(); }
+
+    // Captures the next frame of the current recording
+    void record_frame(const avl::int2 size, const double timestamp)
+    {
+        if (recordingPath.empty()) return;
+        std::string path = recordingPath;
+        if (recordingFormat != capture_format::raw)
+        {
+            char index[16];
+            snprintf(index, sizeof(index), "-%06llu", (unsigned long long) recordedFrames);
+            path += index + std::string(recordingFormat == capture_format::png ? ".png" : ".tga");
+        }
+        capture(size, recordingFormat, path, recordedFrames++, timestamp);
+    }
+
+    uint64_t get_recorded_frames() const { return recordedFrames; }
+    uint64_t get_dropped_frames() const { return droppedFrames.load(); }
+};
+
+#endif // end gl_frame_capture_hpp
@@ -0,0 +1,323 @@
+#pragma once
+
+#ifndef gl_texture_streamer_hpp
+#define gl_texture_streamer_hpp
+
+#include "gl-api.hpp"
+#include "asset_io.hpp"
+#include "string_utils.hpp"
+#include "mpmc_blocking_queue.hpp"
+#include "mpsc_queue.hpp"
+
+#include <deque>
+#include <algorithm>
+#include <thread>
+#include <functional>
+#include <unordered_map>
+
+// Loads textures without stalling the render thread. Files are read and decoded on worker threads; the GL
+// thread calls `update()` once per frame, which copies at most `bytesPerFrame` of pixel data into a
+// persistently mapped PBO ring and issues the glTextureSubImage2D calls from it. Large images are split
+// by rows across frames. Each ring segment is fenced, and a segment still in use by the GPU just skips
+// that frame's uploads instead of waiting. DDS/KTX/KMG files go through gli and are uploaded level by level
+// (compressed or not) with their own mip chain; other formats are decoded with stb_image and optionally
+// get mips generated on the GPU once the base level is in.
+// `onReady` runs on the GL thread, inside `update()`, when a texture's data has been fully submitted.
+class GlTextureStreamer
+{
+    static const int RingSegments = 3;
+
+    struct request
+    {
+        uint64_t id;
+        std::string path;
+        bool flip;
+    };
+
+    struct decoded
+    {
+        uint64_t id{ 0 };
+        decoded_image image;
+        gli::texture compressed;
+        std::string error;
+    };
+
+    struct pending_callback
+    {
+        std::string path;
+        bool mipmaps;
+        std::function<void(GlTexture2D)> onReady;
+    };
+
+    struct upload
+    {
+        uint64_t id;
+        pending_callback info;
+        decoded source;
+        GlTexture2D texture;
+        GLenum target;                  // GL_TEXTURE_2D or GL_TEXTURE_CUBE_MAP
+        gli::gl::format format;         // gli sources only
+        size_t face{ 0 }, level{ 0 };   // next gli image to upload
+        int row{ 0 };                   // next row of an stb image
+        bool started{ false };
+    };
+
+    MPMCBlockingQueue<request> requests;
+    MPSCQueue<decoded> results;
+    std::vector<std::thread> workers;
+
+    std::unordered_map<uint64_t, pending_callback> callbacks;
+    std::deque<upload> uploads;
+    uint64_t nextId{ 1 };
+
+    GlBuffer ring;
+    uint8_t * ringMemory{ nullptr };
+    size_t segmentSize;
+    GLsync fences[RingSegments] = {};
+    int segment{ 0 };
+
+    static bool is_gli_container(const std::string & path)
+    {
+        std::string ext = get_extension(path);
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+        return ext == "dds" || ext == "ktx" || ext == "kmg";
+    }
+
+    void worker_loop()
+    {
+        request r;
+        while (requests.wait_and_consume(r))
+        {
+            decoded d;
+            d.id = r.id;
+            try
+            {
+                mapped_file bytes(r.path);
+                if (is_gli_container(r.path))
+                {
+                    d.compressed = gli::load(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+                    if (d.compressed.empty()) d.error = "unsupported or corrupt texture container";
+                    else if (d.compressed.target() != gli::TARGET_2D && d.compressed.target() != gli::TARGET_CUBE) d.error = "only 2D and cube textures are supported";
+                }
+                else d.image = decode_image(bytes.data(), bytes.size(), r.flip);
+            }
+            catch (const std::exception & e)
+            {
+                d.error = e.what();
+            }
+            results.produce(std::move(d));
+        }
+    }
+
+    // Allocates immutable storage for a freshly decoded texture
+    void begin_upload(upload & u)
+    {
+        if (!u.source.compressed.empty())
+        {
+            const gli::texture & t = u.source.compressed;
+            gli::gl GL(gli::gl::PROFILE_GL33);
+            u.format = GL.translate(t.format(), t.swizzles());
+            u.target = t.target() == gli::TARGET_CUBE ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D;
+            glTextureStorage2DEXT(u.texture, u.target, GLsizei(t.levels()), u.format.Internal, GLsizei(t.extent(0).x), GLsizei(t.extent(0).y));
+            glTextureParameterivEXT(u.texture, u.target, GL_TEXTURE_SWIZZLE_RGBA, &u.format.Swizzles[0]);
+            glTextureParameteriEXT(u.texture, u.target, GL_TEXTURE_MIN_FILTER, t.levels() > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+            glTextureParameteriEXT(u.texture, u.target, GL_TEXTURE_MAX_LEVEL, GLint(t.levels() - 1));
+            if (u.target == GL_TEXTURE_CUBE_MAP)
+            {
+                glTextureParameteriEXT(u.texture, u.target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+                glTextureParameteriEXT(u.texture, u.target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+                glTextureParameteriEXT(u.texture, u.target, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+            }
+            u.texture.width = float(t.extent(0).x);
+            u.texture.height = float(t.extent(0).y);
+        }
+        else
+        {
+            const decoded_image & img = u.source.image;
+            GLenum internalFormat, format;
+            image_gl_format(img.channels, internalFormat, format);
+            GLsizei levels = 1;
+            if (u.info.mipmaps) while ((std::max(img.width, img.height) >> levels) > 0) levels++;
+            u.target = GL_TEXTURE_2D;
+            glTextureStorage2DEXT(u.texture, GL_TEXTURE_2D, levels, internalFormat, img.width, img.height);
+            glTextureParameteriEXT(u.texture, GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+            u.texture.width = float(img.width);
+            u.texture.height = float(img.height);
+        }
+        glTextureParameteriEXT(u.texture, u.target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        u.texture.set_name(u.info.path);
+    }
+
+    // Stages as much of `u` as fits in [ringMemory + offset, segment end). Returns true once the texture is complete.
+    bool continue_upload(upload & u, const size_t segmentBase, size_t & offset)
+    {
+        if (!u.source.compressed.empty())
+        {
+            const gli::texture & t = u.source.compressed;
+            const bool compressed = gli::is_compressed(t.format());
+            while (u.face < t.faces())
+            {
+                const size_t bytes = t.size(u.level);
+                const void * src = t.data(0, u.face, u.level);
+                const GLenum target = u.target == GL_TEXTURE_CUBE_MAP ? GLenum(GL_TEXTURE_CUBE_MAP_POSITIVE_X + u.face) : GL_TEXTURE_2D;
+                const GLsizei w = GLsizei(t.extent(u.level).x), h = GLsizei(t.extent(u.level).y);
+
+                const void * pixels = nullptr;
+                if (offset + bytes <= segmentSize)
+                {
+                    std::memcpy(ringMemory + segmentBase + offset, src, bytes);
+                    pixels = reinterpret_cast<const void *>(segmentBase + offset);
+                    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring);
+                    offset += bytes;
+                }
+                else if (offset == 0)
+                {
+                    // Larger than a whole segment; hand it to the driver directly
+                    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+                    pixels = src;
+                    offset = segmentSize;
+                }
+                else return false; // next frame
+
+                if (compressed) glCompressedTextureSubImage2DEXT(u.texture, target, GLint(u.level), 0, 0, w, h, u.format.Internal, GLsizei(bytes), pixels);
+                else glTextureSubImage2DEXT(u.texture, target, GLint(u.level), 0, 0, w, h, u.format.External, u.format.Type, pixels);
+
+                if (++u.level == t.levels()) { u.level = 0; u.face++; }
+            }
+            return true;
+        }
+
+        const decoded_image & img = u.source.image;
+        GLenum internalFormat, format;
+        image_gl_format(img.channels, internalFormat, format);
+        const size_t stride = size_t(img.width) * img.channels;
+
+        int rows = int(std::min<size_t>((segmentSize - offset) / stride, size_t(img.height - u.row)));
+        const uint8_t * src = img.pixels.get() + stride * u.row;
+        if (rows > 0)
+        {
+            std::memcpy(ringMemory + segmentBase + offset, src, stride * rows);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring);
+            glTextureSubImage2DEXT(u.texture, GL_TEXTURE_2D, 0, 0, u.row, img.width, rows, format, GL_UNSIGNED_BYTE, reinterpret_cast<const void *>(segmentBase + offset));
+            offset += stride * rows;
+        }
+        else if (offset == 0)
+        {
+            // A single row larger than a segment
+            rows = 1;
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            glTextureSubImage2DEXT(u.texture, GL_TEXTURE_2D, 0, 0, u.row, img.width, rows, format, GL_UNSIGNED_BYTE, src);
+            offset = segmentSize;
+        }
+        u.row += rows;
+
+        if (u.row < img.height) return false;
+        if (u.info.mipmaps) glGenerateTextureMipmapEXT(u.texture, GL_TEXTURE_2D);
+        return true;
+    }
+
+public:
+
+    std::function<void(const std::string & path, const std::string & error)> onError = [](const std::string & path, const std::string & error)
+    {
+        std::cerr << "texture load failed: " << path << " (" << error << ")" << std::endl;
+    };
+
+    // Must be constructed on the GL thread. `workerCount` 0 picks one less than the number of hardware threads.
+    GlTextureStreamer(const size_t bytesPerFrame = 8 * 1024 * 1024, unsigned int workerCount = 0) : segmentSize(bytesPerFrame)
+    {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glNamedBufferStorageEXT(ring, segmentSize * RingSegments, nullptr, flags);
+        ringMemory = static_cast<uint8_t *>(glMapNamedBufferRangeEXT(ring, 0, segmentSize * RingSegments, flags));
+        if (!ringMemory) throw std::runtime_error("could not map texture upload ring");
+
+        if (workerCount == 0)
+        {
+            // hardware_concurrency() may report 0
+            const unsigned int hw = std::thread::hardware_concurrency();
+            workerCount = hw > 1 ? hw - 1 : 1;
+        }
+        for (unsigned int i = 0; i < workerCount; ++i) workers.emplace_back(&GlTextureStreamer::worker_loop, this);
+    }
+
+    ~GlTextureStreamer()
+    {
+        requests.close();
+        for (auto & w : workers) w.join();
+        results.consume_all([](decoded &&) {});
+        for (auto & f : fences) if (f) glDeleteSync(f);
+        glUnmapNamedBufferEXT(ring);
+    }
+
+    uint64_t load(const std::string & path, std::function<void(GlTexture2D)> onReady, const bool flip = false, const bool mipmaps = true)
+    {
+        const uint64_t id = nextId++;
+        callbacks[id] = { path, mipmaps, std::move(onReady) };
+        requests.produce(request{ id, path, flip });
+        return id;
+    }
+
+    // Textures requested but not yet handed to their callback
+    size_t pending() const { return callbacks.size() + uploads.size(); }
+
+    // Call once per frame from the GL thread
+    void update()
+    {
+        results.consume_all([this](decoded && d)
+        {
+            auto it = callbacks.find(d.id);
+            if (it == callbacks.end()) return;
+            if (!d.error.empty())
+            {
+                if (onError) onError(it->second.path, d.error);
+                callbacks.erase(it);
+                return;
+            }
+            upload u;
+            u.id = d.id;
+            u.info = std::move(it->second);
+            u.source = std::move(d);
+            callbacks.erase(it);
+            uploads.push_back(std::move(u));
+        });
+
+        if (uploads.empty()) return;
+
+        // The GPU may still be reading this segment from RingSegments frames ago
+        GLsync & fence = fences[segment];
+        if (fence)
+        {
+            if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) return;
+            glDeleteSync(fence);
+            fence = nullptr;
+        }
+
+        GLint alignment;
+        glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+        const size_t segmentBase = segmentSize * segment;
+        size_t offset = 0;
+        while (!uploads.empty() && offset < segmentSize)
+        {
+            upload & u = uploads.front();
+            if (!u.started) { begin_upload(u); u.started = true; }
+            if (!continue_upload(u, segmentBase, offset)) break;
+
+            auto onReady = std::move(u.info.onReady);
+            GlTexture2D texture = std::move(u.texture);
+            uploads.pop_front();
+            if (onReady) onReady(std::move(texture));
+        }
+
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+
+        fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        segment = (segment + 1) % RingSegments;
+
+        gl_check_error(__FILE__, __LINE__);
+    }
+};
+
+#endif // end gl_texture_streamer_hpp
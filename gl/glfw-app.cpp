@@ -2,7 +2,8 @@
 #include "util.hpp"
 #include "math-spatial.hpp"
 #include "gl-api.hpp"
-#include "stb/stb_image_write.h"
+#include "gl-frame-capture.hpp"
+#include "gl-async-gpu-timer.hpp"
 #include "human_time.hpp"
 
 using namespace avl;
@@ -129,6 +130,13 @@ GLFWApp::GLFWApp(int width, int height, const std::string title, int glfwSamples
 
 GLFWApp::~GLFWApp() 
 {
+    stop_simulation_thread();
+    if (window && (frameCapture || gpuTimer))
+    {
+        glfwMakeContextCurrent(window);
+        frameCapture.reset();
+        gpuTimer.reset();
+    }
     if (window) glfwDestroyWindow(window);
 }
 
@@ -183,63 +191,252 @@ void GLFWApp::take_screenshot(const std::string & filename)
     screenshotPath = filename;
 }
 
+GlFrameCapture & GLFWApp::get_frame_capture()
+{
+    if (!frameCapture) frameCapture.reset(new GlFrameCapture());
+    return *frameCapture;
+}
+
+void GLFWApp::begin_recording(const std::string & path, capture_format format)
+{
+    get_frame_capture().begin_recording(path, format);
+}
+
+void GLFWApp::end_recording()
+{
+    if (frameCapture) frameCapture->end_recording();
+}
+
+bool GLFWApp::is_recording() const
+{
+    return frameCapture && frameCapture->is_recording();
+}
+
 void GLFWApp::take_screenshot_impl()
 {
-    int width, height;
-    glfwGetWindowSize(window, &width, &height);
-    int2 size(width, height);
+    int2 size;
+    glfwGetFramebufferSize(window, &size.x, &size.y);
     HumanTime t;
     auto timestamp = t.make_timestamp();
-    std::vector<uint8_t> screenShot(size.x * size.y * 4);
-    glReadPixels(0, 0, size.x, size.y, GL_RGBA, GL_UNSIGNED_BYTE, screenShot.data());
-    auto flipped = screenShot;
-    for (int y = 0; y < size.y; ++y) memcpy(flipped.data() + y * size.x * 4, screenShot.data() + (size.y - y - 1)*size.x * 4, size.x * 4);
-    stbi_write_png(std::string(screenshotPath + "-" + timestamp + ".png").c_str(), size.x, size.y, 4, flipped.data(), 4 * size.x);
+    get_frame_capture().capture(size, capture_format::png, screenshotPath + "-" + timestamp + ".png");
     screenshotPath.clear();
 }
 
+typedef std::chrono::high_resolution_clock loop_clock;
+
+static double seconds_since_epoch(const loop_clock::time_point t)
+{
+    return std::chrono::duration<double>(t.time_since_epoch()).count();
+}
+
+// Sleeps through most of the wait, then spins the rest: sleep granularity is often a millisecond or worse
+static void wait_until(const loop_clock::time_point deadline, const double spinSeconds)
+{
+    const auto spin = std::chrono::duration_cast<loop_clock::duration>(std::chrono::duration<double>(spinSeconds));
+    const auto now = loop_clock::now();
+    if (deadline - now > spin) std::this_thread::sleep_for(deadline - now - spin);
+    while (loop_clock::now() < deadline) std::this_thread::yield();
+}
+
+void GLFWApp::set_fixed_timestep(double seconds, bool ownThread, int maxStepsPerFrame)
+{
+    stop_simulation_thread();
+    fixedTimestep = std::max(seconds, 0.0);
+    simulationOnThread = ownThread && fixedTimestep > 0;
+    maxFixedSteps = std::max(maxStepsPerFrame, 1);
+    fixedAccumulator = 0;
+}
+
+void GLFWApp::set_frame_rate_limit(double framesPerSecond, double spinMs)
+{
+    frameRateLimit = std::max(framesPerSecond, 0.0);
+    spinSeconds.store(std::max(spinMs, 0.0) / 1000.0);
+}
+
+void GLFWApp::set_gpu_timing(bool enabled)
+{
+    gpuTimingEnabled = enabled;
+}
+
+void GLFWApp::swap_buffers()
+{
+    if (gpuTimer) gpuTimer->stop();
+    glfwSwapBuffers(window);
+}
+
+void GLFWApp::run_fixed_steps(double timestep)
+{
+    // Past `maxFixedSteps` the simulation slows down instead of spiralling
+    fixedAccumulator += timestep;
+    const double maxAccumulated = fixedTimestep * maxFixedSteps;
+    if (fixedAccumulator > maxAccumulated)
+    {
+        frameTimings.droppedFixedSteps += uint64_t((fixedAccumulator - maxAccumulated) / fixedTimestep);
+        fixedAccumulator = maxAccumulated;
+    }
+
+    while (fixedAccumulator >= fixedTimestep)
+    {
+        FixedUpdateEvent e;
+        e.step = fixedStep++;
+        e.timestep_s = float(fixedTimestep);
+        e.elapsed_s = double(fixedStep) * fixedTimestep;
+        on_fixed_update(e);
+        fixedAccumulator -= fixedTimestep;
+        frameTimings.fixedSteps++;
+    }
+}
+
+void GLFWApp::simulation_loop(const double timestep, const int maxSteps)
+{
+    const auto step = std::chrono::duration_cast<loop_clock::duration>(std::chrono::duration<double>(timestep));
+    auto next = loop_clock::now();
+
+    while (simulationRunning.load())
+    {
+        try
+        {
+            FixedUpdateEvent e;
+            e.step = fixedStep++;
+            e.timestep_s = float(timestep);
+            e.elapsed_s = double(fixedStep) * timestep;
+            on_fixed_update(e);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> guard(simulationMutex);
+            simulationExceptions.push_back(std::current_exception());
+        }
+
+        frameTimings.fixedSteps++;
+        next += step;
+
+        // Fell too far behind: drop the backlog rather than running steps back to back
+        const auto now = loop_clock::now();
+        if (now - next > step * maxSteps)
+        {
+            frameTimings.droppedFixedSteps += uint64_t((now - next) / step);
+            next = now;
+        }
+
+        lastFixedStepTime.store(seconds_since_epoch(next - step));
+        wait_until(next, spinSeconds.load());
+    }
+}
+
+void GLFWApp::start_simulation_thread()
+{
+    if (simulationRunning.load()) return;
+    simulationRunning = true;
+    lastFixedStepTime = seconds_since_epoch(loop_clock::now());
+    simulationThread = std::thread(&GLFWApp::simulation_loop, this, fixedTimestep, maxFixedSteps);
+}
+
+void GLFWApp::stop_simulation_thread()
+{
+    simulationRunning = false;
+    if (simulationThread.joinable()) simulationThread.join();
+}
+
 void GLFWApp::main_loop() 
 {
-    auto t0 = std::chrono::high_resolution_clock::now();
-    
+    auto t0 = loop_clock::now();
+
     while (!glfwWindowShouldClose(window)) 
     {
         for (auto & e : exceptions) on_uncaught_exception(e);
 
         try
         {
-            auto t1 = std::chrono::high_resolution_clock::now();
+            if (simulationOnThread)
+            {
+                start_simulation_thread();
+
+                std::vector<std::exception_ptr> failed;
+                {
+                    std::lock_guard<std::mutex> guard(simulationMutex);
+                    failed.swap(simulationExceptions);
+                }
+                for (auto & e : failed) on_uncaught_exception(e);
+            }
+
+            auto t1 = loop_clock::now();
             auto timestep = std::chrono::duration<float>(t1 - t0).count();
             t0 = t1;
             
             elapsedFrames++;
+            fpsFrames++;
             fpsTime += timestep;
 
             if (fpsTime > 0.5f)
             {
-                fps = elapsedFrames / fpsTime;
-                elapsedFrames = 0;
+                fps = uint64_t(fpsFrames / fpsTime);
+                fpsFrames = 0;
                 fpsTime = 0;
             }
 
+            if (elapsedFrames > 1) frameTimings.frame.put(timestep * 1000.f);
+
+            float interpolation = 0.f;
+            if (fixedTimestep > 0 && !simulationOnThread)
+            {
+                run_fixed_steps(timestep);
+                interpolation = float(fixedAccumulator / fixedTimestep);
+            }
+            else if (simulationOnThread)
+            {
+                const double sinceStep = seconds_since_epoch(loop_clock::now()) - lastFixedStepTime.load();
+                interpolation = float(std::min(std::max(sinceStep / fixedTimestep, 0.0), 0.999));
+            }
+
             UpdateEvent e;
             e.elapsed_s = glfwGetTime();
             e.timestep_ms = timestep;
-            e.framesPerSecond = fps;
+            e.framesPerSecond = float(fps);
             e.elapsedFrames = elapsedFrames;
+            e.interpolation = interpolation;
 
             on_update(e);
+
+            if (gpuTimingEnabled != bool(gpuTimer)) gpuTimer.reset(gpuTimingEnabled ? new GlGpuTimer() : nullptr);
+
+            // Results lag by the timer's query latency; frames whose interval hasn't retired yet add no sample
+            const bool gpuResult = gpuTimer && gpuTimer->start();
             on_draw();
+            if (gpuTimer) gpuTimer->stop();
+            if (gpuResult) frameTimings.gpu.put(float(gpuTimer->elapsed_ms()));
+
+            if (screenshotPath.size() > 0) take_screenshot_impl();
 
-            if (screenshotPath.size() > 0)take_screenshot_impl();
+            if (frameCapture)
+            {
+                if (frameCapture->is_recording())
+                {
+                    int2 size;
+                    glfwGetFramebufferSize(window, &size.x, &size.y);
+                    frameCapture->record_frame(size, e.elapsed_s);
+                }
+                frameCapture->update();
+            }
 
             glfwPollEvents();
+
+            frameTimings.cpu.put(std::chrono::duration<float, std::milli>(loop_clock::now() - t1).count());
+
+            if (frameRateLimit > 0)
+            {
+                const auto frameTime = std::chrono::duration_cast<loop_clock::duration>(std::chrono::duration<double>(1.0 / frameRateLimit));
+                wait_until(t1 + frameTime, spinSeconds.load());
+            }
         }
         catch(...)
         {
+            stop_simulation_thread();
             on_uncaught_exception(std::current_exception());
         }
     }
+
+    stop_simulation_thread();
 }
 
 void GLFWApp::on_uncaught_exception(std::exception_ptr e)
@@ -5,11 +5,15 @@
 
 #include "util.hpp"
 #include "math-core.hpp"
+#include "frame_timing.hpp"
 
 #include <thread>
 #include <chrono>
 #include <codecvt>
 #include <string>
+#include <memory>
+#include <mutex>
+#include <atomic>
 
 #if defined(ANVIL_PLATFORM_WINDOWS)
 #define GLEW_STATIC
@@ -25,15 +29,27 @@
 #pragma warning(disable : 4800)
 #endif
 
+class GlFrameCapture;
+class GlGpuTimer;
+enum class capture_format;
+
 namespace avl
 {
 
     struct UpdateEvent
     {
         double elapsed_s;
-        float timestep_ms;
+        float timestep_ms;      // seconds since the previous frame (the name predates the unit)
         float framesPerSecond;
         uint64_t elapsedFrames;
+        float interpolation;    // progress into the next fixed step in [0, 1); 0 when no fixed timestep is set
+    };
+
+    struct FixedUpdateEvent
+    {
+        double elapsed_s;       // simulated time, a whole number of steps
+        float timestep_s;
+        uint64_t step;
     };
 
     struct InputEvent
@@ -71,6 +87,7 @@ namespace avl
         void main_loop();
 
         virtual void on_update(const UpdateEvent & e) {}
+        virtual void on_fixed_update(const FixedUpdateEvent & e) {}
         virtual void on_draw() {}
         virtual void on_window_focus(bool focused) {}
         virtual void on_window_resize(int2 size) {}
@@ -85,10 +102,34 @@ namespace avl
         void set_fullscreen(bool state);
         bool get_fullscreen();
 
+        // Written asynchronously as `filename-<timestamp>.png`
         void take_screenshot(const std::string & filename);
 
+        // Captures every frame until `end_recording()`. `path` is the stream file for raw, or a prefix for numbered images.
+        void begin_recording(const std::string & path, capture_format format);
+        void end_recording();
+        bool is_recording() const;
+
         int get_mods() const;
 
+        // Calls on_fixed_update at a constant rate, decoupled from rendering; 0 disables it. By default the steps
+        // run on the main thread before on_update, catching up by at most `maxStepsPerFrame`. With `ownThread`
+        // they run on a simulation thread instead, which must hand state to on_draw through something like a
+        // TripleBuffer and must not touch GL.
+        void set_fixed_timestep(double seconds, bool ownThread = false, int maxStepsPerFrame = 8);
+
+        // Caps the frame rate by sleeping, then spinning for the last `spinMs` to hit the deadline. 0 disables pacing.
+        void set_frame_rate_limit(double framesPerSecond, double spinMs = 1.5);
+
+        // Off by default. When on, FrameTimings::gpu measures the GL work from the start of on_draw to
+        // swap_buffers(); apps that call glfwSwapBuffers themselves end the interval after the swap instead.
+        void set_gpu_timing(bool enabled);
+
+        const FrameTimings & get_frame_timings() const { return frameTimings; }
+
+        // Presents the frame. Ends the GPU timing interval first, so that it doesn't include the swap.
+        void swap_buffers();
+
     protected:
 
         GLFWwindow * window;
@@ -105,6 +146,8 @@ namespace avl
 
         void take_screenshot_impl();
         std::string screenshotPath;
+        std::unique_ptr<GlFrameCapture> frameCapture;
+        GlFrameCapture & get_frame_capture();
         
         void preprocess_input(InputEvent & event);
 
@@ -112,6 +155,7 @@ namespace avl
         static void exit_fullscreen(GLFWwindow * window, const int2 & windowedSize, const int2 & windowedPos);
 
         uint64_t elapsedFrames = 0;
+        uint64_t fpsFrames = 0;
         uint64_t fps = 0;
         double fpsTime = 0;
         int lastButton = 0;
@@ -121,6 +165,31 @@ namespace avl
         int2 windowedPos;
 
         std::vector<std::exception_ptr> exceptions;
+
+        FrameTimings frameTimings;
+        std::unique_ptr<GlGpuTimer> gpuTimer;
+        bool gpuTimingEnabled = false;
+
+        // The simulation thread gets its own copy of the step settings when it starts; they only change
+        // while it is stopped. spinSeconds can change at any time, so it is shared atomically.
+        double fixedTimestep = 0;
+        int maxFixedSteps = 8;
+        double fixedAccumulator = 0;
+        uint64_t fixedStep = 0;
+        double frameRateLimit = 0;
+        std::atomic<double> spinSeconds{ 0.0015 };
+
+        bool simulationOnThread = false;
+        std::thread simulationThread;
+        std::atomic<bool> simulationRunning{ false };
+        std::atomic<double> lastFixedStepTime{ 0 };
+        std::mutex simulationMutex;
+        std::vector<std::exception_ptr> simulationExceptions;
+
+        void run_fixed_steps(double timestep);
+        void simulation_loop(const double timestep, const int maxSteps);
+        void start_simulation_thread();
+        void stop_simulation_thread();
     };
         
     extern int Main(int argc, char * argv[]);
@@ -0,0 +1,5 @@
+// Unit tests for the header-only utilities. Benchmarks are hidden test cases tagged [benchmark]; build
+// Release and run them with `incubator-tests.exe [benchmark]`, or a single one by name.
+
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
@@ -0,0 +1,190 @@
+#include "catch.hpp"
+#include "vr-environment/debug_line_renderer.hpp"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// Only the CPU side of DebugLineRenderer is exercised here; the ring upload and draws need a context
+
+typedef DebugDrawBatch::LineVertex LineVertex;
+typedef DebugDrawBatch::Instance Instance;
+
+struct packed_frame
+{
+    std::vector<LineVertex> lines;
+    std::vector<Instance> instances;
+    DebugDrawBatch::layout layout;
+
+    packed_frame(DebugDrawBatch & batch, const size_t lineBudget, const size_t instanceBudget) : lines(lineBudget * 2), instances(instanceBudget)
+    {
+        layout = batch.pack(lines.data(), lineBudget, instances.data(), instanceBudget);
+    }
+
+    size_t line_count() const { return layout.lineCount[0] + layout.lineCount[1]; }
+    size_t instance_count() const
+    {
+        size_t n = 0;
+        for (auto & shape : layout.instanceCount) for (auto c : shape) n += c;
+        return n;
+    }
+};
+
+TEST_CASE("DebugDrawBatch packs lines and instances by mode and shape")
+{
+    DebugDrawBatch batch;
+    const int depth = int(debug_draw_mode::depth_tested), overlay = int(debug_draw_mode::overlay);
+
+    // Interleaved modes from two threads
+    auto record = [&](const float base)
+    {
+        for (int i = 0; i < 10; ++i)
+        {
+            const debug_draw_mode mode = i % 2 ? debug_draw_mode::overlay : debug_draw_mode::depth_tested;
+            batch.add_line(float3(base + i, 0, 0), float3(base + i, 1, 0), i % 2 ? float3(1, 0, 0) : float3(0, 0, 1), mode);
+            batch.add_instance(DebugDrawBatch::Shape(i % DebugDrawBatch::NumShapes), float3(base + i, 0, 0), float4(0, 0, 0, 1), float3(1, 1, 1), float3(1, 1, 1), mode);
+        }
+    };
+    record(0.f);
+    std::thread([&]() { record(100.f); }).join();
+
+    const packed_frame f(batch, 1000, 1000);
+    REQUIRE(f.layout.droppedLines == 0);
+    REQUIRE(f.layout.droppedInstances == 0);
+
+    // Depth-tested lines come first, then overlay, each contiguous and made of whole segments
+    REQUIRE(f.layout.lineFirst[depth] == 0);
+    REQUIRE(f.layout.lineCount[depth] == 20);
+    REQUIRE(f.layout.lineFirst[overlay] == 20);
+    REQUIRE(f.layout.lineCount[overlay] == 20);
+    for (int m = 0; m < DebugDrawBatch::NumModes; ++m)
+    {
+        const uint32_t color = DebugDrawBatch::pack_color(m == overlay ? float3(1, 0, 0) : float3(0, 0, 1));
+        for (size_t v = f.layout.lineFirst[m]; v < f.layout.lineFirst[m] + f.layout.lineCount[m]; v += 2)
+        {
+            REQUIRE(f.lines[v].color == color);
+            REQUIRE(f.lines[v + 1].color == color);
+            REQUIRE(f.lines[v].position.x == f.lines[v + 1].position.x);
+            REQUIRE(int(f.lines[v].position.x) % 2 == m);
+        }
+    }
+
+    // Instances are grouped by shape, then mode, in that order with no gaps
+    size_t expectedFirst = 0;
+    for (int s = 0; s < DebugDrawBatch::NumShapes; ++s)
+    {
+        for (int m = 0; m < DebugDrawBatch::NumModes; ++m)
+        {
+            REQUIRE(f.layout.instanceFirst[s][m] == expectedFirst);
+            expectedFirst += f.layout.instanceCount[s][m];
+            for (size_t k = f.layout.instanceFirst[s][m]; k < expectedFirst; ++k)
+            {
+                const int i = int(f.instances[k].position.x) % 100;
+                REQUIRE(i % DebugDrawBatch::NumShapes == s);
+                REQUIRE(i % 2 == m);
+            }
+        }
+    }
+    REQUIRE(f.instance_count() == 20);
+
+    // clear() empties the frame
+    batch.clear();
+    const packed_frame empty(batch, 1000, 1000);
+    REQUIRE(empty.line_count() == 0);
+    REQUIRE(empty.instance_count() == 0);
+}
+
+TEST_CASE("DebugDrawBatch drops and counts what is over budget")
+{
+    DebugDrawBatch batch;
+    for (int i = 0; i < 15; ++i) batch.add_line(float3(0, 0, 0), float3(1, 1, 1), float3(1, 1, 1), debug_draw_mode::depth_tested);
+    for (int i = 0; i < 10; ++i) batch.add_line(float3(0, 0, 0), float3(1, 1, 1), float3(1, 1, 1), debug_draw_mode::overlay);
+    for (int i = 0; i < 7; ++i) batch.add_instance(DebugDrawBatch::Box, float3(0, 0, 0), float4(0, 0, 0, 1), float3(1, 1, 1), float3(1, 1, 1), debug_draw_mode::overlay);
+    for (int i = 0; i < 7; ++i) batch.add_instance(DebugDrawBatch::Axis, float3(0, 0, 0), float4(0, 0, 0, 1), float3(1, 1, 1), float3(1, 1, 1), debug_draw_mode::depth_tested);
+
+    // The budget is filled in packing order: depth-tested lines first; boxes before axes
+    const packed_frame f(batch, 20, 9);
+    REQUIRE(f.layout.lineCount[int(debug_draw_mode::depth_tested)] == 30);
+    REQUIRE(f.layout.lineCount[int(debug_draw_mode::overlay)] == 10);
+    REQUIRE(f.layout.droppedLines == 5);
+    REQUIRE(f.layout.instanceCount[DebugDrawBatch::Box][int(debug_draw_mode::overlay)] == 7);
+    REQUIRE(f.layout.instanceCount[DebugDrawBatch::Axis][int(debug_draw_mode::depth_tested)] == 2);
+    REQUIRE(f.layout.droppedInstances == 5);
+
+    // Nothing fits in a zero budget
+    const packed_frame none(batch, 0, 0);
+    REQUIRE(none.line_count() == 0);
+    REQUIRE(none.layout.droppedLines == 25);
+    REQUIRE(none.layout.droppedInstances == 14);
+
+    const packed_frame all(batch, 25, 14);
+    REQUIRE(all.layout.droppedLines == 0);
+    REQUIRE(all.layout.droppedInstances == 0);
+}
+
+TEST_CASE("DebugDrawBatch releases the buffers of exited threads")
+{
+    DebugDrawBatch batch;
+    batch.add_line(float3(0, 0, 0), float3(1, 0, 0), float3(1, 1, 1), debug_draw_mode::depth_tested);
+
+    for (int i = 0; i < 200; ++i)
+    {
+        std::thread([&]() { batch.add_line(float3(0, 0, 0), float3(1, 0, 0), float3(1, 1, 1), debug_draw_mode::overlay); }).join();
+    }
+    REQUIRE(batch.thread_buffer_count() == 201);
+
+    // What exited threads recorded is still drawn in the frame they recorded it for
+    const packed_frame f(batch, 1000, 0);
+    REQUIRE(f.layout.lineCount[int(debug_draw_mode::overlay)] == 400);
+
+    batch.clear();
+    REQUIRE(batch.thread_buffer_count() == 1);
+
+    // The calling thread keeps its buffer
+    batch.add_line(float3(0, 0, 0), float3(1, 0, 0), float3(1, 1, 1), debug_draw_mode::depth_tested);
+    REQUIRE(batch.thread_buffer_count() == 1);
+
+    // A thread outliving the batch is harmless
+    std::unique_ptr<DebugDrawBatch> shortLived(new DebugDrawBatch());
+    std::atomic<bool> recorded{ false }, destroyed{ false };
+    std::thread t([&]()
+    {
+        shortLived->add_line(float3(0, 0, 0), float3(1, 0, 0), float3(1, 1, 1), debug_draw_mode::depth_tested);
+        recorded = true;
+        while (!destroyed) std::this_thread::yield();
+    });
+    while (!recorded) std::this_thread::yield();
+    shortLived.reset();
+    destroyed = true;
+    t.join();
+}
+
+TEST_CASE("DebugDrawBatch keeps one buffer per thread however many batches are live")
+{
+    // More live batches than the old 16-entry thread cache held, used round robin from one thread
+    std::vector<std::unique_ptr<DebugDrawBatch>> batches;
+    for (int i = 0; i < 40; ++i) batches.emplace_back(new DebugDrawBatch());
+
+    for (int round = 0; round < 5; ++round)
+    {
+        for (auto & b : batches) b->add_line(float3(0, 0, 0), float3(1, 0, 0), float3(1, 1, 1), debug_draw_mode::depth_tested);
+    }
+
+    for (auto & b : batches)
+    {
+        REQUIRE(b->thread_buffer_count() == 1);
+        const packed_frame f(*b, 100, 0);
+        REQUIRE(f.line_count() == 10);
+    }
+
+    // Destroyed batches leave the cache on the next miss; the survivors keep their buffers
+    batches.resize(10);
+    DebugDrawBatch fresh;
+    fresh.add_line(float3(0, 0, 0), float3(1, 0, 0), float3(1, 1, 1), debug_draw_mode::depth_tested);
+    for (auto & b : batches)
+    {
+        b->add_line(float3(0, 0, 0), float3(1, 0, 0), float3(1, 1, 1), debug_draw_mode::depth_tested);
+        REQUIRE(b->thread_buffer_count() == 1);
+    }
+}
@@ -0,0 +1,123 @@
+#include "catch.hpp"
+#include "../geometric-decals/decal-geometry.hpp"
+#include "procedural_mesh.hpp"
+#include "simple_timer.hpp"
+
+#include <iostream>
+#include <random>
+#include <vector>
+
+// Random projector boxes sitting on the surface of `mesh`, facing along the surface normal
+static std::vector<std::pair<Pose, float3>> make_projectors(const Geometry & mesh, const size_t count, const float minSize, const float maxSize)
+{
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<size_t> vertex(0, mesh.vertices.size() - 1);
+    std::uniform_real_distribution<float> size(minSize, maxSize), angle(0.f, float(ANVIL_TAU));
+
+    std::vector<std::pair<Pose, float3>> projectors;
+    for (size_t i = 0; i < count; ++i)
+    {
+        const size_t v = vertex(rng);
+        const float3 n = mesh.normals[v];
+        const float4 facing = make_rotation_quat_between_vectors(float3(0, 0, 1), n);
+        const float4 spin = make_rotation_quat_axis_angle(float3(0, 0, 1), angle(rng));
+        const float s = size(rng);
+        projectors.push_back({ Pose(qmul(facing, spin), mesh.vertices[v]), float3(s, s, s) });
+    }
+    return projectors;
+}
+
+static double total_area(const Geometry & g)
+{
+    double area = 0;
+    for (auto & f : g.faces) area += 0.5 * length(cross(g.vertices[f.y] - g.vertices[f.x], g.vertices[f.z] - g.vertices[f.x]));
+    return area;
+}
+
+// The decal of every face, without the BVH: what make_decal_geometry did before it had one
+static Geometry make_decal_brute_force(const Geometry & mesh, const Pose & pose, const Pose & cubePose, const float3 & dimensions)
+{
+    std::vector<uint32_t> all(mesh.faces.size());
+    for (uint32_t i = 0; i < all.size(); ++i) all[i] = i;
+    Geometry decal;
+    append_decal_faces(mesh, all, 0, all.size(), (cubePose.inverse() * pose).matrix(), cubePose.matrix(), pose.orientation, dimensions, decal);
+    return decal;
+}
+
+TEST_CASE("make_decal_geometry clips the same surface as clipping every face")
+{
+    const Geometry torus = make_torus(96);
+    const DecalBVH bvh(torus);
+    const Pose meshPose(make_rotation_quat_axis_angle(float3(1, 0, 0), 0.3f), float3(0.5f, -1.f, 2.f));
+
+    for (auto & p : make_projectors(torus, 50, 0.2f, 2.5f))
+    {
+        const Pose cubePose = meshPose * p.first;
+        const Geometry decal = make_decal_geometry(torus, bvh, meshPose, cubePose, p.second);
+        const Geometry reference = make_decal_brute_force(torus, meshPose, cubePose, p.second);
+
+        REQUIRE(decal.faces.size() > 0);
+        REQUIRE(decal.faces.size() == reference.faces.size());
+        REQUIRE(decal.vertices.size() == reference.vertices.size());
+        REQUIRE(total_area(decal) == Approx(total_area(reference)).epsilon(1e-4));
+
+        // Everything lies inside the projector box, in world space
+        const Pose worldToBox = cubePose.inverse();
+        const float3 halfExtents = p.second * 0.5f + float3(1e-4f);
+        for (auto & v : decal.vertices) REQUIRE(all(lequal(abs(worldToBox.transform_coord(v)), halfExtents)));
+        for (auto & t : decal.texcoord0) REQUIRE((all(gequal(t, float2(-1e-4f))) && all(lequal(t, float2(1 + 1e-4f)))));
+    }
+}
+
+TEST_CASE("make_decal_geometry parallel path matches the serial clip")
+{
+    // A box covering the whole torus gives far more than 4096 candidates
+    const Geometry torus = make_torus(128);
+    const DecalBVH bvh(torus);
+    const Pose cubePose;
+    const float3 dimensions(10, 10, 10);
+
+    const Geometry decal = make_decal_geometry(torus, bvh, Pose(), cubePose, dimensions);
+
+    std::vector<uint32_t> candidates;
+    bvh.query(cubePose.inverse().matrix(), dimensions * 0.5f, candidates);
+    REQUIRE(candidates.size() == torus.faces.size());
+    Geometry serial;
+    append_decal_faces(torus, candidates, 0, candidates.size(), cubePose.inverse().matrix(), cubePose.matrix(), Pose().orientation, dimensions, serial);
+
+    REQUIRE(decal.faces.size() == torus.faces.size());
+    REQUIRE(decal.vertices == serial.vertices);
+    REQUIRE(decal.faces == serial.faces);
+}
+
+TEST_CASE("make_decal_geometry decals per second on a 4M triangle mesh", "[.][benchmark]")
+{
+    SimpleTimer t(true);
+    const Geometry torus = make_torus(1414);
+    const double meshMs = t.nanoseconds().count() * 1e-6;
+
+    t.start();
+    const DecalBVH bvh(torus);
+    const double bvhMs = t.nanoseconds().count() * 1e-6;
+
+    std::cout << torus.faces.size() << " triangles (mesh " << meshMs << " ms, BVH build " << bvhMs << " ms)" << std::endl;
+
+    for (const float size : { 0.2f, 0.5f, 1.0f })
+    {
+        const auto projectors = make_projectors(torus, 2000, size, size);
+        size_t outputFaces = 0;
+
+        t.start();
+        for (auto & p : projectors) outputFaces += make_decal_geometry(torus, bvh, Pose(), p.first, p.second).faces.size();
+        const double ms = t.nanoseconds().count() * 1e-6;
+
+        std::cout << "  " << size << " unit boxes: " << projectors.size() * 1000.0 / ms << " decals/sec (" << outputFaces / projectors.size() << " triangles per decal)" << std::endl;
+    }
+
+    // Clipping every face, for a handful of decals
+    const auto projectors = make_projectors(torus, 4, 0.5f, 0.5f);
+    t.start();
+    for (auto & p : projectors) make_decal_brute_force(torus, Pose(), p.first, p.second);
+    const double bruteMs = t.nanoseconds().count() * 1e-6;
+    std::cout << "  without the BVH: " << projectors.size() * 1000.0 / bruteMs << " decals/sec" << std::endl;
+}
@@ -0,0 +1,179 @@
+#include "catch.hpp"
+#include "file_io.hpp"
+#include "simple_timer.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace avl;
+
+static void write_bytes(const std::string & path, const size_t size, const uint32_t seed)
+{
+    std::vector<uint8_t> bytes(size);
+    uint32_t state = seed;
+    for (auto & b : bytes) { state = state * 1664525u + 1013904223u; b = uint8_t(state >> 24); }
+    FILE * f = fopen(path.c_str(), "wb");
+    REQUIRE(f != nullptr);
+    if (size) fwrite(bytes.data(), 1, size, f);
+    fclose(f);
+}
+
+// Touches every byte, so that each way of reading a file does the same work on the result. A plain sum
+// vectorizes, so it stays well below the cost of the read itself.
+static uint64_t checksum(const uint8_t * data, const size_t size)
+{
+    uint64_t sum = 0;
+    for (size_t i = 0; i < size; ++i) sum += data[i];
+    return sum;
+}
+
+// Evicts a file from the OS page cache so that the next read has to go to the device
+static bool drop_from_page_cache(const std::string & path)
+{
+#if defined(_WIN32)
+    // Opening a file unbuffered makes the cache manager flush and purge the pages it holds for it
+    HANDLE h = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING, nullptr);
+    if (h == INVALID_HANDLE_VALUE) return false;
+    CloseHandle(h);
+    return true;
+#else
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    fsync(fd); // dirty pages can't be dropped
+    const bool dropped = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+    close(fd);
+    return dropped;
+#endif
+}
+
+TEST_CASE("read_file_buffer, read_file_binary, read_file_text and mapped_file agree")
+{
+    for (const size_t size : { size_t(0), size_t(1), size_t(3), size_t(4096), size_t(1000003) })
+    {
+        const std::string path = "file-io-test.bin";
+        write_bytes(path, size, uint32_t(size) + 1);
+
+        const file_buffer buffer = read_file_buffer(path);
+        const std::vector<uint8_t> vec = read_file_binary(path);
+        const std::string text = read_file_text(path);
+        const mapped_file mapped(path);
+
+        REQUIRE(buffer.size() == size);
+        REQUIRE(vec.size() == size);
+        REQUIRE(text.size() == size);
+        REQUIRE(mapped.size() == size);
+        REQUIRE(std::equal(buffer.begin(), buffer.end(), vec.begin()));
+        REQUIRE(std::equal(mapped.begin(), mapped.end(), vec.begin()));
+        REQUIRE(std::equal(text.begin(), text.end(), reinterpret_cast<const char *>(vec.data())));
+
+        std::remove(path.c_str());
+    }
+
+    REQUIRE_THROWS_AS(read_file_buffer("file-io-test-missing.bin"), std::runtime_error);
+    REQUIRE_THROWS_AS(mapped_file("file-io-test-missing.bin"), std::runtime_error);
+}
+
+TEST_CASE("async_file_reader completes every read and survives throwing callbacks")
+{
+    const std::string path = "file-io-async-test.bin";
+    write_bytes(path, 12345, 7);
+
+    std::mutex m;
+    std::vector<std::string> callbackErrors;
+    std::atomic<int> ok{ 0 }, missing{ 0 };
+    {
+        async_file_reader reader(3);
+        reader.onCallbackError = [&](const std::string &, const std::string & e)
+        {
+            std::lock_guard<std::mutex> guard(m);
+            callbackErrors.push_back(e);
+        };
+
+        for (int i = 0; i < 100; ++i)
+        {
+            reader.read(i % 10 == 9 ? "file-io-async-missing.bin" : path, [&, i](async_file_reader::result && r)
+            {
+                if (!r.error.empty()) { missing++; return; }
+                if (r.buffer.size() == 12345) ok++;
+                if (i % 4 == 0) throw std::runtime_error("callback failed");
+            });
+        }
+
+        // Throwing callbacks must not leave their reads counted as pending
+        while (reader.pending()) std::this_thread::yield();
+    }
+
+    REQUIRE(ok == 90);
+    REQUIRE(missing == 10);
+    REQUIRE(callbackErrors.size() == 25); // every fourth read, none of which are the missing files
+    for (auto & e : callbackErrors) REQUIRE(e == "callback failed");
+
+    std::remove(path.c_str());
+}
+
+// Every variant reads each file completely and checksums all of its bytes, so they do the same work: the
+// difference is only in how the bytes get into memory (zero-filled vector, uninitialized buffer, page faults
+// on a mapping, or a pool of reader threads).
+TEST_CASE("file read throughput on cold and warm page cache", "[.][benchmark]")
+{
+    const int fileCount = 16;
+    const size_t fileSize = 8 * 1024 * 1024;
+
+    std::vector<std::string> paths;
+    for (int i = 0; i < fileCount; ++i)
+    {
+        paths.push_back("file-io-bench-" + std::to_string(i) + ".bin");
+        write_bytes(paths.back(), fileSize, i + 1);
+    }
+
+    struct variant { const char * name; std::function<uint64_t()> run; };
+    const std::vector<variant> variants =
+    {
+        { "read_file_binary", [&]() { uint64_t s = 0; for (auto & p : paths) { auto v = read_file_binary(p); s += checksum(v.data(), v.size()); } return s; } },
+        { "read_file_buffer", [&]() { uint64_t s = 0; for (auto & p : paths) { auto b = read_file_buffer(p); s += checksum(b.data(), b.size()); } return s; } },
+        { "mapped_file", [&]() { uint64_t s = 0; for (auto & p : paths) { mapped_file f(p); s += checksum(f.data(), f.size()); } return s; } },
+        { "async_file_reader (4 threads)", [&]()
+            {
+                std::atomic<uint64_t> s{ 0 };
+                async_file_reader reader(4);
+                for (auto & p : paths) reader.read(p, [&s](async_file_reader::result && r) { s += checksum(r.buffer.data(), r.buffer.size()); });
+                while (reader.pending()) std::this_thread::yield();
+                return s.load();
+            }
+        }
+    };
+
+    const double totalMb = double(fileCount) * fileSize / (1024.0 * 1024.0);
+    std::cout << fileCount << " files x " << fileSize / (1024 * 1024) << " MB, read and checksummed" << std::endl;
+
+    uint64_t expected = 0;
+    for (auto & v : variants)
+    {
+        bool cold = true;
+        for (auto & p : paths) cold &= drop_from_page_cache(p);
+
+        SimpleTimer t(true);
+        const uint64_t coldSum = v.run();
+        const double coldMs = t.nanoseconds().count() * 1e-6;
+
+        t.start();
+        const uint64_t warmSum = v.run();
+        const double warmMs = t.nanoseconds().count() * 1e-6;
+
+        if (!expected) expected = warmSum;
+        REQUIRE(coldSum == expected);
+        REQUIRE(warmSum == expected);
+
+        std::cout << "  " << v.name << ": " << (cold ? "cold " : "cold (could not evict) ") << totalMb / (coldMs * 1e-3) << " MB/s, warm "
+            << totalMb / (warmMs * 1e-3) << " MB/s" << std::endl;
+    }
+
+    for (auto & p : paths) std::remove(p.c_str());
+}
@@ -0,0 +1,140 @@
+#include "catch.hpp"
+#include "gl-frame-capture.hpp"
+#include "stb/stb_image.h"
+
+#include <cstdio>
+#include <vector>
+
+// Only the CPU side is exercised here; readback and the keep/drop policy need a context
+
+// A bottom-up RGBA image, as glReadPixels returns it: row r of the top-down image is stored at height - 1 - r
+static captured_frame make_frame(const avl::int2 size, const capture_format format, const std::string & path)
+{
+    captured_frame f;
+    f.size = size;
+    f.format = format;
+    f.path = path;
+    f.frameIndex = 0;
+    f.timestamp = 0;
+    f.pixels.resize(size_t(size.x) * size.y * 4);
+    for (int y = 0; y < size.y; ++y)
+    {
+        for (int x = 0; x < size.x; ++x)
+        {
+            uint8_t * p = &f.pixels[(size_t(size.y - 1 - y) * size.x + x) * 4];
+            p[0] = uint8_t(x);
+            p[1] = uint8_t(y);
+            p[2] = uint8_t(x * 7 + y * 13);
+            p[3] = uint8_t(255 - y);
+        }
+    }
+    return f;
+}
+
+static std::vector<uint8_t> top_down(const avl::int2 size)
+{
+    std::vector<uint8_t> pixels(size_t(size.x) * size.y * 4);
+    for (int y = 0; y < size.y; ++y)
+    {
+        for (int x = 0; x < size.x; ++x)
+        {
+            uint8_t * p = &pixels[(size_t(y) * size.x + x) * 4];
+            p[0] = uint8_t(x);
+            p[1] = uint8_t(y);
+            p[2] = uint8_t(x * 7 + y * 13);
+            p[3] = uint8_t(255 - y);
+        }
+    }
+    return pixels;
+}
+
+TEST_CASE("frame_capture_writer flips rows to top-down")
+{
+    // Odd heights leave the middle row in place
+    for (const avl::int2 size : { avl::int2(1, 1), avl::int2(3, 2), avl::int2(5, 3), avl::int2(17, 8), avl::int2(4, 9) })
+    {
+        captured_frame f = make_frame(size, capture_format::raw, "");
+        frame_capture_writer::flip_rows(f.pixels, size);
+        REQUIRE(f.pixels == top_down(size));
+
+        frame_capture_writer::flip_rows(f.pixels, size);
+        REQUIRE(f.pixels == make_frame(size, capture_format::raw, "").pixels);
+    }
+}
+
+TEST_CASE("frame_capture_writer writes png and tga that decode to the top-down image")
+{
+    const avl::int2 size(37, 21);
+    for (const capture_format format : { capture_format::png, capture_format::tga })
+    {
+        const std::string path = format == capture_format::png ? "frame-capture-test.png" : "frame-capture-test.tga";
+        frame_capture_writer writer;
+        captured_frame f = make_frame(size, format, path);
+        REQUIRE(writer.write(f));
+
+        int width = 0, height = 0, channels = 0;
+        uint8_t * decoded = stbi_load(path.c_str(), &width, &height, &channels, 4);
+        REQUIRE(decoded != nullptr);
+        REQUIRE(width == size.x);
+        REQUIRE(height == size.y);
+        REQUIRE(std::vector<uint8_t>(decoded, decoded + size_t(width) * height * 4) == top_down(size));
+        stbi_image_free(decoded);
+        std::remove(path.c_str());
+    }
+
+    frame_capture_writer writer;
+    captured_frame f = make_frame(size, capture_format::png, "no-such-directory/frame.png");
+    REQUIRE_FALSE(writer.write(f));
+}
+
+TEST_CASE("frame_capture_writer appends raw records to one stream until it is ended")
+{
+    const std::string path = "frame-capture-test.raw";
+    const avl::int2 sizes[3] = { avl::int2(8, 5), avl::int2(8, 5), avl::int2(3, 4) };
+    {
+        frame_capture_writer writer;
+        for (int i = 0; i < 3; ++i)
+        {
+            captured_frame f = make_frame(sizes[i], capture_format::raw, path);
+            f.frameIndex = 100 + i;
+            f.timestamp = 0.5 * i;
+            REQUIRE(writer.write(f));
+        }
+        writer.end_stream();
+    }
+
+    FILE * file = fopen(path.c_str(), "rb");
+    REQUIRE(file != nullptr);
+    for (int i = 0; i < 3; ++i)
+    {
+        raw_frame_header h;
+        h.magic = 0;
+        REQUIRE(fread(&h, sizeof(h), 1, file) == 1);
+        REQUIRE(h.magic == raw_frame_header().magic);
+        REQUIRE(h.width == uint32_t(sizes[i].x));
+        REQUIRE(h.height == uint32_t(sizes[i].y));
+        REQUIRE(h.channels == 4);
+        REQUIRE(h.frameIndex == uint64_t(100 + i));
+        REQUIRE(h.timestamp == 0.5 * i);
+
+        std::vector<uint8_t> pixels(size_t(h.width) * h.height * 4);
+        REQUIRE(fread(pixels.data(), 1, pixels.size(), file) == pixels.size());
+        REQUIRE(pixels == top_down(sizes[i]));
+    }
+    char extra;
+    REQUIRE(fread(&extra, 1, 1, file) == 0);
+    fclose(file);
+
+    // The next stream truncates the file rather than appending to it
+    {
+        frame_capture_writer writer;
+        captured_frame f = make_frame(sizes[2], capture_format::raw, path);
+        REQUIRE(writer.write(f));
+    }
+    file = fopen(path.c_str(), "rb");
+    REQUIRE(file != nullptr);
+    fseek(file, 0, SEEK_END);
+    REQUIRE(size_t(ftell(file)) == sizeof(raw_frame_header) + size_t(sizes[2].x) * sizes[2].y * 4);
+    fclose(file);
+    std::remove(path.c_str());
+}
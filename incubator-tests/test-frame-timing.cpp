@@ -0,0 +1,184 @@
+#include "catch.hpp"
+#include "frame_timing.hpp"
+#include "triple_buffer.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace avl;
+
+TEST_CASE("TripleBuffer hands over published values")
+{
+    TripleBuffer<int> b(-1);
+    REQUIRE_FALSE(b.update());
+    REQUIRE(b.read_buffer() == -1);
+
+    b.write_buffer() = 1;
+    b.publish();
+    REQUIRE(b.update());
+    REQUIRE(b.read_buffer() == 1);
+
+    // Nothing new: the reader keeps the value it has
+    REQUIRE_FALSE(b.update());
+    REQUIRE(b.read_buffer() == 1);
+
+    // The writer runs ahead: only the latest value is seen, once
+    for (int i = 2; i <= 10; ++i)
+    {
+        b.write_buffer() = i;
+        b.publish();
+    }
+    REQUIRE(b.update());
+    REQUIRE(b.read_buffer() == 10);
+    REQUIRE_FALSE(b.update());
+    REQUIRE(b.read_buffer() == 10);
+
+    // Writing without publishing is invisible to the reader
+    b.write_buffer() = 11;
+    REQUIRE_FALSE(b.update());
+    REQUIRE(b.read_buffer() == 10);
+    b.publish();
+    REQUIRE(b.update());
+    REQUIRE(b.read_buffer() == 11);
+}
+
+TEST_CASE("TripleBuffer reader never sees a partially written value")
+{
+    struct snapshot { uint64_t words[32]; };
+    const uint64_t count = 200000;
+
+    snapshot initial;
+    std::fill(std::begin(initial.words), std::end(initial.words), 0);
+    TripleBuffer<snapshot> b(initial);
+
+    std::thread writer([&]()
+    {
+        for (uint64_t i = 1; i <= count; ++i)
+        {
+            snapshot & s = b.write_buffer();
+            for (auto & w : s.words) w = i;
+            b.publish();
+        }
+    });
+
+    uint64_t previous = 0, updates = 0;
+    bool torn = false, backwards = false;
+    while (previous < count)
+    {
+        if (!b.update()) { std::this_thread::yield(); continue; }
+        const snapshot & s = b.read_buffer();
+        for (auto w : s.words) torn |= w != s.words[0];
+        backwards |= s.words[0] <= previous;
+        previous = s.words[0];
+        updates++;
+    }
+    writer.join();
+
+    REQUIRE_FALSE(torn);
+    REQUIRE_FALSE(backwards);
+    REQUIRE(previous == count);
+    REQUIRE(updates >= 1);
+}
+
+TEST_CASE("FrameTimeHistogram assigns buckets and clamps at maxMs")
+{
+    FrameTimeHistogram h(100, 0.5f, 10.f);
+    const std::vector<uint32_t> & buckets = h.get_buckets();
+    REQUIRE(buckets.size() == 21); // 20 buckets up to maxMs, plus the overflow bucket
+
+    h.put(0.f);
+    h.put(0.49f);
+    h.put(0.5f);
+    h.put(3.2f);
+    h.put(-1.f);    // clamped to the first bucket
+    h.put(9.99f);
+    h.put(10.f);    // the overflow bucket starts at maxMs
+    h.put(250.f);
+
+    REQUIRE(buckets[0] == 3);
+    REQUIRE(buckets[1] == 1);
+    REQUIRE(buckets[6] == 1);
+    REQUIRE(buckets[19] == 1);
+    REQUIRE(buckets[20] == 2);
+    REQUIRE(h.num_frames() == 8);
+    REQUIRE(h.get_last() == 250.f);
+
+    // Percentiles report the upper edge of a bucket, and never more than maxMs
+    REQUIRE(h.compute_percentile(0.0) == 0.5f);
+    REQUIRE(h.compute_percentile(0.5) == 3.5f);
+    REQUIRE(h.compute_percentile(1.0) == 10.f);
+}
+
+TEST_CASE("FrameTimeHistogram percentiles follow the window as it evicts")
+{
+    const size_t windowSize = 50;
+    const float width = 0.25f, maxMs = 40.f;
+    FrameTimeHistogram h(windowSize, width, maxMs, 1000.f);
+
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<float> u(0.f, 30.f);
+    std::vector<float> frames;
+    for (int i = 0; i < 400; ++i)
+    {
+        // The level changes every 100 frames so that old frames have to leave for the percentiles to move
+        const float ms = (i / 100) % 2 ? 30.f + u(rng) : u(rng) * 0.5f;
+        h.put(ms);
+        frames.push_back(ms);
+
+        const size_t n = std::min(frames.size(), windowSize);
+        std::vector<float> edges;
+        for (size_t k = frames.size() - n; k < frames.size(); ++k) edges.push_back(std::min(float(int(frames[k] / width) + 1) * width, maxMs));
+        std::sort(edges.begin(), edges.end());
+
+        REQUIRE(h.num_frames() == n);
+        for (const double q : { 0.0, 0.1, 0.5, 0.9, 0.99, 1.0 })
+        {
+            const size_t rank = std::min(n - 1, size_t(q * double(n)));
+            REQUIRE(h.compute_percentile(q) == edges[rank]);
+        }
+    }
+
+    uint32_t total = 0;
+    for (auto c : h.get_buckets()) total += c;
+    REQUIRE(total == windowSize);
+    REQUIRE(h.total_frames() == 400);
+
+    h.clear();
+    REQUIRE(h.num_frames() == 0);
+    REQUIRE(h.compute_percentile(0.5) == 0.f);
+}
+
+TEST_CASE("FrameTimeHistogram counts hitches against the median")
+{
+    FrameTimeHistogram h(20, 0.25f, 100.f, 2.f);
+
+    // No hitches until eight frames have set a median
+    h.put(1.f);
+    h.put(90.f);
+    REQUIRE(h.total_hitches() == 0);
+    for (int i = 0; i < 6; ++i) h.put(10.f);
+    REQUIRE(h.compute_percentile(0.5) == 10.25f);
+
+    // The threshold is hitchFactor times the median bucket's upper edge, exclusive
+    h.put(20.5f);
+    REQUIRE(h.total_hitches() == 0);
+    h.put(20.6f);
+    REQUIRE(h.total_hitches() == 1);
+    REQUIRE(h.window_hitches() == 1);
+
+    for (int i = 0; i < 8; ++i) h.put(10.f);
+    h.put(50.f);
+    REQUIRE(h.total_hitches() == 2);
+    REQUIRE(h.window_hitches() == 2);
+
+    // Hitches leave the window count as their frames are evicted, but stay in the total
+    for (int i = 0; i < 11; ++i) h.put(10.f);
+    REQUIRE(h.window_hitches() == 1);
+    for (int i = 0; i < 9; ++i) h.put(10.f);
+    REQUIRE(h.window_hitches() == 0);
+    REQUIRE(h.total_hitches() == 2);
+    REQUIRE(h.total_frames() == 39);
+}
@@ -0,0 +1,107 @@
+#include "catch.hpp"
+#include "geometry.hpp"
+#include "simple_timer.hpp"
+
+#include <atomic>
+#include <stdexcept>
+
+// A flat grid of `quads` x `quads` cells (two triangles each) in the xz plane with texcoords along x and z
+static Geometry make_grid(const uint32_t quads)
+{
+    Geometry g;
+    const uint32_t side = quads + 1;
+    g.vertices.reserve(side * side);
+    g.texcoord0.reserve(side * side);
+    for (uint32_t z = 0; z < side; ++z)
+    {
+        for (uint32_t x = 0; x < side; ++x)
+        {
+            g.vertices.push_back(float3(float(x), 0.f, float(z)));
+            g.texcoord0.push_back(float2(float(x) / quads, float(z) / quads));
+        }
+    }
+    g.faces.reserve(size_t(quads) * quads * 2);
+    for (uint32_t z = 0; z < quads; ++z)
+    {
+        for (uint32_t x = 0; x < quads; ++x)
+        {
+            const uint32_t i = z * side + x;
+            g.faces.push_back(uint3(i, i + side, i + 1));
+            g.faces.push_back(uint3(i + 1, i + side, i + side + 1));
+        }
+    }
+    return g;
+}
+
+TEST_CASE("parallel_for visits every index exactly once")
+{
+    for (const size_t count : { size_t(0), size_t(1), size_t(1000), size_t(1000003) })
+    {
+        std::vector<std::atomic<int>> hits(count);
+        for (auto & h : hits) h = 0;
+        parallel_for(0, count, 64, [&](size_t b, size_t e) { for (size_t i = b; i < e; ++i) hits[i]++; });
+        bool once = true;
+        for (auto & h : hits) once &= (h == 1);
+        REQUIRE(once);
+    }
+}
+
+TEST_CASE("parallel_for rethrows chunk exceptions on the caller and stays usable")
+{
+    for (int repeat = 0; repeat < 100; ++repeat)
+    {
+        REQUIRE_THROWS_AS(parallel_for(0, 100000, 64, [](size_t b, size_t e)
+        {
+            if (b <= 99999 && 99999 < e) throw std::runtime_error("chunk failed");
+        }), std::runtime_error);
+    }
+
+    std::atomic<size_t> sum{ 0 };
+    parallel_for(0, 100000, 64, [&](size_t b, size_t e) { sum += e - b; });
+    REQUIRE(sum == 100000);
+}
+
+TEST_CASE("parallel_for can be nested")
+{
+    std::atomic<size_t> sum{ 0 };
+    parallel_for(0, 64, 1, [&](size_t b, size_t e)
+    {
+        for (size_t i = b; i < e; ++i) parallel_for(0, 1000, 10, [&](size_t ib, size_t ie) { sum += ie - ib; });
+    });
+    REQUIRE(sum == 64000);
+}
+
+TEST_CASE("compute_normals and compute_tangents on a flat grid")
+{
+    Geometry g = make_grid(64);
+    compute_normals(g, true);
+    compute_tangents(g);
+
+    REQUIRE(g.normals.size() == g.vertices.size());
+    REQUIRE(g.tangents.size() == g.vertices.size());
+    for (size_t i = 0; i < g.vertices.size(); ++i)
+    {
+        REQUIRE(g.normals[i].y == Approx(1.f).epsilon(1e-4));
+        REQUIRE(g.tangents[i].x == Approx(1.f).epsilon(1e-4));
+        REQUIRE(g.bitangents[i].z == Approx(1.f).epsilon(1e-4));
+    }
+}
+
+TEST_CASE("compute_normals and compute_tangents at 100k / 1M / 10M triangles", "[.][benchmark]")
+{
+    std::cout << "parallel_for pool: " << parallel_for_pool::get_instance().num_threads() << " threads" << std::endl;
+    for (const uint32_t quads : { 224u, 708u, 2237u })
+    {
+        Geometry g = make_grid(quads);
+
+        SimpleTimer t(true);
+        compute_normals(g, true);
+        const double normalsMs = t.nanoseconds().count() * 1e-6;
+
+        t.start();
+        compute_tangents(g);
+        const double tangentsMs = t.nanoseconds().count() * 1e-6;
+
+        std::cout << g.faces.size() << " triangles: compute_normals " << normalsMs << " ms, compute_tangents " << tangentsMs << " ms" << std::endl;
+    }
+}
@@ -0,0 +1,119 @@
+#include "catch.hpp"
+#include "asset_io.hpp"
+#include "simple_timer.hpp"
+#include "third_party/stb/stb_image_write.h"
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+// An RGB image where every pixel encodes its own coordinates, plus some noise so that it doesn't compress away
+static std::vector<uint8_t> make_png(const int width, const int height, const uint32_t seed = 1)
+{
+    std::vector<uint8_t> pixels(size_t(width) * height * 3);
+    uint32_t state = seed;
+    for (int y = 0; y < height; ++y)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            state = state * 1664525u + 1013904223u;
+            uint8_t * p = &pixels[(size_t(y) * width + x) * 3];
+            p[0] = uint8_t(x);
+            p[1] = uint8_t(y);
+            p[2] = uint8_t(state >> 24);
+        }
+    }
+
+    std::vector<uint8_t> png;
+    stbi_write_png_to_func([](void * context, void * data, int size)
+    {
+        auto & out = *static_cast<std::vector<uint8_t> *>(context);
+        out.insert(out.end(), static_cast<uint8_t *>(data), static_cast<uint8_t *>(data) + size);
+    }, &png, width, height, 3, pixels.data(), width * 3);
+    return png;
+}
+
+TEST_CASE("decode_image flips rows without touching global stb state")
+{
+    const std::vector<uint8_t> png = make_png(37, 21);
+
+    decoded_image upright = decode_image(png);
+    decoded_image flipped = decode_image(png, true);
+    decoded_image again = decode_image(png);
+
+    REQUIRE(upright.width == 37);
+    REQUIRE(upright.height == 21);
+    REQUIRE(upright.channels == 3);
+    REQUIRE(flipped.size_bytes() == upright.size_bytes());
+
+    const size_t stride = size_t(upright.width) * upright.channels;
+    for (int y = 0; y < upright.height; ++y)
+    {
+        REQUIRE(upright.pixels.get()[stride * y + 1] == uint8_t(y));
+        REQUIRE(std::equal(upright.pixels.get() + stride * y, upright.pixels.get() + stride * (y + 1), flipped.pixels.get() + stride * (upright.height - 1 - y)));
+    }
+
+    // A flipped decode must not leak into later ones
+    REQUIRE(std::equal(upright.pixels.get(), upright.pixels.get() + upright.size_bytes(), again.pixels.get()));
+}
+
+TEST_CASE("decode_image from several threads at once")
+{
+    const std::vector<uint8_t> png = make_png(256, 128);
+    const decoded_image reference = decode_image(png);
+
+    std::vector<int> mismatches(8, 0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; ++t)
+    {
+        threads.emplace_back([&, t]()
+        {
+            for (int i = 0; i < 50; ++i)
+            {
+                const bool flip = (i + t) % 2 == 1;
+                decoded_image img = decode_image(png, flip);
+                const size_t stride = size_t(img.width) * img.channels;
+                const uint8_t * firstRow = img.pixels.get() + (flip ? stride * (img.height - 1) : 0);
+                if (!std::equal(firstRow, firstRow + stride, reference.pixels.get())) mismatches[t]++;
+            }
+        });
+    }
+    for (auto & t : threads) t.join();
+    for (auto m : mismatches) REQUIRE(m == 0);
+}
+
+// The CPU half of texture streaming: how long 500 images take to decode on the GL thread (what load_image
+// did) versus on a pool of workers the way GlTextureStreamer spreads them. The GL upload half needs a context;
+// it is measured by the scene editor's "Texture Streaming Benchmark" button.
+TEST_CASE("decoding 500 textures on the calling thread vs worker threads", "[.][benchmark]")
+{
+    const int count = 500;
+    std::vector<std::vector<uint8_t>> files;
+    for (int i = 0; i < 8; ++i) files.push_back(make_png(512, 512, i + 1));
+
+    SimpleTimer t(true);
+    size_t bytes = 0;
+    for (int i = 0; i < count; ++i) bytes += decode_image(files[i % files.size()]).size_bytes();
+    const double serialMs = t.nanoseconds().count() * 1e-6;
+
+    const unsigned int hw = std::thread::hardware_concurrency();
+    const unsigned int workers = hw > 1 ? hw - 1 : 1;
+    std::atomic<int> next{ 0 };
+    t.start();
+    std::vector<std::thread> pool;
+    for (unsigned int w = 0; w < workers; ++w)
+    {
+        pool.emplace_back([&]()
+        {
+            for (int i = next++; i < count; i = next++) decode_image(files[i % files.size()]);
+        });
+    }
+    for (auto & p : pool) p.join();
+    const double parallelMs = t.nanoseconds().count() * 1e-6;
+
+    std::cout << count << " x 512x512 RGB PNG (" << bytes / (1024 * 1024) << " MB decoded)" << std::endl;
+    std::cout << "  calling thread: " << serialMs << " ms (" << serialMs / count << " ms per texture blocked)" << std::endl;
+    std::cout << "  " << workers << " workers: " << parallelMs << " ms wall, 0 ms on the calling thread" << std::endl;
+}
@@ -0,0 +1,201 @@
+#include "catch.hpp"
+#include "kd_tree.hpp"
+#include "simple_timer.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <vector>
+
+// Uniform points with a dense cluster and exact duplicates mixed in, so that leaves are uneven and distances tie
+static std::vector<float3> make_cloud(const size_t count, const uint32_t seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> unit(-1.f, 1.f);
+    std::vector<float3> cloud(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        switch (i % 8)
+        {
+            case 0: cloud[i] = 0.01f * float3(unit(rng), unit(rng), unit(rng)) + float3(0.5f, 0.5f, 0.5f); break;
+            case 1: cloud[i] = i > 8 ? cloud[i - 8] : float3(0, 0, 0); break;
+            default: cloud[i] = float3(unit(rng), unit(rng), unit(rng)); break;
+        }
+    }
+    return cloud;
+}
+
+// The k smallest squared distances from q, ascending, computed the way the tree computes them
+static std::vector<float> brute_force_knn(const std::vector<float3> & cloud, const float3 & q, const uint32_t k)
+{
+    std::vector<float> d2(cloud.size());
+    for (size_t i = 0; i < cloud.size(); ++i) d2[i] = length2(cloud[i] - q);
+    const size_t n = std::min<size_t>(k, d2.size());
+    std::partial_sort(d2.begin(), d2.begin() + n, d2.end());
+    d2.resize(n);
+    return d2;
+}
+
+static std::vector<uint32_t> brute_force_radius(const std::vector<float3> & cloud, const float3 & q, const float radius)
+{
+    std::vector<uint32_t> found;
+    for (uint32_t i = 0; i < cloud.size(); ++i) if (length2(cloud[i] - q) <= radius * radius) found.push_back(i);
+    return found;
+}
+
+TEST_CASE("KDTree k-NN matches brute force")
+{
+    for (const size_t size : { size_t(1), size_t(15), size_t(16), size_t(17), size_t(1000), size_t(20011) })
+    {
+        const std::vector<float3> cloud = make_cloud(size, uint32_t(size));
+        const KDTree tree(cloud);
+        REQUIRE(tree.size() == size);
+
+        std::vector<float3> queries = make_cloud(200, 99);
+        queries.insert(queries.end(), cloud.begin(), cloud.begin() + std::min<size_t>(size, 50)); // queries on points
+        queries.push_back(float3(10, 10, 10));                                                      // far outside
+
+        for (const uint32_t k : { 1u, 8u, 33u })
+        {
+            std::vector<uint32_t> indices(k);
+            std::vector<float> dist2(k);
+            for (auto & q : queries)
+            {
+                const std::vector<float> expected = brute_force_knn(cloud, q, k);
+                const uint32_t found = tree.knn(q, k, indices.data(), dist2.data());
+
+                // Distances must be exactly the k smallest; ties may pick any of the tied points
+                REQUIRE(found == expected.size());
+                REQUIRE(std::vector<float>(dist2.begin(), dist2.begin() + found) == expected);
+                for (uint32_t i = 0; i < found; ++i)
+                {
+                    REQUIRE(indices[i] < size);
+                    REQUIRE(length2(cloud[indices[i]] - q) == dist2[i]);
+                }
+                std::vector<uint32_t> unique(indices.begin(), indices.begin() + found);
+                std::sort(unique.begin(), unique.end());
+                REQUIRE(std::unique(unique.begin(), unique.end()) == unique.end());
+            }
+
+            // Batched rows agree with single queries, and pad past the tree size
+            std::vector<uint32_t> rows(queries.size() * k);
+            std::vector<float> rowDist2(queries.size() * k);
+            tree.knn(queries.data(), queries.size(), k, rows.data(), rowDist2.data());
+            for (size_t i = 0; i < queries.size(); ++i)
+            {
+                const std::vector<float> expected = brute_force_knn(cloud, queries[i], k);
+                for (uint32_t j = 0; j < k; ++j)
+                {
+                    if (j < expected.size()) REQUIRE(rowDist2[i * k + j] == expected[j]);
+                    else
+                    {
+                        REQUIRE(rows[i * k + j] == std::numeric_limits<uint32_t>::max());
+                        REQUIRE(rowDist2[i * k + j] == std::numeric_limits<float>::infinity());
+                    }
+                }
+            }
+        }
+    }
+
+    const KDTree empty(std::vector<float3>{});
+    uint32_t index;
+    float dist2;
+    REQUIRE(empty.knn(float3(0, 0, 0), 4, &index, &dist2) == 0);
+}
+
+TEST_CASE("KDTree radius search matches brute force")
+{
+    const std::vector<float3> cloud = make_cloud(20011, 7);
+    const KDTree tree(cloud);
+    const std::vector<float3> queries = make_cloud(300, 8);
+
+    for (const float r : { 0.0f, 0.005f, 0.05f, 0.3f, 4.0f })
+    {
+        for (auto & q : queries)
+        {
+            std::vector<uint32_t> found;
+            std::vector<float> dist2;
+            tree.radius(q, r, found, &dist2);
+            REQUIRE(found.size() == dist2.size());
+            for (size_t i = 0; i < found.size(); ++i) REQUIRE(length2(cloud[found[i]] - q) == dist2[i]);
+
+            std::sort(found.begin(), found.end());
+            REQUIRE(found == brute_force_radius(cloud, q, r));
+        }
+
+        // Batched compressed rows hold the same sets, in query order
+        std::vector<uint32_t> offsets, indices;
+        tree.radius(queries.data(), queries.size(), r, offsets, indices);
+        REQUIRE(offsets.size() == queries.size() + 1);
+        REQUIRE(offsets.back() == indices.size());
+        for (size_t i = 0; i < queries.size(); ++i)
+        {
+            std::vector<uint32_t> row(indices.begin() + offsets[i], indices.begin() + offsets[i + 1]);
+            std::sort(row.begin(), row.end());
+            REQUIRE(row == brute_force_radius(cloud, queries[i], r));
+        }
+    }
+
+    // Queries exactly on duplicated points find every copy at zero radius
+    std::vector<uint32_t> found;
+    tree.radius(cloud[9], 0.0f, found);
+    REQUIRE(found.size() == brute_force_radius(cloud, cloud[9], 0.0f).size());
+    REQUIRE(found.size() >= 2);
+}
+
+TEST_CASE("KDTree build and queries over 10M points", "[.][benchmark]")
+{
+    const size_t size = 10000000;
+    std::vector<float3> cloud(size);
+    {
+        std::mt19937 rng(1);
+        std::uniform_real_distribution<float> unit(0.f, 1.f);
+        for (auto & p : cloud) p = float3(unit(rng), unit(rng), unit(rng));
+    }
+
+    SimpleTimer t(true);
+    const KDTree tree(cloud);
+    std::cout << "10M uniform points in a unit cube; build " << t.milliseconds().count() << " ms" << std::endl;
+
+    const size_t numQueries = 1000000;
+    std::vector<float3> queries(tree.tree_points().begin(), tree.tree_points().begin() + numQueries); // tree order
+    std::vector<float3> shuffled(queries);
+    std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937(2));
+
+    for (const uint32_t k : { 1u, 8u, 32u })
+    {
+        std::vector<uint32_t> rows(numQueries * k);
+        std::vector<float> rowDist2(numQueries * k);
+
+        t.start();
+        tree.knn(queries.data(), numQueries, k, rows.data(), rowDist2.data());
+        const double orderedMs = t.nanoseconds().count() * 1e-6;
+
+        t.start();
+        tree.knn(shuffled.data(), numQueries, k, rows.data(), rowDist2.data());
+        const double shuffledMs = t.nanoseconds().count() * 1e-6;
+
+        std::cout << "  1M k-NN, k = " << k << ": " << numQueries / (orderedMs * 1e3) << " M queries/s in tree order, "
+            << numQueries / (shuffledMs * 1e3) << " M queries/s shuffled" << std::endl;
+    }
+
+    // 0.01 holds ~42 points on average in this density
+    for (const float r : { 0.005f, 0.01f, 0.02f })
+    {
+        std::vector<uint32_t> offsets, indices;
+        t.start();
+        tree.radius(queries.data(), numQueries, r, offsets, indices);
+        const double ms = t.nanoseconds().count() * 1e-6;
+        std::cout << "  1M radius " << r << ": " << numQueries / (ms * 1e3) << " M queries/s (" << double(indices.size()) / numQueries << " points per query)" << std::endl;
+    }
+
+    // The same k-NN by scanning every point, for a handful of queries
+    const size_t bruteQueries = 20;
+    t.start();
+    float sink = 0;
+    for (size_t i = 0; i < bruteQueries; ++i) sink += brute_force_knn(cloud, shuffled[i], 8).back();
+    const double bruteMs = t.nanoseconds().count() * 1e-6;
+    std::cout << "  brute force k-NN, k = 8: " << bruteQueries / (bruteMs * 1e-3) << " queries/s" << std::endl;
+    REQUIRE(sink >= 0);
+}
@@ -0,0 +1,235 @@
+#include "catch.hpp"
+#include "oriented_bounding_box.hpp"
+#include "simple_timer.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cfloat>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <set>
+#include <vector>
+
+using namespace avl;
+
+static std::vector<OrientedBoundingBox> make_boxes(const size_t count, const float spread, const uint32_t seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> position(-spread, spread), extent(0.1f, 1.f);
+    std::normal_distribution<float> gaussian;
+
+    std::vector<OrientedBoundingBox> boxes;
+    for (size_t i = 0; i < count; ++i)
+    {
+        const float4 q = normalize(float4(gaussian(rng), gaussian(rng), gaussian(rng), gaussian(rng)));
+        boxes.emplace_back(float3(position(rng), position(rng), position(rng)), float3(extent(rng), extent(rng), extent(rng)), q);
+    }
+    return boxes;
+}
+
+// Reference SAT in double precision, written independently of obb_detail::separated: it projects all eight
+// corners of both boxes onto each of the 15 candidate axes. Returns the largest gap found (positive when
+// separated, negative when overlapping on every axis), so callers can skip pairs that are within rounding of touching.
+struct reference_box
+{
+    double c[3], u[3][3], e[3];
+    double corners[8][3];
+
+    reference_box(const OrientedBoundingBox & b)
+    {
+        const float3 axes[3] = { qxdir(b.orientation), qydir(b.orientation), qzdir(b.orientation) };
+        for (int i = 0; i < 3; ++i)
+        {
+            c[i] = b.center[i];
+            e[i] = b.halfExtents[i];
+            for (int k = 0; k < 3; ++k) u[i][k] = axes[i][k];
+        }
+        for (int n = 0; n < 8; ++n)
+        {
+            for (int k = 0; k < 3; ++k)
+            {
+                corners[n][k] = c[k];
+                for (int i = 0; i < 3; ++i) corners[n][k] += ((n >> i) & 1 ? 1.0 : -1.0) * e[i] * u[i][k];
+            }
+        }
+    }
+
+    void project(const double axis[3], double & lo, double & hi) const
+    {
+        lo = DBL_MAX; hi = -DBL_MAX;
+        for (auto & p : corners)
+        {
+            const double d = p[0] * axis[0] + p[1] * axis[1] + p[2] * axis[2];
+            lo = std::min(lo, d);
+            hi = std::max(hi, d);
+        }
+    }
+};
+
+static double reference_gap(const reference_box & a, const reference_box & b, const bool faceAxesOnly = false)
+{
+    std::vector<std::array<double, 3>> axes;
+    for (int i = 0; i < 3; ++i) axes.push_back({ a.u[i][0], a.u[i][1], a.u[i][2] });
+    for (int i = 0; i < 3; ++i) axes.push_back({ b.u[i][0], b.u[i][1], b.u[i][2] });
+    if (!faceAxesOnly)
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            for (int j = 0; j < 3; ++j)
+            {
+                const double * p = a.u[i], * q = b.u[j];
+                std::array<double, 3> n = { p[1] * q[2] - p[2] * q[1], p[2] * q[0] - p[0] * q[2], p[0] * q[1] - p[1] * q[0] };
+                const double len = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+                if (len < 1e-9) continue; // parallel edges: covered by the face axes
+                for (auto & x : n) x /= len;
+                axes.push_back(n);
+            }
+        }
+    }
+
+    double gap = -DBL_MAX;
+    for (auto & axis : axes)
+    {
+        double alo, ahi, blo, bhi;
+        a.project(axis.data(), alo, ahi);
+        b.project(axis.data(), blo, bhi);
+        gap = std::max(gap, std::max(blo - ahi, alo - bhi));
+    }
+    return gap;
+}
+
+TEST_CASE("OrientedBoundingBox::intersects matches a double-precision 15-axis reference")
+{
+    const auto boxes = make_boxes(4000, 2.f, 7);
+    const double margin = 1e-4;
+
+    size_t compared = 0, overlapping = 0, edgeSeparated = 0;
+    for (size_t i = 0; i + 1 < boxes.size(); i += 2)
+    {
+        const reference_box a(boxes[i]), b(boxes[i + 1]);
+        const double gap = reference_gap(a, b);
+        if (std::abs(gap) < margin) continue;
+
+        const bool expected = gap < 0;
+        REQUIRE(boxes[i].intersects(boxes[i + 1]) == expected);
+        REQUIRE(boxes[i + 1].intersects(boxes[i]) == expected);
+        compared++;
+        overlapping += expected;
+
+        // Pairs that only an edge-edge axis separates: a face-axis test would report these as overlapping
+        if (!expected && reference_gap(a, b, true) < -margin) edgeSeparated++;
+    }
+
+    REQUIRE(compared > 1900);
+    REQUIRE(overlapping > 100);
+    REQUIRE(edgeSeparated > 10);
+}
+
+TEST_CASE("OrientedBoundingBox::intersects with parallel and touching boxes")
+{
+    const float4 identity(0, 0, 0, 1);
+    const float4 turned = make_rotation_quat_axis_angle(float3(0, 1, 0), float(ANVIL_PI / 2));
+    const OrientedBoundingBox a(float3(0, 0, 0), float3(1, 1, 1), identity);
+
+    // Parallel axes make every edge-edge cross product zero; only the face axes decide
+    REQUIRE(a.intersects(OrientedBoundingBox(float3(1.9f, 0, 0), float3(1, 1, 1), identity)));
+    REQUIRE_FALSE(a.intersects(OrientedBoundingBox(float3(2.1f, 0, 0), float3(1, 1, 1), identity)));
+    REQUIRE(a.intersects(OrientedBoundingBox(float3(1.9f, 1.9f, 1.9f), float3(1, 1, 1), turned)));
+    REQUIRE_FALSE(a.intersects(OrientedBoundingBox(float3(0, 2.1f, 0), float3(1, 1, 1), turned)));
+
+    // Contained, and identical
+    REQUIRE(a.intersects(OrientedBoundingBox(float3(0.1f, 0, 0), float3(0.1f, 0.1f, 0.1f), turned)));
+    REQUIRE(a.intersects(a));
+
+    REQUIRE(a.is_inside(float3(0.99f, -0.99f, 0.5f)));
+    REQUIRE_FALSE(a.is_inside(float3(1.01f, 0, 0)));
+}
+
+TEST_CASE("OrientedBoundingBoxBatch queries match pairwise intersects exactly")
+{
+    const auto set = make_boxes(3001, 12.f, 11);    // odd size exercises the scalar tail of each SIMD loop
+    const auto probes = make_boxes(200, 12.f, 12);
+
+    OrientedBoundingBoxBatch batch, probeBatch;
+    for (auto & b : set) batch.push_back(b);
+    for (auto & b : probes) probeBatch.push_back(b);
+    REQUIRE(batch.size() == set.size());
+
+    // One vs many
+    for (auto & p : probes)
+    {
+        std::vector<uint32_t> hits;
+        intersect(p, batch, hits);
+        std::vector<uint32_t> expected;
+        for (uint32_t i = 0; i < set.size(); ++i) if (p.intersects(set[i])) expected.push_back(i);
+        REQUIRE(hits == expected);
+    }
+
+    // Many vs many
+    std::vector<std::pair<uint32_t, uint32_t>> pairs;
+    intersect(probeBatch, batch, pairs);
+    std::set<std::pair<uint32_t, uint32_t>> expected;
+    for (uint32_t i = 0; i < probes.size(); ++i) for (uint32_t j = 0; j < set.size(); ++j) if (probes[i].intersects(set[j])) expected.insert({ i, j });
+    REQUIRE(pairs.size() == expected.size());
+    REQUIRE(std::set<std::pair<uint32_t, uint32_t>>(pairs.begin(), pairs.end()) == expected);
+
+    // Within one set
+    std::vector<std::pair<uint32_t, uint32_t>> self;
+    intersect_self(batch, self);
+    std::set<std::pair<uint32_t, uint32_t>> expectedSelf;
+    for (uint32_t i = 0; i < set.size(); ++i) for (uint32_t j = i + 1; j < set.size(); ++j) if (set[i].intersects(set[j])) expectedSelf.insert({ i, j });
+    REQUIRE(self.size() == expectedSelf.size());
+    REQUIRE(std::set<std::pair<uint32_t, uint32_t>>(self.begin(), self.end()) == expectedSelf);
+    REQUIRE(expectedSelf.size() > 100);
+}
+
+TEST_CASE("OrientedBoundingBox scalar vs SoA batch throughput", "[.][benchmark]")
+{
+#if defined(AVL_OBB_SSE)
+    std::cout << "SSE2 batch kernel" << std::endl;
+#else
+    std::cout << "scalar batch kernel (no SSE2)" << std::endl;
+#endif
+
+    for (const float spread : { 4.f, 40.f })
+    {
+        const auto set = make_boxes(100000, spread, 21);
+        const auto probes = make_boxes(100, spread, 22);
+        OrientedBoundingBoxBatch batch;
+        for (auto & b : set) batch.push_back(b);
+
+        size_t scalarHits = 0, batchHits = 0;
+        SimpleTimer t(true);
+        for (auto & p : probes) for (auto & b : set) scalarHits += p.intersects(b);
+        const double scalarMs = t.nanoseconds().count() * 1e-6;
+
+        std::vector<uint32_t> hits;
+        t.start();
+        for (auto & p : probes) { hits.clear(); batchHits += intersect(p, batch, hits); }
+        const double batchMs = t.nanoseconds().count() * 1e-6;
+
+        const double tests = double(probes.size()) * set.size();
+        std::cout << "one vs 100k, spread " << spread << " (" << scalarHits / probes.size() << " hits per query)" << std::endl;
+        std::cout << "  OrientedBoundingBox::intersects loop: " << tests / (scalarMs * 1e3) << " tests/us" << std::endl;
+        std::cout << "  intersect(box, batch): " << tests / (batchMs * 1e3) << " tests/us" << (batchHits == scalarHits ? "" : " (MISMATCH)") << std::endl;
+    }
+
+    const auto set = make_boxes(20000, 60.f, 23);
+    OrientedBoundingBoxBatch batch;
+    for (auto & b : set) batch.push_back(b);
+
+    SimpleTimer t(true);
+    size_t bruteHits = 0;
+    for (size_t i = 0; i < set.size(); ++i) for (size_t j = i + 1; j < set.size(); ++j) bruteHits += set[i].intersects(set[j]);
+    const double bruteMs = t.nanoseconds().count() * 1e-6;
+
+    std::vector<std::pair<uint32_t, uint32_t>> pairs;
+    t.start();
+    intersect_self(batch, pairs);
+    const double selfMs = t.nanoseconds().count() * 1e-6;
+
+    std::cout << "all pairs in 20k boxes (" << bruteHits << " overlapping)" << std::endl;
+    std::cout << "  O(n^2) intersects loop: " << bruteMs << " ms" << std::endl;
+    std::cout << "  intersect_self: " << selfMs << " ms" << (pairs.size() == bruteHits ? "" : " (MISMATCH)") << std::endl;
+}
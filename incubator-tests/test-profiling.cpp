@@ -0,0 +1,156 @@
+#include "catch.hpp"
+#include "profiling.hpp"
+#include "simple_timer.hpp"
+#include "json.hpp"
+
+#include <thread>
+#include <sstream>
+#include <fstream>
+#include <atomic>
+#include <cstdio>
+
+using namespace avl;
+
+// Only CPU zones are exercised here; GPU zones need a context and are covered by running the scene editor
+
+TEST_CASE("frame_profiler scopes stay balanced when disabled mid-scope")
+{
+    auto & profiler = frame_profiler::get_instance();
+    const uint32_t outer = profiler.register_zone("test-latch-outer");
+    const uint32_t inner = profiler.register_zone("test-latch-inner");
+
+    profiler.set_enabled(true);
+    {
+        scoped_cpu_zone a(outer);
+        profiler.set_enabled(false);
+        {
+            scoped_cpu_zone b(inner); // opened while disabled: never recorded, even though it closes enabled
+            profiler.set_enabled(true);
+        }
+    }
+    {
+        scoped_cpu_zone a(outer);
+        profiler.set_enabled(false); // opened while enabled: still closed and recorded
+    }
+    profiler.set_enabled(true);
+    profiler.end_frame();
+
+    bool sawOuter = false;
+    for (auto & z : profiler.summarize())
+    {
+        REQUIRE(z.zone != inner);
+        if (z.zone == outer) sawOuter = true;
+    }
+    REQUIRE(sawOuter);
+}
+
+TEST_CASE("frame_profiler chrome trace escapes zone names")
+{
+    auto & profiler = frame_profiler::get_instance();
+    const std::string name = "quote \" backslash \\ tab \t newline \n";
+    const uint32_t zone = profiler.register_zone(name.c_str());
+    const std::string path = "profiler-trace-test.json";
+
+    profiler.capture_chrome_trace(path, 1);
+    { scoped_cpu_zone z(zone); }
+    for (int i = 0; i < 8 && profiler.capture_in_progress(); ++i) profiler.end_frame();
+    REQUIRE_FALSE(profiler.capture_in_progress());
+
+    std::ifstream file(path);
+    std::stringstream text;
+    text << file.rdbuf();
+
+    JsonValue trace;
+    REQUIRE_NOTHROW(trace = jsonFrom(text.str()));
+
+    bool found = false;
+    for (auto & e : trace["traceEvents"].array()) if (e["name"].string() == name) found = true;
+    REQUIRE(found);
+    std::remove(path.c_str());
+}
+
+TEST_CASE("frame_profiler reuses the buffers of exited threads")
+{
+    auto & profiler = frame_profiler::get_instance();
+    const uint32_t zone = profiler.register_zone("test-thread-churn");
+    profiler.set_enabled(true);
+    { scoped_cpu_zone z(zone); }
+    const size_t before = profiler.thread_buffer_count();
+
+    // One at a time: every thread after the first picks up the buffer the previous one released
+    for (int i = 0; i < 500; ++i)
+    {
+        std::thread([&]() { scoped_cpu_zone z(zone); }).join();
+        if (i % 100 == 0) profiler.end_frame();
+    }
+    REQUIRE(profiler.thread_buffer_count() == before + 1);
+
+    // Four at a time need at most four buffers, however often they are replaced
+    for (int round = 0; round < 50; ++round)
+    {
+        std::vector<std::thread> workers;
+        for (int i = 0; i < 4; ++i) workers.emplace_back([&]() { for (int s = 0; s < 10; ++s) { scoped_cpu_zone z(zone); } });
+        for (auto & w : workers) w.join();
+        profiler.end_frame();
+    }
+    REQUIRE(profiler.thread_buffer_count() <= before + 4);
+
+    bool sawZone = false;
+    for (auto & z : profiler.summarize()) if (z.zone == zone) sawZone = true;
+    REQUIRE(sawZone);
+}
+
+// Cost of one begin/end pair, recording and disabled, and with several threads recording at once
+TEST_CASE("frame_profiler scope overhead", "[.][benchmark]")
+{
+    auto & profiler = frame_profiler::get_instance();
+    const uint32_t zone = profiler.register_zone("benchmark-zone");
+    const int frames = 1000, scopesPerFrame = 4000; // below ThreadBufferSize so no events are dropped
+
+    auto run = [&]()
+    {
+        for (int s = 0; s < scopesPerFrame; ++s) { scoped_cpu_zone z(zone); }
+    };
+
+    for (const bool enabled : { true, false })
+    {
+        profiler.set_enabled(enabled);
+        SimpleTimer t(true);
+        for (int f = 0; f < frames; ++f)
+        {
+            run();
+            profiler.end_frame();
+        }
+        std::cout << "Profiler scope, " << (enabled ? "enabled" : "disabled") << ": " << double(t.nanoseconds().count()) / (frames * scopesPerFrame) << " ns" << std::endl;
+    }
+    profiler.set_enabled(true);
+
+    for (const int numThreads : { 2, 4, 8 })
+    {
+        std::atomic<int> frame{ 0 }, done{ 0 };
+        std::vector<std::thread> workers;
+        for (int i = 0; i < numThreads; ++i)
+        {
+            workers.emplace_back([&]()
+            {
+                for (int f = 0; f < frames; ++f)
+                {
+                    while (frame.load() < f) std::this_thread::yield();
+                    run();
+                    done++;
+                }
+            });
+        }
+
+        // Each frame is drained once every thread has finished it, like a job system joining before end_frame
+        SimpleTimer t(true);
+        for (int f = 0; f < frames; ++f)
+        {
+            while (done.load() < (f + 1) * numThreads) std::this_thread::yield();
+            profiler.end_frame();
+            frame++;
+        }
+        for (auto & w : workers) w.join();
+        std::cout << "Profiler scope, " << numThreads << " threads: " << double(t.nanoseconds().count()) / (frames * scopesPerFrame * numThreads) << " ns per scope (wall time over all threads)" << std::endl;
+    }
+}
@@ -0,0 +1,464 @@
+#include "catch.hpp"
+#include "spsc_queue.hpp"
+#include "spsc_bounded_queue.hpp"
+#include "mpsc_queue.hpp"
+#include "mpsc_bounded_queue.hpp"
+#include "mpmc_bounded_queue.hpp"
+#include "mpmc_blocking_queue.hpp"
+#include "simple_timer.hpp"
+
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <queue>
+#include <memory>
+#include <string>
+
+///////////////////////////
+//   Queue conformance   //
+///////////////////////////
+
+TEST_CASE("SPSCBoundedQueue rejects items once full and keeps FIFO order")
+{
+    SPSCBoundedQueue<int> q(6); // rounded up to 8
+    REQUIRE(q.max_size() == 8);
+    for (int i = 0; i < 8; ++i) REQUIRE(q.produce(i));
+    REQUIRE_FALSE(q.produce(8));
+    REQUIRE(q.size() == 8);
+
+    int v = -1;
+    for (int i = 0; i < 8; ++i) { REQUIRE(q.consume(v)); REQUIRE(v == i); }
+    REQUIRE_FALSE(q.consume(v));
+    REQUIRE(q.empty());
+}
+
+TEST_CASE("SPSCQueue grows past its block size instead of dropping items")
+{
+    SPSCQueue<int> q(16);
+    std::vector<int> batch(100);
+    for (int i = 0; i < 100; ++i) batch[i] = 1000 + i;
+
+    for (int i = 0; i < 1000; ++i) REQUIRE(q.produce(i));
+    REQUIRE(q.produce_n(batch.data(), batch.size()) == batch.size());
+    REQUIRE(q.size() == 1100);
+    REQUIRE(*q.front() == 0);
+
+    std::vector<int> out(1100);
+    REQUIRE(q.consume_n(out.data(), 500) == 500);
+    int v = 0;
+    for (int i = 500; i < 1100; ++i) { REQUIRE(q.consume(v)); out[i] = v; }
+    for (int i = 0; i < 1100; ++i) REQUIRE(out[i] == i);
+    REQUIRE_FALSE(q.consume(v));
+    REQUIRE(q.front() == nullptr);
+}
+
+// Checks ordering across threads and that size() never reports an impossible value while both sides run
+template<typename Queue>
+void spsc_stress(Queue & q, const size_t count, const size_t bound)
+{
+    std::thread producer([&]()
+    {
+        for (size_t i = 0; i < count;) if (q.produce(i)) ++i; else std::this_thread::yield();
+    });
+
+    size_t expected = 0, worstSize = 0;
+    bool inOrder = true;
+    while (expected < count)
+    {
+        worstSize = std::max(worstSize, q.size());
+        size_t v;
+        if (q.consume(v)) inOrder &= (v == expected++);
+        else std::this_thread::yield();
+    }
+    producer.join();
+
+    REQUIRE(inOrder);
+    REQUIRE(worstSize <= bound);
+    REQUIRE(q.empty());
+}
+
+TEST_CASE("SPSC queues preserve order across threads")
+{
+    SPSCBoundedQueue<size_t> bounded(64);
+    spsc_stress(bounded, 1000000, 64);
+
+    SPSCQueue<size_t> unbounded(64);
+    spsc_stress(unbounded, 1000000, 1000000);
+}
+
+//////////////////////////
+//   Queue benchmarks   //
+//////////////////////////
+
+// Adapters so the benchmarks can drive every queue in the tree through the same two calls
+template<typename Q> bool bench_push(Q & q, const uint64_t v) { return q.produce(v); }
+template<typename Q> bool bench_pop(Q & q, uint64_t & v) { return q.consume(v); }
+template<> bool bench_push(MPMCBoundedQueue<uint64_t> & q, const uint64_t v) { return q.mp_produce(v); }
+template<> bool bench_pop(MPMCBlockingQueue<uint64_t> & q, uint64_t & v) { return q.try_consume(v); }
+
+// One producer streams `count` items to one consumer; reports millions of items per second
+template<typename Queue>
+double spsc_throughput(const size_t count)
+{
+    Queue q;
+    SimpleTimer t(true);
+    std::thread producer([&]()
+    {
+        for (uint64_t i = 0; i < count;) if (bench_push(q, i)) ++i; else std::this_thread::yield();
+    });
+
+    uint64_t v = 0, sum = 0;
+    for (size_t n = 0; n < count;)
+    {
+        if (bench_pop(q, v)) { sum += v; ++n; }
+        else std::this_thread::yield();
+    }
+    producer.join();
+    const double seconds = t.nanoseconds().count() * 1e-9;
+    REQUIRE(sum == uint64_t(count) * (count - 1) / 2);
+    return count / seconds * 1e-6;
+}
+
+// Ping-pong between two threads over a pair of queues; returns the median and 99th percentile one-way latency in ns
+template<typename Queue>
+std::pair<double, double> spsc_latency(const size_t roundTrips)
+{
+    Queue ping, pong;
+    std::thread echo([&]()
+    {
+        uint64_t v = 0;
+        for (size_t n = 0; n < roundTrips;)
+        {
+            if (bench_pop(ping, v)) { while (!bench_push(pong, v)) std::this_thread::yield(); ++n; }
+            else std::this_thread::yield();
+        }
+    });
+
+    std::vector<double> samples(roundTrips);
+    uint64_t v = 0;
+    for (size_t i = 0; i < roundTrips; ++i)
+    {
+        SimpleTimer t(true);
+        while (!bench_push(ping, i)) std::this_thread::yield();
+        while (!bench_pop(pong, v)) std::this_thread::yield();
+        samples[i] = t.nanoseconds().count() * 0.5;
+    }
+    echo.join();
+
+    std::sort(samples.begin(), samples.end());
+    return { samples[roundTrips / 2], samples[roundTrips * 99 / 100] };
+}
+
+template<typename Queue>
+void spsc_report(const char * name)
+{
+    const double throughput = spsc_throughput<Queue>(10000000);
+    const auto latency = spsc_latency<Queue>(100000);
+    std::cout << name << ": " << throughput << " M items/s, one-way latency p50 " << latency.first << " ns, p99 " << latency.second << " ns" << std::endl;
+}
+
+TEST_CASE("single producer / single consumer throughput and latency", "[.][benchmark]")
+{
+    spsc_report<SPSCBoundedQueue<uint64_t>>("SPSCBoundedQueue");
+    spsc_report<SPSCQueue<uint64_t>>("SPSCQueue");
+    spsc_report<MPSCQueue<uint64_t>>("MPSCQueue");
+    spsc_report<MPSCBoundedQueue<uint64_t>>("MPSCBoundedQueue");
+    spsc_report<MPMCBoundedQueue<uint64_t>>("MPMCBoundedQueue");
+    spsc_report<MPMCBlockingQueue<uint64_t>>("MPMCBlockingQueue");
+}
+
+//////////////////////////////////
+//   Multi-producer contention   //
+//////////////////////////////////
+
+// The node-per-item MPSCQueue that the recycling queue replaced, kept as the baseline for the contention benchmark
+template<typename T>
+class NodeAllocatingMPSCQueue
+{
+    struct node_t { T data; std::atomic<node_t*> next; };
+    std::atomic<node_t*> head;
+    node_t * tail;
+
+public:
+
+    NodeAllocatingMPSCQueue() : head(new node_t()), tail(head.load()) { tail->next.store(nullptr); }
+    ~NodeAllocatingMPSCQueue() { T v; while (consume(v)) {} delete tail; }
+
+    bool produce(const T & input)
+    {
+        node_t * node = new node_t();
+        node->data = input;
+        node->next.store(nullptr, std::memory_order_relaxed);
+        head.exchange(node, std::memory_order_acq_rel)->next.store(node, std::memory_order_release);
+        return true;
+    }
+
+    bool consume(T & output)
+    {
+        node_t * n = tail->next.load(std::memory_order_acquire);
+        if (!n) return false;
+        output = n->data;
+        delete tail;
+        tail = n;
+        return true;
+    }
+};
+
+// Items are (producer << 32 | sequence) so the consumer can check per-producer FIFO order
+template<typename Queue>
+void mpsc_stress(Queue & q, const uint32_t producers, const uint32_t perProducer)
+{
+    std::vector<std::thread> threads;
+    for (uint32_t p = 0; p < producers; ++p)
+    {
+        threads.emplace_back([&, p]()
+        {
+            for (uint32_t i = 0; i < perProducer;) if (q.produce((uint64_t(p) << 32) | i)) ++i; else std::this_thread::yield();
+        });
+    }
+
+    std::vector<uint32_t> next(producers, 0);
+    bool inOrder = true;
+    for (size_t n = 0; n < size_t(producers) * perProducer;)
+    {
+        uint64_t v;
+        if (!q.consume(v)) { std::this_thread::yield(); continue; }
+        const uint32_t p = uint32_t(v >> 32);
+        inOrder &= (p < producers && uint32_t(v) == next[p]);
+        if (p < producers) next[p] = uint32_t(v) + 1;
+        ++n;
+    }
+    for (auto & t : threads) t.join();
+    REQUIRE(inOrder);
+}
+
+TEST_CASE("MPSC queues keep per-producer order without losing items")
+{
+    MPSCQueue<uint64_t> unbounded;
+    mpsc_stress(unbounded, 8, 100000);
+
+    MPSCBoundedQueue<uint64_t> bounded(256);
+    mpsc_stress(bounded, 8, 100000);
+
+    MPSCQueue<uint64_t> drained;
+    std::thread producer([&]() { for (uint64_t i = 0; i < 100000; ++i) drained.produce(i); });
+    uint64_t expected = 0;
+    while (expected < 100000) drained.consume_all([&](uint64_t && v) { REQUIRE(v == expected); ++expected; });
+    producer.join();
+}
+
+template<typename Queue> size_t bench_drain(Queue & q, uint64_t & sum)
+{
+    size_t n = 0;
+    uint64_t v;
+    while (bench_pop(q, v)) { sum += v; ++n; }
+    return n;
+}
+
+template<> size_t bench_drain(MPSCQueue<uint64_t> & q, uint64_t & sum)
+{
+    return q.consume_all([&](uint64_t && v) { sum += v; });
+}
+
+template<> size_t bench_drain(MPMCBlockingQueue<uint64_t> & q, uint64_t & sum)
+{
+    uint64_t batch[256];
+    const size_t n = q.consume_bulk(batch, 256);
+    for (size_t i = 0; i < n; ++i) sum += batch[i];
+    return n;
+}
+
+// `producers` threads push `total` items between them while one consumer drains; returns millions of items per second
+template<typename Queue>
+double mpsc_throughput(const uint32_t producers, const size_t total)
+{
+    Queue q;
+    const size_t perProducer = total / producers;
+    std::atomic<bool> go{ false };
+    std::vector<std::thread> threads;
+    for (uint32_t p = 0; p < producers; ++p)
+    {
+        threads.emplace_back([&]()
+        {
+            while (!go.load()) std::this_thread::yield();
+            for (uint64_t i = 0; i < perProducer;) if (bench_push(q, i)) ++i; else std::this_thread::yield();
+        });
+    }
+
+    SimpleTimer t(true);
+    go = true;
+    uint64_t sum = 0;
+    for (size_t n = 0; n < perProducer * producers;)
+    {
+        const size_t drained = bench_drain(q, sum);
+        if (!drained) std::this_thread::yield();
+        n += drained;
+    }
+    const double seconds = t.nanoseconds().count() * 1e-9;
+    for (auto & th : threads) th.join();
+
+    REQUIRE(sum == uint64_t(producers) * (perProducer * (perProducer - 1) / 2));
+    return perProducer * producers / seconds * 1e-6;
+}
+
+TEST_CASE("multi-producer contention, 1 to 32 producers", "[.][benchmark]")
+{
+    const size_t total = 4000000;
+    std::cout << "producers, node-allocating MPSCQueue, MPSCQueue, MPSCBoundedQueue, MPMCBlockingQueue (M items/s)" << std::endl;
+    for (const uint32_t producers : { 1u, 2u, 4u, 8u, 16u, 32u })
+    {
+        std::cout << producers << ", "
+                  << mpsc_throughput<NodeAllocatingMPSCQueue<uint64_t>>(producers, total) << ", "
+                  << mpsc_throughput<MPSCQueue<uint64_t>>(producers, total) << ", "
+                  << mpsc_throughput<MPSCBoundedQueue<uint64_t>>(producers, total) << ", "
+                  << mpsc_throughput<MPMCBlockingQueue<uint64_t>>(producers, total) << std::endl;
+    }
+}
+
+///////////////////////////////
+//   Blocking hand-off queue   //
+///////////////////////////////
+
+TEST_CASE("MPMCBlockingQueue moves values, supports bulk calls and timeouts, and drains after close")
+{
+    MPMCBlockingQueue<std::unique_ptr<int>> q;
+    REQUIRE(q.produce(std::unique_ptr<int>(new int(1))));
+
+    std::vector<std::unique_ptr<int>> batch;
+    for (int i = 2; i <= 4; ++i) batch.emplace_back(new int(i));
+    REQUIRE(q.produce_bulk(batch.begin(), batch.end()) == 3);
+    REQUIRE(q.size() == 4);
+
+    std::vector<std::unique_ptr<int>> out;
+    REQUIRE(q.consume_bulk(std::back_inserter(out), 3) == 3);
+    for (int i = 0; i < 3; ++i) REQUIRE(*out[i] == i + 1);
+
+    std::unique_ptr<int> v;
+    REQUIRE(q.wait_for(v, std::chrono::milliseconds(1)));
+    REQUIRE(*v == 4);
+    REQUIRE_FALSE(q.wait_for(v, std::chrono::milliseconds(5)));
+
+    // A parked consumer is woken by close, after the remaining item has been handed out
+    REQUIRE(q.produce(std::unique_ptr<int>(new int(5))));
+    std::atomic<int> received{ 0 };
+    std::thread consumer([&]() { std::unique_ptr<int> x; while (q.wait_and_consume(x)) received++; });
+    while (!q.empty()) std::this_thread::yield();
+    q.close();
+    consumer.join();
+    REQUIRE(received == 1);
+    REQUIRE_FALSE(q.produce(std::unique_ptr<int>(new int(6))));
+}
+
+// The mutex + std::queue version that the adaptive queue replaced: notifies under the lock and copies values
+template<typename T>
+class SingleMutexBlockingQueue
+{
+    std::queue<T> queue;
+    std::mutex mutex;
+    std::condition_variable condition;
+
+public:
+
+    bool produce(const T & value)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push(value);
+        condition.notify_one();
+        return true;
+    }
+
+    bool wait_and_consume(T & value)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (queue.empty()) condition.wait(lock);
+        value = queue.front();
+        queue.pop();
+        return true;
+    }
+};
+
+static uint64_t steady_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Items carry their enqueue time; a consumer records how long each waited before being picked up. Producers pause
+// `gapNs` between items so that with more consumers than work the consumers park and have to be woken.
+template<typename Queue>
+std::vector<uint64_t> handoff_latencies(const uint32_t producers, const uint32_t consumers, const uint32_t perProducer, const uint64_t gapNs)
+{
+    const uint64_t Sentinel = ~uint64_t(0);
+    Queue q;
+    std::vector<std::vector<uint64_t>> samples(consumers);
+    std::vector<std::thread> threads;
+
+    for (uint32_t c = 0; c < consumers; ++c)
+    {
+        threads.emplace_back([&, c]()
+        {
+            uint64_t sent = 0;
+            while (q.wait_and_consume(sent) && sent != Sentinel) samples[c].push_back(steady_ns() - sent);
+        });
+    }
+
+    std::vector<std::thread> producerThreads;
+    for (uint32_t p = 0; p < producers; ++p)
+    {
+        producerThreads.emplace_back([&]()
+        {
+            for (uint32_t i = 0; i < perProducer; ++i)
+            {
+                if (gapNs) { const uint64_t until = steady_ns() + gapNs; while (steady_ns() < until) std::this_thread::yield(); }
+                q.produce(steady_ns());
+            }
+        });
+    }
+    for (auto & t : producerThreads) t.join();
+    for (uint32_t c = 0; c < consumers; ++c) q.produce(Sentinel);
+    for (auto & t : threads) t.join();
+
+    std::vector<uint64_t> all;
+    for (auto & s : samples) all.insert(all.end(), s.begin(), s.end());
+    std::sort(all.begin(), all.end());
+    return all;
+}
+
+// Power-of-two microsecond buckets from <1 us to >= 8 ms, followed by percentiles
+static void print_latency_histogram(const char * name, const std::vector<uint64_t> & sorted)
+{
+    const int NumBuckets = 15;
+    size_t buckets[NumBuckets] = {};
+    for (const uint64_t ns : sorted)
+    {
+        int b = 0;
+        for (uint64_t us = ns / 1000; us && b < NumBuckets - 1; us >>= 1) ++b;
+        buckets[b]++;
+    }
+
+    auto pct = [&](const double p) { return sorted.empty() ? 0.0 : sorted[std::min(sorted.size() - 1, size_t(p * sorted.size()))] * 1e-3; };
+    std::cout << name << ": p50 " << pct(0.5) << " us, p99 " << pct(0.99) << " us, p99.9 " << pct(0.999) << " us, max " << pct(1.0) << " us" << std::endl;
+    for (int b = 0; b < NumBuckets; ++b)
+    {
+        if (!buckets[b]) continue;
+        std::cout << "    " << (b ? (1u << (b - 1)) : 0u) << (b == NumBuckets - 1 ? "+ us" : (" - " + std::to_string(1u << b) + " us")) << ": " << buckets[b] << std::endl;
+    }
+}
+
+TEST_CASE("blocking queue wake-up latency under producer / consumer imbalance", "[.][benchmark]")
+{
+    struct scenario { const char * name; uint32_t producers, consumers, perProducer; uint64_t gapNs; };
+    const scenario scenarios[] =
+    {
+        { "1 producer, 8 consumers, 50 us apart (consumers park)", 1, 8, 20000, 50000 },
+        { "8 producers, 1 consumer, back to back (backlog)", 8, 1, 50000, 0 },
+        { "4 producers, 4 consumers, 5 us apart", 4, 4, 20000, 5000 },
+    };
+
+    for (auto & s : scenarios)
+    {
+        std::cout << s.name << std::endl;
+        print_latency_histogram("  SingleMutexBlockingQueue", handoff_latencies<SingleMutexBlockingQueue<uint64_t>>(s.producers, s.consumers, s.perProducer, s.gapNs));
+        print_latency_histogram("  MPMCBlockingQueue", handoff_latencies<MPMCBlockingQueue<uint64_t>>(s.producers, s.consumers, s.perProducer, s.gapNs));
+    }
+}
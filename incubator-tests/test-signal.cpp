@@ -0,0 +1,196 @@
+#include "catch.hpp"
+#include "signal.hpp"
+#include "simple_timer.hpp"
+
+#include <atomic>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace avl;
+
+struct tracking_event
+{
+    float position[3];
+    float orientation[4];
+    uint64_t timestamp;
+};
+
+TEST_CASE("Signal add, remove and stale handles")
+{
+    Signal<int> s;
+    int sum = 0;
+    signal_handle a = s.add([&](const int & v) { sum += v; });
+    signal_handle b = s.add([&](const int & v) { sum += 10 * v; });
+    REQUIRE(s.size() == 2);
+
+    s.broadcast(1);
+    REQUIRE(sum == 11);
+
+    s.remove(a);
+    REQUIRE_FALSE(s.connected(a));
+    REQUIRE(s.connected(b));
+    s.broadcast(1);
+    REQUIRE(sum == 21);
+
+    // `a`'s slot is recycled; the stale handle must not remove the new subscriber
+    signal_handle c = s.add([&](const int & v) { sum += 100 * v; });
+    REQUIRE(c.index == a.index);
+    s.remove(a);
+    REQUIRE(s.connected(c));
+    s.broadcast(1);
+    REQUIRE(sum == 131);
+}
+
+TEST_CASE("Signal subscribers returning false and add_once are removed after one call")
+{
+    Signal<int> s;
+    int calls = 0;
+    s.add([&](const int &) { ++calls; return false; });
+    s.add_once([&](const int &) { ++calls; });
+    s.broadcast(0);
+    s.broadcast(0);
+    REQUIRE(calls == 2);
+    REQUIRE(s.size() == 0);
+}
+
+TEST_CASE("Signal changes made during a broadcast")
+{
+    Signal<int> s;
+    std::vector<int> order;
+    signal_handle second;
+    signal_handle added;
+
+    s.add([&](const int &)
+    {
+        order.push_back(0);
+        s.remove(second);                                               // takes effect for this broadcast
+        added = s.add([&](const int &) { order.push_back(2); });        // first called next broadcast
+    });
+    second = s.add([&](const int &) { order.push_back(1); });
+
+    s.broadcast(0);
+    REQUIRE(order == std::vector<int>({ 0 }));
+    REQUIRE(s.connected(added));
+
+    order.clear();
+    s.remove(added);
+    s.broadcast(0);
+    REQUIRE(order.size() == 1);
+}
+
+TEST_CASE("Signal stays usable after a subscriber throws")
+{
+    Signal<int> s;
+    int calls = 0;
+    signal_handle victim;
+    signal_handle late;
+
+    s.add([&](const int & v)
+    {
+        if (v >= 0) return;
+        s.remove(victim);
+        late = s.add([&](const int &) { ++calls; });
+        throw std::runtime_error("subscriber failed");
+    });
+    victim = s.add([&](const int &) { ++calls; });
+
+    REQUIRE_THROWS_AS(s.broadcast(-1), std::runtime_error);
+
+    // The deferred removal and addition were applied on the way out
+    REQUIRE_FALSE(s.connected(victim));
+    REQUIRE(s.connected(late));
+    REQUIRE(s.size() == 2);
+
+    s.broadcast(1);
+    REQUIRE(calls == 1);
+
+    // No longer deferring: a removal outside of a broadcast frees the slot immediately
+    s.remove(late);
+    REQUIRE(s.size() == 1);
+}
+
+TEST_CASE("ThreadSafeSignal with concurrent broadcasts and subscriptions")
+{
+    ThreadSafeSignal<int> s;
+    std::atomic<int> received{ 0 };
+    s.add([&](const int &) { received++; });
+
+    std::thread churn([&]()
+    {
+        for (int i = 0; i < 10000; ++i) s.remove(s.add([](const int &) {}));
+    });
+    for (int i = 0; i < 10000; ++i) s.broadcast(i);
+    churn.join();
+
+    REQUIRE(received == 10000);
+    REQUIRE(s.size() == 1);
+}
+
+// The std::list<std::function> signal this replaced, kept as the baseline
+template <typename T>
+class ListSignal
+{
+    std::list<std::function<bool(T)>> subscribers;
+public:
+    template <typename F>
+    void add(F && f) { subscribers.push_back(std::forward<F>(f)); }
+
+    void broadcast(T const & v)
+    {
+        for (auto it = subscribers.begin(); it != subscribers.end();)
+        {
+            if ((*it)(v)) ++it;
+            else it = subscribers.erase(it);
+        }
+    }
+};
+
+TEST_CASE("Signal broadcast throughput", "[.][benchmark]")
+{
+    const size_t deliveries = 20000000;
+
+    for (const size_t listeners : { size_t(1), size_t(10), size_t(100), size_t(1000) })
+    {
+        const size_t broadcasts = deliveries / listeners;
+        std::vector<uint64_t> sinks(listeners, 0);
+        tracking_event e = {};
+
+        double ns[3];
+        {
+            ListSignal<tracking_event> s;
+            for (auto & k : sinks) s.add([&k](tracking_event v) { k += v.timestamp; return true; });
+            SimpleTimer t(true);
+            for (size_t i = 0; i < broadcasts; ++i) { e.timestamp = i; s.broadcast(e); }
+            ns[0] = double(t.nanoseconds().count());
+        }
+        {
+            Signal<tracking_event> s;
+            for (auto & k : sinks) s.add([&k](const tracking_event & v) { k += v.timestamp; });
+            SimpleTimer t(true);
+            for (size_t i = 0; i < broadcasts; ++i) { e.timestamp = i; s.broadcast(e); }
+            ns[1] = double(t.nanoseconds().count());
+        }
+        {
+            ThreadSafeSignal<tracking_event> s;
+            for (auto & k : sinks) s.add([&k](const tracking_event & v) { k += v.timestamp; });
+            SimpleTimer t(true);
+            for (size_t i = 0; i < broadcasts; ++i) { e.timestamp = i; s.broadcast(e); }
+            ns[2] = double(t.nanoseconds().count());
+        }
+
+        uint64_t check = 0;
+        for (auto k : sinks) check += k;
+
+        std::cout << listeners << " listeners, " << broadcasts << " broadcasts (checksum " << check << ")" << std::endl;
+        const char * names[] = { "std::list<std::function>", "Signal", "ThreadSafeSignal" };
+        for (int i = 0; i < 3; ++i)
+        {
+            std::cout << "  " << names[i] << ": " << ns[i] / broadcasts << " ns/broadcast, " << ns[i] / (broadcasts * listeners) << " ns/delivery, "
+                << (broadcasts * 1e9 / ns[i]) << " broadcasts/s" << std::endl;
+        }
+    }
+}
@@ -0,0 +1,144 @@
+#include "catch.hpp"
+#include "splines.hpp"
+
+#include <random>
+#include <vector>
+
+using namespace avl;
+
+static ConstantSpline make_constant_spline()
+{
+    ConstantSpline s;
+    s.p0 = float3(0, 0, 0);
+    s.p1 = float3(1, 2, 0);
+    s.p2 = float3(3, 2, 1);
+    s.p3 = float3(4, 0, 1);
+    return s;
+}
+
+TEST_CASE("ConstantSpline::calculate ends on p3 exactly once")
+{
+    ConstantSpline s = make_constant_spline();
+
+    // 1 / increment is an integer: the last step is p3 itself
+    for (const float increment : { 0.5f, 0.25f, 0.2f, 0.1f, 0.05f, 0.01f, 0.001f })
+    {
+        s.calculate(increment);
+        const auto & points = s.get_points();
+        const size_t steps = size_t(1.0f / increment + 0.5f);
+        REQUIRE(points.size() == steps + 1);
+        REQUIRE(points.back().point == s.p3);
+        REQUIRE(points[points.size() - 2].point != s.p3);
+    }
+
+    // A remainder: p3 is appended after the last whole step
+    s.calculate(0.3f);
+    REQUIRE(s.get_points().size() == 5);
+    REQUIRE(s.get_points()[3].point != s.p3);
+    REQUIRE(s.get_points().back().point == s.p3);
+
+    // No zero-length segment at the end
+    s.calculate(0.1f);
+    s.calculate_distances();
+    const auto & points = s.get_points();
+    for (size_t i = 1; i < points.size(); ++i) REQUIRE(distance(points[i].point, points[i - 1].point) > 0.0f);
+}
+
+TEST_CASE("SplinePath::sample_uniform spaces points evenly by arc length")
+{
+    const SplinePath path(spline_basis::catmull_rom, { float3(0, 0, 0), float3(0, 0, 0), float3(2, 1, 0), float3(3, 3, 1), float3(6, 3, 0), float3(6, 3, 0) });
+    REQUIRE(path.segment_count() == 3);
+
+    // Length against a dense polyline
+    double polyline = 0;
+    float3 previous = path.point(0, 0.0f);
+    for (size_t s = 0; s < path.segment_count(); ++s)
+    {
+        for (int i = 1; i <= 10000; ++i)
+        {
+            const float3 p = path.point(s, i / 10000.0f);
+            polyline += distance(p, previous);
+            previous = p;
+        }
+    }
+    REQUIRE(path.length() == Approx(polyline).epsilon(1e-4));
+
+    std::vector<float3> samples;
+    path.sample_uniform(101, samples);
+    REQUIRE(samples.size() == 101);
+    REQUIRE(distance(samples.front(), float3(0, 0, 0)) < 1e-5f);
+    REQUIRE(distance(samples.back(), float3(6, 3, 0)) < 1e-4f);
+
+    // Chords are slightly shorter than arcs, so compare spacing with a little slack
+    const float step = path.length() / 100.0f;
+    for (size_t i = 1; i < samples.size(); ++i) REQUIRE(distance(samples[i], samples[i - 1]) == Approx(step).epsilon(1e-2));
+
+    // The ordered walk agrees with independent lookups
+    for (size_t i = 0; i < samples.size(); ++i) REQUIRE(distance(samples[i], path.position_at_distance(step * float(i))) < 1e-4f);
+}
+
+// Incremental edits must leave the path exactly as a full rebuild over the same control points would
+static void require_same_path(const SplinePath & edited, const std::vector<float3> & points)
+{
+    const SplinePath rebuilt(edited.get_basis(), points);
+    REQUIRE(edited.segment_count() == rebuilt.segment_count());
+    REQUIRE(edited.get_arc_table() == rebuilt.get_arc_table());
+    REQUIRE(edited.length() == rebuilt.length());
+    if (!rebuilt.segment_count()) return;
+
+    for (size_t s = 0; s < rebuilt.segment_count(); ++s) REQUIRE(edited.point(s, 0.37f) == rebuilt.point(s, 0.37f));
+
+    std::vector<float3> a, b, ta, tb;
+    edited.sample_uniform(64, a, &ta);
+    rebuilt.sample_uniform(64, b, &tb);
+    REQUIRE(a == b);
+    REQUIRE(ta == tb);
+    for (int i = 0; i <= 20; ++i) REQUIRE(edited.position_at_distance(rebuilt.length() * i / 20.0f) == rebuilt.position_at_distance(rebuilt.length() * i / 20.0f));
+}
+
+TEST_CASE("SplinePath incremental edits match a full rebuild")
+{
+    for (const spline_basis basis : { spline_basis::catmull_rom, spline_basis::uniform_b_spline, spline_basis::bezier })
+    {
+        std::mt19937 rng(int(basis) + 1);
+        std::uniform_real_distribution<float> u(-5.0f, 5.0f);
+        auto random_point = [&]() { return float3(u(rng), u(rng), u(rng)); };
+
+        // 25 points: whole segments for every basis, so edits reach both ends of the path
+        std::vector<float3> points(25);
+        for (auto & p : points) p = random_point();
+
+        SplinePath path(basis, points);
+        require_same_path(path, points);
+
+        // Every control point once, including the first and last three, then random ones
+        for (size_t i = 0; i < points.size(); ++i)
+        {
+            points[i] = random_point();
+            path.set_control_point(i, points[i]);
+            require_same_path(path, points);
+        }
+        for (int n = 0; n < 50; ++n)
+        {
+            const size_t i = rng() % points.size();
+            points[i] = random_point();
+            path.set_control_point(i, points[i]);
+        }
+        require_same_path(path, points);
+
+        // Growing from empty, checking after every point, including those that do not complete a segment
+        SplinePath trail(basis);
+        std::vector<float3> prefix;
+        for (auto & p : points)
+        {
+            prefix.push_back(p);
+            trail.push_back(p);
+            require_same_path(trail, prefix);
+        }
+
+        // Edits after appending
+        trail.set_control_point(points.size() - 1, float3(0, 0, 0));
+        prefix.back() = float3(0, 0, 0);
+        require_same_path(trail, prefix);
+    }
+}
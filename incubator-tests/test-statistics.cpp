@@ -0,0 +1,421 @@
+#include "catch.hpp"
+#include "circular_buffer.hpp"
+#include "running_statistics.hpp"
+#include "simple_timer.hpp"
+
+#include <atomic>
+#include <cmath>
+#include <deque>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace avl;
+
+TEST_CASE("CircularBuffer get_last stays within the window")
+{
+    CircularBuffer<float> b(5);
+    REQUIRE_THROWS_AS(b.get_last(0), std::out_of_range);
+
+    for (int i = 0; i < 3; ++i) b.put(float(i));
+    REQUIRE(b.get_last(0) == 2.f);
+    REQUIRE(b.get_last(2) == 0.f);
+    REQUIRE_THROWS_AS(b.get_last(3), std::out_of_range);
+
+    // Wrapped: the window holds 3..7
+    for (int i = 3; i < 8; ++i) b.put(float(i));
+    REQUIRE(b.get_last(0) == 7.f);
+    REQUIRE(b.get_last(4) == 3.f);
+    REQUIRE_THROWS_AS(b.get_last(5), std::out_of_range);
+}
+
+TEST_CASE("CircularBuffer reinitialize_values fills the window")
+{
+    CircularBuffer<float> b(5);
+    b.put(1.f);
+    b.put(2.f);
+
+    REQUIRE(b.reinitialize_values(4.f));
+    REQUIRE(b.is_full());
+    REQUIRE(b.get_current_size() == 5);
+    REQUIRE(b.get_data_as_vector() == std::vector<float>(5, 4.f));
+    REQUIRE(compute_mean(b) == Approx(4.f));
+    REQUIRE(compute_variance(b) == Approx(0.f));
+    REQUIRE(b.get_last(4) == 4.f);
+
+    // Subsequent puts evict the reinitialized values oldest first
+    b.put(9.f);
+    REQUIRE(b.get_current_size() == 5);
+    REQUIRE(b[0] == 4.f);
+    REQUIRE(b[4] == 9.f);
+    REQUIRE(compute_mean(b) == Approx(5.f));
+    REQUIRE(compute_max(b) == 9.f);
+
+    CircularBuffer<float> uninitialized;
+    REQUIRE_FALSE(uninitialized.reinitialize_values(1.f));
+}
+
+// Mean and population variance of the window, recomputed from scratch in long double
+template<typename T>
+static void window_reference(const std::deque<T> & w, double & mean, double & variance)
+{
+    long double sum = 0, m2 = 0;
+    for (auto x : w) sum += x;
+    const long double m = sum / w.size();
+    for (auto x : w) m2 += (x - m) * (x - m);
+    mean = double(m);
+    variance = double(m2 / w.size());
+}
+
+TEST_CASE("CircularBuffer moments track the window under eviction")
+{
+    std::mt19937 rng(37);
+    std::normal_distribution<double> noise(0.0, 3.0);
+
+    // 37 rounds up to 64 slots, so the window is evicting and wrapping for most of the run
+    CircularBuffer<double> b(37);
+    std::deque<double> window;
+    for (int i = 0; i < 5000; ++i)
+    {
+        const double x = 1000.0 + noise(rng) + (i / 500) * 50.0; // level shifts exercise the backwards update
+        b.put(x);
+        window.push_back(x);
+        if (window.size() > 37) window.pop_front();
+
+        double mean, variance;
+        window_reference(window, mean, variance);
+        REQUIRE(b.get_current_size() == window.size());
+        REQUIRE(b.get_moments().mean == Approx(mean).epsilon(1e-12));
+        REQUIRE(b.get_moments().variance() == Approx(variance).epsilon(1e-6));
+    }
+
+    // Floats accumulate in double too
+    CircularBuffer<float> f(100);
+    std::deque<float> fw;
+    for (int i = 0; i < 3000; ++i)
+    {
+        const float x = float(noise(rng));
+        f.put(x);
+        fw.push_back(x);
+        if (fw.size() > 100) fw.pop_front();
+    }
+    double mean, variance;
+    window_reference(fw, mean, variance);
+    REQUIRE(compute_mean(f) == Approx(mean).epsilon(1e-5));
+    REQUIRE(compute_variance(f) == Approx(variance).epsilon(1e-5));
+}
+
+TEST_CASE("CircularBuffer rebuilds its moments once per storage lap")
+{
+    // Values far from zero with a small spread: the backwards Welford update loses digits on every eviction
+    std::mt19937 rng(5);
+    std::uniform_real_distribution<double> jitter(-1.0, 1.0);
+
+    CircularBuffer<double> b(40); // 64 slots
+    for (int i = 0; i < 40; ++i) b.put(1e7 + jitter(rng));
+
+    size_t laps = 0;
+    for (int i = 1; i <= 64 * 20; ++i)
+    {
+        b.put(1e7 + jitter(rng));
+
+        CircularBuffer<double> rebuilt(b);
+        rebuilt.rebuild_statistics();
+        if (i % 64 == 0)
+        {
+            // The put that completes a lap of evictions leaves exactly the from-scratch result
+            REQUIRE(b.get_moments().mean == rebuilt.get_moments().mean);
+            REQUIRE(b.get_moments().m2 == rebuilt.get_moments().m2);
+            laps++;
+        }
+        else REQUIRE(b.get_moments().variance() == Approx(rebuilt.get_moments().variance()).epsilon(1e-4));
+    }
+    REQUIRE(laps == 20);
+}
+
+TEST_CASE("CircularBuffer spans and copy_to follow the window across a wrap")
+{
+    CircularBuffer<int> b(5); // 8 slots
+    std::deque<int> window;
+    for (int i = 0; i < 40; ++i)
+    {
+        b.put(i);
+        window.push_back(i);
+        if (window.size() > 5) window.pop_front();
+
+        const auto spans = b.get_spans();
+        REQUIRE(spans.first.size() + spans.second.size() == window.size());
+        REQUIRE(spans.first.size() > 0);
+
+        std::vector<int> joined(spans.first.begin(), spans.first.end());
+        joined.insert(joined.end(), spans.second.begin(), spans.second.end());
+        REQUIRE(joined == std::vector<int>(window.begin(), window.end()));
+
+        std::vector<int> copied(b.get_current_size(), -1);
+        b.copy_to(copied.data());
+        REQUIRE(copied == joined);
+        for (size_t k = 0; k < window.size(); ++k) REQUIRE(b[k] == window[k]);
+
+        // The second span starts at the front of storage exactly when the window wraps
+        if (!spans.second.empty()) REQUIRE(spans.second.data == &b(0));
+    }
+
+    // Puts 35..39 sit in slots 3..7: one span. 36..40 wraps: slots 4..7 then 0.
+    REQUIRE(b.get_spans().second.empty());
+    b.put(40);
+    REQUIRE(b.get_spans().first.size() == 4);
+    REQUIRE(b.get_spans().second.size() == 1);
+    REQUIRE(*b.get_spans().second.data == 40);
+}
+
+TEST_CASE("CircularBuffer set replaces a value and its contribution to the moments")
+{
+    CircularBuffer<double> b(6);
+    std::deque<double> window;
+    for (int i = 0; i < 9; ++i) { b.put(double(i * i)); window.push_back(double(i * i)); }
+    while (window.size() > 6) window.pop_front();
+
+    b.set(0, -4.0);
+    b.set(5, 100.0);
+    b.set(2, 7.5);
+    window[0] = -4.0;
+    window[5] = 100.0;
+    window[2] = 7.5;
+
+    double mean, variance;
+    window_reference(window, mean, variance);
+    REQUIRE(b.get_data_as_vector() == std::vector<double>(window.begin(), window.end()));
+    REQUIRE(b.get_moments().mean == Approx(mean).epsilon(1e-12));
+    REQUIRE(b.get_moments().variance() == Approx(variance).epsilon(1e-12));
+    REQUIRE(compute_max(b) == 100.0);
+    REQUIRE_THROWS_AS(b.set(6, 0.0), std::out_of_range);
+}
+
+TEST_CASE("CircularBuffer float3 covariance and pearson match a recomputation over the window")
+{
+    std::mt19937 rng(9);
+    std::normal_distribution<float> n(0.f, 1.f);
+
+    CircularBuffer<float3> b(50);
+    std::deque<float3> window;
+    for (int i = 0; i < 700; ++i)
+    {
+        // Correlated axes: y follows x, z opposes it, plus independent noise
+        const float t = n(rng);
+        const float3 x = float3(t, 0.8f * t + 0.3f * n(rng), -0.5f * t + 0.6f * n(rng)) + float3(10, -3, 2);
+        b.put(x);
+        window.push_back(x);
+        if (window.size() > 50) window.pop_front();
+
+        if (i < 2) continue;
+        double mean[3] = { 0, 0, 0 }, cov[3][3] = {};
+        for (auto & p : window) for (int r = 0; r < 3; ++r) mean[r] += p[r];
+        for (auto & m : mean) m /= window.size();
+        for (auto & p : window) for (int r = 0; r < 3; ++r) for (int c = 0; c < 3; ++c) cov[r][c] += (p[r] - mean[r]) * (p[c] - mean[c]);
+        for (auto & row : cov) for (auto & v : row) v /= window.size();
+
+        // linalg matrices are column-major: cov[c][r] is row r, column c; the matrix is symmetric either way
+        const float3x3 c = compute_covariance_matrix(b);
+        for (int r = 0; r < 3; ++r) for (int k = 0; k < 3; ++k) REQUIRE(c[k][r] == Approx(cov[r][k]).margin(1e-4));
+
+        const float3 pearson = compute_pearson_coefficient(b);
+        REQUIRE(pearson.x == Approx(cov[0][1] / std::sqrt(cov[0][0] * cov[1][1])).margin(1e-4));
+        REQUIRE(pearson.y == Approx(cov[1][2] / std::sqrt(cov[1][1] * cov[2][2])).margin(1e-4));
+        REQUIRE(pearson.z == Approx(cov[2][0] / std::sqrt(cov[2][2] * cov[0][0])).margin(1e-4));
+    }
+    REQUIRE(compute_pearson_coefficient(b).x > 0.5f);
+    REQUIRE(compute_pearson_coefficient(b).z < -0.3f);
+}
+
+TEST_CASE("CircularBuffer min, max and sums agree with the scalar reductions")
+{
+    std::mt19937 rng(17);
+    std::uniform_real_distribution<float> u(-1000.f, 1000.f);
+
+    // Window sizes around the 4-wide SIMD stride, so both spans end in every possible scalar tail
+    for (const size_t size : { size_t(1), size_t(3), size_t(4), size_t(5), size_t(7), size_t(64), size_t(65), size_t(1021) })
+    {
+        CircularBuffer<float> b(size);
+        std::deque<float> window;
+        for (size_t i = 0; i < size * 3 + 11; ++i)
+        {
+            const float x = u(rng);
+            b.put(x);
+            window.push_back(x);
+            if (window.size() > size) window.pop_front();
+
+            REQUIRE(compute_min(b) == *std::min_element(window.begin(), window.end()));
+            REQUIRE(compute_max(b) == *std::max_element(window.begin(), window.end()));
+
+            // The SSE overloads against the generic templates on the same spans
+            const auto s = b.get_spans();
+            for (const auto & span : { s.first, s.second })
+            {
+                REQUIRE(circular_buffer_detail::reduce_min(span.data, span.count, 0.f) == circular_buffer_detail::reduce_min<float>(span.data, span.count, 0.f));
+                REQUIRE(circular_buffer_detail::reduce_max(span.data, span.count, 0.f) == circular_buffer_detail::reduce_max<float>(span.data, span.count, 0.f));
+                REQUIRE(circular_buffer_detail::reduce_sum(span.data, span.count, 0.0) == Approx(circular_buffer_detail::reduce_sum<float, double>(span.data, span.count, 0.0)).margin(1e-6));
+            }
+        }
+    }
+}
+
+// Samples from a fixed lattice of values so that exact quantiles and moments can be computed from a
+// histogram of counts instead of storing and sorting the stream. Value i (in increasing order) is
+// -lattice(K - 1 - i) for i < K, 0 for i == K and +lattice(i - K - 1) above; magnitudes span 1e-3 .. ~5e5.
+struct lattice_stream
+{
+    static const int K = 100000;
+    std::mt19937_64 rng{ 20171103 };
+    std::vector<uint64_t> counts = std::vector<uint64_t>(2 * K + 1, 0);
+
+    static double lattice(const int k) { return 1e-3 * std::pow(1.0002, double(k)); }
+    static double value(const int i) { return i < K ? -lattice(K - 1 - i) : i == K ? 0.0 : lattice(i - K - 1); }
+
+    // Skewed towards small magnitudes, with ~5% negative values and ~1% zeros
+    int next()
+    {
+        const uint64_t r = rng();
+        const int k = int(double((r >> 11) & 0xFFFFF) / double(1 << 20) * double((r >> 32) & 0xFFFFF) / double(1 << 20) * K);
+        const int sign = int(r & 0x7F);
+        const int i = sign < 1 ? K : sign < 7 ? K - 1 - k : K + 1 + k;
+        counts[i]++;
+        return i;
+    }
+
+    // Value at rank ceil(q * n), the definition QuantileSketch uses
+    double exact_quantile(const double q, const uint64_t n) const
+    {
+        const double rank = q * double(n);
+        uint64_t seen = 0;
+        for (int i = 0; i < 2 * K + 1; ++i)
+        {
+            seen += counts[i];
+            if (counts[i] && double(seen) >= rank) return value(i);
+        }
+        return value(2 * K);
+    }
+};
+
+static void check_merged_against_exact(const uint64_t n, const int shards)
+{
+    const double accuracy = 0.01;
+    lattice_stream stream;
+
+    StreamingStats<double> single(accuracy);
+    std::vector<StreamingStats<double>> parts(shards, StreamingStats<double>(accuracy));
+    for (uint64_t j = 0; j < n; ++j)
+    {
+        const double x = lattice_stream::value(stream.next());
+        single.put(x);
+        parts[(j / 4096) % shards].put(x); // contiguous runs, like per-frame or per-thread batches
+    }
+
+    StreamingStats<double> merged(accuracy);
+    for (auto & p : parts) merged += p;
+
+    // Exact moments and extrema from the histogram
+    long double sum = 0;
+    int lo = -1, hi = -1;
+    for (int i = 0; i < 2 * lattice_stream::K + 1; ++i)
+    {
+        if (!stream.counts[i]) continue;
+        sum += (long double) stream.counts[i] * lattice_stream::value(i);
+        if (lo < 0) lo = i;
+        hi = i;
+    }
+    const long double mean = sum / n;
+    long double m2 = 0;
+    for (int i = 0; i < 2 * lattice_stream::K + 1; ++i)
+    {
+        const long double d = lattice_stream::value(i) - mean;
+        m2 += (long double) stream.counts[i] * d * d;
+    }
+    const double variance = double(m2 / (n - 1));
+
+    REQUIRE(merged.num_values() == n);
+    REQUIRE(merged.compute_min() == lattice_stream::value(lo));
+    REQUIRE(merged.compute_max() == lattice_stream::value(hi));
+    REQUIRE(merged.compute_mean() == Approx(double(mean)).epsilon(1e-9));
+    REQUIRE(merged.compute_variance() == Approx(variance).epsilon(1e-9));
+
+    for (const double q : { 0.0, 0.001, 0.01, 0.05, 0.0505, 0.06, 0.1, 0.25, 0.5, 0.75, 0.9, 0.99, 0.999, 0.9999, 1.0 })
+    {
+        const double exact = stream.exact_quantile(q, n);
+        const double estimate = merged.compute_quantile(q);
+
+        // Bucket counts add exactly, so the merge is indistinguishable from one sketch over the stream
+        REQUIRE(estimate == single.compute_quantile(q));
+        REQUIRE(std::abs(estimate - exact) <= accuracy * std::abs(exact) * (1.0 + 1e-9));
+    }
+}
+
+TEST_CASE("StreamingStats merges match exact quantiles and moments")
+{
+    check_merged_against_exact(1000000, 7);
+}
+
+TEST_CASE("StreamingStats merges match exact quantiles and moments over 100M samples", "[.][slow]")
+{
+    SimpleTimer t(true);
+    check_merged_against_exact(100000000, 64);
+    std::cout << "100M samples checked in " << t.milliseconds().count() << " ms" << std::endl;
+}
+
+TEST_CASE("DecayingStats decays mean and quantiles but keeps extrema")
+{
+    DecayingStats<float> d(1.0);
+    for (int i = 0; i < 100; ++i) d.put(100.f);
+    d.advance(20.0);
+    for (int i = 0; i < 100; ++i) d.put(1.f);
+
+    REQUIRE(d.compute_min() == 1.0);
+    REQUIRE(d.compute_max() == 100.0);
+    REQUIRE(d.compute_mean() == Approx(1.0).epsilon(1e-3));
+    REQUIRE(d.compute_quantile(0.99) == Approx(1.0).epsilon(0.01));
+}
+
+TEST_CASE("ConcurrentStats collects every put exactly once")
+{
+    const int threads = 4;
+    const int perThread = 200000;
+
+    ConcurrentStats<double> stats;
+    QuantileSketch reference;
+    for (int t = 0; t < threads; ++t) for (int i = 0; i < perThread; ++i) reference.put(double(t * perThread + i));
+
+    std::atomic<int> done{ 0 };
+    std::vector<std::thread> writers;
+    for (int t = 0; t < threads; ++t)
+    {
+        writers.emplace_back([&, t]()
+        {
+            for (int i = 0; i < perThread; ++i) stats.put(double(t * perThread + i));
+            done++;
+        });
+    }
+
+    uint64_t collected = 0;
+    while (done < threads) collected += stats.collect().num_values();
+    for (auto & w : writers) w.join();
+    collected += stats.collect().num_values();
+
+    const StreamingStats<double> & total = stats.get_total();
+    REQUIRE(collected == uint64_t(threads) * perThread);
+    REQUIRE(total.num_values() == collected);
+    REQUIRE(total.compute_min() == 0.0);
+    REQUIRE(total.compute_max() == double(threads * perThread - 1));
+    for (const double q : { 0.01, 0.5, 0.99 }) REQUIRE(total.compute_quantile(q) == reference.compute_quantile(q));
+}
+
+TEST_CASE("ConcurrentStats instances can be created and destroyed from long-lived threads")
+{
+    // Each instance leaves an entry in the calling thread's shard cache; expired ones are pruned on the next miss
+    for (int i = 0; i < 10000; ++i)
+    {
+        ConcurrentStats<float> stats;
+        stats.put(float(i));
+        REQUIRE(stats.collect().num_values() == 1);
+    }
+}
@@ -0,0 +1,359 @@
+#include "catch.hpp"
+#include "pointcloud_processing.hpp"
+#include "simple_timer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// Test matrices with the shapes that trouble 3x3 solvers: full rank, rank 2, rank 1, zero, and exactly or nearly
+// repeated values, over six orders of magnitude. Built as R1 * diag(d) * R2 (symmetric: R * diag(d) * R^T).
+struct matrix_source
+{
+    std::mt19937 rng;
+    std::uniform_real_distribution<float> unit{ -1.f, 1.f };
+    std::normal_distribution<float> gaussian;
+
+    matrix_source(const uint32_t seed) : rng(seed) {}
+
+    float3x3 rotation()
+    {
+        return qmat(normalize(float4(gaussian(rng), gaussian(rng), gaussian(rng), gaussian(rng))));
+    }
+
+    float3 spectrum(const bool allowNegative)
+    {
+        const float scale = std::pow(10.f, 3.f * unit(rng));
+        const float a = allowNegative ? unit(rng) : std::abs(unit(rng)), b = allowNegative ? unit(rng) : std::abs(unit(rng)), c = allowNegative ? unit(rng) : std::abs(unit(rng));
+        switch (rng() % 6)
+        {
+            case 0: return scale * float3(a, b, c);                 // full rank
+            case 1: return scale * float3(a, b, 0);                 // rank 2
+            case 2: return scale * float3(a, 0, 0);                 // rank 1
+            case 3: return scale * float3(a, a, b);                 // repeated
+            case 4: return scale * float3(a, a * (1 + 1e-4f), b);   // nearly repeated
+            default: return rng() % 4 ? scale * float3(a, a, a) : float3(0, 0, 0);
+        }
+    }
+
+    float3x3 general()
+    {
+        const float3 d = spectrum(true);
+        return mul(rotation(), float3x3({ d.x, 0, 0 }, { 0, d.y, 0 }, { 0, 0, d.z }), rotation());
+    }
+
+    float3x3 symmetric()
+    {
+        const float3 d = spectrum(true);
+        const float3x3 r = rotation();
+        const float3x3 s = mul(r, float3x3({ d.x, 0, 0 }, { 0, d.y, 0 }, { 0, 0, d.z }), transpose(r));
+        return (s + transpose(s)) * 0.5f;
+    }
+};
+
+static double norm(const float3x3 & m)
+{
+    double sum = 0;
+    for (int c = 0; c < 3; ++c) for (int r = 0; r < 3; ++r) sum += double(m[c][r]) * m[c][r];
+    return std::sqrt(sum);
+}
+
+static double3x3 to_double(const float3x3 & m)
+{
+    double3x3 d;
+    for (int c = 0; c < 3; ++c) for (int r = 0; r < 3; ++r) d[c][r] = m[c][r];
+    return d;
+}
+
+// Cyclic Jacobi in double precision, run to convergence: eigenvalues in descending order
+static double3 reference_eigenvalues(double3x3 a)
+{
+    for (int sweep = 0; sweep < 50; ++sweep)
+    {
+        const double off = a[1][0] * a[1][0] + a[2][0] * a[2][0] + a[2][1] * a[2][1];
+        if (off < 1e-300) break;
+        for (int p = 0; p < 2; ++p)
+        {
+            for (int q = p + 1; q < 3; ++q)
+            {
+                if (a[q][p] == 0) continue;
+                const double theta = (a[q][q] - a[p][p]) / (2 * a[q][p]);
+                const double t = (theta >= 0 ? 1.0 : -1.0) / (std::abs(theta) + std::sqrt(theta * theta + 1));
+                const double c = 1 / std::sqrt(t * t + 1), s = t * c;
+                double3x3 j = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } };
+                j[p][p] = c; j[q][q] = c; j[q][p] = s; j[p][q] = -s;
+                a = mul(transpose(j), a, j);
+            }
+        }
+    }
+    double3 e(a[0][0], a[1][1], a[2][2]);
+    std::sort(&e[0], &e[0] + 3, [](double x, double y) { return x > y; });
+    return e;
+}
+
+// Singular values as square roots of the eigenvalues of A^T A, descending; double leaves ~1e-8 of the largest
+static double3 reference_singular_values(const float3x3 & m)
+{
+    const double3x3 a = to_double(m);
+    const double3 e = reference_eigenvalues(mul(transpose(a), a));
+    return { std::sqrt(std::max(e.x, 0.0)), std::sqrt(std::max(e.y, 0.0)), std::sqrt(std::max(e.z, 0.0)) };
+}
+
+static double orthonormality_error(const float3x3 & m)
+{
+    return norm(mul(transpose(m), m) - float3x3(Identity3x3));
+}
+
+static float3x3 diagonal(const float3 & d) { return { { d.x, 0, 0 }, { 0, d.y, 0 }, { 0, 0, d.z } }; }
+
+// Worst errors over a set of decompositions, each relative to the Frobenius norm of its input
+struct error_bounds
+{
+    double reconstruction = 0, values = 0, orthonormality = 0;
+
+    void add(const float3x3 & input, const float3x3 & product, const double3 & values, const double3 & reference, const double orthonormal)
+    {
+        const double n = std::max(norm(input), 1e-30);
+        reconstruction = std::max(reconstruction, norm(product - input) / n);
+        for (int k = 0; k < 3; ++k) this->values = std::max(this->values, std::abs(values[k] - reference[k]) / n);
+        orthonormality = std::max(orthonormality, orthonormal);
+    }
+
+    void merge(const error_bounds & other)
+    {
+        reconstruction = std::max(reconstruction, other.reconstruction);
+        values = std::max(values, other.values);
+        orthonormality = std::max(orthonormality, other.orthonormality);
+    }
+};
+
+std::ostream & operator << (std::ostream & o, const error_bounds & e)
+{
+    return o << "reconstruction " << e.reconstruction << ", values " << e.values << ", orthonormality " << e.orthonormality;
+}
+
+static error_bounds check_eigen(const float3x3 & a, const float3x3 & v, const float3 & e)
+{
+    error_bounds bounds;
+    bounds.add(a, mul(v, diagonal(e), transpose(v)), double3(e), reference_eigenvalues(to_double(a)), orthonormality_error(v));
+    return bounds;
+}
+
+static error_bounds check_svd(const float3x3 & a, const float3x3 & u, const float3 & s, const float3x3 & v)
+{
+    error_bounds bounds;
+    bounds.add(a, mul(u, diagonal(s), transpose(v)), double3(std::abs(s.x), std::abs(s.y), std::abs(s.z)), reference_singular_values(a), std::max(orthonormality_error(u), orthonormality_error(v)));
+    return bounds;
+}
+
+// The generic Golub-Kahan routine, used the way svd_tests::validate_matrix does
+static void generic_svd(const float3x3 & a, float3x3 & u, float3 & s, float3x3 & v)
+{
+    u = a;
+    std::vector<float> values(3);
+    singular_value_decomposition<float3x3, float>(u, 3, 3, values, v);
+    s = { values[0], values[1], values[2] };
+}
+
+static void diagonalizer(const float3x3 & a, float3x3 & v, float3 & e)
+{
+    v = qmat(pca_impl::Diagonalizer(a));
+    e = pca_impl::Diagonal(mul(transpose(v), a, v));
+}
+
+// Noisy samples of randomly placed and tilted planes, k points each; every point's neighbourhood is its whole patch
+static void make_planar_patches(const uint32_t patches, const uint32_t k, std::vector<float3> & points, std::vector<float3> & planeNormals,
+    std::vector<uint32_t> & offsets, std::vector<uint32_t> & indices)
+{
+    std::mt19937 rng(5);
+    std::uniform_real_distribution<float> unit(-1.f, 1.f);
+    matrix_source source(6);
+
+    for (uint32_t i = 0; i < patches; ++i)
+    {
+        const float3x3 r = source.rotation();
+        const float3 center(unit(rng) * 100, unit(rng) * 100, unit(rng) * 100);
+        for (uint32_t j = 0; j < k; ++j) points.push_back(center + mul(r, float3(unit(rng), 0.5f * unit(rng), 0.01f * unit(rng))));
+        planeNormals.push_back(r.z);
+    }
+    for (uint32_t p = 0; p < points.size(); ++p)
+    {
+        offsets.push_back(uint32_t(indices.size()));
+        for (uint32_t j = 0; j < k; ++j) indices.push_back(p / k * k + j);
+    }
+    offsets.push_back(uint32_t(indices.size()));
+}
+
+TEST_CASE("svd_tests::execute")
+{
+    svd_tests::execute();
+}
+
+TEST_CASE("symmetric_eigen_decomposition_3x3 error bounds against a double-precision reference")
+{
+    const size_t count = 20001; // not a multiple of the lane width: exercises the scalar tail of the batch
+    matrix_source source(3);
+    std::vector<float3x3> a(count), v(count);
+    std::vector<float3> e(count);
+    for (auto & m : a) m = source.symmetric();
+    symmetric_eigen_decomposition_3x3(a.data(), count, v.data(), e.data());
+
+    error_bounds batched, single;
+    for (size_t i = 0; i < count; ++i)
+    {
+        batched.merge(check_eigen(a[i], v[i], e[i]));
+
+        REQUIRE(e[i].x >= e[i].y);
+        REQUIRE(e[i].y >= e[i].z);
+        REQUIRE(determinant(v[i]) == Approx(1.0f).margin(1e-5));
+
+        // The scalar path and the SIMD lanes run the same operations
+        float3x3 v1;
+        float3 e1;
+        symmetric_eigen_decomposition_3x3(a[i], v1, e1);
+        single.merge(check_eigen(a[i], v1, e1));
+        for (int k = 0; k < 3; ++k) REQUIRE(std::abs(e1[k] - e[i][k]) <= 1e-6 * std::max(norm(a[i]), 1e-30));
+    }
+
+    INFO("batched: " << batched);
+    INFO("single: " << single);
+    for (auto & b : { batched, single })
+    {
+        REQUIRE(b.reconstruction < 4e-6);
+        REQUIRE(b.values < 4e-6);
+        REQUIRE(b.orthonormality < 4e-6);
+    }
+}
+
+TEST_CASE("singular_value_decomposition_3x3 error bounds against a double-precision reference")
+{
+    const size_t count = 20001;
+    matrix_source source(4);
+    std::vector<float3x3> a(count), u(count), v(count);
+    std::vector<float3> s(count);
+    for (auto & m : a) m = source.general();
+    singular_value_decomposition_3x3(a.data(), count, u.data(), s.data(), v.data());
+
+    error_bounds batched;
+    for (size_t i = 0; i < count; ++i)
+    {
+        batched.merge(check_svd(a[i], u[i], s[i], v[i]));
+
+        // Sorted on the eigenvalues of A^T A, so equal singular values can come out of the QR a rounding apart
+        const float tie = 1e-6f * float(norm(a[i]));
+        REQUIRE(std::abs(s[i].x) >= std::abs(s[i].y) - tie);
+        REQUIRE(std::abs(s[i].y) >= std::abs(s[i].z) - tie);
+        REQUIRE(determinant(u[i]) == Approx(1.0f).margin(1e-5));
+        REQUIRE(determinant(v[i]) == Approx(1.0f).margin(1e-5));
+    }
+
+    INFO("batched: " << batched);
+    REQUIRE(batched.reconstruction < 4e-6);
+    REQUIRE(batched.values < 4e-6);
+    REQUIRE(batched.orthonormality < 4e-6);
+}
+
+TEST_CASE("make_local_principal_axes agrees with Diagonalizer on planar neighbourhoods")
+{
+    const uint32_t k = 16;
+    std::vector<float3> points, planeNormals;
+    std::vector<uint32_t> offsets, indices;
+    make_planar_patches(1000, k, points, planeNormals, offsets, indices);
+
+    // The last point gets a two point neighbourhood, which is too small for a normal
+    indices.erase(indices.end() - (k - 2), indices.end());
+    offsets.back() = uint32_t(indices.size());
+
+    std::vector<float3> normals, variances;
+    make_local_principal_axes(points, offsets, indices, normals, &variances);
+    REQUIRE(normals.size() == points.size());
+    REQUIRE(normals.back() == float3(0, 0, 0));
+
+    for (uint32_t p = 0; p + 1 < points.size(); ++p)
+    {
+        float3x3 q;
+        float3 e;
+        diagonalizer(pca_impl::neighbourhood_covariance(points.data(), indices.data() + offsets[p], k), q, e);
+
+        REQUIRE(std::abs(dot(normals[p], planeNormals[p / k])) > 0.999f);
+        REQUIRE(std::abs(dot(normals[p], q.z)) > 0.999f);
+        REQUIRE(variances[p].z == Approx(e.z).margin(1e-6));
+        REQUIRE(variances[p].x >= variances[p].y);
+        REQUIRE(variances[p].y >= variances[p].z);
+    }
+}
+
+TEST_CASE("3x3 eigen and SVD throughput against Diagonalizer and the generic SVD", "[.][benchmark]")
+{
+#if defined(AVL_SVD3_AVX)
+    std::cout << "batched kernels: AVX, 8 lanes" << std::endl;
+#elif defined(AVL_SVD3_SSE)
+    std::cout << "batched kernels: SSE2, 4 lanes" << std::endl;
+#else
+    std::cout << "batched kernels: scalar" << std::endl;
+#endif
+
+    const size_t count = 200000;
+    matrix_source source(7);
+    std::vector<float3x3> sym(count), gen(count), u(count), v(count);
+    std::vector<float3> values(count);
+    for (auto & m : sym) m = source.symmetric();
+    for (auto & m : gen) m = source.general();
+
+    auto report = [&](const char * name, const double ms, const std::vector<float3x3> & input, const bool isSvd)
+    {
+        error_bounds bounds;
+        for (size_t i = 0; i < count; i += 10)
+        {
+            bounds.merge(isSvd ? check_svd(input[i], u[i], values[i], v[i]) : check_eigen(input[i], v[i], values[i]));
+        }
+        std::cout << "  " << name << ": " << ms * 1e6 / count << " ns per matrix; worst " << bounds << std::endl;
+    };
+
+    std::cout << count << " symmetric matrices, eigen decomposition" << std::endl;
+    SimpleTimer t(true);
+    symmetric_eigen_decomposition_3x3(sym.data(), count, v.data(), values.data());
+    report("symmetric_eigen_decomposition_3x3 (batched)", t.nanoseconds().count() * 1e-6, sym, false);
+
+    t.start();
+    for (size_t i = 0; i < count; ++i) symmetric_eigen_decomposition_3x3(sym[i], v[i], values[i]);
+    report("symmetric_eigen_decomposition_3x3 (single)", t.nanoseconds().count() * 1e-6, sym, false);
+
+    t.start();
+    for (size_t i = 0; i < count; ++i) diagonalizer(sym[i], v[i], values[i]);
+    report("pca_impl::Diagonalizer", t.nanoseconds().count() * 1e-6, sym, false);
+
+    std::cout << count << " general matrices, SVD" << std::endl;
+    t.start();
+    singular_value_decomposition_3x3(gen.data(), count, u.data(), values.data(), v.data());
+    report("singular_value_decomposition_3x3 (batched)", t.nanoseconds().count() * 1e-6, gen, true);
+
+    t.start();
+    for (size_t i = 0; i < count; ++i) singular_value_decomposition_3x3(gen[i], u[i], values[i], v[i]);
+    report("singular_value_decomposition_3x3 (single)", t.nanoseconds().count() * 1e-6, gen, true);
+
+    t.start();
+    for (size_t i = 0; i < count; ++i) generic_svd(gen[i], u[i], values[i], v[i]);
+    report("singular_value_decomposition (generic)", t.nanoseconds().count() * 1e-6, gen, true);
+
+    std::cout << "local PCA over 1M points, 16 neighbours each" << std::endl;
+    std::vector<float3> points, planeNormals, normals;
+    std::vector<uint32_t> offsets, indices;
+    make_planar_patches(62500, 16, points, planeNormals, offsets, indices);
+
+    t.start();
+    make_local_principal_axes(points, offsets, indices, normals);
+    std::cout << "  make_local_principal_axes: " << t.milliseconds().count() << " ms" << std::endl;
+
+    t.start();
+    for (size_t p = 0; p < points.size(); ++p)
+    {
+        float3x3 q;
+        float3 e;
+        diagonalizer(pca_impl::neighbourhood_covariance(points.data(), indices.data() + offsets[p], offsets[p + 1] - offsets[p]), q, e);
+        normals[p] = q.z;
+    }
+    std::cout << "  covariance + Diagonalizer per point: " << t.milliseconds().count() << " ms" << std::endl;
+}
@@ -0,0 +1,279 @@
+// This is free and unencumbered software released into the public domain.
+
+#ifndef kd_tree_hpp
+#define kd_tree_hpp
+
+#include "math-core.hpp"
+#include "util.hpp"
+
+#include <vector>
+#include <mutex>
+#include <algorithm>
+
+using namespace avl;
+
+/*
+ * Implicit (pointer free) KD-tree over a point cloud. The points are copied and permuted so that every node
+ * is a contiguous range of the array: the root covers all of it, and a node's range is split at its midpoint
+ * into the left child [begin, mid) and the right child [mid, end), with the median along the node's widest
+ * axis placed at mid. Children of node i are 2i + 1 and 2i + 2, so the only per-node data is the split
+ * plane, and ranges are recovered from the node index during traversal. Leaves hold at most LeafSize points.
+ * Construction partitions one level at a time, spreading the nodes of each level across threads.
+ * Queries return indices into the original array; batched forms run in parallel.
+ */
+class KDTree
+{
+public:
+
+    static const uint32_t LeafSize = 16;
+
+private:
+
+    std::vector<float3> points;         // tree order
+    std::vector<uint32_t> indices;      // original index of each point, tree order
+    std::vector<float> splitValues;     // per internal node
+    std::vector<uint8_t> splitAxes;
+    uint32_t numLevels{ 0 };            // internal levels; nodes at depth numLevels are leaves
+
+    struct node_ref { uint32_t node, begin, end, level; float bound; };
+
+    void node_range(const uint32_t node, uint32_t & begin, uint32_t & end) const
+    {
+        begin = 0;
+        end = uint32_t(points.size());
+        const uint32_t path = node + 1;
+        int bit = 31;
+        while (bit > 0 && !(path & (1u << bit))) --bit; // skip to the leading one, which marks the root
+        for (--bit; bit >= 0; --bit)
+        {
+            const uint32_t mid = (begin + end) / 2;
+            if (path & (1u << bit)) begin = mid;
+            else end = mid;
+        }
+    }
+
+    struct build_item { float3 p; uint32_t index; };
+
+    void split_node(std::vector<build_item> & items, const uint32_t node)
+    {
+        uint32_t begin, end;
+        node_range(node, begin, end);
+
+        float3 lo = items[begin].p, hi = items[begin].p;
+        for (uint32_t i = begin + 1; i < end; ++i)
+        {
+            lo = min(lo, items[i].p);
+            hi = max(hi, items[i].p);
+        }
+        const float3 extent = hi - lo;
+        const int axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z ? 1 : 2);
+
+        const uint32_t mid = (begin + end) / 2;
+        std::nth_element(items.begin() + begin, items.begin() + mid, items.begin() + end, [axis](const build_item & a, const build_item & b) { return a.p[axis] < b.p[axis]; });
+
+        splitAxes[node] = uint8_t(axis);
+        splitValues[node] = items[mid].p[axis];
+    }
+
+    // Keeps the k closest slots seen so far, sorted nearest first
+    struct nearest_set
+    {
+        uint32_t * slots;
+        float * dist2;
+        uint32_t k, count{ 0 };
+
+        nearest_set(uint32_t * slots, float * dist2, const uint32_t k) : slots(slots), dist2(dist2), k(k) {}
+
+        float worst() const { return count < k ? std::numeric_limits<float>::infinity() : dist2[k - 1]; }
+
+        void insert(const uint32_t slot, const float d2)
+        {
+            uint32_t i = count < k ? count++ : k - 1;
+            while (i > 0 && dist2[i - 1] > d2)
+            {
+                dist2[i] = dist2[i - 1];
+                slots[i] = slots[i - 1];
+                --i;
+            }
+            dist2[i] = d2;
+            slots[i] = slot;
+        }
+    };
+
+    // Depth first, near child first. `visit_leaf(begin, end)` scans a leaf; `limit()` is the current squared
+    // search radius, so subtrees whose split plane lies beyond it are skipped.
+    template<typename LeafF, typename LimitF>
+    void traverse(const float3 & q, LeafF && visit_leaf, LimitF && limit) const
+    {
+        if (points.empty()) return;
+
+        node_ref stack[64];
+        int top = 0;
+        stack[top++] = { 0, 0, uint32_t(points.size()), 0, 0.0f };
+
+        while (top > 0)
+        {
+            node_ref n = stack[--top];
+            if (n.bound > limit()) continue;
+
+            while (n.level < numLevels)
+            {
+                const int axis = splitAxes[n.node];
+                const float diff = q[axis] - splitValues[n.node];
+                const uint32_t mid = (n.begin + n.end) / 2;
+
+                node_ref left = { 2 * n.node + 1, n.begin, mid, n.level + 1, n.bound };
+                node_ref right = { 2 * n.node + 2, mid, n.end, n.level + 1, n.bound };
+                node_ref & farChild = diff < 0.0f ? right : left;
+                farChild.bound = std::max(n.bound, diff * diff);
+
+                if (farChild.bound <= limit()) stack[top++] = farChild;
+                n = diff < 0.0f ? left : right;
+            }
+
+            visit_leaf(n.begin, n.end);
+        }
+    }
+
+public:
+
+    KDTree() = default;
+    explicit KDTree(const std::vector<float3> & cloud) { build(cloud); }
+
+    void build(const std::vector<float3> & cloud)
+    {
+        assert(cloud.size() < std::numeric_limits<uint32_t>::max());
+        points.resize(cloud.size());
+
+        // Nodes on one level differ in size by at most one, so every node above numLevels gets split
+        numLevels = 0;
+        while (((points.size() + (size_t(1) << numLevels) - 1) >> numLevels) > LeafSize) ++numLevels;
+
+        const size_t numInternal = (size_t(1) << numLevels) - 1;
+        splitValues.assign(numInternal, 0.0f);
+        splitAxes.assign(numInternal, 0);
+
+        // Positions and indices are partitioned together, then split into separate arrays for querying
+        std::vector<build_item> items(cloud.size());
+        for (size_t i = 0; i < cloud.size(); ++i) items[i] = { cloud[i], uint32_t(i) };
+
+        for (uint32_t level = 0; level < numLevels; ++level)
+        {
+            const uint32_t first = (1u << level) - 1;
+            parallel_for(0, size_t(1) << level, 1, [&](size_t b, size_t e)
+            {
+                for (size_t i = b; i < e; ++i) split_node(items, first + uint32_t(i));
+            });
+        }
+
+        indices.resize(items.size());
+        for (size_t i = 0; i < items.size(); ++i)
+        {
+            points[i] = items[i].p;
+            indices[i] = items[i].index;
+        }
+    }
+
+    size_t size() const { return points.size(); }
+    bool empty() const { return points.empty(); }
+
+    // Points in tree order, with their original indices. Consecutive entries are spatially close, which makes
+    // this the cache friendly order for issuing one query per point.
+    const std::vector<float3> & tree_points() const { return points; }
+    const std::vector<uint32_t> & tree_indices() const { return indices; }
+
+    // k-NN returning slots into tree_points() rather than original indices, which saves a lookup when the
+    // neighbour positions are needed next
+    uint32_t knn_slots(const float3 & q, const uint32_t k, uint32_t * slots, float * dist2) const
+    {
+        nearest_set set(slots, dist2, std::min<uint32_t>(k, uint32_t(points.size())));
+        if (set.k == 0) return 0;
+        traverse(q, [&](uint32_t begin, uint32_t end)
+        {
+            for (uint32_t i = begin; i < end; ++i)
+            {
+                const float d2 = length2(points[i] - q);
+                if (d2 < set.worst()) set.insert(i, d2);
+            }
+        }, [&]() { return set.worst(); });
+        return set.count;
+    }
+
+    // Up to k nearest points to q, nearest first, as original indices and squared distances. Returns the count.
+    uint32_t knn(const float3 & q, const uint32_t k, uint32_t * outIndices, float * outDist2) const
+    {
+        const uint32_t found = knn_slots(q, k, outIndices, outDist2);
+        for (uint32_t i = 0; i < found; ++i) outIndices[i] = indices[outIndices[i]];
+        return found;
+    }
+
+    // Appends the original index of every point within `radius` of q (in no particular order)
+    void radius(const float3 & q, const float radius, std::vector<uint32_t> & outIndices, std::vector<float> * outDist2 = nullptr) const
+    {
+        const float r2 = radius * radius;
+        traverse(q, [&](uint32_t begin, uint32_t end)
+        {
+            for (uint32_t i = begin; i < end; ++i)
+            {
+                const float d2 = length2(points[i] - q);
+                if (d2 > r2) continue;
+                outIndices.push_back(indices[i]);
+                if (outDist2) outDist2->push_back(d2);
+            }
+        }, [r2]() { return r2; });
+    }
+
+    // Batched k-NN: row i of outIndices / outDist2 (k entries each) holds the neighbours of queries[i]. When the
+    // tree has fewer than k points, rows are padded with UINT32_MAX and infinity.
+    void knn(const float3 * queries, const size_t count, const uint32_t k, uint32_t * outIndices, float * outDist2) const
+    {
+        parallel_for(0, count, 1024, [&](size_t b, size_t e)
+        {
+            for (size_t i = b; i < e; ++i)
+            {
+                uint32_t * row = outIndices + i * k;
+                float * rowDist2 = outDist2 + i * k;
+                const uint32_t found = knn(queries[i], k, row, rowDist2);
+                std::fill(row + found, row + k, std::numeric_limits<uint32_t>::max());
+                std::fill(rowDist2 + found, rowDist2 + k, std::numeric_limits<float>::infinity());
+            }
+        });
+    }
+
+    // Batched radius search in compressed rows: the neighbours of queries[i] are
+    // outIndices[outOffsets[i] .. outOffsets[i + 1])
+    void radius(const float3 * queries, const size_t count, const float radius, std::vector<uint32_t> & outOffsets, std::vector<uint32_t> & outIndices) const
+    {
+        struct chunk { size_t begin; std::vector<uint32_t> counts, indices; };
+        std::vector<chunk> chunks;
+        std::mutex chunkMutex;
+
+        parallel_for(0, count, 1024, [&](size_t b, size_t e)
+        {
+            chunk c;
+            c.begin = b;
+            c.counts.reserve(e - b);
+            for (size_t i = b; i < e; ++i)
+            {
+                const size_t before = c.indices.size();
+                this->radius(queries[i], radius, c.indices);
+                c.counts.push_back(uint32_t(c.indices.size() - before));
+            }
+            std::lock_guard<std::mutex> guard(chunkMutex);
+            chunks.push_back(std::move(c));
+        });
+
+        std::sort(chunks.begin(), chunks.end(), [](const chunk & a, const chunk & b) { return a.begin < b.begin; });
+
+        outOffsets.assign(1, 0);
+        outOffsets.reserve(count + 1);
+        outIndices.clear();
+        for (auto & c : chunks)
+        {
+            for (auto n : c.counts) outOffsets.push_back(outOffsets.back() + n);
+            outIndices.insert(outIndices.end(), c.indices.begin(), c.indices.end());
+        }
+    }
+};
+
+#endif // end kd_tree_hpp
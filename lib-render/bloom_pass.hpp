@@ -6,227 +6,194 @@
 #include "util.hpp"
 #include "math-common.hpp"
 #include "gl-api.hpp"
-#include "gl-async-pbo.hpp"
 #include "gl-imgui.hpp"
 #include "file_io.hpp"
-#include "procedural_mesh.hpp"
+#include "simple_timer.hpp"
+#include "uniforms.hpp"
 
 using namespace avl;
 
+// Compute-based HDR post chain shared by all views:
+// 1. A single-workgroup reduction averages log-luminance over every view and adapts it against last frame's
+//    value. The result and a short history live in a storage buffer that the later stages read directly,
+//    so nothing is read back on the CPU.
+// 2. The exposed scene is thresholded into half resolution, then dual-filter downsampled and upsampled
+//    through a mip chain. Views are layers of the same texture arrays, so each level is one dispatch for all of them.
+// 3. The composite adds the glow, applies exposure and tonemaps each view's color texture in place.
 struct BloomPass
 {
-    union
-    {
-        GLuint pipelines[1];
-        struct { GLuint downsample_pipeline; };
-    };
-
-
-    GlShader hdr_post;
-    GlShader hdr_lumShader;
-    GlShader hdr_avgLumShader;
-    GlShader hdr_blurShader;
-    GlShader hdr_brightShader;
-
-    GlShaderHandle hdr_tonemapShader = { "post-tonemap" };
+    GlComputeProgram luminanceProgram;
+    GlComputeProgram prefilterProgram;
+    GlComputeProgram downsampleProgram;
+    GlComputeProgram upsampleProgram;
+    GlComputeProgram tonemapProgram;
 
-    GlFramebuffer brightFramebuffer, blurFramebuffer, outputFramebuffer;
-    GlFramebuffer luminance[5];
+    GlBuffer luminanceState;
 
-    GlTexture2D brightTex, blurPasses[2], outputTex; 
-    GlTexture2D luminanceTex[5];
+    GlTexture3D downChain;   // bloomLevels mips, one layer per view
+    GlTexture3D upChain;     // bloomLevels - 1 mips
 
-    GlMesh fsQuad;
+    SimpleTimer timer;
+    double lastTime{ 0 };
 
     float2 perEyeSize;
-
-    int blurPixelsPerSide = 2;
-    float blurSigma = 4.0f;
-    float middleGrey = 1.0f;
-    float whitePoint = 1.5f;
+    int viewCount;
+    int bloomLevels;
+
+    float middleGrey = 0.18f;
+    float exposure = 1.0f;          // compensation on top of the adapted exposure
+    float minExposure = 0.25f;
+    float maxExposure = 4.0f;
+    float adaptationRate = 1.5f;    // per second
     float threshold = 0.66f;
-    float exposure = 0.5f;
+    float knee = 0.25f;
+    float radius = 0.75f;
+    float intensity = 0.5f;
 
-    float blurDownsampleFactor = 2.0f;
+    BloomPass(float2 size, const int viewCount = 1) : perEyeSize(size), viewCount(viewCount)
+    {
+        const int halfWidth = std::max(1, int(perEyeSize.x) / 2);
+        const int halfHeight = std::max(1, int(perEyeSize.y) / 2);
 
-    AsyncRead1 avgLuminance;
+        // Stop once the coarsest level would be smaller than ~8 pixels on its short side
+        bloomLevels = 1;
+        while (bloomLevels < 6 && (std::min(halfWidth, halfHeight) >> bloomLevels) >= 8) bloomLevels++;
 
-    BloomPass(float2 size) : perEyeSize(size)
-    {
-        fsQuad = make_fullscreen_quad();
-
-        luminanceTex[0].setup(128, 128, GL_RGBA, GL_RGBA, GL_FLOAT, nullptr);
-        luminanceTex[1].setup(64, 64, GL_RGBA, GL_RGBA, GL_FLOAT, nullptr);
-        luminanceTex[2].setup(16, 16, GL_RGBA, GL_RGBA, GL_FLOAT, nullptr);
-        luminanceTex[3].setup(4, 4, GL_RGBA, GL_RGBA, GL_FLOAT, nullptr);
-        luminanceTex[4].setup(1, 1, GL_RGBA, GL_RGBA, GL_FLOAT, nullptr);
-        brightTex.setup(perEyeSize.x / 2, perEyeSize.y / 2, GL_RGBA, GL_RGBA, GL_FLOAT, nullptr);
-        blurPasses[0].setup(perEyeSize.x / blurDownsampleFactor, perEyeSize.y / blurDownsampleFactor, GL_RGBA, GL_RGBA, GL_FLOAT, nullptr);
-        blurPasses[1].setup(perEyeSize.x / blurDownsampleFactor, perEyeSize.y / blurDownsampleFactor, GL_RGBA, GL_RGBA, GL_FLOAT, nullptr);
-        outputTex.setup(perEyeSize.x, perEyeSize.y, GL_RGBA, GL_RGBA, GL_FLOAT, nullptr);
-
-        glNamedFramebufferTexture2DEXT(luminance[0], GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, luminanceTex[0], 0);
-        glNamedFramebufferTexture2DEXT(luminance[1], GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, luminanceTex[1], 0);
-        glNamedFramebufferTexture2DEXT(luminance[2], GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, luminanceTex[2], 0);
-        glNamedFramebufferTexture2DEXT(luminance[3], GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, luminanceTex[3], 0);
-        glNamedFramebufferTexture2DEXT(luminance[4], GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, luminanceTex[4], 0);
-        glNamedFramebufferTexture2DEXT(brightFramebuffer, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, brightTex, 0);
-        glNamedFramebufferTexture2DEXT(blurFramebuffer, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, blurPasses[0], 0);
-        glNamedFramebufferTexture2DEXT(blurFramebuffer, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, blurPasses[1], 0);
-        glNamedFramebufferTexture2DEXT(outputFramebuffer, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, outputTex, 0);
-
-        for (auto & l : luminance) l.check_complete();
-        brightFramebuffer.check_complete();
-        blurFramebuffer.check_complete();
-        outputFramebuffer.check_complete();
-
-        hdr_post = GlShader(GL_VERTEX_SHADER, read_file_text("../assets/shaders/renderer/post_vert.glsl"));
-        hdr_avgLumShader = GlShader(GL_FRAGMENT_SHADER, read_file_text("../assets/shaders/renderer/post_lumavg_frag.glsl"));
-
-        hdr_lumShader = GlShader(read_file_text("../assets/shaders/renderer/post_vert.glsl"), read_file_text("../assets/shaders/renderer/post_lum_frag.glsl"));
-        hdr_blurShader = GlShader(read_file_text("../assets/shaders/renderer/gaussian_blur_vert.glsl"), read_file_text("../assets/shaders/renderer/gaussian_blur_frag.glsl"));
-        hdr_brightShader = GlShader(read_file_text("../assets/shaders/renderer/post_vert.glsl"), read_file_text("../assets/shaders/renderer/post_bright_frag.glsl"));
-
-        glCreateProgramPipelines(GLsizei(1), pipelines);
-        glBindProgramPipeline(downsample_pipeline);
-        glUseProgramStages(downsample_pipeline, GL_VERTEX_SHADER_BIT, hdr_post.handle());
-        glUseProgramStages(downsample_pipeline, GL_FRAGMENT_SHADER_BIT, hdr_avgLumShader.handle());
+        auto setup_chain = [&](GlTexture3D & tex, const int levels)
+        {
+            glTextureStorage3DEXT(tex, GL_TEXTURE_2D_ARRAY, levels, GL_RGBA16F, halfWidth, halfHeight, viewCount);
+            glTextureParameteriEXT(tex, GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_NEAREST);
+            glTextureParameteriEXT(tex, GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTextureParameteriEXT(tex, GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTextureParameteriEXT(tex, GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            tex.width = float(halfWidth);
+            tex.height = float(halfHeight);
+            tex.depth = float(viewCount);
+        };
+
+        setup_chain(downChain, bloomLevels);
+        setup_chain(upChain, std::max(1, bloomLevels - 1));
+
+        uniforms::luminance_state initial = {};
+        initial.adaptedLuminance = middleGrey;
+        initial.exposure = 1.0f;
+        luminanceState.set_buffer_data(sizeof(initial), &initial, GL_DYNAMIC_COPY);
+
+        luminanceProgram = GlComputeProgram(read_file_text("../assets/shaders/renderer/post_luminance_comp.glsl"));
+        prefilterProgram = GlComputeProgram(read_file_text("../assets/shaders/renderer/post_bloom_prefilter_comp.glsl"));
+        downsampleProgram = GlComputeProgram(read_file_text("../assets/shaders/renderer/post_bloom_downsample_comp.glsl"));
+        upsampleProgram = GlComputeProgram(read_file_text("../assets/shaders/renderer/post_bloom_upsample_comp.glsl"));
+        tonemapProgram = GlComputeProgram(read_file_text("../assets/shaders/renderer/post_tonemap_comp.glsl"));
+
+        timer.start();
 
         gl_check_error(__FILE__, __LINE__);
     }
 
-    ~BloomPass()
-    {
-        glDeleteProgramPipelines(GLsizei(1), pipelines);
-    }
-
-    void execute(GlTexture2D & sceneColorTex)
-    {
-        glBindFramebuffer(GL_FRAMEBUFFER, luminance[0]); // 128x128 surface area - calculate luminance 
-        glViewport(0, 0, 128, 128);
-        hdr_lumShader.bind();
-        hdr_lumShader.texture("s_texColor", 0, sceneColorTex, GL_TEXTURE_2D);
-        hdr_lumShader.uniform("u_modelViewProj", Identity4x4);
-        fsQuad.draw_elements();
+    static GLuint group_count(const int pixels) { return GLuint((pixels + 7) / 8); }
 
-        {
-            glBindProgramPipeline(downsample_pipeline);
+    int2 level_size(const int level) const { return int2(std::max(1, int(downChain.width) >> level), std::max(1, int(downChain.height) >> level)); }
 
-            std::vector<float3> downsampleTargets = { { 0, 64, 64 },{ 1, 16, 16 },{ 2, 4, 4 },{ 3, 1, 1 } };
-
-            auto downsample = [&](const int idx, const float2 targetSize)
-            {
-                glBindFramebuffer(GL_FRAMEBUFFER, luminance[idx + 1]);
-                glViewport(0, 0, targetSize.x, targetSize.y);
-                hdr_avgLumShader.texture("s_texColor", 0, luminance[idx], GL_TEXTURE_2D); // not bound?
-                fsQuad.draw_elements();
-            };
+    // Runs the whole chain for `count` views (at most the count given at construction) and tonemaps them in place
+    void execute(GlTexture2D * sceneColorTex, const int count)
+    {
+        assert(count >= 1 && count <= viewCount && count <= uniforms::MAX_VIEWS);
 
-            for (auto target : downsampleTargets) downsample(target.x, float2(target.y, target.z));
+        const double now = timer.elapsed_ms();
+        const float dt = float(std::min(now - lastTime, 250.0) / 1000.0);
+        lastTime = now;
 
-            glBindProgramPipeline(0);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, uniforms::luminance_state::binding, luminanceState);
 
-            hdr_avgLumShader.unbind();
+        // Luminance reduction and adaptation
+        for (int v = 0; v < count; ++v)
+        {
+            const std::string name = "s_texColor[" + std::to_string(v) + "]";
+            luminanceProgram.texture(name.c_str(), v, sceneColorTex[v], GL_TEXTURE_2D);
         }
+        luminanceProgram.uniform("u_viewCount", count);
+        luminanceProgram.uniform("u_deltaTime", dt);
+        luminanceProgram.uniform("u_adaptationRate", adaptationRate);
+        luminanceProgram.uniform("u_middleGrey", middleGrey);
+        luminanceProgram.uniform("u_exposureRange", float2(minExposure, maxExposure));
+        luminanceProgram.dispatch(1, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        // Threshold into the top of the chain; the scene textures are separate objects, so one dispatch per view
+        const int2 top = level_size(0);
+        glBindImageTexture(0, downChain, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+        prefilterProgram.uniform("u_exposure", exposure);
+        prefilterProgram.uniform("u_threshold", threshold);
+        prefilterProgram.uniform("u_knee", std::max(knee, 0.0001f));
+        for (int v = 0; v < count; ++v)
+        {
+            prefilterProgram.texture("s_texColor", 0, sceneColorTex[v], GL_TEXTURE_2D);
+            prefilterProgram.uniform("u_layer", v);
+            prefilterProgram.dispatch(group_count(top.x), group_count(top.y), 1);
+        }
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
 
-        hdr_lumShader.unbind();
-
-        // Readback luminance value
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, luminance[4]);
-        float4 lumValue = avgLuminance.download();
-        glBindTexture(GL_TEXTURE_2D, 0);
-
-        float4 tonemap = { middleGrey, whitePoint * whitePoint, threshold, 0.0f };
-
-        /*
-        const float lumTarget = 0.4f;
-        const float exposureTarget = lumValue.x += 0.1 * (lumTarget - lumValue.x);
-        float exposureCtrl = 0.86f;
-        exposureCtrl = exposureCtrl * 0.1 + exposureTarget * 0.9;
-        const float exposure = std::exp(exposureCtrl*exposureCtrl) - 1.0f;
-        ImGui::Text("Exposure %f", exposure);
-        ImGui::Text("Luminance %f", lumValue.x);
-        */
-
-        glBindFramebuffer(GL_FRAMEBUFFER, brightFramebuffer);
-        glViewport(0, 0, perEyeSize.x / 2, perEyeSize.y / 2);
-        hdr_brightShader.bind();
-        hdr_brightShader.texture("s_texColor", 0, sceneColorTex, GL_TEXTURE_2D);
-        hdr_brightShader.uniform("u_exposure", exposure);
-        hdr_brightShader.uniform("u_tonemap", tonemap);
-        hdr_brightShader.uniform("u_modelViewProj", Identity4x4);
-        fsQuad.draw_elements();
-        hdr_brightShader.unbind();
-
-        static int dx = 0;
+        // Downsample, every view per dispatch
+        downsampleProgram.texture("s_source", 0, downChain, GL_TEXTURE_2D_ARRAY);
+        for (int level = 1; level < bloomLevels; ++level)
+        {
+            const int2 size = level_size(level);
+            glBindImageTexture(0, downChain, level, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+            downsampleProgram.uniform("u_sourceLevel", level - 1);
+            downsampleProgram.dispatch(group_count(size.x), group_count(size.y), count);
+            glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+        }
 
+        // Upsample back towards half resolution; the coarsest step reads from the bottom of the down chain
+        upsampleProgram.texture("s_detail", 1, downChain, GL_TEXTURE_2D_ARRAY);
+        upsampleProgram.uniform("u_radius", radius);
+        for (int level = bloomLevels - 2; level >= 0; --level)
         {
-            glBindFramebuffer(GL_FRAMEBUFFER, blurFramebuffer);
-
-            if (dx == 0)
-            {
-                glDrawBuffer(GL_COLOR_ATTACHMENT1);
-                glReadBuffer(GL_COLOR_ATTACHMENT0);
-            }
-            else
-            {
-                glDrawBuffer(GL_COLOR_ATTACHMENT0);
-                glReadBuffer(GL_COLOR_ATTACHMENT1);
-            }
-
-            glViewport(0, 0, perEyeSize.x / blurDownsampleFactor, perEyeSize.y / blurDownsampleFactor);
-
-            hdr_blurShader.bind();
-
-            hdr_blurShader.uniform("u_modelViewProj", Identity4x4);
-            hdr_blurShader.uniform("sigma", blurSigma);
-            hdr_blurShader.uniform("numBlurPixelsPerSide", float(blurPixelsPerSide));
-
-            // Horizontal pass
-            hdr_blurShader.uniform("blurSize", 1.f / (perEyeSize.x / blurDownsampleFactor));
-            hdr_blurShader.uniform("blurMultiplyVec", float2(1.0f, 0.0f));
-            hdr_blurShader.texture("s_blurTexure", 0, brightTex, GL_TEXTURE_2D);
-            fsQuad.draw_elements();
-
-            // Vertical pass
-            hdr_blurShader.uniform("blurSize", 1.f / (perEyeSize.y / blurDownsampleFactor));
-            hdr_blurShader.uniform("blurMultiplyVec", float2(0.0f, 1.0f));
-            hdr_blurShader.texture("s_blurTexure", 0, blurPasses[1 - dx], GL_TEXTURE_2D);
-            fsQuad.draw_elements();
-
-            dx = 1 - dx; // swap
-
-            hdr_blurShader.unbind();
+            const int2 size = level_size(level);
+            const bool fromDownChain = (level == bloomLevels - 2);
+            upsampleProgram.texture("s_source", 0, fromDownChain ? downChain : upChain, GL_TEXTURE_2D_ARRAY);
+            upsampleProgram.uniform("u_sourceLevel", level + 1);
+            upsampleProgram.uniform("u_detailLevel", level);
+            glBindImageTexture(0, upChain, level, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+            upsampleProgram.dispatch(group_count(size.x), group_count(size.y), count);
+            glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
         }
 
-        glBindFramebuffer(GL_FRAMEBUFFER, outputFramebuffer);
-        glViewport(0, 0, perEyeSize.x, perEyeSize.y);
-        auto & tonemapProgram = hdr_tonemapShader.get();
-        tonemapProgram.bind();
-        tonemapProgram.texture("s_texColor", 0, sceneColorTex, GL_TEXTURE_2D);
-        tonemapProgram.texture("s_bloom", 1, blurPasses[dx], GL_TEXTURE_2D);
-        fsQuad.draw_elements();
-        tonemapProgram.unbind();
-    }
+        // Composite and tonemap in place
+        tonemapProgram.texture("s_bloom", 1, get_bloom_texture(), GL_TEXTURE_2D_ARRAY);
+        tonemapProgram.uniform("u_exposure", exposure);
+        tonemapProgram.uniform("u_bloomIntensity", intensity);
+        for (int v = 0; v < count; ++v)
+        {
+            glBindImageTexture(0, sceneColorTex[v], 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA8);
+            tonemapProgram.uniform("u_layer", v);
+            tonemapProgram.dispatch(group_count(int(perEyeSize.x)), group_count(int(perEyeSize.y)), 1);
+        }
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
 
-    GLuint get_output_framebuffer() const { return outputFramebuffer.id(); }
+        glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA16F);
+        glUseProgram(0);
 
-    GLuint get_luminance_texture() const { return luminanceTex[0].id(); }
+        gl_check_error(__FILE__, __LINE__);
+    }
 
-    GLuint get_bright_tex() const { return brightTex.id(); }
+    // With a single level there is nothing to upsample and the prefiltered level is used directly
+    GLuint get_bloom_texture() const { return bloomLevels > 1 ? upChain.id() : downChain.id(); }
 
-    GLuint get_blur_tex() const { return blurPasses[0].id(); }
+    GLuint get_luminance_buffer() const { return luminanceState.id(); }
 };
 
 template<class F> void visit_fields(BloomPass & o, F f)
 {
-    f("blur_radius", o.blurPixelsPerSide, range_metadata<int>{ 2, 6 });
-    f("blur_sigma", o.blurSigma, range_metadata<float>{ 0.1f, 8.f});
-    f("middle_grey", o.middleGrey, range_metadata<float>{ 0.1f, 1.0});
-    f("whitepoint", o.whitePoint, range_metadata<float>{ 0.1f, 2.f});
-    f("threshold", o.threshold, range_metadata<float>{ 0.f, 2.f});
-    f("exposure", o.exposure, range_metadata<float>{ 0.f, 2.f});
+    f("middle_grey", o.middleGrey, range_metadata<float>{ 0.01f, 1.0f });
+    f("exposure", o.exposure, range_metadata<float>{ 0.f, 4.f });
+    f("min_exposure", o.minExposure, range_metadata<float>{ 0.01f, 1.f });
+    f("max_exposure", o.maxExposure, range_metadata<float>{ 1.f, 16.f });
+    f("adaptation_rate", o.adaptationRate, range_metadata<float>{ 0.1f, 10.f });
+    f("threshold", o.threshold, range_metadata<float>{ 0.f, 2.f });
+    f("knee", o.knee, range_metadata<float>{ 0.f, 1.f });
+    f("radius", o.radius, range_metadata<float>{ 0.f, 1.f });
+    f("intensity", o.intensity, range_metadata<float>{ 0.f, 2.f });
 }
 
 #endif // end bloom_pass_hpp
@@ -3,15 +3,25 @@
 #include "math-spatial.hpp"
 #include "geometry.hpp"
 
-// Update per-object uniform buffer
-void forward_renderer::update_per_object_uniform_buffer(Renderable * r, const view_data & d)
+// Cascade zones are registered up front since their names are built at runtime
+static uint32_t cascade_zone(const int cascade, const bool gpu)
 {
-    uniforms::per_object object = {};
-    object.modelMatrix = mul(r->get_pose().matrix(), make_scaling_matrix(r->get_scale()));
-    object.modelMatrixIT = inverse(transpose(object.modelMatrix));
-    object.modelViewMatrix = mul(d.viewMatrix, object.modelMatrix);
-    object.receiveShadow = (float)r->get_receive_shadow();
-    perObject.set_buffer_data(sizeof(object), &object, GL_STREAM_DRAW);
+    static std::vector<uint32_t> ids;
+    if (ids.empty())
+    {
+        for (int c = 0; c < uniforms::NUM_CASCADES; ++c) ids.push_back(frame_profiler::get_instance().register_zone(("shadow-cascade-" + std::to_string(c)).c_str(), false));
+        for (int c = 0; c < uniforms::NUM_CASCADES; ++c) ids.push_back(frame_profiler::get_instance().register_zone(("shadow-cascade-" + std::to_string(c)).c_str(), true));
+    }
+    return ids[cascade + (gpu ? uniforms::NUM_CASCADES : 0)];
+}
+
+static uniforms::view_uniforms make_view_uniforms(const view_data & view)
+{
+    uniforms::view_uniforms v = {};
+    v.view = view.viewMatrix;
+    v.viewProj = view.viewProjMatrix;
+    v.eyePos = float4(view.pose.position, 1);
+    return v;
 }
 
 uint32_t forward_renderer::get_color_texture(const uint32_t idx) const
@@ -36,7 +46,7 @@ BloomPass & forward_renderer::get_bloom_pass() const
     return *bloom;
 }
 
-void forward_renderer::run_depth_prepass(const view_data & view, const scene_data & scene)
+void forward_renderer::run_depth_prepass(const std::vector<draw_item> & draws, const view_data & view, const scene_data & scene)
 {
     GLboolean colorMask[4];
     glGetBooleanv(GL_COLOR_WRITEMASK, &colorMask[0]);
@@ -48,11 +58,7 @@ void forward_renderer::run_depth_prepass(const view_data & view, const scene_dat
 
     auto & shader = earlyZPass.get();
     shader.bind();
-    for (auto obj : scene.renderSet)
-    {
-        update_per_object_uniform_buffer(obj, view);
-        obj->draw();
-    }
+    for (auto & item : draws) batcher.submit(item);
     shader.unbind();
 
     // Restore color mask state
@@ -71,27 +77,21 @@ void forward_renderer::run_skybox_pass(const view_data & view, const scene_data
     if (wasDepthTestingEnabled) glEnable(GL_DEPTH_TEST);
 }
 
-void forward_renderer::run_shadow_pass(const view_data & view, const scene_data & scene)
+void forward_renderer::run_shadow_pass(const std::vector<std::vector<draw_item>> & cascadeDraws, const view_data & view, const scene_data & scene)
 {
-    shadow->update_cascades(view.viewMatrix,
-        view.nearClip,
-        view.farClip,
-        aspect_from_projection(view.projectionMatrix),
-        vfov_from_projection(view.projectionMatrix),
-        scene.sunlight.direction);
-
     shadow->pre_draw();
 
     gl_check_error(__FILE__, __LINE__);
 
-    for (Renderable * obj : scene.renderSet)
+    for (int c = 0; c < uniforms::NUM_CASCADES; ++c)
     {
-        if (obj->get_cast_shadow())
-        {
-            float4x4 modelMatrix = mul(obj->get_pose().matrix(), make_scaling_matrix(obj->get_scale()));
-            shadow->program.get().uniform("u_modelShadowMatrix", modelMatrix);
-            obj->draw();
-        }
+        // Cached cascades keep last frame's contents
+        if (!shadow->should_render_cascade(c)) continue;
+
+        scoped_gpu_zone zone(cascade_zone(c, true));
+        shadow->begin_cascade(c);
+        for (auto & item : cascadeDraws[c]) batcher.submit(item);
+        shadow->end_cascade(c);
     }
 
     shadow->post_draw();
@@ -99,7 +99,7 @@ void forward_renderer::run_shadow_pass(const view_data & view, const scene_data
     gl_check_error(__FILE__, __LINE__);
 }
 
-void forward_renderer::run_forward_pass(std::vector<Renderable *> & renderQueueMaterial, std::vector<Renderable *> & renderQueueDefault, const view_data & view, const scene_data & scene)
+void forward_renderer::run_forward_pass(const std::vector<draw_item> & materialDraws, const std::vector<draw_item> & defaultDraws, const view_data & view, const scene_data & scene)
 {
     if (settings.useDepthPrepass)
     {
@@ -108,24 +108,19 @@ void forward_renderer::run_forward_pass(std::vector<Renderable *> & renderQueueM
         glDepthMask(GL_FALSE); // depth already comes from the prepass
     }
 
-    for (auto r : renderQueueMaterial)
+    // Each item is either a single object or a run of batched objects sharing a material
+    for (auto & item : materialDraws)
     {
-        update_per_object_uniform_buffer(r, view);
-
-        Material * mat = r->get_material();
+        Material * mat = item.renderable->get_material();
         mat->update_uniforms();
         if (auto * mr = dynamic_cast<MetallicRoughnessMaterial*>(mat)) mr->update_cascaded_shadow_array_handle(shadow->get_output_texture());
         mat->use();
 
-        r->draw();
+        batcher.submit(item);
     }
 
     // We assume that objects without a valid material take care of their own shading in the `draw()` function. 
-    for (auto r : renderQueueDefault)
-    {
-        update_per_object_uniform_buffer(r, view);
-        r->draw();
-    }
+    for (auto & item : defaultDraws) batcher.submit(item);
 
     if (settings.useDepthPrepass)
     {
@@ -133,7 +128,7 @@ void forward_renderer::run_forward_pass(std::vector<Renderable *> & renderQueueM
     }
 }
 
-void forward_renderer::run_post_pass(const view_data & view, const scene_data & scene)
+void forward_renderer::run_post_pass(const scene_data & scene)
 {
     GLboolean wasCullingEnabled = glIsEnabled(GL_CULL_FACE);
     GLboolean wasDepthTestingEnabled = glIsEnabled(GL_DEPTH_TEST);
@@ -142,18 +137,29 @@ void forward_renderer::run_post_pass(const view_data & view, const scene_data &
     glDisable(GL_CULL_FACE);
     glDisable(GL_DEPTH_TEST);
 
+    // Runs once for all views and writes the result back into the eye textures
     if (settings.bloomEnabled)
     {
-        bloom->execute(eyeTextures[view.index]);
-        glBlitNamedFramebuffer(bloom->get_output_framebuffer(), eyeFramebuffers[view.index], 0, 0,
-            settings.renderSize.x, settings.renderSize.y, 0, 0,
-            settings.renderSize.x, settings.renderSize.y, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+        bloom->execute(eyeTextures.data(), settings.cameraCount);
     }
 
     if (wasCullingEnabled) glEnable(GL_CULL_FACE);
     if (wasDepthTestingEnabled) glEnable(GL_DEPTH_TEST);
 }
 
+void forward_renderer::resolve_multisample(const uint32_t viewIndex, const int sourceX)
+{
+    // blit color 
+    glBlitNamedFramebuffer(multisampleFramebuffer, eyeFramebuffers[viewIndex],
+        sourceX, 0, sourceX + settings.renderSize.x, settings.renderSize.y, 0, 0,
+        settings.renderSize.x, settings.renderSize.y, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+
+    // blit depth
+    glBlitNamedFramebuffer(multisampleFramebuffer, eyeFramebuffers[viewIndex],
+        sourceX, 0, sourceX + settings.renderSize.x, settings.renderSize.y, 0, 0,
+        settings.renderSize.x, settings.renderSize.y, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+}
+
 forward_renderer::forward_renderer(const renderer_settings & settings) : settings(settings)
 {
     assert(settings.renderSize.x > 0 && settings.renderSize.y > 0);
@@ -163,10 +169,12 @@ forward_renderer::forward_renderer(const renderer_settings & settings) : setting
     eyeTextures.resize(settings.cameraCount);
     eyeDepthTextures.resize(settings.cameraCount);
 
-    // Generate multisample render buffers for color and depth, attach to multi-sampled framebuffer target
-    glNamedRenderbufferStorageMultisampleEXT(multisampleRenderbuffers[0], settings.msaaSamples, GL_RGBA8, settings.renderSize.x, settings.renderSize.y);
+    // Generate multisample render buffers for color and depth, attach to multi-sampled framebuffer target. With two
+    // cameras it is twice as wide so single-pass stereo can render both eyes side by side; sequential rendering uses the left half.
+    const int multisampleWidth = settings.renderSize.x * (settings.cameraCount == uniforms::MAX_VIEWS ? 2 : 1);
+    glNamedRenderbufferStorageMultisampleEXT(multisampleRenderbuffers[0], settings.msaaSamples, GL_RGBA8, multisampleWidth, settings.renderSize.y);
     glNamedFramebufferRenderbufferEXT(multisampleFramebuffer, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, multisampleRenderbuffers[0]);
-    glNamedRenderbufferStorageMultisampleEXT(multisampleRenderbuffers[1], settings.msaaSamples, GL_DEPTH_COMPONENT, settings.renderSize.x, settings.renderSize.y);
+    glNamedRenderbufferStorageMultisampleEXT(multisampleRenderbuffers[1], settings.msaaSamples, GL_DEPTH_COMPONENT, multisampleWidth, settings.renderSize.y);
     glNamedFramebufferRenderbufferEXT(multisampleFramebuffer, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, multisampleRenderbuffers[1]);
 
     multisampleFramebuffer.check_complete();
@@ -188,7 +196,7 @@ forward_renderer::forward_renderer(const renderer_settings & settings) : setting
     }
 
     shadow.reset(new StableCascadedShadowPass());
-    bloom.reset(new BloomPass(settings.renderSize));
+    bloom.reset(new BloomPass(settings.renderSize, settings.cameraCount));
 
     timer.start();
 }
@@ -202,7 +210,7 @@ void forward_renderer::render_frame(const scene_data & scene)
 {
     assert(settings.cameraCount == scene.views.size());
 
-    cpuProfiler.begin("renderloop");
+    PROFILE_CPU_SCOPE("renderloop");
 
     // Renderer default state
     glEnable(GL_CULL_FACE);
@@ -211,7 +219,6 @@ void forward_renderer::render_frame(const scene_data & scene)
 
     glBindBufferBase(GL_UNIFORM_BUFFER, uniforms::per_scene::binding, perScene);
     glBindBufferBase(GL_UNIFORM_BUFFER, uniforms::per_view::binding, perView);
-    glBindBufferBase(GL_UNIFORM_BUFFER, uniforms::per_object::binding, perObject);
 
     // Update per-scene uniform buffer
     uniforms::per_scene b = {};
@@ -232,7 +239,7 @@ void forward_renderer::render_frame(const scene_data & scene)
 
     if (settings.cameraCount == 2)
     {
-        cpuProfiler.begin("center-view");
+        PROFILE_CPU_SCOPE("center-view");
 
         // Take the mid-point between the eyes
         shadowAndCullingView.pose = Pose(scene.views[0].pose.orientation, (scene.views[0].pose.position + scene.views[1].pose.position) * 0.5f);
@@ -247,27 +254,8 @@ void forward_renderer::render_frame(const scene_data & scene)
         // Regenerate the view matrix and near/far clip planes
         shadowAndCullingView.viewMatrix = inverse(mul(shadowAndCullingView.pose.matrix(), make_translation_matrix(centerOffsetZ)));
         near_far_clip_from_projection(shadowAndCullingView.projectionMatrix, shadowAndCullingView.nearClip, shadowAndCullingView.farClip);
-        cpuProfiler.end("center-view");
     }
 
-    if (settings.shadowsEnabled)
-    {
-        gpuProfiler.begin("shadowpass");
-        run_shadow_pass(shadowAndCullingView, scene);
-        gpuProfiler.end("shadowpass");
-
-        for (int c = 0; c < uniforms::NUM_CASCADES; c++)
-        {
-            b.cascadesPlane[c] = float4(shadow->splitPlanes[c].x, shadow->splitPlanes[c].y, 0, 0);
-            b.cascadesMatrix[c] = shadow->shadowMatrices[c];
-            b.cascadesNear[c] = shadow->nearPlanes[c];
-            b.cascadesFar[c] = shadow->farPlanes[c];
-        }
-    }
-
-    // Per-scene can be uploaded now that the shadow pass has completed
-    perScene.set_buffer_data(sizeof(b), &b, GL_STREAM_DRAW);
-
     // We follow the sorting strategy outlined here: http://realtimecollisiondetection.net/blog/?p=86
     auto materialSortFunc = [shadowAndCullingView](Renderable * lhs, Renderable * rhs)
     {
@@ -279,6 +267,9 @@ void forward_renderer::render_frame(const scene_data & scene)
         auto rid = rhs->get_material()->id();
         if (lid != rid) return lid > rid;
 
+        // Keep instances of the same material contiguous so they can share a multi-draw
+        if (lhs->get_material() != rhs->get_material()) return lhs->get_material() > rhs->get_material();
+
         // Otherwise sort by distance
         return lDist < rDist;
     };
@@ -317,71 +308,157 @@ void forward_renderer::render_frame(const scene_data & scene)
         defaultRenderList.push_back(top);
     }
 
-    for (int camIdx = 0; camIdx < settings.cameraCount; ++camIdx)
+    // Stage per-object data and indirect commands for every pass once; all views share them
+    batcher.enabled = settings.useMultiDrawIndirect;
+    batcher.begin_frame(scene.renderSet);
+
+    // Casters are culled against each cascade's light-space volume; cascades that are still valid are not rebuilt
+    std::vector<std::vector<draw_item>> shadowDraws(uniforms::NUM_CASCADES);
+    if (settings.shadowsEnabled)
+    {
+        shadow->update_cascades(shadowAndCullingView.viewMatrix,
+            shadowAndCullingView.nearClip,
+            shadowAndCullingView.farClip,
+            aspect_from_projection(shadowAndCullingView.projectionMatrix),
+            vfov_from_projection(shadowAndCullingView.projectionMatrix),
+            scene.sunlight.direction);
+
+        std::vector<Renderable *> shadowCasters, cascadeCasters;
+        for (auto obj : scene.renderSet) if (obj->get_cast_shadow()) shadowCasters.push_back(obj);
+
+        for (int c = 0; c < uniforms::NUM_CASCADES; ++c)
+        {
+            scoped_cpu_zone zone(cascade_zone(c, false));
+            shadow->gather_casters(c, shadowCasters, cascadeCasters);
+            if (shadow->should_render_cascade(c)) shadowDraws[c] = batcher.build(cascadeCasters, false, true);
+        }
+    }
+
+    // Single-pass stereo draws every object once per eye through instancing
+    const bool singlePassStereo = settings.singlePassStereo && settings.cameraCount == uniforms::MAX_VIEWS;
+    const uint32_t viewInstances = singlePassStereo ? uniforms::MAX_VIEWS : 1;
+
+    const std::vector<draw_item> depthDraws = settings.useDepthPrepass ? batcher.build(scene.renderSet, false, true, viewInstances) : std::vector<draw_item>();
+    const std::vector<draw_item> materialDraws = batcher.build(materialRenderList, true, false, viewInstances);
+    const std::vector<draw_item> defaultDraws = batcher.build(defaultRenderList, false, false, viewInstances);
+    batcher.upload();
+
+    if (settings.shadowsEnabled)
     {
-        // Update per-view uniform buffer
+        {
+            PROFILE_GPU_SCOPE("shadowpass");
+            run_shadow_pass(shadowDraws, shadowAndCullingView, scene);
+        }
+
+        for (int c = 0; c < uniforms::NUM_CASCADES; c++)
+        {
+            b.cascadesPlane[c] = float4(shadow->splitPlanes[c].x, shadow->splitPlanes[c].y, 0, 0);
+            b.cascadesMatrix[c] = shadow->shadowMatrices[c];
+            b.cascadesNear[c] = shadow->nearPlanes[c];
+            b.cascadesFar[c] = shadow->farPlanes[c];
+        }
+    }
+
+    // Per-scene can be uploaded now that the shadow pass has completed
+    perScene.set_buffer_data(sizeof(b), &b, GL_STREAM_DRAW);
+
+    if (singlePassStereo)
+    {
+        // Both eyes are uploaded once and rendered side by side into the multisample target;
+        // each draw is instanced per eye and routed to the matching viewport by the vertex stage.
         uniforms::per_view v = {};
-        v.view = scene.views[camIdx].viewMatrix;
-        v.viewProj = scene.views[camIdx].viewProjMatrix;
-        v.eyePos = float4(scene.views[camIdx].pose.position, 1);
+        for (int camIdx = 0; camIdx < settings.cameraCount; ++camIdx) v.views[camIdx] = make_view_uniforms(scene.views[camIdx]);
         perView.set_buffer_data(sizeof(v), &v, GL_STREAM_DRAW);
 
-
-        // Render into multisampled fbo
         glEnable(GL_MULTISAMPLE);
         glBindFramebuffer(GL_DRAW_FRAMEBUFFER, multisampleFramebuffer);
-        glViewport(0, 0, settings.renderSize.x, settings.renderSize.y);
         glClearNamedFramebufferfv(multisampleFramebuffer, GL_COLOR, 0, &defaultColor[0]);
         glClearNamedFramebufferfv(multisampleFramebuffer, GL_DEPTH, 0, &defaultDepth);
 
-        // Execute the forward passes
-        if (settings.useDepthPrepass)
         {
-            gpuProfiler.begin("depth-prepass");
-            run_depth_prepass(scene.views[camIdx], scene);
-            gpuProfiler.end("depth-prepass");
+            PROFILE_GPU_SCOPE("forward pass");
+
+            // The skybox is a single non-instanced draw; render it into each half separately. It
+            // doesn't write depth, so it can go ahead of the prepass.
+            for (int camIdx = 0; camIdx < settings.cameraCount; ++camIdx)
+            {
+                glViewport(settings.renderSize.x * camIdx, 0, settings.renderSize.x, settings.renderSize.y);
+                run_skybox_pass(scene.views[camIdx], scene);
+            }
+
+            for (int camIdx = 0; camIdx < settings.cameraCount; ++camIdx)
+            {
+                glViewportIndexedf(camIdx, settings.renderSize.x * camIdx, 0, settings.renderSize.x, settings.renderSize.y);
+            }
+
+            if (settings.useDepthPrepass)
+            {
+                PROFILE_GPU_SCOPE("depth-prepass");
+                run_depth_prepass(depthDraws, scene.views[0], scene);
+            }
+
+            run_forward_pass(materialDraws, defaultDraws, scene.views[0], scene);
         }
 
-        gpuProfiler.begin("forward pass");
-        run_skybox_pass(scene.views[camIdx], scene);
-        run_forward_pass(materialRenderList, defaultRenderList, scene.views[camIdx], scene);
-        gpuProfiler.end("forward pass");
-
         glDisable(GL_MULTISAMPLE);
 
-        // Resolve multisample into per-view framebuffer
         {
-            gpuProfiler.begin("blit");
-
-            // blit color 
-            glBlitNamedFramebuffer(multisampleFramebuffer, eyeFramebuffers[camIdx],
-                0, 0, settings.renderSize.x, settings.renderSize.y, 0, 0,
-                settings.renderSize.x, settings.renderSize.y, GL_COLOR_BUFFER_BIT, GL_LINEAR);
-
-            // blit depth
-            glBlitNamedFramebuffer(multisampleFramebuffer, eyeFramebuffers[camIdx],
-                0, 0, settings.renderSize.x, settings.renderSize.y, 0, 0,
-                settings.renderSize.x, settings.renderSize.y, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
-
-            gpuProfiler.end("blit");
+            PROFILE_GPU_SCOPE("blit");
+            for (int camIdx = 0; camIdx < settings.cameraCount; ++camIdx) resolve_multisample(camIdx, settings.renderSize.x * camIdx);
         }
 
+        glViewport(0, 0, settings.renderSize.x, settings.renderSize.y);
+
         gl_check_error(__FILE__, __LINE__);
     }
-
-    // Execute the post passes after having resolved the multisample framebuffers
+    else
     {
-        gpuProfiler.begin("postprocess");
         for (int camIdx = 0; camIdx < settings.cameraCount; ++camIdx)
         {
-            run_post_pass(scene.views[camIdx], scene);
+            // Update per-view uniform buffer
+            uniforms::per_view v = {};
+            v.views[0] = make_view_uniforms(scene.views[camIdx]);
+            perView.set_buffer_data(sizeof(v), &v, GL_STREAM_DRAW);
+
+            // Render into multisampled fbo
+            glEnable(GL_MULTISAMPLE);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, multisampleFramebuffer);
+            glViewport(0, 0, settings.renderSize.x, settings.renderSize.y);
+            glClearNamedFramebufferfv(multisampleFramebuffer, GL_COLOR, 0, &defaultColor[0]);
+            glClearNamedFramebufferfv(multisampleFramebuffer, GL_DEPTH, 0, &defaultDepth);
+
+            // Execute the forward passes
+            if (settings.useDepthPrepass)
+            {
+                PROFILE_GPU_SCOPE("depth-prepass");
+                run_depth_prepass(depthDraws, scene.views[camIdx], scene);
+            }
+
+            {
+                PROFILE_GPU_SCOPE("forward pass");
+                run_skybox_pass(scene.views[camIdx], scene);
+                run_forward_pass(materialDraws, defaultDraws, scene.views[camIdx], scene);
+            }
+
+            glDisable(GL_MULTISAMPLE);
+
+            // Resolve multisample into per-view framebuffer
+            {
+                PROFILE_GPU_SCOPE("blit");
+                resolve_multisample(camIdx, 0);
+            }
+
+            gl_check_error(__FILE__, __LINE__);
         }
-        gpuProfiler.end("postprocess");
     }
 
-    glDisable(GL_FRAMEBUFFER_SRGB);
+    // Execute the post passes after having resolved the multisample framebuffers
+    {
+        PROFILE_GPU_SCOPE("postprocess");
+        run_post_pass(scene);
+    }
 
-    cpuProfiler.end("renderloop");
+    glDisable(GL_FRAMEBUFFER_SRGB);
 
     gl_check_error(__FILE__, __LINE__);
 }
\ No newline at end of file
@@ -14,6 +14,8 @@
 #include "gl-procedural-sky.hpp"
 
 #include "scene.hpp"
+#include "profiling.hpp"
+#include "static_mesh_batcher.hpp"
 #include "bloom_pass.hpp"
 #include "shadow_pass.hpp"
 
@@ -26,6 +28,8 @@ struct renderer_settings
     int msaaSamples = 4;
     bool performanceProfiling = true;
     bool useDepthPrepass = false;
+    bool useMultiDrawIndirect = true;
+    bool singlePassStereo = false;  // with two cameras; shaders must be built with SINGLE_PASS_STEREO
     bool bloomEnabled = true;
     bool shadowsEnabled = true;
 };
@@ -60,51 +64,15 @@ struct scene_data
     std::vector<view_data> views;
 };
 
-template<typename T>
-struct profiler
-{
-    struct data_point
-    {
-        CircularBuffer<double> average;
-        T timer;
-    };
-
-    std::unordered_map<std::string, data_point> dataPoints;
-
-    bool enabled{ true };
-    uint32_t numSamples;
-    profiler(uint32_t numSamplesToKeep = 5) : numSamples(numSamplesToKeep) { }
-
-    void set_enabled(bool newState) 
-    { 
-        enabled = newState;
-        dataPoints.clear();
-    }
-
-    void begin(const std::string & id)
-    { 
-        if (!enabled) return;
-        auto pt = dataPoints.insert({ id, {} });
-        if (pt.second == true) pt.first->second.average.resize(numSamples);
-        dataPoints[id].timer.start();
-    }
-
-    void end(const std::string & id) 
-    { 
-        if (!enabled) return;
-        dataPoints[id].timer.stop();
-        double t = dataPoints[id].timer.elapsed_ms();
-        if (t > 0) dataPoints[id].average.put(t);
-    }
-};
-
 class forward_renderer
 {
     SimpleTimer timer;
 
     GlBuffer perScene;
     GlBuffer perView;
-    GlBuffer perObject;
+
+    // Per-object data and multi-draw-indirect batches for static meshes
+    static_mesh_batcher batcher;
 
     // MSAA 
     GlRenderbuffer multisampleRenderbuffers[2];
@@ -120,20 +88,16 @@ class forward_renderer
 
     GlShaderHandle earlyZPass = { "depth-prepass" };
 
-    // Update per-object uniform buffer
-    void update_per_object_uniform_buffer(Renderable * top, const view_data & d);
-
-    void run_depth_prepass(const view_data & view, const scene_data & scene);
+    void run_depth_prepass(const std::vector<draw_item> & draws, const view_data & view, const scene_data & scene);
     void run_skybox_pass(const view_data & view, const scene_data & scene);
-    void run_shadow_pass(const view_data & view, const scene_data & scene);
-    void run_forward_pass(std::vector<Renderable *> & renderQueueMaterial, std::vector<Renderable *> & renderQueueDefault, const view_data & view, const scene_data & scene);
-    void run_post_pass(const view_data & view, const scene_data & scene);
+    void run_shadow_pass(const std::vector<std::vector<draw_item>> & cascadeDraws, const view_data & view, const scene_data & scene);
+    void run_forward_pass(const std::vector<draw_item> & materialDraws, const std::vector<draw_item> & defaultDraws, const view_data & view, const scene_data & scene);
+    void run_post_pass(const scene_data & scene);
+    void resolve_multisample(const uint32_t viewIndex, const int sourceX);
 
 public:
 
     renderer_settings settings;
-    profiler<SimpleTimer> cpuProfiler;
-    profiler<GlGpuTimer> gpuProfiler;
 
     forward_renderer(const renderer_settings & settings);
     ~forward_renderer();
@@ -154,6 +118,8 @@ template<class F> void visit_fields(forward_renderer & o, F f)
     f("render_size", o.settings.renderSize);
     f("performance_profiling", o.settings.performanceProfiling);
     f("depth_prepass", o.settings.useDepthPrepass);
+    f("multidraw_indirect", o.settings.useMultiDrawIndirect);
+    f("single_pass_stereo", o.settings.singlePassStereo);
     f("bloom_pass", o.settings.bloomEnabled);
     f("shadow_pass", o.settings.shadowsEnabled);
 };
@@ -0,0 +1,463 @@
+#pragma once
+
+#ifndef render_profiling_hpp
+#define render_profiling_hpp
+
+#include "util.hpp"
+#include "gl-api.hpp"
+#include "gl-async-gpu-timer.hpp"
+#include "spsc_bounded_queue.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+
+// Low-overhead hierarchical frame profiler.
+//
+// Zones are registered once (usually through a function-local static in the PROFILE_* macros) and
+// referred to by integer ID afterwards, so recording never hashes or allocates. Scopes may nest on
+// any thread: every thread appends completed events to its own lock-free buffer, and the thread that
+// calls `end_frame()` drains all of them. A buffer is handed back when its thread exits and reused by
+// the next thread that records, so thread churn does not grow the registry. GPU zones are bracketed with timestamps from a GlTimestampQueryPool,
+// read back `GpuLatency - 1` frames later and placed on the CPU timeline using a periodically calibrated
+// offset. A frame whose timestamps have not retired by then is dropped rather than waited on. The profiler
+// is a static, so apps that record GPU zones call `shutdown()` before destroying their GL context.
+//
+// Whether a scope records is decided when it opens: toggling `set_enabled` while scopes are open only
+// affects scopes opened afterwards.
+//
+// Per-zone totals are kept for the last `HistoryFrames` frames for percentile statistics, and a range
+// of frames can be captured and written out as Chrome trace JSON (chrome://tracing, Perfetto).
+
+struct profile_event
+{
+    uint64_t beginNs;
+    uint64_t endNs;
+    uint32_t zone;
+    uint16_t depth;
+    uint16_t thread;
+};
+
+struct profile_zone_summary
+{
+    uint32_t zone;
+    const char * name;
+    bool gpu;
+    double mean, p50, p95, p99, max; // milliseconds per frame
+};
+
+class frame_profiler
+{
+public:
+
+    static const size_t HistoryFrames = 256;
+    static const size_t ThreadBufferSize = 8192;    // events in flight per thread between two `end_frame` calls
+    static const size_t MaxDepth = 64;
+    static const uint16_t GpuThread = 0xFFFF;
+
+private:
+
+    static const uint32_t GpuLatency = 4;          // ring slots; timestamps are read back GpuLatency - 1 frames after issue
+    static const uint32_t MaxGpuZonesPerFrame = 256;
+
+    struct zone_info
+    {
+        std::string name;
+        bool gpu{ false };
+        double frameTotal{ 0 };
+        bool touched{ false };
+        std::vector<float> history = std::vector<float>(HistoryFrames);
+        size_t head{ 0 }, count{ 0 };
+    };
+
+    struct thread_buffer
+    {
+        SPSCBoundedQueue<profile_event> events{ ThreadBufferSize };
+        struct open_scope { uint64_t beginNs; uint32_t zone; } stack[MaxDepth];
+        uint32_t depth{ 0 };
+        uint16_t index{ 0 };
+    };
+
+    struct gpu_scope
+    {
+        uint32_t zone;
+        uint16_t depth;
+        uint32_t beginQuery, endQuery; // indices into the pool slot
+    };
+
+    std::atomic<bool> enabled{ true };
+
+    mutable std::mutex registryMutex;
+    std::vector<zone_info> zones;
+    std::vector<std::unique_ptr<thread_buffer>> threads;
+    std::vector<uint16_t> freeThreads;              // buffers of exited threads, by index
+
+    const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+    // GPU state, only touched from the GL thread
+    GlTimestampQueryPool gpuTimestamps{ MaxGpuZonesPerFrame * 2, GpuLatency };
+    std::vector<gpu_scope> gpuScopes[GpuLatency];   // per pool slot
+    std::vector<uint32_t> gpuStack;
+    int64_t gpuClockOffset{ 0 };
+    bool gpuCalibrated{ false };
+    uint64_t gpuFramesDropped{ 0 };
+
+    // Trace capture
+    std::vector<profile_event> captured;
+    std::string capturePath;
+    uint32_t captureFramesRemaining{ 0 };
+    uint32_t captureDrainFrames{ 0 };
+
+    // Returns the buffer to the free list when its thread exits. Events it still holds are drained by the
+    // next `end_frame` as usual; the hand-off under `registryMutex` orders them before the next owner's.
+    struct buffer_owner
+    {
+        thread_buffer * buffer{ nullptr };
+        ~buffer_owner() { if (buffer) get_instance().release_buffer(*buffer); }
+    };
+
+    // Null only if GpuThread - 1 threads are recording at once, in which case the scope is not recorded
+    thread_buffer * local_buffer()
+    {
+        thread_local buffer_owner owner;
+        if (!owner.buffer)
+        {
+            std::lock_guard<std::mutex> guard(registryMutex);
+            if (!freeThreads.empty())
+            {
+                owner.buffer = threads[freeThreads.back()].get();
+                freeThreads.pop_back();
+            }
+            else if (threads.size() < GpuThread)
+            {
+                threads.emplace_back(new thread_buffer());
+                owner.buffer = threads.back().get();
+                owner.buffer->index = static_cast<uint16_t>(threads.size() - 1);
+            }
+        }
+        return owner.buffer;
+    }
+
+    void release_buffer(thread_buffer & b)
+    {
+        std::lock_guard<std::mutex> guard(registryMutex);
+        b.depth = 0;
+        freeThreads.push_back(b.index);
+    }
+
+    void record(profile_event & e)
+    {
+        if (e.zone >= zones.size()) return;
+        zone_info & z = zones[e.zone];
+        z.frameTotal += (e.endNs - e.beginNs) * 1e-6;
+        z.touched = true;
+        if (captureFramesRemaining || captureDrainFrames) captured.push_back(e);
+    }
+
+    void calibrate_gpu_clock()
+    {
+        GLint64 gpuNow = 0;
+        glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+        gpuClockOffset = static_cast<int64_t>(now_ns()) - static_cast<int64_t>(gpuNow);
+    }
+
+    void resolve_gpu_slot(const uint32_t slot)
+    {
+        std::vector<gpu_scope> & scopes = gpuScopes[slot];
+        if (scopes.empty()) return;
+
+        if (!gpuTimestamps.ready(slot))
+        {
+            gpuFramesDropped++;
+            scopes.clear();
+            return;
+        }
+
+        for (auto & s : scopes)
+        {
+            if (s.endQuery == GlTimestampQueryPool::InvalidQuery) continue;
+
+            profile_event e;
+            e.beginNs = static_cast<uint64_t>(static_cast<int64_t>(gpuTimestamps.get(slot, s.beginQuery)) + gpuClockOffset);
+            e.endNs = static_cast<uint64_t>(static_cast<int64_t>(gpuTimestamps.get(slot, s.endQuery)) + gpuClockOffset);
+            e.zone = s.zone;
+            e.depth = s.depth;
+            e.thread = GpuThread;
+            record(e);
+        }
+        scopes.clear();
+    }
+
+    static std::string json_escape(const std::string & s)
+    {
+        std::string r;
+        r.reserve(s.size());
+        for (const char c : s)
+        {
+            switch (c)
+            {
+            case '"': r += "\\\""; break;
+            case '\\': r += "\\\\"; break;
+            case '\n': r += "\\n"; break;
+            case '\r': r += "\\r"; break;
+            case '\t': r += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20)
+                {
+                    char code[8];
+                    snprintf(code, sizeof(code), "\\u%04x", c);
+                    r += code;
+                }
+                else r += c;
+            }
+        }
+        return r;
+    }
+
+    bool write_chrome_trace(const std::string & path) const
+    {
+        std::ofstream file(path, std::ios::out | std::ios::trunc);
+        if (!file.is_open()) return false;
+
+        const uint64_t base = captured.size() ? std::min_element(captured.begin(), captured.end(), [](const profile_event & a, const profile_event & b) { return a.beginNs < b.beginNs; })->beginNs : 0;
+
+        file << "{\"traceEvents\":[\n";
+        file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << GpuThread << ",\"args\":{\"name\":\"GPU\"}}";
+        for (size_t t = 0; t < threads.size(); ++t)
+        {
+            file << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << t << ",\"args\":{\"name\":\"" << (t == 0 ? "Main" : "Worker " + std::to_string(t)) << "\"}}";
+        }
+        for (auto & e : captured)
+        {
+            file << ",\n{\"name\":\"" << json_escape(zones[e.zone].name) << "\",\"cat\":\"" << (zones[e.zone].gpu ? "gpu" : "cpu") << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << e.thread
+                 << ",\"ts\":" << (e.beginNs - base) * 1e-3 << ",\"dur\":" << (e.endNs - e.beginNs) * 1e-3 << "}";
+        }
+        file << "\n]}\n";
+        return true;
+    }
+
+    frame_profiler() {}
+
+public:
+
+    static frame_profiler & get_instance()
+    {
+        static frame_profiler instance;
+        return instance;
+    }
+
+    uint64_t now_ns() const
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    // Returns a stable ID for `name`. Call once per zone and keep the result.
+    uint32_t register_zone(const char * name, const bool gpu = false)
+    {
+        std::lock_guard<std::mutex> guard(registryMutex);
+        for (uint32_t i = 0; i < zones.size(); ++i) if (zones[i].gpu == gpu && zones[i].name == name) return i;
+        zones.emplace_back();
+        zones.back().name = name;
+        zones.back().gpu = gpu;
+        return static_cast<uint32_t>(zones.size() - 1);
+    }
+
+    // Number of per-thread event buffers, which is the most threads that have recorded at the same time
+    size_t thread_buffer_count() const
+    {
+        std::lock_guard<std::mutex> guard(registryMutex);
+        return threads.size();
+    }
+
+    void set_enabled(const bool newState) { enabled = newState; }
+    bool is_enabled() const { return enabled; }
+
+    // Returns whether the scope is recorded; `end_cpu` must be called if and only if it is
+    bool begin_cpu(const uint32_t zone)
+    {
+        if (!enabled) return false;
+        thread_buffer * b = local_buffer();
+        if (!b) return false;
+        if (b->depth < MaxDepth) b->stack[b->depth] = { now_ns(), zone };
+        b->depth++;
+        return true;
+    }
+
+    void end_cpu(const uint32_t zone)
+    {
+        thread_buffer & b = *local_buffer(); // non-null: `begin_cpu` succeeded on this thread
+        if (b.depth == 0) return;
+        b.depth--;
+        if (b.depth >= MaxDepth) return;
+
+        assert(b.stack[b.depth].zone == zone); // scopes must be closed in reverse order
+        profile_event e = { b.stack[b.depth].beginNs, now_ns(), zone, static_cast<uint16_t>(b.depth), b.index };
+        b.events.produce(e); // dropped if the buffer is full
+    }
+
+    // GPU zones may only be opened from the thread that owns the GL context. Same contract as `begin_cpu`.
+    bool begin_gpu(const uint32_t zone)
+    {
+        if (!enabled) return false;
+        if (!gpuCalibrated) { calibrate_gpu_clock(); gpuCalibrated = true; }
+
+        const uint32_t query = gpuTimestamps.timestamp();
+        if (query == GlTimestampQueryPool::InvalidQuery) { gpuStack.push_back(UINT32_MAX); return true; }
+
+        std::vector<gpu_scope> & scopes = gpuScopes[gpuTimestamps.current_slot()];
+        gpuStack.push_back(static_cast<uint32_t>(scopes.size()));
+        scopes.push_back({ zone, static_cast<uint16_t>(gpuStack.size() - 1), query, GlTimestampQueryPool::InvalidQuery });
+        return true;
+    }
+
+    void end_gpu(const uint32_t zone)
+    {
+        if (gpuStack.empty()) return;
+        const uint32_t idx = gpuStack.back();
+        gpuStack.pop_back();
+        if (idx == UINT32_MAX) return;
+
+        gpu_scope & s = gpuScopes[gpuTimestamps.current_slot()][idx];
+        assert(s.zone == zone);
+        s.endQuery = gpuTimestamps.timestamp();
+    }
+
+    // Call once per frame on the GL thread, after all zones of the frame have been closed
+    void end_frame()
+    {
+        // Registration may happen concurrently on other threads
+        std::lock_guard<std::mutex> guard(registryMutex);
+
+        // Drain every thread's events
+        profile_event e;
+        for (auto & t : threads) while (t->events.consume(e)) record(e);
+
+        // Read back the slot that is about to be reused, then hand it to the next frame
+        if (gpuCalibrated)
+        {
+            resolve_gpu_slot(gpuTimestamps.oldest_slot());
+            if (gpuTimestamps.frame_index() % 120 == 0) calibrate_gpu_clock();
+        }
+        gpuTimestamps.advance();
+
+        for (auto & z : zones)
+        {
+            if (!z.touched) continue;
+            z.history[z.head] = static_cast<float>(z.frameTotal);
+            z.head = (z.head + 1) % HistoryFrames;
+            z.count = std::min(z.count + 1, HistoryFrames);
+            z.frameTotal = 0;
+            z.touched = false;
+        }
+
+        if (captureFramesRemaining)
+        {
+            // Keep recording until the GPU events of the last captured frame have been resolved
+            if (--captureFramesRemaining == 0) captureDrainFrames = GpuLatency;
+        }
+        else if (captureDrainFrames && --captureDrainFrames == 0)
+        {
+            write_chrome_trace(capturePath);
+            captured.clear();
+        }
+    }
+
+    // Releases the GPU queries and discards unresolved GPU zones. Call on the GL thread, with no GPU zones open,
+    // before the context is destroyed; recording may resume afterwards on a new context.
+    void shutdown()
+    {
+        std::lock_guard<std::mutex> guard(registryMutex);
+        assert(gpuStack.empty());
+        gpuTimestamps.shutdown();
+        for (auto & scopes : gpuScopes) scopes.clear();
+        gpuCalibrated = false;
+    }
+
+    // Records all events of the next `numFrames` frames and writes them to `path` as Chrome trace JSON
+    void capture_chrome_trace(const std::string & path, const uint32_t numFrames)
+    {
+        if (capture_in_progress()) return;
+        captured.clear();
+        capturePath = path;
+        captureFramesRemaining = std::max(numFrames, 1u);
+    }
+
+    bool capture_in_progress() const { return captureFramesRemaining || captureDrainFrames; }
+
+    // Number of frames whose GPU timestamps had not retired in time and were discarded
+    uint64_t gpu_frames_dropped() const { return gpuFramesDropped; }
+
+    // Per-frame totals over the history window. Only zones that have been hit are reported.
+    std::vector<profile_zone_summary> summarize() const
+    {
+        std::lock_guard<std::mutex> guard(registryMutex);
+        std::vector<profile_zone_summary> result;
+        std::vector<float> sorted;
+        for (uint32_t i = 0; i < zones.size(); ++i)
+        {
+            const zone_info & z = zones[i];
+            if (!z.count) continue;
+            sorted.assign(z.history.begin(), z.history.begin() + z.count);
+            std::sort(sorted.begin(), sorted.end());
+
+            double sum = 0;
+            for (auto v : sorted) sum += v;
+            auto percentile = [&](const double p) { return (double) sorted[std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()))]; };
+
+            result.push_back({ i, z.name.c_str(), z.gpu, sum / sorted.size(), percentile(0.50), percentile(0.95), percentile(0.99), (double) sorted.back() });
+        }
+        return result;
+    }
+
+    // Distribution of per-frame totals for `zone` over the history window, in `numBins` buckets spanning [0, maxMs]
+    std::vector<float> histogram(const uint32_t zone, const uint32_t numBins, float & maxMs) const
+    {
+        std::lock_guard<std::mutex> guard(registryMutex);
+        std::vector<float> bins(numBins, 0.f);
+        maxMs = 0.f;
+        if (zone >= zones.size() || numBins == 0) return bins;
+
+        const zone_info & z = zones[zone];
+        for (size_t i = 0; i < z.count; ++i) maxMs = std::max(maxMs, z.history[i]);
+        if (maxMs <= 0.f) return bins;
+
+        for (size_t i = 0; i < z.count; ++i) bins[std::min(numBins - 1, static_cast<uint32_t>(z.history[i] / maxMs * numBins))] += 1.f;
+        return bins;
+    }
+};
+
+struct scoped_cpu_zone
+{
+    const uint32_t zone;
+    const bool active;
+    scoped_cpu_zone(const uint32_t z) : zone(z), active(frame_profiler::get_instance().begin_cpu(z)) { }
+    ~scoped_cpu_zone() { if (active) frame_profiler::get_instance().end_cpu(zone); }
+};
+
+struct scoped_gpu_zone
+{
+    const uint32_t zone;
+    const bool active;
+    scoped_gpu_zone(const uint32_t z) : zone(z), active(frame_profiler::get_instance().begin_gpu(z)) { }
+    ~scoped_gpu_zone() { if (active) frame_profiler::get_instance().end_gpu(zone); }
+};
+
+#define PROFILE_CONCAT_IMPL(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_IMPL(a, b)
+
+// Scoped zones with an ID registered the first time the line executes
+#define PROFILE_CPU_SCOPE(name) \
+    static const uint32_t PROFILE_CONCAT(profileZone_, __LINE__) = frame_profiler::get_instance().register_zone(name, false); \
+    scoped_cpu_zone PROFILE_CONCAT(profileScope_, __LINE__)(PROFILE_CONCAT(profileZone_, __LINE__))
+
+#define PROFILE_GPU_SCOPE(name) \
+    static const uint32_t PROFILE_CONCAT(profileZone_, __LINE__) = frame_profiler::get_instance().register_zone(name, true); \
+    scoped_gpu_zone PROFILE_CONCAT(profileScope_, __LINE__)(PROFILE_CONCAT(profileZone_, __LINE__))
+
+#endif // end render_profiling_hpp
@@ -73,6 +73,11 @@ struct Renderable : public GameObject
     bool get_cast_shadow() const { return cast_shadow; }
 
     virtual void draw() const {};
+
+    // Used for single-pass stereo, where shaders pick the view from gl_InstanceID, so all `instances`
+    // must come from one instanced draw. Pure virtual: a type that draws but doesn't instance would
+    // silently render the left eye only.
+    virtual void draw_instanced(const uint32_t instances) const = 0;
 };
 
 struct PointLight final : public Renderable
@@ -97,6 +102,11 @@ struct PointLight final : public Renderable
 
     }
 
+    void draw_instanced(const uint32_t instances) const override
+    {
+
+    }
+
     Bounds3D get_world_bounds() const override
     {
         const Bounds3D local = get_bounds();
@@ -144,6 +154,11 @@ struct DirectionalLight final : public Renderable
 
     }
 
+    void draw_instanced(const uint32_t instances) const override
+    {
+
+    }
+
     Bounds3D get_world_bounds() const override
     {
         const Bounds3D local = get_bounds();
@@ -178,6 +193,11 @@ struct StaticMesh final : public Renderable
         mesh.get().draw_elements();
     }
 
+    void draw_instanced(const uint32_t instances) const override
+    {
+        mesh.get().draw_elements(instances);
+    }
+
     void update(const float & dt) override { }
 
     Bounds3D get_world_bounds() const override
@@ -215,6 +235,7 @@ struct PhysicsMesh final : public Renderable
     Bounds3D get_bounds() const override { return Bounds3D(); }
     Bounds3D get_world_bounds() const override { return Bounds3D(); }
     RaycastResult raycast(const Ray & worldRay) const override { return{ false, -FLT_MAX,{ 0,0,0 } }; }
+    void draw_instanced(const uint32_t instances) const override { }
 };
 
 struct VRController final : public Renderable
@@ -227,6 +248,7 @@ struct VRController final : public Renderable
     Bounds3D get_bounds() const override { return Bounds3D(); }
     Bounds3D get_world_bounds() const override { return Bounds3D(); }
     RaycastResult raycast(const Ray & worldRay) const override { return{ false, -FLT_MAX,{ 0,0,0 } }; }
+    void draw_instanced(const uint32_t instances) const override { }
 };
 
 struct TeleportDestination final : public Renderable
@@ -239,6 +261,7 @@ struct TeleportDestination final : public Renderable
     Bounds3D get_bounds() const override { return Bounds3D(); }
     Bounds3D get_world_bounds() const override { return Bounds3D(); }
     RaycastResult raycast(const Ray & worldRay) const override { return{ false, -FLT_MAX,{ 0,0,0 } }; }
+    void draw_instanced(const uint32_t instances) const override { }
 };
 
 struct Reticle final : public Renderable
@@ -251,6 +274,7 @@ struct Reticle final : public Renderable
     Bounds3D get_bounds() const override { return Bounds3D(); }
     Bounds3D get_world_bounds() const override { return Bounds3D(); }
     RaycastResult raycast(const Ray & worldRay) const override { return{ false, -FLT_MAX,{ 0,0,0 } }; }
+    void draw_instanced(const uint32_t instances) const override { }
 };
 
 struct TexturedQuad final : public Renderable
@@ -263,6 +287,7 @@ struct TexturedQuad final : public Renderable
     Bounds3D get_bounds() const override { return Bounds3D(); }
     Bounds3D get_world_bounds() const override { return Bounds3D(); }
     RaycastResult raycast(const Ray & worldRay) const override { return{ false, -FLT_MAX,{ 0,0,0 } }; }
+    void draw_instanced(const uint32_t instances) const override { }
 };
 
 struct WorldAnchor final : public GameObject
@@ -9,6 +9,7 @@
 #include "gl-imgui.hpp"
 #include "file_io.hpp"
 #include "procedural_mesh.hpp"
+#include "scene.hpp"
 
 #undef near
 #undef far
@@ -22,13 +23,13 @@
 
 /*
  * To Do - 3.25.2017
- * [ ] Set shadow map resolution at runtime (default 1024^2)
+ * [X] Set shadow map resolution at runtime (default 1024^2)
  * [X] Set number of cascades used at compile time (default 4)
  * [X] Configurable filtering modes (ESM, PCF, PCSS + PCF)
  * [ ] Experiment with Moment Shadow Maps
  * [ ] Frustum depth-split is a good candidate for compute shader experimentation (default far-near/4)
  * [ ] Blending / overlap between cascades
- * [ ] Performance profiling
+ * [X] Performance profiling
  */
 
 using namespace avl;
@@ -36,7 +37,7 @@ using namespace avl;
 struct StableCascadedShadowPass
 {
     GlTexture3D shadowArrayDepth;
-    GlFramebuffer shadowArrayFramebuffer;
+    GlFramebuffer cascadeFramebuffers[uniforms::NUM_CASCADES]; // one per layer of the array
 
     std::vector<float4x4> viewMatrices;
     std::vector<float4x4> projMatrices;
@@ -49,24 +50,35 @@ struct StableCascadedShadowPass
     float resolution = 2048; // shadowmap resolution
     float splitLambda = 0.25f;  // frustum split constant
 
+    // Cascades past the first are only re-rendered every N frames, or earlier if the casters inside them
+    // change, the light moves, or the camera leaves the area the cached map covers. The padding enlarges
+    // cached cascades so the camera can move for a while before a refresh is forced.
+    int farCascadeUpdateInterval = 1;
+    float cachedCascadePadding = 0.15f;
+
     GlShaderHandle program = { "cascaded-shadows" };
 
     StableCascadedShadowPass()
     {
-        shadowArrayDepth.setup(GL_TEXTURE_2D_ARRAY, resolution, resolution, uniforms::NUM_CASCADES, GL_DEPTH_COMPONENT, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
-        glNamedFramebufferTextureEXT(shadowArrayFramebuffer, GL_DEPTH_ATTACHMENT, shadowArrayDepth, 0);
-        shadowArrayFramebuffer.check_complete();
-        gl_check_error(__FILE__, __LINE__);
+        viewMatrices.resize(uniforms::NUM_CASCADES);
+        projMatrices.resize(uniforms::NUM_CASCADES);
+        shadowMatrices.resize(uniforms::NUM_CASCADES);
+        splitPlanes.resize(uniforms::NUM_CASCADES);
+        nearPlanes.resize(uniforms::NUM_CASCADES);
+        farPlanes.resize(uniforms::NUM_CASCADES);
+        allocate();
     }
 
     void update_cascades(const float4x4 view, const float near, const float far, const float aspectRatio, const float vfov, const float3 lightDir)
     {
-        nearPlanes.clear();
-        farPlanes.clear();
-        splitPlanes.clear();
-        viewMatrices.clear();
-        projMatrices.clear();
-        shadowMatrices.clear();
+        if (resolution != allocatedResolution) allocate();
+        if (lightDir != lastLightDir) for (auto & r : renderCascade) r = true;
+        lastLightDir = lightDir;
+        frameIndex++;
+
+        // The corners of each split are found in view space and brought to world space with a single inverse
+        const float4x4 inverseView = inverse(view);
+        const float tanHalfFov = std::tan(vfov * 0.5f);
 
         for (size_t C = 0; C < uniforms::NUM_CASCADES; ++C)
         {
@@ -81,27 +93,21 @@ struct StableCascadedShadowPass
             const float splitFar = C < splitIdx - 1 ? mix(near + (static_cast<float>(C + 1) / splitIdx) * (far - near),
                 near * pow(far / near, static_cast<float>(C + 1) / splitIdx), splitLambda) : far;
 
-            const float4x4 splitProjectionMatrix = make_projection_matrix(vfov, aspectRatio, splitNear, splitFar);
-
             // Extract the frustum points
-            float4 splitFrustumVerts[8] = {
-                { -1.f, -1.f, -1.f, 1.f }, // Near plane
-                { -1.f,  1.f, -1.f, 1.f },
-                { +1.f,  1.f, -1.f, 1.f },
-                { +1.f, -1.f, -1.f, 1.f },
-                { -1.f, -1.f,  1.f, 1.f }, // Far plane
-                { -1.f,  1.f,  1.f, 1.f },
-                { +1.f,  1.f,  1.f, 1.f },
-                { +1.f, -1.f,  1.f, 1.f }
-            };
-
-            for (unsigned int j = 0; j < 8; ++j)
+            float3 splitFrustumVerts[8];
+            const float splitDistances[2] = { splitNear, splitFar };
+            for (int p = 0; p < 2; ++p)
             {
-                splitFrustumVerts[j] = float4(transform_coord(inverse(mul(splitProjectionMatrix, view)), splitFrustumVerts[j].xyz()), 1);
+                const float halfHeight = splitDistances[p] * tanHalfFov;
+                const float halfWidth = halfHeight * aspectRatio;
+                splitFrustumVerts[p * 4 + 0] = transform_coord(inverseView, float3(-halfWidth, -halfHeight, -splitDistances[p]));
+                splitFrustumVerts[p * 4 + 1] = transform_coord(inverseView, float3(-halfWidth, +halfHeight, -splitDistances[p]));
+                splitFrustumVerts[p * 4 + 2] = transform_coord(inverseView, float3(+halfWidth, +halfHeight, -splitDistances[p]));
+                splitFrustumVerts[p * 4 + 3] = transform_coord(inverseView, float3(+halfWidth, -halfHeight, -splitDistances[p]));
             }
 
             float3 frustumCentroid = float3(0, 0, 0);
-            for (size_t i = 0; i < 8; ++i) frustumCentroid += splitFrustumVerts[i].xyz();
+            for (size_t i = 0; i < 8; ++i) frustumCentroid += splitFrustumVerts[i];
             frustumCentroid /= 8.0f;
 
             // Calculate the radius of a bounding sphere surrounding the frustum corners in worldspace
@@ -109,10 +115,25 @@ struct StableCascadedShadowPass
             float sphereRadius = 0.0f;
             for (int i = 0; i < 8; ++i)
             {
-                float dist = length(splitFrustumVerts[i].xyz() - frustumCentroid) * 1.0;
+                float dist = length(splitFrustumVerts[i] - frustumCentroid) * 1.0;
                 sphereRadius = std::max(sphereRadius, dist);
             }
-                
+
+            const int updateInterval = C > 0 ? std::max(farCascadeUpdateInterval, 1) : 1;
+
+            if (updateInterval > 1 && !renderCascade[C])
+            {
+                // Keep the cached cascade while the current split still fits inside the region it covers
+                const float3 p = transform_coord(viewMatrices[C], frustumCentroid);
+                const float R = -nearPlanes[C];
+                const bool covered = std::abs(p.x) + sphereRadius <= R && std::abs(p.y) + sphereRadius <= R && p.z + sphereRadius <= 0.f && p.z - sphereRadius >= -2.f * R;
+                if (covered && frameIndex - lastRendered[C] < (uint64_t) updateInterval) continue;
+            }
+
+            renderCascade[C] = true;
+            lastRendered[C] = frameIndex;
+
+            if (updateInterval > 1) sphereRadius *= (1.0f + cachedCascadePadding);
             sphereRadius = (std::ceil(sphereRadius * 8.0f) / 8.0f);
 
             const float3 maxExtents = float3(sphereRadius, sphereRadius, sphereRadius);
@@ -137,16 +158,50 @@ struct StableCascadedShadowPass
   
             const float4x4 theShadowMatrix = mul(shadowProjectionMatrix, splitViewMatrix);
 
-            viewMatrices.push_back(splitViewMatrix);
-            projMatrices.push_back(shadowProjectionMatrix);
-            shadowMatrices.push_back(theShadowMatrix);
-            splitPlanes.push_back(float2(splitNear, splitFar));
-            nearPlanes.push_back(-maxExtents.z);
-            farPlanes.push_back(-minExtents.z);
+            viewMatrices[C] = splitViewMatrix;
+            projMatrices[C] = shadowProjectionMatrix;
+            shadowMatrices[C] = theShadowMatrix;
+            splitPlanes[C] = float2(splitNear, splitFar);
+            nearPlanes[C] = -maxExtents.z;
+            farPlanes[C] = -minExtents.z;
         }
+    }
+
+    // Collects the casters overlapping the light-space volume of cascade `c`. A cached cascade is
+    // scheduled for rendering if the set of casters inside it, or any of their transforms, changed.
+    void gather_casters(const size_t c, const std::vector<Renderable *> & casters, std::vector<Renderable *> & visible)
+    {
+        visible.clear();
+
+        const Frustum cascadeFrustum(shadowMatrices[c]);
+
+        uint64_t signature = 14695981039346656037ull;
+        for (Renderable * r : casters)
+        {
+            const float4x4 modelMatrix = mul(r->get_pose().matrix(), make_scaling_matrix(r->get_scale()));
+            const Bounds3D localBounds = r->get_bounds();
 
+            // Objects without meaningful bounds are never culled
+            if (localBounds.volume() > 0.f)
+            {
+                const float3 scale = abs(r->get_scale());
+                const float radius = length(localBounds.size() * 0.5f) * std::max(scale.x, std::max(scale.y, scale.z));
+                if (!cascadeFrustum.intersects(transform_coord(modelMatrix, localBounds.center()), radius)) continue;
+            }
+
+            visible.push_back(r);
+
+            const uintptr_t address = reinterpret_cast<uintptr_t>(r);
+            signature = hash_bytes(signature, &address, sizeof(address));
+            signature = hash_bytes(signature, &modelMatrix, sizeof(modelMatrix));
+        }
+
+        if (signature != casterSignatures[c]) renderCascade[c] = true;
+        casterSignatures[c] = signature;
     }
 
+    bool should_render_cascade(const size_t c) const { return renderCascade[c]; }
+
     void pre_draw()
     {
         glEnable(GL_DEPTH_TEST);
@@ -154,14 +209,22 @@ struct StableCascadedShadowPass
         glEnable(GL_CULL_FACE);
         glCullFace(GL_FRONT);
 
-        glBindFramebuffer(GL_FRAMEBUFFER, shadowArrayFramebuffer);
         glViewport(0, 0, resolution, resolution);
+
+        program.get().bind();
+    }
+
+    // Targets a single layer of the cascade array; casters are only drawn into the cascades they overlap
+    void begin_cascade(const size_t c)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, cascadeFramebuffers[c]);
         glClear(GL_DEPTH_BUFFER_BIT);
+        program.get().uniform("u_cascadeViewProjMatrix", shadowMatrices[c]);
+    }
 
-        auto & shader = program.get();
-        shader.bind();
-        shader.uniform("u_cascadeViewMatrixArray", uniforms::NUM_CASCADES, viewMatrices);
-        shader.uniform("u_cascadeProjMatrixArray", uniforms::NUM_CASCADES, projMatrices);
+    void end_cascade(const size_t c)
+    {
+        renderCascade[c] = false;
     }
 
     void post_draw()
@@ -174,12 +237,44 @@ struct StableCascadedShadowPass
     }
 
     GLuint get_output_texture() const { return shadowArrayDepth.id(); }
+
+private:
+
+    float allocatedResolution = 0;
+    float3 lastLightDir = { 0, 0, 0 };
+    uint64_t frameIndex = 0;
+    uint64_t lastRendered[uniforms::NUM_CASCADES] = {};
+    uint64_t casterSignatures[uniforms::NUM_CASCADES] = {};
+    bool renderCascade[uniforms::NUM_CASCADES] = {};
+
+    static uint64_t hash_bytes(uint64_t hash, const void * data, const size_t size)
+    {
+        const uint8_t * bytes = static_cast<const uint8_t *>(data);
+        for (size_t i = 0; i < size; ++i) hash = (hash ^ bytes[i]) * 1099511628211ull;
+        return hash;
+    }
+
+    // (Re)creates the depth array at the current resolution and invalidates every cascade
+    void allocate()
+    {
+        shadowArrayDepth.setup(GL_TEXTURE_2D_ARRAY, resolution, resolution, uniforms::NUM_CASCADES, GL_DEPTH_COMPONENT, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+        for (int c = 0; c < uniforms::NUM_CASCADES; ++c)
+        {
+            glNamedFramebufferTextureLayerEXT(cascadeFramebuffers[c], GL_DEPTH_ATTACHMENT, shadowArrayDepth, 0, c);
+            cascadeFramebuffers[c].check_complete();
+            renderCascade[c] = true;
+        }
+        allocatedResolution = resolution;
+        gl_check_error(__FILE__, __LINE__);
+    }
 };
 
 template<class F> void visit_fields(StableCascadedShadowPass & o, F f)
 {
     f("shadowmap_resolution", o.resolution);
     f("cascade_split", o.splitLambda, range_metadata<float>{ 0.1f, 1.0f });
+    f("far_cascade_update_interval", o.farCascadeUpdateInterval, range_metadata<int>{ 1, 16 });
+    f("cached_cascade_padding", o.cachedCascadePadding, range_metadata<float>{ 0.0f, 1.0f });
 }
 
 #endif // end shadow_pass_hpp
@@ -0,0 +1,361 @@
+#pragma once
+
+#ifndef static_mesh_batcher_hpp
+#define static_mesh_batcher_hpp
+
+#include "util.hpp"
+#include "gl-api.hpp"
+#include "uniforms.hpp"
+#include "scene.hpp"
+
+#include <unordered_map>
+#include <algorithm>
+
+// Packs the geometry of StaticMesh objects that share a vertex format into shared vertex/index
+// buffers so that runs of objects can be submitted with a single glMultiDrawElementsIndirect.
+// Per-object data for every pass is staged into one shader storage buffer per frame which the
+// shaders index with gl_DrawIDARB. Objects that can't be batched are drawn individually against
+// a single-element range of the same buffer, so both paths share the same shader programs.
+
+using namespace avl;
+
+struct draw_item
+{
+    Renderable * renderable{ nullptr };     // first object of the run, provides the material
+    const GlMesh * batch{ nullptr };        // shared mesh for the run, or nullptr to call `renderable->draw()`
+    GLintptr objectOffset{ 0 };             // range of the per-object storage buffer
+    GLsizeiptr objectSize{ 0 };
+    GLintptr commandOffset{ 0 };            // range of the indirect command buffer
+    GLsizei drawCount{ 0 };
+    uint32_t instanceCount{ 1 };            // > 1 for single-pass stereo, one instance per view
+};
+
+class static_mesh_batcher
+{
+    enum attribute_bits : uint32_t
+    {
+        ATTRIB_NORMAL       = 1 << 0,
+        ATTRIB_COLOR        = 1 << 1,
+        ATTRIB_TEXCOORD     = 1 << 2,
+        ATTRIB_TANGENT      = 1 << 3,
+        ATTRIB_BITANGENT    = 1 << 4
+    };
+
+    struct format_batch
+    {
+        GlMesh mesh;
+        std::vector<const GlMesh *> sources;    // in packing order
+        bool dirty{ true };
+    };
+
+    // Identifies the contents of a source mesh as of its last packing: a reassigned asset keeps its address
+    // but gets new buffers, and an in-place upload bumps the buffer's revision
+    struct source_version
+    {
+        GLuint vertexBuffer{ 0 }, indexBuffer{ 0 };
+        uint32_t vertexRevision{ 0 }, indexRevision{ 0 };
+        bool operator == (const source_version & r) const
+        {
+            return vertexBuffer == r.vertexBuffer && indexBuffer == r.indexBuffer && vertexRevision == r.vertexRevision && indexRevision == r.indexRevision;
+        }
+    };
+
+    struct mesh_range
+    {
+        uint32_t format{ 0 };
+        source_version version;
+        GLuint firstIndex{ 0 };
+        GLuint indexCount{ 0 };
+        GLint baseVertex{ 0 };
+    };
+
+    // Meshes are owned by the asset table, so their addresses are stable for the life of the program
+    std::unordered_map<uint32_t, format_batch> formats;
+    std::unordered_map<const GlMesh *, mesh_range> ranges;
+
+    std::vector<uint8_t> objectData;
+    std::vector<GlDrawElementsIndirectCommand> commands;
+    std::vector<std::pair<uint32_t, Renderable *>> scratch;
+    std::vector<Renderable *> sorted;
+
+    GlBuffer objectBuffer;
+    GlBuffer commandBuffer;
+    GLint storageAlignment{ 0 };
+
+    static_assert(sizeof(uniforms::per_object) % 16 == 0, "per_object must match the std430 array stride");
+
+    // Matches the interleaved layout produced by `make_mesh_from_geometry`
+    static GLsizei attribute_components(const uint32_t format)
+    {
+        GLsizei components = 3;
+        if (format & ATTRIB_NORMAL) components += 3;
+        if (format & ATTRIB_COLOR) components += 3;
+        if (format & ATTRIB_TEXCOORD) components += 2;
+        if (format & ATTRIB_TANGENT) components += 3;
+        if (format & ATTRIB_BITANGENT) components += 3;
+        return components;
+    }
+
+    static uint32_t attribute_format(const Geometry & g)
+    {
+        uint32_t format = 0;
+        if (g.normals.size()) format |= ATTRIB_NORMAL;
+        if (g.colors.size()) format |= ATTRIB_COLOR;
+        if (g.texcoord0.size()) format |= ATTRIB_TEXCOORD;
+        if (g.tangents.size()) format |= ATTRIB_TANGENT;
+        if (g.bitangents.size()) format |= ATTRIB_BITANGENT;
+        return format;
+    }
+
+    static source_version version_of(const GlMesh & mesh)
+    {
+        source_version v;
+        v.vertexBuffer = mesh.get_vertex_data_buffer().id();
+        v.indexBuffer = mesh.get_index_data_buffer().id();
+        v.vertexRevision = mesh.get_vertex_data_buffer().revision;
+        v.indexRevision = mesh.get_index_data_buffer().revision;
+        return v;
+    }
+
+    // Takes a mesh out of its batch, e.g. after a reassignment changed its format or made it unbatchable
+    void remove_range(const GlMesh * mesh)
+    {
+        auto it = ranges.find(mesh);
+        if (it == ranges.end()) return;
+        format_batch & batch = formats[it->second.format];
+        batch.sources.erase(std::remove(batch.sources.begin(), batch.sources.end(), mesh), batch.sources.end());
+        batch.dirty = true;
+        ranges.erase(it);
+    }
+
+    // Returns nullptr if the object must be drawn individually. New and changed meshes are (re)validated and
+    // mark their batch dirty; the batch is repacked by the next `begin_frame`.
+    const mesh_range * find_range(Renderable * r)
+    {
+        auto * sm = dynamic_cast<StaticMesh *>(r);
+        if (!sm || !sm->mesh.assigned() || !sm->geom.assigned()) return nullptr;
+
+        const GlMesh & mesh = sm->mesh.get();
+        const source_version version = version_of(mesh);
+
+        auto it = ranges.find(&mesh);
+        if (it != ranges.end() && it->second.version == version) return &it->second;
+
+        // New, reassigned or re-uploaded: the format and stride may have changed along with the data
+        const uint32_t format = attribute_format(sm->geom.get());
+        const GLsizei stride = attribute_components(format) * sizeof(float);
+        const bool batchable = mesh.get_draw_mode() == GL_TRIANGLES && mesh.get_index_type() == GL_UNSIGNED_INT && mesh.get_index_count()
+            && mesh.get_vertex_stride() == stride && mesh.get_vertex_data_buffer().size % stride == 0;
+
+        if (it != ranges.end() && (!batchable || it->second.format != format))
+        {
+            remove_range(&mesh);
+            it = ranges.end();
+        }
+        if (!batchable) return nullptr;
+
+        auto & batch = formats[format];
+        batch.dirty = true;
+        if (it == ranges.end())
+        {
+            batch.sources.push_back(&mesh);
+            it = ranges.emplace(&mesh, mesh_range()).first;
+            it->second.format = format;
+        }
+        it->second.version = version;
+        return &it->second;
+    }
+
+    // Re-packs every source mesh of a format with GPU-side copies. Only happens when a mesh is first
+    // seen, reassigned or re-uploaded, so the cost is paid once per change rather than per frame.
+    void pack(const uint32_t format, format_batch & batch)
+    {
+        if (batch.sources.empty())
+        {
+            batch.mesh = GlMesh();
+            batch.dirty = false;
+            return;
+        }
+
+        const GLsizei stride = attribute_components(format) * sizeof(float);
+
+        GLsizeiptr vertexBytes = 0;
+        GLsizei indexCount = 0;
+        for (auto src : batch.sources)
+        {
+            vertexBytes += src->get_vertex_data_buffer().size;
+            indexCount += src->get_index_count();
+        }
+
+        GlMesh packed;
+        packed.set_vertex_data(vertexBytes, nullptr, GL_STATIC_DRAW);
+        packed.set_index_data(GL_TRIANGLES, GL_UNSIGNED_INT, indexCount, nullptr, GL_STATIC_DRAW);
+
+        GLintptr vertexOffset = 0;
+        GLuint indexOffset = 0;
+        for (auto src : batch.sources)
+        {
+            const GLsizeiptr srcVertexBytes = src->get_vertex_data_buffer().size;
+            const GLsizei srcIndexCount = src->get_index_count();
+
+            glCopyNamedBufferSubData(src->get_vertex_data_buffer(), packed.get_vertex_data_buffer(), 0, vertexOffset, srcVertexBytes);
+            glCopyNamedBufferSubData(src->get_index_data_buffer(), packed.get_index_data_buffer(), 0, indexOffset * sizeof(uint32_t), srcIndexCount * sizeof(uint32_t));
+
+            mesh_range & range = ranges[src];
+            range.firstIndex = indexOffset;
+            range.indexCount = srcIndexCount;
+            range.baseVertex = static_cast<GLint>(vertexOffset / stride);
+
+            vertexOffset += srcVertexBytes;
+            indexOffset += srcIndexCount;
+        }
+
+        int offset = 0;
+        packed.set_attribute(0, 3, GL_FLOAT, GL_FALSE, stride, ((float*)0) + offset); offset += 3;
+        if (format & ATTRIB_NORMAL) { packed.set_attribute(1, 3, GL_FLOAT, GL_FALSE, stride, ((float*)0) + offset); offset += 3; }
+        if (format & ATTRIB_COLOR) { packed.set_attribute(2, 3, GL_FLOAT, GL_FALSE, stride, ((float*)0) + offset); offset += 3; }
+        if (format & ATTRIB_TEXCOORD) { packed.set_attribute(3, 2, GL_FLOAT, GL_FALSE, stride, ((float*)0) + offset); offset += 2; }
+        if (format & ATTRIB_TANGENT) { packed.set_attribute(4, 3, GL_FLOAT, GL_FALSE, stride, ((float*)0) + offset); offset += 3; }
+        if (format & ATTRIB_BITANGENT) { packed.set_attribute(5, 3, GL_FLOAT, GL_FALSE, stride, ((float*)0) + offset); offset += 3; }
+
+        batch.mesh = std::move(packed);
+        batch.dirty = false;
+    }
+
+    void append_object(Renderable * r)
+    {
+        uniforms::per_object object = {};
+        object.modelMatrix = mul(r->get_pose().matrix(), make_scaling_matrix(r->get_scale()));
+        object.modelMatrixIT = inverse(transpose(object.modelMatrix));
+        object.receiveShadow = (float)r->get_receive_shadow();
+
+        const size_t offset = objectData.size();
+        objectData.resize(offset + sizeof(object));
+        memcpy(objectData.data() + offset, &object, sizeof(object));
+    }
+
+    void align_object_data()
+    {
+        const size_t alignment = static_cast<size_t>(storageAlignment);
+        objectData.resize((objectData.size() + alignment - 1) / alignment * alignment);
+    }
+
+public:
+
+    bool enabled{ true };
+
+    // Discard the data staged during the previous frame and pack any meshes in `renderSet` that
+    // are new or were reassigned, so that ranges stay fixed while this frame's commands are built.
+    void begin_frame(const std::vector<Renderable *> & renderSet)
+    {
+        if (!storageAlignment) glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storageAlignment);
+        objectData.clear();
+        commands.clear();
+
+        if (!enabled) return;
+        for (Renderable * r : renderSet) find_range(r);
+        for (auto & f : formats) if (f.second.dirty) pack(f.first, f.second);
+    }
+
+    // Stages per-object data and indirect commands for `renderables` in submission order. Consecutive
+    // batchable objects sharing a vertex format (and a material, if `splitByMaterial`) become one item.
+    // If the order of the input is irrelevant (shadows, depth prepass) pass `sortByFormat` for longer runs.
+    // Every draw is issued `instanceCount` times.
+    std::vector<draw_item> build(const std::vector<Renderable *> & renderables, const bool splitByMaterial, const bool sortByFormat = false, const uint32_t instanceCount = 1)
+    {
+        std::vector<draw_item> items;
+
+        const std::vector<Renderable *> * list = &renderables;
+        if (enabled && sortByFormat)
+        {
+            scratch.clear();
+            for (Renderable * r : renderables)
+            {
+                const mesh_range * range = find_range(r);
+                scratch.push_back({ range ? range->format + 1 : 0, r });
+            }
+
+            std::stable_sort(scratch.begin(), scratch.end(), [](const std::pair<uint32_t, Renderable *> & lhs, const std::pair<uint32_t, Renderable *> & rhs)
+            {
+                return lhs.first < rhs.first;
+            });
+
+            sorted.clear();
+            for (auto & s : scratch) sorted.push_back(s.second);
+            list = &sorted;
+        }
+
+        for (Renderable * r : *list)
+        {
+            const mesh_range * range = enabled ? find_range(r) : nullptr;
+
+            // A mesh that is new or changed since `begin_frame` leaves its batch unpacked until the next frame.
+            // Repacking here would move the ranges of commands already staged, so the whole batch is drawn
+            // individually instead.
+            if (range && formats[range->format].dirty) range = nullptr;
+
+            if (range)
+            {
+                format_batch & batch = formats[range->format];
+
+                // Extend the current run
+                draw_item * last = items.size() ? &items.back() : nullptr;
+                if (last && last->batch == &batch.mesh && (!splitByMaterial || last->renderable->get_material() == r->get_material()))
+                {
+                    append_object(r);
+                    commands.push_back({ range->indexCount, instanceCount, range->firstIndex, range->baseVertex, 0 });
+                    last->objectSize += sizeof(uniforms::per_object);
+                    last->drawCount++;
+                    continue;
+                }
+
+                align_object_data();
+                draw_item item;
+                item.renderable = r;
+                item.batch = &batch.mesh;
+                item.objectOffset = objectData.size();
+                item.objectSize = sizeof(uniforms::per_object);
+                item.commandOffset = commands.size() * sizeof(GlDrawElementsIndirectCommand);
+                item.drawCount = 1;
+                item.instanceCount = instanceCount;
+                append_object(r);
+                commands.push_back({ range->indexCount, instanceCount, range->firstIndex, range->baseVertex, 0 });
+                items.push_back(item);
+            }
+            else
+            {
+                align_object_data();
+                draw_item item;
+                item.renderable = r;
+                item.objectOffset = objectData.size();
+                item.objectSize = sizeof(uniforms::per_object);
+                item.drawCount = 1;
+                item.instanceCount = instanceCount;
+                append_object(r);
+                items.push_back(item);
+            }
+        }
+
+        return items;
+    }
+
+    // Upload everything staged by `build` this frame. Must be called before the first `submit`.
+    void upload()
+    {
+        if (objectData.size()) objectBuffer.set_buffer_data(objectData.size(), objectData.data(), GL_STREAM_DRAW);
+        if (commands.size()) commandBuffer.set_buffer_data(commands.size() * sizeof(GlDrawElementsIndirectCommand), commands.data(), GL_STREAM_DRAW);
+    }
+
+    // Binds the per-object range of `item` and draws it with whatever program is currently bound
+    void submit(const draw_item & item) const
+    {
+        glBindBufferRange(GL_SHADER_STORAGE_BUFFER, uniforms::per_object::binding, objectBuffer, item.objectOffset, item.objectSize);
+        if (item.batch) item.batch->draw_elements_indirect(commandBuffer, item.drawCount, item.commandOffset);
+        else if (item.instanceCount > 1) item.renderable->draw_instanced(item.instanceCount);
+        else item.renderable->draw();
+    }
+
+    size_t num_commands() const { return commands.size(); }
+};
+
+#endif // end static_mesh_batcher_hpp
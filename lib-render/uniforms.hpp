@@ -14,6 +14,7 @@ namespace uniforms
 {
     static const int MAX_POINT_LIGHTS = 4;
     static const int NUM_CASCADES = 2;
+    static const int MAX_VIEWS = 2;
 
     struct point_light
     {
@@ -53,23 +54,43 @@ namespace uniforms
         float                 cascadesFar[NUM_CASCADES];
     };
 
-    struct per_view
+    struct view_uniforms
     {
-        static const int      binding = 1;
         ALIGNED(16) float4x4  view;
         ALIGNED(16) float4x4  viewProj;
         ALIGNED(16) float4    eyePos;
     };
 
+    // One entry per eye for single-pass stereo; otherwise only views[0] is read
+    struct per_view
+    {
+        static const int      binding = 1;
+        view_uniforms         views[MAX_VIEWS];
+    };
+
+    // Array element of a shader storage buffer (std430), indexed by gl_DrawIDARB
     struct per_object
     {
         static const int      binding = 2;
         ALIGNED(16) float4x4  modelMatrix;
         ALIGNED(16) float4x4  modelMatrixIT;
-        ALIGNED(16) float4x4  modelViewMatrix;
         ALIGNED(16) float     receiveShadow;
     };
 
+    // Shader storage buffer (std430) written by the bloom pass's luminance reduction and read by its
+    // threshold and composite stages. Never read back on the CPU.
+    static const int LUMINANCE_HISTORY = 64;
+
+    struct luminance_state
+    {
+        static const int      binding = 3;
+        float                 adaptedLuminance;
+        float                 exposure;
+        uint32_t              historyIndex;
+        float                 pad;
+        float                 history[LUMINANCE_HISTORY]; // per-frame log-average, ring indexed by historyIndex
+    };
+
 }
 
 #endif // end vr_uniforms_hpp
@@ -5,56 +5,212 @@
 #define mpmc_blocking_queue_hpp
 
 #include <mutex>
-#include <queue>
+#include <deque>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <iterator>
+#include <algorithm>
 #include <condition_variable>
 
+// Mutex-protected hand-off queue for worker threads. Values are moved in and out, producers notify only
+// when a consumer is parked and always after releasing the lock, and consumers spin briefly on an atomic
+// count before parking. The spin budget adapts: it grows while spinning keeps paying off and shrinks when
+// consumers end up parking anyway, so an idle queue doesn't burn CPU.
+// After `close()` producers are rejected and consumers drain what is left, then return false.
 template<typename T>
 class MPMCBlockingQueue
 {
-    std::queue<T> queue;
-    std::mutex mutex;
+    std::deque<T> queue;
+    mutable std::mutex mutex;
     std::condition_variable condition;
+    std::atomic<size_t> count{ 0 };
+    std::atomic<uint32_t> spinLimit{ 64 };
+    uint32_t parkedConsumers{ 0 };
+    bool closed{ false };
+
+    static const uint32_t MinSpin = 16;
+    static const uint32_t MaxSpin = 4096;
 
     MPMCBlockingQueue(const MPMCBlockingQueue &) = delete;
     MPMCBlockingQueue & operator= (const MPMCBlockingQueue &) = delete;
 
+    // Called with the lock held; the caller notifies after unlocking
+    size_t wakeups_for(const size_t produced) const { return std::min<size_t>(produced, parkedConsumers); }
+
+    void notify(const size_t wakeups)
+    {
+        if (wakeups == 1) condition.notify_one();
+        else if (wakeups > 1) condition.notify_all();
+    }
+
+    // Spin on the atomic count before taking the lock; adjusts the spin budget based on the outcome
+    bool spin_for_item()
+    {
+        const uint32_t limit = spinLimit.load(std::memory_order_relaxed);
+        for (uint32_t i = 0; i < limit; ++i)
+        {
+            if (count.load(std::memory_order_acquire) != 0)
+            {
+                spinLimit.store(std::min(MaxSpin, limit * 2), std::memory_order_relaxed);
+                return true;
+            }
+            if ((i & 7) == 7) std::this_thread::yield();
+        }
+        spinLimit.store(std::max(MinSpin, limit / 2), std::memory_order_relaxed);
+        return false;
+    }
+
+    void pop_locked(T & value)
+    {
+        value = std::move(queue.front());
+        queue.pop_front();
+        count.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // Waits until an item is available, the queue is closed, or `deadline` passes. Returns with the lock held.
+    template<typename Clock, typename Duration>
+    bool wait_locked(std::unique_lock<std::mutex> & lock, const std::chrono::time_point<Clock, Duration> * deadline)
+    {
+        if (queue.empty() && !closed)
+        {
+            lock.unlock();
+            spin_for_item();
+            lock.lock();
+        }
+
+        parkedConsumers++;
+        bool timedOut = false;
+        while (queue.empty() && !closed && !timedOut)
+        {
+            if (deadline) timedOut = condition.wait_until(lock, *deadline) == std::cv_status::timeout;
+            else condition.wait(lock);
+        }
+        parkedConsumers--;
+        return !queue.empty();
+    }
+
 public:
 
+    MPMCBlockingQueue() = default;
+
+    // Returns false if the queue has been closed
+    template<typename ... Args>
+    bool emplace(Args && ... args)
+    {
+        size_t wakeups = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (closed) return false;
+            queue.emplace_back(std::forward<Args>(args)...);
+            count.fetch_add(1, std::memory_order_release);
+            wakeups = wakeups_for(1);
+        }
+        notify(wakeups);
+        return true;
+    }
+
     // Produce a new value and possibily notify one of the threads calling `wait_and_consume`
-    void produce(T const & value)
+    bool produce(const T & value) { return emplace(value); }
+    bool produce(T && value) { return emplace(std::move(value)); }
+
+    // Moves [first, last) in under a single lock. Returns the number of items enqueued (0 if closed).
+    template<typename InputIt>
+    size_t produce_bulk(InputIt first, InputIt last)
     {
-        std::lock_guard<std::mutex> lock(mutex);
-        queue.push(value);
-        condition.notify_one();
+        size_t produced = 0, wakeups = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (closed) return 0;
+            for (; first != last; ++first, ++produced) queue.emplace_back(std::move(*first));
+            count.fetch_add(produced, std::memory_order_release);
+            wakeups = wakeups_for(produced);
+        }
+        notify(wakeups);
+        return produced;
+    }
+
+    // Blocking operation if queue is empty. Returns false only once the queue is closed and drained.
+    bool wait_and_consume(T & popped_value)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!wait_locked<std::chrono::steady_clock, std::chrono::steady_clock::duration>(lock, nullptr)) return false;
+        pop_locked(popped_value);
+        return true;
     }
 
-    // Blocking operation if queue is empty
-    void wait_and_consume(T & popped_value)
+    // As `wait_and_consume` but gives up after `timeout`
+    template<typename Rep, typename Period>
+    bool wait_for(T & popped_value, const std::chrono::duration<Rep, Period> & timeout)
     {
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
         std::unique_lock<std::mutex> lock(mutex);
-        while (queue.empty()) condition.wait(lock);
-        popped_value = queue.front();
-        queue.pop();
+        if (!wait_locked(lock, &deadline)) return false;
+        pop_locked(popped_value);
+        return true;
     }
 
     // Permits polling threads to do something else if the queue is empty
     bool try_consume(T & popped_value)
     {
+        if (count.load(std::memory_order_acquire) == 0) return false;
         std::lock_guard<std::mutex> lock(mutex);
         if (queue.empty()) return false;
-        popped_value = queue.front();
-        queue.pop();
+        pop_locked(popped_value);
         return true;
     }
 
-    bool empty() const
+    // Moves up to `maxCount` items into `output` under a single lock without blocking. Returns the number consumed.
+    template<typename OutputIt>
+    size_t consume_bulk(OutputIt output, const size_t maxCount)
+    {
+        if (count.load(std::memory_order_acquire) == 0) return 0;
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t n = 0;
+        for (; n < maxCount && !queue.empty(); ++n)
+        {
+            *output++ = std::move(queue.front());
+            queue.pop_front();
+        }
+        count.fetch_sub(n, std::memory_order_relaxed);
+        return n;
+    }
+
+    // Blocks until at least one item is available (or the queue is closed and drained), then takes up to `maxCount`
+    template<typename OutputIt>
+    size_t wait_and_consume_bulk(OutputIt output, const size_t maxCount)
     {
         std::unique_lock<std::mutex> lock(mutex);
-        return queue.empty();
+        if (!wait_locked<std::chrono::steady_clock, std::chrono::steady_clock::duration>(lock, nullptr)) return 0;
+        size_t n = 0;
+        for (; n < maxCount && !queue.empty(); ++n)
+        {
+            *output++ = std::move(queue.front());
+            queue.pop_front();
+        }
+        count.fetch_sub(n, std::memory_order_relaxed);
+        return n;
+    }
+
+    // Rejects further produce calls and wakes every waiting consumer. Items already queued can still be consumed.
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+        condition.notify_all();
     }
-        
-    std::size_t size() const { return queue.size(); }
-    
+
+    bool is_closed() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return closed;
+    }
+
+    // Snapshot; may be stale by the time the caller looks at it
+    bool empty() const { return count.load(std::memory_order_acquire) == 0; }
+    std::size_t size() const { return count.load(std::memory_order_acquire); }
 };
 
 #endif // end mpmc_blocking_queue_hpp
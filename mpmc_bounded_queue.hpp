@@ -46,15 +46,16 @@ public:
     
     bool sp_produce(T const & input)
     {
+        const size_t headSequence = head.load(std::memory_order_relaxed);
         node_t * node = &buffer[headSequence & mask];
-        size_t nodeSequence = node->node.load(std::memory_order_acquire);
-        intptr_t diff = (intptr_t)nodeSequence - (intptr_t)headSequence;
+        size_t nodeSequence = node->next.load(std::memory_order_acquire);
+        intptr_t dif = (intptr_t)nodeSequence - (intptr_t)headSequence;
 
         if (dif == 0) 
         {
-            ++head;
+            head.store(headSequence + 1, std::memory_order_relaxed);
             node->data = input;
-            node->next.store(headSequence, std::memory_order_release);
+            node->next.store(headSequence + 1, std::memory_order_release);
             return true;
         }
 
@@ -6,62 +6,215 @@
 #include <assert.h>
 #include <atomic>
 #include <stdint.h>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <new>
+#include <utility>
+#include <type_traits>
 
+// Unbounded multi-producer, single-consumer queue (Vyukov's intrusive node queue). Nodes are allocated in
+// chunks and recycled through a lock-free free list: the consumer returns each node it retires and producers
+// pop from the list, so the allocator is only touched when the queue grows past its previous high-water mark.
+// Free-list entries are addressed by 32-bit index with a 32-bit tag in the same word to rule out ABA.
 template<typename T>
 class MPSCQueue
 {
-    struct buffer_node_t { T data; std::atomic<buffer_node_t*> next; };
-    typedef typename std::aligned_storage<sizeof(buffer_node_t), std::alignment_of<buffer_node_t>::value>::type buffer_node_aligned_t;
+    typedef typename std::aligned_storage<sizeof(T), std::alignment_of<T>::value>::type aligned_t;
+    typedef char cache_line_pad_t[64];
 
-    std::atomic<buffer_node_t*> head;
-    std::atomic<buffer_node_t*> tail;
+    static const uint32_t ChunkShift = 10;
+    static const uint32_t ChunkSize = 1u << ChunkShift;
+    static const uint32_t MaxChunks = 4096;
 
-    MPSCQueue(const MPSCQueue &) { }
-    void operator= (const MPSCQueue &) { }
-    
-public:
+    struct buffer_node_t
+    {
+        std::atomic<buffer_node_t*> next;
+        std::atomic<uint32_t> freeNext;     // 1-based index of the next free node, 0 terminates
+        uint32_t index;
+        aligned_t storage;
+        T * item() { return reinterpret_cast<T*>(&storage); }
+    };
+
+    cache_line_pad_t pad0;
+    std::atomic<buffer_node_t*> head;   // producers
+    cache_line_pad_t pad1;
+    buffer_node_t * tail;               // consumer only
+    cache_line_pad_t pad2;
+    std::atomic<uint64_t> freeHead{ 0 }; // (tag << 32) | (index + 1)
+    cache_line_pad_t pad3;
+
+    std::unique_ptr<buffer_node_t[]> chunks[MaxChunks];
+    std::atomic<uint32_t> numChunks{ 0 };
+    std::mutex growMutex;
+    const bool growable;
+
+    std::atomic<bool> consumerWaiting{ false };
+    std::mutex waitMutex;
+    std::condition_variable waitCondition;
+
+    MPSCQueue(const MPSCQueue &) = delete;
+    MPSCQueue & operator= (const MPSCQueue &) = delete;
+
+    buffer_node_t * node_at(const uint32_t index) const { return &chunks[index >> ChunkShift][index & (ChunkSize - 1)]; }
+
+    void push_free(buffer_node_t * node)
+    {
+        uint64_t h = freeHead.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            node->freeNext.store(static_cast<uint32_t>(h), std::memory_order_relaxed);
+            const uint64_t next = (((h >> 32) + 1) << 32) | (node->index + 1);
+            if (freeHead.compare_exchange_weak(h, next, std::memory_order_release, std::memory_order_relaxed)) return;
+        }
+    }
 
-    MPSCQueue() : head(reinterpret_cast<buffer_node_t*>(new buffer_node_aligned_t)), tail(head.load(std::memory_order_relaxed))
+    buffer_node_t * pop_free()
     {
-        buffer_node_t * front = head.load(std::memory_order_relaxed);
-        front->next.store(nullptr, std::memory_order_relaxed);
+        uint64_t h = freeHead.load(std::memory_order_acquire);
+        while (static_cast<uint32_t>(h) != 0)
+        {
+            buffer_node_t * node = node_at(static_cast<uint32_t>(h) - 1);
+            const uint64_t next = (((h >> 32) + 1) << 32) | node->freeNext.load(std::memory_order_relaxed);
+            if (freeHead.compare_exchange_weak(h, next, std::memory_order_acquire, std::memory_order_acquire)) return node;
+        }
+        return nullptr;
     }
 
+    bool grow(const bool force = false)
+    {
+        std::lock_guard<std::mutex> guard(growMutex);
+        if (!force && static_cast<uint32_t>(freeHead.load(std::memory_order_acquire)) != 0) return true; // another producer already grew it
+        const uint32_t c = numChunks.load(std::memory_order_relaxed);
+        if (c == MaxChunks) return false;
+
+        chunks[c].reset(new buffer_node_t[ChunkSize]);
+        numChunks.store(c + 1, std::memory_order_release);
+        for (uint32_t i = 0; i < ChunkSize; ++i)
+        {
+            buffer_node_t * node = &chunks[c][i];
+            node->index = (c << ChunkShift) + i;
+            push_free(node);
+        }
+        return true;
+    }
+
+    buffer_node_t * allocate()
+    {
+        for (;;)
+        {
+            if (buffer_node_t * node = pop_free()) return node;
+            if (!growable || !grow()) return nullptr;
+        }
+    }
+
+    void wake_consumer()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst); // pairs with the fence in wait(): either we see the flag or the consumer sees the item
+        if (consumerWaiting.load(std::memory_order_seq_cst))
+        {
+            std::lock_guard<std::mutex> guard(waitMutex);
+            waitCondition.notify_one();
+        }
+    }
+
+protected:
+
+    // Preallocates room for `reserve` items (plus the stub node), rounded up to whole chunks
+    MPSCQueue(const size_t reserve, const bool growable) : growable(growable)
+    {
+        do { grow(true); } while (numChunks.load(std::memory_order_relaxed) * size_t(ChunkSize) < reserve + 1 && numChunks.load(std::memory_order_relaxed) < MaxChunks);
+
+        buffer_node_t * stub = pop_free();
+        stub->next.store(nullptr, std::memory_order_relaxed);
+        head.store(stub, std::memory_order_relaxed);
+        tail = stub;
+    }
+
+public:
+
+    MPSCQueue(const size_t reserve = ChunkSize - 1) : MPSCQueue(reserve, true) { }
+
     ~MPSCQueue()
     {
-        T output;
-        while (this->consume(output)) {}
-        buffer_node_t* front = head.load(std::memory_order_relaxed);
-        delete front;
+        consume_all([](T &&) {});
     }
 
-    bool produce(const T & input)
+    template<typename ... Args>
+    bool emplace(Args && ... args)
     {
-        buffer_node_t* node = reinterpret_cast<buffer_node_t*>(new buffer_node_aligned_t);
-        node->data = input;
+        buffer_node_t * node = allocate();
+        if (!node) return false;
+        new (node->item()) T(std::forward<Args>(args)...);
         node->next.store(nullptr, std::memory_order_relaxed);
-        buffer_node_t* prevhead = head.exchange(node, std::memory_order_acq_rel);
+        buffer_node_t * prevhead = head.exchange(node, std::memory_order_acq_rel);
         prevhead->next.store(node, std::memory_order_release);
+        wake_consumer();
         return true;
     }
 
+    bool produce(const T & input) { return emplace(input); }
+    bool produce(T && input) { return emplace(std::move(input)); }
+
     bool consume(T & output)
     {
-        buffer_node_t * t = tail.load(std::memory_order_relaxed);
+        buffer_node_t * t = tail;
         buffer_node_t * n = t->next.load(std::memory_order_acquire);
         if (n == nullptr) return false;
-        output = n->data;
-        tail.store(n, std::memory_order_release);
-        delete t;
+        output = std::move(*n->item());
+        n->item()->~T();
+        tail = n; // n becomes the new stub
+        push_free(t);
         return true;
     }
 
-    bool available()
+    // Hands every currently visible item to `callback(T &&)` in FIFO order. Returns the number drained.
+    template<typename F>
+    size_t consume_all(F && callback)
+    {
+        size_t count = 0;
+        buffer_node_t * t = tail;
+        for (buffer_node_t * n = t->next.load(std::memory_order_acquire); n != nullptr; n = t->next.load(std::memory_order_acquire))
+        {
+            callback(std::move(*n->item()));
+            n->item()->~T();
+            push_free(t);
+            t = n;
+            ++count;
+        }
+        tail = t;
+        return count;
+    }
+
+    bool available() const
+    {
+        return tail->next.load(std::memory_order_acquire) != nullptr;
+    }
+
+    // Blocks the consumer until an item is available or `timeout` expires. Producers only pay for a
+    // notification while the consumer is actually parked here.
+    template<typename Rep, typename Period>
+    bool wait_for(const std::chrono::duration<Rep, Period> & timeout)
+    {
+        if (available()) return true;
+        std::unique_lock<std::mutex> lock(waitMutex);
+        consumerWaiting.store(true, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const bool result = waitCondition.wait_for(lock, timeout, [this]() { return available(); });
+        consumerWaiting.store(false, std::memory_order_relaxed);
+        return result;
+    }
+
+    void wait()
     {
-        buffer_node_t * tail = tail.load(std::memory_order_relaxed);
-        buffer_node_t * next = tail->next.load(std::memory_order_acquire);
-        return next != nullptr;
+        if (available()) return;
+        std::unique_lock<std::mutex> lock(waitMutex);
+        consumerWaiting.store(true, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        waitCondition.wait(lock, [this]() { return available(); });
+        consumerWaiting.store(false, std::memory_order_relaxed);
     }
 };
 
-#endif // mpsc_queue_hpp
\ No newline at end of file
+#endif // mpsc_queue_hpp
@@ -4,11 +4,86 @@
 #define oriented_bounding_box_hpp
 
 #include "math-core.hpp"
+#include "util.hpp"
 #include <assert.h>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define AVL_OBB_SSE 1
+#endif
 
 namespace avl
 {
 
+    namespace obb_detail
+    {
+        // Added to every |R_ij| so that near-parallel edge pairs, whose cross product is close to zero, can't
+        // produce a false separation from rounding
+        static const float ParallelEpsilon = 1e-6f;
+
+        inline float abs_v(const float x) { return std::abs(x); }
+
+        // The 15-axis separating axis test (Ericsson, Real-Time Collision Detection 4.4.1), written once for
+        // scalars and for SIMD lanes. A is described by its center, axes and half extents; B likewise.
+        // `u[i][k]` is component k of axis i. Returns a mask that is set where the boxes are separated.
+        template<typename T, typename M>
+        inline M separated(const T ac[3], const T au[3][3], const T ae[3], const T bc[3], const T bu[3][3], const T be[3], const T & eps)
+        {
+            T R[3][3], AbsR[3][3];
+            for (int i = 0; i < 3; ++i)
+            {
+                for (int j = 0; j < 3; ++j)
+                {
+                    R[i][j] = au[i][0] * bu[j][0] + au[i][1] * bu[j][1] + au[i][2] * bu[j][2];
+                    AbsR[i][j] = abs_v(R[i][j]) + eps;
+                }
+            }
+
+            // Translation into A's frame
+            const T d[3] = { bc[0] - ac[0], bc[1] - ac[1], bc[2] - ac[2] };
+            T t[3];
+            for (int i = 0; i < 3; ++i) t[i] = d[0] * au[i][0] + d[1] * au[i][1] + d[2] * au[i][2];
+
+            M s = abs_v(t[0]) > ae[0] + be[0] * AbsR[0][0] + be[1] * AbsR[0][1] + be[2] * AbsR[0][2];
+            s = s | (abs_v(t[1]) > ae[1] + be[0] * AbsR[1][0] + be[1] * AbsR[1][1] + be[2] * AbsR[1][2]);
+            s = s | (abs_v(t[2]) > ae[2] + be[0] * AbsR[2][0] + be[1] * AbsR[2][1] + be[2] * AbsR[2][2]);
+
+            for (int j = 0; j < 3; ++j)
+            {
+                s = s | (abs_v(t[0] * R[0][j] + t[1] * R[1][j] + t[2] * R[2][j]) > ae[0] * AbsR[0][j] + ae[1] * AbsR[1][j] + ae[2] * AbsR[2][j] + be[j]);
+            }
+
+            // A_i x B_j
+            s = s | (abs_v(t[2] * R[1][0] - t[1] * R[2][0]) > ae[1] * AbsR[2][0] + ae[2] * AbsR[1][0] + be[1] * AbsR[0][2] + be[2] * AbsR[0][1]);
+            s = s | (abs_v(t[2] * R[1][1] - t[1] * R[2][1]) > ae[1] * AbsR[2][1] + ae[2] * AbsR[1][1] + be[0] * AbsR[0][2] + be[2] * AbsR[0][0]);
+            s = s | (abs_v(t[2] * R[1][2] - t[1] * R[2][2]) > ae[1] * AbsR[2][2] + ae[2] * AbsR[1][2] + be[0] * AbsR[0][1] + be[1] * AbsR[0][0]);
+            s = s | (abs_v(t[0] * R[2][0] - t[2] * R[0][0]) > ae[0] * AbsR[2][0] + ae[2] * AbsR[0][0] + be[1] * AbsR[1][2] + be[2] * AbsR[1][1]);
+            s = s | (abs_v(t[0] * R[2][1] - t[2] * R[0][1]) > ae[0] * AbsR[2][1] + ae[2] * AbsR[0][1] + be[0] * AbsR[1][2] + be[2] * AbsR[1][0]);
+            s = s | (abs_v(t[0] * R[2][2] - t[2] * R[0][2]) > ae[0] * AbsR[2][2] + ae[2] * AbsR[0][2] + be[0] * AbsR[1][1] + be[1] * AbsR[1][0]);
+            s = s | (abs_v(t[1] * R[0][0] - t[0] * R[1][0]) > ae[0] * AbsR[1][0] + ae[1] * AbsR[0][0] + be[1] * AbsR[2][2] + be[2] * AbsR[2][1]);
+            s = s | (abs_v(t[1] * R[0][1] - t[0] * R[1][1]) > ae[0] * AbsR[1][1] + ae[1] * AbsR[0][1] + be[0] * AbsR[2][2] + be[2] * AbsR[2][0]);
+            s = s | (abs_v(t[1] * R[0][2] - t[0] * R[1][2]) > ae[0] * AbsR[1][2] + ae[1] * AbsR[0][2] + be[0] * AbsR[2][1] + be[1] * AbsR[2][0]);
+            return s;
+        }
+
+    #if defined(AVL_OBB_SSE)
+        // Four boxes per register; comparisons yield all-ones lane masks
+        struct lane4 { __m128 v; lane4() {} lane4(__m128 v) : v(v) {} explicit lane4(float x) : v(_mm_set1_ps(x)) {} };
+        struct mask4 { __m128 v; mask4(__m128 v) : v(v) {} };
+
+        inline lane4 operator + (const lane4 & a, const lane4 & b) { return _mm_add_ps(a.v, b.v); }
+        inline lane4 operator - (const lane4 & a, const lane4 & b) { return _mm_sub_ps(a.v, b.v); }
+        inline lane4 operator * (const lane4 & a, const lane4 & b) { return _mm_mul_ps(a.v, b.v); }
+        inline mask4 operator > (const lane4 & a, const lane4 & b) { return _mm_cmpgt_ps(a.v, b.v); }
+        inline mask4 operator | (const mask4 & a, const mask4 & b) { return _mm_or_ps(a.v, b.v); }
+        inline lane4 abs_v(const lane4 & a) { return _mm_andnot_ps(_mm_set1_ps(-0.f), a.v); }
+        inline int lane_bits(const mask4 & m) { return _mm_movemask_ps(m.v); }
+    #endif
+    }
+
     struct OrientedBoundingBox
     {
         float3 halfExtents;
@@ -19,8 +94,13 @@ namespace avl
 
         float calc_radius() const { return length(halfExtents); };
 
-        bool is_inside(const float3 & point) const { return false; }
+        bool is_inside(const float3 & point) const
+        {
+            const float3 local = qrot(qconj(orientation), point - center);
+            return std::abs(local.x) <= halfExtents.x && std::abs(local.y) <= halfExtents.y && std::abs(local.z) <= halfExtents.z;
+        }
 
+        // Exact separating axis test over the 3 + 3 face normals and the 9 edge-edge cross products
         bool intersects(const OrientedBoundingBox & other) const
         {
             // Early out using a sphere check
@@ -30,82 +110,22 @@ namespace avl
                 return false;
             }
 
-            std::vector<float3> thisCorners(8);
-            std::vector<float3> otherCorners(8);
-            std::vector<float3> thisAxes(3);
-            std::vector<float3> otherAxes(3);
-
-            OrientedBoundingBox::calculate_corner_points(thisCorners, center, halfExtents, orientation);
-            OrientedBoundingBox::calculate_corner_points(otherCorners, other.center, other.halfExtents, other.orientation);
-
-            OrientedBoundingBox::calculate_orthogonal_axes(thisAxes, orientation);
-            OrientedBoundingBox::calculate_orthogonal_axes(otherAxes, other.orientation);
-
-            std::vector<Plane> thisPlanes = {
-                Plane(-thisAxes [0], thisCorners [0]),
-                Plane(-thisAxes [1], thisCorners [0]),
-                Plane(-thisAxes [2], thisCorners [0]),
-                Plane(thisAxes [0], thisCorners [7]),
-                Plane(thisAxes [1], thisCorners [7]),
-                Plane(thisAxes [2], thisCorners [7]) };
-
-            std::vector<Plane> otherPlanes = {
-                Plane(-otherAxes [0], otherCorners [0]),
-                Plane(-otherAxes [1], otherCorners [0]),
-                Plane(-otherAxes [2], otherCorners [0]),
-                Plane(otherAxes [0], otherCorners [7]),
-                Plane(otherAxes [1], otherCorners [7]),
-                Plane(otherAxes [2], otherCorners [7]) };
-
-            // Corners of box1 vs faces of box2
-            for (int i = 0; i < 6; i++)  
-            { 
-                bool allPositive = true;
-                for (int j = 0; j < 8; j++)
-                {
-                    if (otherPlanes[i].is_negative_half_space(thisCorners[j]))
-                    {
-                        allPositive = false;
-                        break;
-                    }
-                }
+            const float3 ax = qxdir(orientation), ay = qydir(orientation), az = qzdir(orientation);
+            const float3 bx = qxdir(other.orientation), by = qydir(other.orientation), bz = qzdir(other.orientation);
 
-                if (allPositive)
-                {
-                    return false; // We found a separating axis so there's no collision
-                }
-            }
+            const float ac[3] = { center.x, center.y, center.z };
+            const float au[3][3] = { { ax.x, ax.y, ax.z },{ ay.x, ay.y, ay.z },{ az.x, az.y, az.z } };
+            const float ae[3] = { halfExtents.x, halfExtents.y, halfExtents.z };
+            const float bc[3] = { other.center.x, other.center.y, other.center.z };
+            const float bu[3][3] = { { bx.x, bx.y, bx.z },{ by.x, by.y, by.z },{ bz.x, bz.y, bz.z } };
+            const float be[3] = { other.halfExtents.x, other.halfExtents.y, other.halfExtents.z };
 
-            // Corners of box2 vs faces of box1
-            for (int i = 0; i <6; i++)
-            {
-                bool allPositive = true;
-                for (int j = 0; j <8; j++)
-                {
-                    // A negative projection has been found, no need to keep checking.
-                    // It does not mean that there is a collision though.
-                    if (thisPlanes[i].is_negative_half_space(otherCorners[j]))
-                    {
-                        allPositive = false;
-                        break;
-                    }
-                }
-
-                // We found a separating axis so there's no collision
-                if (allPositive)
-                {
-                    return false;
-                }
-            }
-
-            // No separating axis has been found = collision
-            return true;
+            return !obb_detail::separated<float, bool>(ac, au, ae, bc, bu, be, obb_detail::ParallelEpsilon);
         }
 
-        static void calculate_corner_points(std::vector<float3> & corners, const float3 center, const float3 he, const float4 & orientation)
+        static void calculate_corner_points(float3 (&corners)[8], const float3 center, const float3 he, const float4 & orientation)
         {
-            assert(corners.size() == 8);
-            std::vector<float3> orthogonalAxes(3);
+            float3 orthogonalAxes[3];
             OrientedBoundingBox::calculate_orthogonal_axes(orthogonalAxes, orientation);
             corners[0] = center - orthogonalAxes [0] * he.x - orthogonalAxes[1] * he.y - orthogonalAxes[2] * he.z;
             corners[1] = center + orthogonalAxes [0] * he.x - orthogonalAxes[1] * he.y - orthogonalAxes[2] * he.z;
@@ -117,16 +137,289 @@ namespace avl
             corners[7] = center + orthogonalAxes [0] * he.x + orthogonalAxes[1] * he.y + orthogonalAxes[2] * he.z;
         }
 
-        static void calculate_orthogonal_axes(std::vector<float3> & axes, const float4 & orientation)
+        static void calculate_corner_points(std::vector<float3> & corners, const float3 center, const float3 he, const float4 & orientation)
+        {
+            assert(corners.size() == 8);
+            calculate_corner_points(*reinterpret_cast<float3 (*)[8]>(corners.data()), center, he, orientation);
+        }
+
+        static void calculate_orthogonal_axes(float3 (&axes)[3], const float4 & orientation)
         {
-            assert(axes.size() == 3);
             axes[0] = qxdir(orientation);
             axes[1] = qydir(orientation);
             axes[2] = qzdir(orientation);
         }
 
+        static void calculate_orthogonal_axes(std::vector<float3> & axes, const float4 & orientation)
+        {
+            assert(axes.size() == 3);
+            calculate_orthogonal_axes(*reinterpret_cast<float3 (*)[3]>(axes.data()), orientation);
+        }
+
+    };
+
+    // Structure-of-arrays copy of many boxes, laid out so the batch queries below can test four boxes per
+    // SIMD register. Axes are stored expanded (not as quaternions) since every test needs them.
+    class OrientedBoundingBoxBatch
+    {
+        friend size_t intersect(const OrientedBoundingBox &, const OrientedBoundingBoxBatch &, std::vector<uint32_t> &);
+        friend void intersect(const OrientedBoundingBoxBatch &, const OrientedBoundingBoxBatch &, std::vector<std::pair<uint32_t, uint32_t>> &);
+        friend void intersect_self(const OrientedBoundingBoxBatch &, std::vector<std::pair<uint32_t, uint32_t>> &);
+
+        std::vector<float> c[3];        // center
+        std::vector<float> e[3];        // half extents
+        std::vector<float> u[3][3];     // u[i][k]: component k of axis i
+        std::vector<float> reach[3];    // half size of the world-space AABB, for the broadphase
+        std::vector<float> radius;      // bounding sphere, for the one-vs-many early out
+
+    public:
+
+        size_t size() const { return c[0].size(); }
+        bool empty() const { return c[0].empty(); }
+
+        void reserve(const size_t n)
+        {
+            for (int i = 0; i < 3; ++i)
+            {
+                c[i].reserve(n); e[i].reserve(n); reach[i].reserve(n);
+                for (int k = 0; k < 3; ++k) u[i][k].reserve(n);
+            }
+            radius.reserve(n);
+        }
+
+        void clear()
+        {
+            for (int i = 0; i < 3; ++i)
+            {
+                c[i].clear(); e[i].clear(); reach[i].clear();
+                for (int k = 0; k < 3; ++k) u[i][k].clear();
+            }
+            radius.clear();
+        }
+
+        void push_back(const OrientedBoundingBox & b)
+        {
+            const float3 axes[3] = { qxdir(b.orientation), qydir(b.orientation), qzdir(b.orientation) };
+            for (int i = 0; i < 3; ++i)
+            {
+                c[i].push_back(b.center[i]);
+                e[i].push_back(b.halfExtents[i]);
+                for (int k = 0; k < 3; ++k) u[i][k].push_back(axes[i][k]);
+            }
+            for (int k = 0; k < 3; ++k)
+            {
+                reach[k].push_back(std::abs(axes[0][k]) * b.halfExtents.x + std::abs(axes[1][k]) * b.halfExtents.y + std::abs(axes[2][k]) * b.halfExtents.z);
+            }
+            radius.push_back(b.calc_radius());
+        }
+
+    private:
+
+        void load(const size_t i, float bc[3], float bu[3][3], float be[3]) const
+        {
+            for (int a = 0; a < 3; ++a)
+            {
+                bc[a] = c[a][i];
+                be[a] = e[a][i];
+                for (int k = 0; k < 3; ++k) bu[a][k] = u[a][k][i];
+            }
+        }
+
+        bool aabbs_overlap(const size_t i, const OrientedBoundingBoxBatch & other, const size_t j) const
+        {
+            for (int k = 0; k < 3; ++k) if (std::abs(c[k][i] - other.c[k][j]) > reach[k][i] + other.reach[k][j]) return false;
+            return true;
+        }
+
+    #if defined(AVL_OBB_SSE)
+        // Loads boxes idx[0..3] of this batch into SIMD lanes
+        void gather(const uint32_t idx[4], obb_detail::lane4 bc[3], obb_detail::lane4 bu[3][3], obb_detail::lane4 be[3]) const
+        {
+            for (int a = 0; a < 3; ++a)
+            {
+                bc[a] = _mm_setr_ps(c[a][idx[0]], c[a][idx[1]], c[a][idx[2]], c[a][idx[3]]);
+                be[a] = _mm_setr_ps(e[a][idx[0]], e[a][idx[1]], e[a][idx[2]], e[a][idx[3]]);
+                for (int k = 0; k < 3; ++k) bu[a][k] = _mm_setr_ps(u[a][k][idx[0]], u[a][k][idx[1]], u[a][k][idx[2]], u[a][k][idx[3]]);
+            }
+        }
+    #endif
+
+        // Narrow phase over candidate pairs (index into `a`, index into `b`); appends the overlapping ones
+        static void test_pairs(const OrientedBoundingBoxBatch & a, const OrientedBoundingBoxBatch & b, const std::pair<uint32_t, uint32_t> * pairs, const size_t count, std::vector<std::pair<uint32_t, uint32_t>> & out)
+        {
+            size_t p = 0;
+        #if defined(AVL_OBB_SSE)
+            using obb_detail::lane4;
+            const lane4 eps(obb_detail::ParallelEpsilon);
+            for (; p + 4 <= count; p += 4)
+            {
+                const uint32_t ia[4] = { pairs[p].first, pairs[p + 1].first, pairs[p + 2].first, pairs[p + 3].first };
+                const uint32_t ib[4] = { pairs[p].second, pairs[p + 1].second, pairs[p + 2].second, pairs[p + 3].second };
+                lane4 ac[3], au[3][3], ae[3], bc[3], bu[3][3], be[3];
+                a.gather(ia, ac, au, ae);
+                b.gather(ib, bc, bu, be);
+                const int sep = obb_detail::lane_bits(obb_detail::separated<lane4, obb_detail::mask4>(ac, au, ae, bc, bu, be, eps));
+                for (int l = 0; l < 4; ++l) if (!(sep & (1 << l))) out.push_back(pairs[p + l]);
+            }
+        #endif
+            for (; p < count; ++p)
+            {
+                float ac[3], au[3][3], ae[3], bc[3], bu[3][3], be[3];
+                a.load(pairs[p].first, ac, au, ae);
+                b.load(pairs[p].second, bc, bu, be);
+                if (!obb_detail::separated<float, bool>(ac, au, ae, bc, bu, be, obb_detail::ParallelEpsilon)) out.push_back(pairs[p]);
+            }
+        }
+
+        // Sweep and prune along x, keeping pairs whose world AABBs overlap. With `self`, a and b are the same
+        // batch and only pairs i < j are reported.
+        static void broadphase(const OrientedBoundingBoxBatch & a, const OrientedBoundingBoxBatch & b, const bool self, std::vector<std::pair<uint32_t, uint32_t>> & candidates)
+        {
+            struct endpoint { float min; uint32_t index; bool fromA; };
+            std::vector<endpoint> sorted;
+            sorted.reserve(a.size() + (self ? 0 : b.size()));
+            for (uint32_t i = 0; i < a.size(); ++i) sorted.push_back({ a.c[0][i] - a.reach[0][i], i, true });
+            if (!self) for (uint32_t j = 0; j < b.size(); ++j) sorted.push_back({ b.c[0][j] - b.reach[0][j], j, false });
+            std::sort(sorted.begin(), sorted.end(), [](const endpoint & l, const endpoint & r) { return l.min < r.min; });
+
+            // Each interval is compared against the ones that start before it ends
+            for (size_t s = 0; s < sorted.size(); ++s)
+            {
+                const endpoint & p = sorted[s];
+                const OrientedBoundingBoxBatch & pb = p.fromA ? a : b;
+                const float maxX = pb.c[0][p.index] + pb.reach[0][p.index];
+
+                for (size_t t = s + 1; t < sorted.size() && sorted[t].min <= maxX; ++t)
+                {
+                    const endpoint & q = sorted[t];
+                    if (!self && p.fromA == q.fromA) continue;
+
+                    const uint32_t ia = p.fromA ? p.index : q.index;
+                    const uint32_t ib = p.fromA ? q.index : p.index;
+                    if (!a.aabbs_overlap(ia, b, ib)) continue;
+                    candidates.push_back(self ? std::make_pair(std::min(ia, ib), std::max(ia, ib)) : std::make_pair(ia, ib));
+                }
+            }
+        }
+
+        static void narrowphase(const OrientedBoundingBoxBatch & a, const OrientedBoundingBoxBatch & b, const std::vector<std::pair<uint32_t, uint32_t>> & candidates, std::vector<std::pair<uint32_t, uint32_t>> & pairs)
+        {
+            const size_t grain = 8192;
+            const size_t maxChunks = std::max<size_t>(1, std::thread::hardware_concurrency());
+            const size_t numChunks = std::min(maxChunks, std::max<size_t>(1, candidates.size() / grain));
+            if (numChunks == 1) { test_pairs(a, b, candidates.data(), candidates.size(), pairs); return; }
+
+            const size_t chunkSize = (candidates.size() + numChunks - 1) / numChunks;
+            std::vector<std::vector<std::pair<uint32_t, uint32_t>>> parts(numChunks);
+            parallel_for(0, numChunks, 1, [&](size_t first, size_t last)
+            {
+                for (size_t ch = first; ch < last; ++ch)
+                {
+                    const size_t begin = ch * chunkSize, end = std::min(candidates.size(), begin + chunkSize);
+                    if (begin < end) test_pairs(a, b, candidates.data() + begin, end - begin, parts[ch]);
+                }
+            });
+            for (auto & part : parts) pairs.insert(pairs.end(), part.begin(), part.end());
+        }
     };
 
+    // One against many: appends the indices of the boxes in `batch` that overlap `box`. Returns the number found.
+    inline size_t intersect(const OrientedBoundingBox & box, const OrientedBoundingBoxBatch & batch, std::vector<uint32_t> & hits)
+    {
+        const size_t start = hits.size();
+        const size_t n = batch.size();
+
+        const float3 axes[3] = { qxdir(box.orientation), qydir(box.orientation), qzdir(box.orientation) };
+        float ac[3], au[3][3], ae[3];
+        for (int i = 0; i < 3; ++i)
+        {
+            ac[i] = box.center[i];
+            ae[i] = box.halfExtents[i];
+            for (int k = 0; k < 3; ++k) au[i][k] = axes[i][k];
+        }
+
+        auto test_range = [&](const size_t begin, const size_t end, std::vector<uint32_t> & out)
+        {
+            size_t i = begin;
+        #if defined(AVL_OBB_SSE)
+            using obb_detail::lane4;
+            lane4 lac[3], lau[3][3], lae[3];
+            for (int a = 0; a < 3; ++a)
+            {
+                lac[a] = lane4(ac[a]);
+                lae[a] = lane4(ae[a]);
+                for (int k = 0; k < 3; ++k) lau[a][k] = lane4(au[a][k]);
+            }
+            const lane4 eps(obb_detail::ParallelEpsilon);
+            const lane4 lradius(box.calc_radius());
+            for (; i + 4 <= end; i += 4)
+            {
+                lane4 bc[3], bu[3][3], be[3];
+                for (int a = 0; a < 3; ++a) bc[a] = _mm_loadu_ps(&batch.c[a][i]);
+
+                // Skip the full test when all four bounding spheres miss
+                const lane4 d[3] = { bc[0] - lac[0], bc[1] - lac[1], bc[2] - lac[2] };
+                const lane4 reachSum = lradius + lane4(_mm_loadu_ps(&batch.radius[i]));
+                if (obb_detail::lane_bits((d[0] * d[0] + d[1] * d[1] + d[2] * d[2]) > reachSum * reachSum) == 0xF) continue;
+
+                for (int a = 0; a < 3; ++a)
+                {
+                    be[a] = _mm_loadu_ps(&batch.e[a][i]);
+                    for (int k = 0; k < 3; ++k) bu[a][k] = _mm_loadu_ps(&batch.u[a][k][i]);
+                }
+                const int sep = obb_detail::lane_bits(obb_detail::separated<lane4, obb_detail::mask4>(lac, lau, lae, bc, bu, be, eps));
+                for (int l = 0; l < 4; ++l) if (!(sep & (1 << l))) out.push_back(uint32_t(i + l));
+            }
+        #endif
+            for (; i < end; ++i)
+            {
+                float bc[3], bu[3][3], be[3];
+                batch.load(i, bc, bu, be);
+                if (!obb_detail::separated<float, bool>(ac, au, ae, bc, bu, be, obb_detail::ParallelEpsilon)) out.push_back(uint32_t(i));
+            }
+        };
+
+        const size_t grain = 16384;
+        const size_t maxChunks = std::max<size_t>(1, std::thread::hardware_concurrency());
+        const size_t numChunks = std::min(maxChunks, std::max<size_t>(1, n / grain));
+        if (numChunks == 1)
+        {
+            test_range(0, n, hits);
+        }
+        else
+        {
+            // Chunk sizes are rounded to whole SIMD groups so only the last chunk has a scalar tail
+            const size_t chunkSize = ((n + numChunks - 1) / numChunks + 3) & ~size_t(3);
+            std::vector<std::vector<uint32_t>> parts(numChunks);
+            parallel_for(0, numChunks, 1, [&](size_t first, size_t last)
+            {
+                for (size_t ch = first; ch < last; ++ch)
+                {
+                    const size_t begin = ch * chunkSize, end = std::min(n, begin + chunkSize);
+                    if (begin < end) test_range(begin, end, parts[ch]);
+                }
+            });
+            for (auto & part : parts) hits.insert(hits.end(), part.begin(), part.end());
+        }
+        return hits.size() - start;
+    }
+
+    // Many against many: appends every overlapping (index in a, index in b) pair
+    inline void intersect(const OrientedBoundingBoxBatch & a, const OrientedBoundingBoxBatch & b, std::vector<std::pair<uint32_t, uint32_t>> & pairs)
+    {
+        std::vector<std::pair<uint32_t, uint32_t>> candidates;
+        OrientedBoundingBoxBatch::broadphase(a, b, false, candidates);
+        OrientedBoundingBoxBatch::narrowphase(a, b, candidates, pairs);
+    }
+
+    // All overlapping pairs (i < j) within one batch
+    inline void intersect_self(const OrientedBoundingBoxBatch & set, std::vector<std::pair<uint32_t, uint32_t>> & pairs)
+    {
+        std::vector<std::pair<uint32_t, uint32_t>> candidates;
+        OrientedBoundingBoxBatch::broadphase(set, set, true, candidates);
+        OrientedBoundingBoxBatch::narrowphase(set, set, candidates, pairs);
+    }
+
     // For GJK intersection test
     /*
     inline float3 obb_support(const OrientedBoundingBox & obb, const float3 & dir)
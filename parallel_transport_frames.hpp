@@ -20,25 +20,9 @@
 //
 //   See Game Programming Gems 2, Section 2.5
 
-inline std::vector<float4x4> make_parallel_transport_frame_bezier(const std::array<Pose, 4> controlPoints, const int segments)
+// Frames for an ordered set of curve samples and their tangents
+inline std::vector<float4x4> make_parallel_transport_frames(const std::vector<float3> & points, const std::vector<float3> & tangents)
 {
-    BezierCurve curve(controlPoints[0].position, controlPoints[1].position, controlPoints[2].position, controlPoints[3].position);
-
-    std::vector<float3> points;         // Points in spline
-    std::vector<float3> tangents;       // Tangents in spline (fwd dir)
-
-    // Build the spline.
-    float dt = 1.0f / float(segments);
-    for (int i = 0; i < segments; ++i) 
-    {
-        float t = float(i) * dt;
-        float3 P = curve.point(t);
-        points.push_back(P);
-
-        float3 T = normalize(curve.derivative(t));
-        tangents.push_back(T);
-    }
-
     auto n = points.size();
     std::vector<float4x4> frames(n); // Coordinate frame at each spline sample
 
@@ -48,7 +32,7 @@ inline std::vector<float4x4> make_parallel_transport_frame_bezier(const std::arr
         // First frame, expressed in a Y-up, right-handed coordinate system
         const float3 B = normalize(points[1] - points[0]);      // bitangent
         const float3 T = normalize(cross({ 0, 1, 0 }, B));      // tangent
-        const float3 N = cross(B, N);                           // normal
+        const float3 N = cross(B, T);                           // normal
         frames[0] = { float4(-T, 0), float4(N, 0), float4(B, 0), float4(points[0], 1) };
 
         // This sets the transformation matrix to the last reference frame defined by the previously computed 
@@ -93,4 +77,34 @@ inline std::vector<float4x4> make_parallel_transport_frame_bezier(const std::arr
     return frames;
 }
 
+inline std::vector<float4x4> make_parallel_transport_frame_bezier(const std::array<Pose, 4> controlPoints, const int segments)
+{
+    BezierCurve curve(controlPoints[0].position, controlPoints[1].position, controlPoints[2].position, controlPoints[3].position);
+
+    std::vector<float3> points;         // Points in spline
+    std::vector<float3> tangents;       // Tangents in spline (fwd dir)
+
+    // Build the spline.
+    float dt = 1.0f / float(segments);
+    for (int i = 0; i < segments; ++i) 
+    {
+        float t = float(i) * dt;
+        float3 P = curve.point(t);
+        points.push_back(P);
+
+        float3 T = normalize(curve.derivative(t));
+        tangents.push_back(T);
+    }
+
+    return make_parallel_transport_frames(points, tangents);
+}
+
+// Frames spaced evenly by arc length, so stepping through them moves at constant speed
+inline std::vector<float4x4> make_parallel_transport_frame_path(const SplinePath & path, const int segments)
+{
+    std::vector<float3> points, tangents;
+    path.sample_uniform(size_t(std::max(segments, 0)), points, &tangents);
+    return make_parallel_transport_frames(points, tangents);
+}
+
 #endif // end parallel_transport_frames_hpp
\ No newline at end of file
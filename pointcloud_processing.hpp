@@ -2,6 +2,9 @@
 #define pointcloud_processing_hpp
 
 #include "math-core.hpp"
+#include "util.hpp"
+#include "svd.hpp"
+#include "kd_tree.hpp"
 #include <random>
 #include <utility>
 
@@ -132,6 +135,188 @@ namespace pca_impl
     }
 }
 
+namespace pca_impl
+{
+    // Two-pass (centroid, then centered outer products) covariance of points[indices[0 .. count)]
+    inline float3x3 neighbourhood_covariance(const float3 * points, const uint32_t * indices, const size_t count)
+    {
+        float3 centroid(0, 0, 0);
+        for (size_t i = 0; i < count; ++i) centroid += points[indices[i]];
+        centroid /= static_cast<float>(count);
+
+        float3x3 covariance;
+        for (size_t i = 0; i < count; ++i)
+        {
+            const float3 d = points[indices[i]] - centroid;
+            covariance += outerprod(d, d);
+        }
+        return covariance / static_cast<float>(count);
+    }
+}
+
+/*
+ * Local PCA for every point of a cloud, over neighbourhoods found beforehand (e.g. k nearest neighbours). The
+ * neighbours of point i are neighbourIndices[neighbourOffsets[i] .. neighbourOffsets[i + 1]), so there are
+ * points.size() + 1 offsets. Covariances are built a block at a time and handed to the batched 3x3 eigen solver,
+ * with blocks spread across threads. normals[i] is the (unoriented) direction of least variance; eigenvalues,
+ * if requested, are the variances along the principal axes in descending order. Neighbourhoods of fewer than
+ * 3 points get a zero normal.
+ */
+inline void make_local_principal_axes(const std::vector<float3> & points, const std::vector<uint32_t> & neighbourOffsets, const std::vector<uint32_t> & neighbourIndices,
+    std::vector<float3> & normals, std::vector<float3> * eigenvalues = nullptr)
+{
+    assert(neighbourOffsets.size() == points.size() + 1);
+
+    const size_t n = points.size();
+    normals.resize(n);
+    if (eigenvalues) eigenvalues->resize(n);
+
+    static const size_t BlockSize = 256;
+    const size_t numBlocks = (n + BlockSize - 1) / BlockSize;
+
+    parallel_for(0, numBlocks, 16, [&](size_t blockBegin, size_t blockEnd)
+    {
+        float3x3 covariance[BlockSize], axes[BlockSize];
+        float3 variance[BlockSize];
+
+        for (size_t block = blockBegin; block < blockEnd; ++block)
+        {
+            const size_t first = block * BlockSize;
+            const size_t count = std::min(BlockSize, n - first);
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                const uint32_t begin = neighbourOffsets[first + i], end = neighbourOffsets[first + i + 1];
+                covariance[i] = (end - begin >= 3) ? pca_impl::neighbourhood_covariance(points.data(), neighbourIndices.data() + begin, end - begin) : float3x3();
+            }
+
+            symmetric_eigen_decomposition_3x3(covariance, count, axes, variance);
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                const bool valid = neighbourOffsets[first + i + 1] - neighbourOffsets[first + i] >= 3;
+                normals[first + i] = valid ? axes[i].z : float3(0, 0, 0);
+                if (eigenvalues) (*eigenvalues)[first + i] = variance[i];
+            }
+        }
+    });
+}
+
+/*
+ * Per-point normals from the k nearest neighbours of each point (the point itself included), as the direction of
+ * least variance of the neighbourhood. Points are processed in tree order, a block at a time, so neighbouring
+ * queries touch the same part of the tree; blocks run in parallel. Normals are unoriented, and indexed like the
+ * cloud the tree was built from. eigenvalues, if requested, are the neighbourhood variances in descending order.
+ */
+inline std::vector<float3> make_pointcloud_normals(const KDTree & tree, const uint32_t k, std::vector<float3> * eigenvalues = nullptr)
+{
+    const size_t n = tree.size();
+    const std::vector<float3> & treePoints = tree.tree_points();
+    const std::vector<uint32_t> & treeIndices = tree.tree_indices();
+
+    std::vector<float3> normals(n);
+    if (eigenvalues) eigenvalues->resize(n);
+
+    static const size_t BlockSize = 256;
+    const size_t numBlocks = (n + BlockSize - 1) / BlockSize;
+
+    parallel_for(0, numBlocks, 16, [&](size_t blockBegin, size_t blockEnd)
+    {
+        std::vector<float3x3> covariance(BlockSize), axes(BlockSize);
+        std::vector<float3> variance(BlockSize);
+        std::vector<uint32_t> slots(k);
+        std::vector<float> dist2(k);
+        std::vector<uint8_t> valid(BlockSize);
+
+        for (size_t block = blockBegin; block < blockEnd; ++block)
+        {
+            const size_t first = block * BlockSize;
+            const size_t count = std::min(BlockSize, n - first);
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                const uint32_t found = tree.knn_slots(treePoints[first + i], k, slots.data(), dist2.data());
+                valid[i] = found >= 3;
+                covariance[i] = valid[i] ? pca_impl::neighbourhood_covariance(treePoints.data(), slots.data(), found) : float3x3();
+            }
+
+            symmetric_eigen_decomposition_3x3(covariance.data(), count, axes.data(), variance.data());
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                const uint32_t original = treeIndices[first + i];
+                normals[original] = valid[i] ? axes[i].z : float3(0, 0, 0);
+                if (eigenvalues) (*eigenvalues)[original] = variance[i];
+            }
+        }
+    });
+
+    return normals;
+}
+
+inline std::vector<float3> make_pointcloud_normals(const std::vector<float3> & points, const uint32_t k)
+{
+    return make_pointcloud_normals(KDTree(points), k);
+}
+
+/*
+ * Statistical outlier removal, as in PCL: a point is dropped when its mean distance to its k nearest neighbours
+ * is more than `stdDevMultiplier` standard deviations above the mean of that distance over the whole cloud.
+ * `tree` must have been built from `points`. Survivors keep their relative order; keptIndices receives their
+ * indices in `points`.
+ */
+inline std::vector<float3> make_outlier_filtered_pointcloud(const std::vector<float3> & points, const KDTree & tree, const uint32_t k, const float stdDevMultiplier, std::vector<uint32_t> * keptIndices = nullptr)
+{
+    assert(tree.size() == points.size());
+
+    const size_t n = points.size();
+    const std::vector<float3> & treePoints = tree.tree_points();
+    std::vector<float> meanDistance(n, 0.0f);
+
+    // Queries go in tree order for locality
+    parallel_for(0, n, 4096, [&](size_t b, size_t e)
+    {
+        // One extra neighbour, since each point finds itself
+        std::vector<uint32_t> slots(k + 1);
+        std::vector<float> dist2(k + 1);
+        for (size_t s = b; s < e; ++s)
+        {
+            const uint32_t found = tree.knn_slots(treePoints[s], k + 1, slots.data(), dist2.data());
+            float sum = 0.0f;
+            uint32_t used = 0;
+            for (uint32_t j = 0; j < found && used < k; ++j)
+            {
+                if (slots[j] == s) continue;
+                sum += std::sqrt(dist2[j]);
+                ++used;
+            }
+            meanDistance[tree.tree_indices()[s]] = used ? sum / float(used) : 0.0f;
+        }
+    });
+
+    double sum = 0.0, sumSquares = 0.0;
+    for (const float d : meanDistance) { sum += d; sumSquares += double(d) * d; }
+    const double mean = n ? sum / double(n) : 0.0;
+    const double variance = n > 1 ? std::max(0.0, (sumSquares - sum * mean) / double(n - 1)) : 0.0;
+    const float threshold = float(mean + stdDevMultiplier * std::sqrt(variance));
+
+    std::vector<float3> inliers;
+    inliers.reserve(n);
+    if (keptIndices) keptIndices->clear();
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (meanDistance[i] > threshold) continue;
+        inliers.push_back(points[i]);
+        if (keptIndices) keptIndices->push_back(uint32_t(i));
+    }
+    return inliers;
+}
+
+inline std::vector<float3> make_outlier_filtered_pointcloud(const std::vector<float3> & points, const uint32_t k, const float stdDevMultiplier, std::vector<uint32_t> * keptIndices = nullptr)
+{
+    return make_outlier_filtered_pointcloud(points, KDTree(points), k, stdDevMultiplier, keptIndices);
+}
+
 // Returns principal axes as a pose and population's variance along pose's local x,y,z
 inline std::pair<Pose, float3> make_principal_axes(const std::vector<float3> & points)
 {
@@ -1,9 +1,21 @@
 // based on http://www.johndcook.com/blog/skewness_kurtosis/
+// Quantile sketch after DDSketch (Masson, Rim, Lee - "DDSketch: A Fast and Fully-Mergeable Quantile Sketch
+// with Relative-Error Guarantees", VLDB 2019)
 
 #ifndef running_stats_h
 #define running_stats_h
 
 #include <stdint.h>
+#include <assert.h>
+#include <cmath>
+#include <vector>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include <type_traits>
 
 namespace avl
 {
@@ -13,6 +25,7 @@ namespace avl
     {
         uint64_t n;
         T M1, M2, M3, M4;
+        T minimum, maximum;
     public:
 
         RunningStats()
@@ -22,21 +35,30 @@ namespace avl
 
         friend RunningStats operator + (const RunningStats a, const RunningStats b)
         {
+            if (a.n == 0) return b;
+            if (b.n == 0) return a;
+
             RunningStats combined;
 
-            combined.n += a.n + b.n;
+            combined.n = a.n + b.n;
+
+            // Counts as T; (a.n - b.n) would wrap around as unsigned
+            const T an = T(a.n), bn = T(b.n), cn = T(combined.n);
 
             T delta = b.M1 - a.M1;
             T delta2 = delta*delta;
             T delta3 = delta*delta2;
             T delta4 = delta2*delta2;
 
-            combined.M1 = (a.n*a.M1 + b.n*b.M1) / combined.n;
-            combined.M2 = a.M2 + b.M2 + delta2 * a.n * b.n / combined.n;
-            combined.M3 = a.M3 + b.M3 +  delta3 * a.n * b.n * (a.n - b.n)/(combined.n*combined.n);
-            combined.M3 += 3.0 * delta * (a.n*b.M2 - b.n*a.M2) / combined.n;
-            combined.M4 = a.M4 + b.M4 + delta4*a.n*b.n * (a.n*a.n - a.n*b.n + b.n*b.n) / (combined.n*combined.n*combined.n);
-            combined.M4 += 6.0 * delta2 * (a.n*a.n*b.M2 + b.n*b.n*a.M2)/(combined.n*combined.n) + 4.0 * delta*(a.n*b.M3 - b.n*a.M3) / combined.n;
+            combined.M1 = (an*a.M1 + bn*b.M1) / cn;
+            combined.M2 = a.M2 + b.M2 + delta2 * an * bn / cn;
+            combined.M3 = a.M3 + b.M3 +  delta3 * an * bn * (an - bn)/(cn*cn);
+            combined.M3 += 3.0 * delta * (an*b.M2 - bn*a.M2) / cn;
+            combined.M4 = a.M4 + b.M4 + delta4*an*bn * (an*an - an*bn + bn*bn) / (cn*cn*cn);
+            combined.M4 += 6.0 * delta2 * (an*an*b.M2 + bn*bn*a.M2)/(cn*cn) + 4.0 * delta*(an*b.M3 - bn*a.M3) / cn;
+
+            combined.minimum = std::min(a.minimum, b.minimum);
+            combined.maximum = std::max(a.maximum, b.maximum);
 
             return combined;
         }
@@ -52,6 +74,8 @@ namespace avl
         {
             n = 0;
             M1 = M2 = M3 = M4 = 0;
+            minimum = std::numeric_limits<T>::max();
+            maximum = std::numeric_limits<T>::lowest();
         }
 
         void put(T x)
@@ -68,6 +92,9 @@ namespace avl
             M4 += term1 * delta_n2 * (n*n - 3*n + 3) + 6 * delta_n2 * M2 - 4 * delta_n * M3;
             M3 += term1 * delta_n * (n - 2) - 3 * delta_n * M2;
             M2 += term1;
+
+            minimum = std::min(minimum, x);
+            maximum = std::max(maximum, x);
         }
 
         uint64_t num_values() const
@@ -100,8 +127,422 @@ namespace avl
             return T(n) * M4 / (M2 * M2) - (T) 3.0;
         }
 
+        T compute_min() const
+        {
+            return minimum;
+        }
+
+        T compute_max() const
+        {
+            return maximum;
+        }
+
+    };
+
+    ////////////////////////
+    //   QuantileSketch   //
+    ////////////////////////
+
+    // Values are counted in logarithmically sized buckets, so any quantile comes back within `relativeAccuracy`
+    // of the true value regardless of the distribution. Two sketches with the same accuracy merge by adding
+    // bucket counts, which is exact: merging per-thread or per-frame sketches gives the same answer as one
+    // sketch over the whole stream. Counts are weights, which is what allows exponential decay.
+    // When more than `maxBuckets` are in use the lowest ones are folded together, trading accuracy on the
+    // smallest magnitudes for bounded memory.
+    class QuantileSketch
+    {
+        struct bucket_store
+        {
+            std::vector<double> counts;
+            int32_t offset{ 0 };    // key of counts[0]
+            double total{ 0 };
+
+            void add(const int32_t key, const double weight, const size_t maxBuckets)
+            {
+                if (counts.empty())
+                {
+                    counts.assign(1, 0.0);
+                    offset = key;
+                }
+                else if (key < offset)
+                {
+                    const size_t grow = size_t(offset - key);
+                    if (counts.size() + grow > maxBuckets)
+                    {
+                        // Below everything kept; lands in the lowest bucket
+                        counts[0] += weight;
+                        total += weight;
+                        return;
+                    }
+                    counts.insert(counts.begin(), grow, 0.0);
+                    offset = key;
+                }
+                else if (key >= offset + int32_t(counts.size()))
+                {
+                    counts.resize(size_t(key - offset) + 1, 0.0);
+                    collapse(maxBuckets);
+                }
+                counts[size_t(key - offset)] += weight;
+                total += weight;
+            }
+
+            // Folds the lowest buckets into one so that at most `maxBuckets` remain
+            void collapse(const size_t maxBuckets)
+            {
+                if (counts.size() <= maxBuckets) return;
+                const size_t excess = counts.size() - maxBuckets;
+                double folded = 0;
+                for (size_t i = 0; i <= excess; ++i) folded += counts[i];
+                counts.erase(counts.begin(), counts.begin() + excess);
+                counts[0] = folded;
+                offset += int32_t(excess);
+            }
+
+            void merge(const bucket_store & other, const size_t maxBuckets)
+            {
+                if (other.counts.empty()) return;
+                if (counts.empty()) { *this = other; return; }
+
+                const int32_t lo = std::min(offset, other.offset);
+                const int32_t hi = std::max(offset + int32_t(counts.size()), other.offset + int32_t(other.counts.size()));
+                if (lo < offset) counts.insert(counts.begin(), size_t(offset - lo), 0.0);
+                offset = lo;
+                counts.resize(size_t(hi - lo), 0.0);
+                for (size_t i = 0; i < other.counts.size(); ++i) counts[size_t(other.offset - lo) + i] += other.counts[i];
+                total += other.total;
+                collapse(maxBuckets);
+            }
+
+            void scale(const double f)
+            {
+                for (auto & c : counts) c *= f;
+                total *= f;
+            }
+
+            void clear() { counts.clear(); offset = 0; total = 0; }
+        };
+
+        double relativeAccuracy;
+        double gamma;
+        double logGamma;
+        double minIndexable;
+        size_t maxBuckets;
+
+        bucket_store positive;
+        bucket_store negative;  // keyed on magnitude
+        double zeroCount{ 0 };
+        double minimum{ std::numeric_limits<double>::max() };
+        double maximum{ std::numeric_limits<double>::lowest() };
+
+        int32_t key(const double magnitude) const { return int32_t(std::ceil(std::log(magnitude) / logGamma)); }
+
+        // Midpoint of the bucket in the relative sense: within `relativeAccuracy` of anything stored in it
+        double value(const int32_t k) const { return 2.0 * std::pow(gamma, double(k)) / (gamma + 1.0); }
+
+    public:
+
+        QuantileSketch(const double relativeAccuracy = 0.01, const size_t maxBuckets = 2048) : relativeAccuracy(relativeAccuracy), maxBuckets(std::max<size_t>(maxBuckets, 1))
+        {
+            gamma = (1.0 + relativeAccuracy) / (1.0 - relativeAccuracy);
+            logGamma = std::log(gamma);
+            minIndexable = std::max(std::numeric_limits<double>::min() * gamma, std::exp(double(std::numeric_limits<int32_t>::min() + 1) * logGamma));
+        }
+
+        void put(const double x, const double weight = 1.0)
+        {
+            if (x > minIndexable) positive.add(key(x), weight, maxBuckets);
+            else if (x < -minIndexable) negative.add(key(-x), weight, maxBuckets);
+            else zeroCount += weight;
+            minimum = std::min(minimum, x);
+            maximum = std::max(maximum, x);
+        }
+
+        // Both sketches must have been created with the same accuracy, or the bucket keys don't line up
+        void merge(const QuantileSketch & other)
+        {
+            assert(other.relativeAccuracy == relativeAccuracy);
+            positive.merge(other.positive, maxBuckets);
+            negative.merge(other.negative, maxBuckets);
+            zeroCount += other.zeroCount;
+            minimum = std::min(minimum, other.minimum);
+            maximum = std::max(maximum, other.maximum);
+        }
+
+        QuantileSketch & operator += (const QuantileSketch & rhs) { merge(rhs); return *this; }
+
+        // Multiplies every weight by `f` (0..1). Quantiles only depend on relative weights, so decaying
+        // sketches can instead grow the weight of new samples and call this now and then to renormalize.
+        void scale(const double f)
+        {
+            positive.scale(f);
+            negative.scale(f);
+            zeroCount *= f;
+        }
+
+        void clear()
+        {
+            positive.clear();
+            negative.clear();
+            zeroCount = 0;
+            minimum = std::numeric_limits<double>::max();
+            maximum = std::numeric_limits<double>::lowest();
+        }
+
+        double total_weight() const { return positive.total + negative.total + zeroCount; }
+        bool empty() const { return total_weight() <= 0.0; }
+
+        double compute_min() const { return minimum; }
+        double compute_max() const { return maximum; }
+        double get_relative_accuracy() const { return relativeAccuracy; }
+
+        // q in [0, 1]; the result is clamped to the exact min/max
+        double compute_quantile(const double q) const
+        {
+            const double total = total_weight();
+            if (total <= 0.0) return std::numeric_limits<double>::quiet_NaN();
+            if (q <= 0.0) return minimum;
+            if (q >= 1.0) return maximum;
+
+            const double rank = q * total;
+            double seen = 0;
+            double result = maximum;
+
+            // Most negative first
+            bool found = false;
+            for (size_t i = negative.counts.size(); i-- > 0 && !found;)
+            {
+                seen += negative.counts[i];
+                if (seen >= rank) { result = -value(negative.offset + int32_t(i)); found = true; }
+            }
+            if (!found)
+            {
+                seen += zeroCount;
+                if (seen >= rank) { result = 0.0; found = true; }
+            }
+            for (size_t i = 0; i < positive.counts.size() && !found; ++i)
+            {
+                seen += positive.counts[i];
+                if (seen >= rank) { result = value(positive.offset + int32_t(i)); found = true; }
+            }
+            return std::min(maximum, std::max(minimum, result));
+        }
+    };
+
+    //////////////////////
+    //   StreamingStats //
+    //////////////////////
+
+    // Moments, extrema and quantiles of a stream; fully mergeable
+    template<typename T>
+    class StreamingStats
+    {
+        RunningStats<double> moments;
+        QuantileSketch sketch;
+    public:
+
+        StreamingStats(const double relativeAccuracy = 0.01) : sketch(relativeAccuracy) { }
+
+        void put(const T x)
+        {
+            moments.put(double(x));
+            sketch.put(double(x));
+        }
+
+        StreamingStats & operator += (const StreamingStats & rhs)
+        {
+            moments += rhs.moments;
+            sketch.merge(rhs.sketch);
+            return *this;
+        }
+
+        friend StreamingStats operator + (StreamingStats a, const StreamingStats & b) { a += b; return a; }
+
+        void clear()
+        {
+            moments.clear();
+            sketch.clear();
+        }
+
+        uint64_t num_values() const { return moments.num_values(); }
+        double compute_mean() const { return moments.compute_mean(); }
+        double compute_variance() const { return moments.compute_variance(); }
+        double compute_std_dev() const { return moments.compute_std_dev(); }
+        double compute_min() const { return moments.compute_min(); }
+        double compute_max() const { return moments.compute_max(); }
+        double compute_quantile(const double q) const { return sketch.compute_quantile(q); }
+
+        const RunningStats<double> & get_moments() const { return moments; }
+        const QuantileSketch & get_sketch() const { return sketch; }
+    };
+
+    //////////////////////
+    //   DecayingStats  //
+    //////////////////////
+
+    // Exponentially decayed mean, variance and quantiles: a sample's weight halves every `halfLife` units of
+    // whatever is passed to `advance` (seconds, frames...). Min/max are not decayed and cover every sample
+    // since the last clear; use the quantiles for a recent range.
+    template<typename T>
+    class DecayingStats
+    {
+        double halfLife;
+        double weight{ 0 }, mean{ 0 }, m2{ 0 };
+
+        // Forward decay for the sketch: new samples get weight `boost`, which grows as time advances
+        QuantileSketch sketch;
+        double boost{ 1.0 };
+
+    public:
+
+        DecayingStats(const double halfLife, const double relativeAccuracy = 0.01) : halfLife(halfLife), sketch(relativeAccuracy) { }
+
+        void advance(const double dt)
+        {
+            const double f = std::exp2(-dt / halfLife);
+            weight *= f;
+            m2 *= f;
+            boost /= f;
+            if (boost > 1e100)
+            {
+                sketch.scale(1.0 / boost);
+                boost = 1.0;
+            }
+        }
+
+        void put(const T v)
+        {
+            const double x = double(v);
+            weight += 1.0;
+            const double d = x - mean;
+            mean += d / weight;
+            m2 += d * (x - mean);
+            sketch.put(x, boost);
+        }
+
+        void clear()
+        {
+            weight = mean = m2 = 0;
+            boost = 1.0;
+            sketch.clear();
+        }
+
+        double effective_count() const { return weight; }
+        double compute_mean() const { return mean; }
+        double compute_variance() const { return weight > 0 ? m2 / weight : 0.0; }
+        double compute_std_dev() const { return std::sqrt(compute_variance()); }
+        double compute_min() const { return sketch.compute_min(); }
+        double compute_max() const { return sketch.compute_max(); }
+        double compute_quantile(const double q) const { return sketch.compute_quantile(q); }
+    };
+
+    ///////////////////////
+    //  ConcurrentStats  //
+    ///////////////////////
+
+    // Each thread accumulates into its own shard, so `put` doesn't lock once the calling thread has a shard.
+    // The first put from a thread on an instance registers the shard under a mutex, which `collect` only holds
+    // long enough to snapshot the shard list; threads that must never block should put once up front.
+    // `collect` swaps every shard's accumulator for a spare one and merges what was taken, so writers never wait
+    // on the collector and the collector only waits for a put that is already in flight. Collection is meant
+    // to run from one thread at a time (it is serialized internally).
+    template<typename T>
+    class ConcurrentStats
+    {
+        struct shard
+        {
+            std::atomic<StreamingStats<T> *> current{ nullptr };
+            std::atomic<bool> busy{ false };
+            std::unique_ptr<StreamingStats<T>> a, b;
+        };
+
+        struct cache_entry
+        {
+            uint64_t id;
+            shard * s;
+            std::weak_ptr<void> alive;
+        };
+
+        const uint64_t id;
+        const double relativeAccuracy;
+        const std::shared_ptr<void> alive{ std::make_shared<char>(0) }; // expires with the instance
+        std::mutex registryMutex;   // guards `shards`
+        std::mutex collectMutex;    // serializes collect()
+        std::vector<std::unique_ptr<shard>> shards;
+        std::vector<shard *> collecting;
+        StreamingStats<T> total;
+
+        static uint64_t next_id()
+        {
+            static std::atomic<uint64_t> counter{ 1 };
+            return counter.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        shard * local_shard()
+        {
+            // Keyed by instance id rather than address so that a recycled address never maps to a dead shard
+            static thread_local std::vector<cache_entry> cache;
+            for (auto & e : cache) if (e.id == id) return e.s;
+
+            // On a miss, drop the entries of instances that have since been destroyed
+            cache.erase(std::remove_if(cache.begin(), cache.end(), [](const cache_entry & e) { return e.alive.expired(); }), cache.end());
+
+            std::unique_ptr<shard> s(new shard());
+            s->a.reset(new StreamingStats<T>(relativeAccuracy));
+            s->b.reset(new StreamingStats<T>(relativeAccuracy));
+            s->current.store(s->a.get(), std::memory_order_release);
+            shard * result = s.get();
+            {
+                std::lock_guard<std::mutex> guard(registryMutex);
+                shards.push_back(std::move(s));
+            }
+            cache.push_back({ id, result, alive });
+            return result;
+        }
+
+    public:
+
+        ConcurrentStats(const double relativeAccuracy = 0.01) : id(next_id()), relativeAccuracy(relativeAccuracy), total(relativeAccuracy) { }
+
+        ConcurrentStats(const ConcurrentStats &) = delete;
+        ConcurrentStats & operator = (const ConcurrentStats &) = delete;
+
+        void put(const T x)
+        {
+            shard * s = local_shard();
+            s->busy.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst); // pairs with the fence in collect()
+            s->current.load(std::memory_order_acquire)->put(x);
+            s->busy.store(false, std::memory_order_release);
+        }
+
+        // Merges everything put since the last call, adds it to the running total and returns it
+        StreamingStats<T> collect()
+        {
+            StreamingStats<T> interval(relativeAccuracy);
+            std::lock_guard<std::mutex> guard(collectMutex);
+            {
+                // Shards are never removed, so the snapshot stays valid; ones registered after it wait for the next call
+                std::lock_guard<std::mutex> registryGuard(registryMutex);
+                collecting.clear();
+                for (auto & s : shards) collecting.push_back(s.get());
+            }
+            for (shard * s : collecting)
+            {
+                StreamingStats<T> * spare = (s->current.load(std::memory_order_relaxed) == s->a.get()) ? s->b.get() : s->a.get();
+                StreamingStats<T> * taken = s->current.exchange(spare, std::memory_order_acq_rel);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                while (s->busy.load(std::memory_order_acquire)) std::this_thread::yield();
+                interval += *taken;
+                taken->clear();
+            }
+            total += interval;
+            return interval;
+        }
+
+        // Everything collected so far
+        const StreamingStats<T> & get_total() const { return total; }
     };
 
 }
- 
-#endif // end running_stats_h
\ No newline at end of file
+
+#endif // end running_stats_h
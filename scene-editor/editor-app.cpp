@@ -6,12 +6,24 @@
 
 using namespace avl;
 
+// Adds or removes a preprocessor define on a watched shader and queues a recompile
+static void set_shader_define(ShaderMonitor & monitor, const uint32_t asset, const std::string & define, const bool enabled)
+{
+    auto & shaderAsset = monitor.get_asset(asset);
+    auto & defines = shaderAsset.defines;
+    auto itr = std::find(defines.begin(), defines.end(), define);
+    if (enabled && itr == defines.end()) defines.push_back(define);
+    else if (!enabled && itr != defines.end()) defines.erase(itr);
+    shaderAsset.shouldRecompile = true;
+}
+
 scene_editor_app::scene_editor_app() : GLFWApp(1920, 1080, "Scene Editor")
 {
     std::cout << "Timestamp: " << HumanTime().make_timestamp() << std::endl;
 
     glfwMakeContextCurrent(window);
     glfwSwapInterval(1);
+    set_gpu_timing(true);
 
     int width, height;
     glfwGetWindowSize(window, &width, &height);
@@ -33,7 +45,7 @@ scene_editor_app::scene_editor_app() : GLFWApp(1920, 1080, "Scene Editor")
         read_file_text("../assets/shaders/wireframe_geom.glsl"));
     create_handle_for_asset("wireframe", std::move(wireframeProgram));
 
-    shaderMonitor.watch(
+    depthPrepassProgramAsset = shaderMonitor.watch(
         "../assets/shaders/renderer/depth_prepass_vert.glsl",
         "../assets/shaders/renderer/depth_prepass_frag.glsl",
         "../assets/shaders/renderer", {}, [](GlShader shader)
@@ -41,7 +53,7 @@ scene_editor_app::scene_editor_app() : GLFWApp(1920, 1080, "Scene Editor")
         create_handle_for_asset("depth-prepass", std::move(shader));
     });
 
-    shaderMonitor.watch(
+    defaultProgramAsset = shaderMonitor.watch(
         "../assets/shaders/renderer/forward_lighting_vert.glsl",
         "../assets/shaders/renderer/default_material_frag.glsl",
         "../assets/shaders/renderer", {}, [](GlShader shader)
@@ -63,21 +75,12 @@ scene_editor_app::scene_editor_app() : GLFWApp(1920, 1080, "Scene Editor")
     shaderMonitor.watch(
         "../assets/shaders/renderer/shadowcascade_vert.glsl", 
         "../assets/shaders/renderer/shadowcascade_frag.glsl", 
-        "../assets/shaders/renderer/shadowcascade_geom.glsl", 
         "../assets/shaders/renderer", {}, 
         [](GlShader shader) 
     {
         create_handle_for_asset("cascaded-shadows", std::move(shader));
     });
 
-    shaderMonitor.watch(
-        "../assets/shaders/renderer/post_tonemap_vert.glsl",
-        "../assets/shaders/renderer/post_tonemap_frag.glsl",
-        [](GlShader shader) 
-    {
-        create_handle_for_asset("post-tonemap", std::move(shader));
-    });
-
     renderer_settings settings;
     settings.renderSize = float2(width, height);
     renderer.reset(new forward_renderer(settings));
@@ -103,17 +106,24 @@ scene_editor_app::scene_editor_app() : GLFWApp(1920, 1080, "Scene Editor")
     create_handle_for_asset("wells-radiance-cubemap", load_cubemap(radianceHandle));
     create_handle_for_asset("wells-irradiance-cubemap", load_cubemap(irradianceHandle));
 
-    create_handle_for_asset("rusted-iron-albedo", load_image("../assets/nonfree/Metal_ModernMetalIsoDiamondTile_2k_basecolor.tga", false));
-    create_handle_for_asset("rusted-iron-normal", load_image("../assets/nonfree/Metal_ModernMetalIsoDiamondTile_2k_n.tga", false));
-    create_handle_for_asset("rusted-iron-metallic", load_image("../assets/nonfree/Metal_ModernMetalIsoDiamondTile_2k_metallic.tga", false));
-    create_handle_for_asset("rusted-iron-roughness", load_image("../assets/nonfree/Metal_ModernMetalIsoDiamondTile_2k_roughness.tga", false));
-    create_handle_for_asset("rusted-iron-occlusion", load_image("../assets/nonfree/Metal_ModernMetalIsoDiamondTile_2k_ao.tga", false));
+    // Material textures arrive over the next few frames; handles resolve to an empty texture until then
+    textureStreamer.reset(new GlTextureStreamer());
+    auto stream_texture = [this](const std::string & name, const std::string & path)
+    {
+        textureStreamer->load(path, [name](GlTexture2D tex) { create_handle_for_asset(name.c_str(), std::move(tex)); }, false);
+    };
+
+    stream_texture("rusted-iron-albedo", "../assets/nonfree/Metal_ModernMetalIsoDiamondTile_2k_basecolor.tga");
+    stream_texture("rusted-iron-normal", "../assets/nonfree/Metal_ModernMetalIsoDiamondTile_2k_n.tga");
+    stream_texture("rusted-iron-metallic", "../assets/nonfree/Metal_ModernMetalIsoDiamondTile_2k_metallic.tga");
+    stream_texture("rusted-iron-roughness", "../assets/nonfree/Metal_ModernMetalIsoDiamondTile_2k_roughness.tga");
+    stream_texture("rusted-iron-occlusion", "../assets/nonfree/Metal_ModernMetalIsoDiamondTile_2k_ao.tga");
 
-    create_handle_for_asset("scifi-floor-albedo", load_image("../assets/nonfree/Metal_ScifiHangarFloor_2k_basecolor.tga", false));
-    create_handle_for_asset("scifi-floor-normal", load_image("../assets/nonfree/Metal_ScifiHangarFloor_2k_n.tga", false));
-    create_handle_for_asset("scifi-floor-metallic", load_image("../assets/nonfree/Metal_ScifiHangarFloor_2k_metallic.tga", false));
-    create_handle_for_asset("scifi-floor-roughness", load_image("../assets/nonfree/Metal_ScifiHangarFloor_2k_roughness.tga", false));
-    create_handle_for_asset("scifi-floor-occlusion", load_image("../assets/nonfree/Metal_ScifiHangarFloor_2k_ao.tga", false));
+    stream_texture("scifi-floor-albedo", "../assets/nonfree/Metal_ScifiHangarFloor_2k_basecolor.tga");
+    stream_texture("scifi-floor-normal", "../assets/nonfree/Metal_ScifiHangarFloor_2k_n.tga");
+    stream_texture("scifi-floor-metallic", "../assets/nonfree/Metal_ScifiHangarFloor_2k_metallic.tga");
+    stream_texture("scifi-floor-roughness", "../assets/nonfree/Metal_ScifiHangarFloor_2k_roughness.tga");
+    stream_texture("scifi-floor-occlusion", "../assets/nonfree/Metal_ScifiHangarFloor_2k_ao.tga");
 
     std::shared_ptr<DefaultMaterial> default = std::make_shared<DefaultMaterial>();
     create_handle_for_asset("default-material", static_cast<std::shared_ptr<Material>>(default));
@@ -160,7 +170,8 @@ scene_editor_app::scene_editor_app() : GLFWApp(1920, 1080, "Scene Editor")
 
 scene_editor_app::~scene_editor_app()
 { 
-
+    // The profiler is a static and outlives the GL context owned by GLFWApp
+    frame_profiler::get_instance().shutdown();
 }
 
 void scene_editor_app::on_drop(std::vector<std::string> filepaths)
@@ -170,9 +181,10 @@ void scene_editor_app::on_drop(std::vector<std::string> filepaths)
         std::transform(path.begin(), path.end(), path.begin(), ::tolower);
         const std::string fileExtension = get_extension(path);
 
-        if (fileExtension == "png" || fileExtension == "tga" || fileExtension == "jpg")
+        if (fileExtension == "png" || fileExtension == "tga" || fileExtension == "jpg" || fileExtension == "dds" || fileExtension == "ktx")
         {
-            create_handle_for_asset(get_filename_without_extension(path).c_str(), load_image(path, false));
+            const std::string name = get_filename_without_extension(path);
+            textureStreamer->load(path, [name](GlTexture2D tex) { create_handle_for_asset(name.c_str(), std::move(tex)); }, false);
             return;
         }
 
@@ -308,10 +320,154 @@ void scene_editor_app::on_update(const UpdateEvent & e)
     editor->on_update(cam, float2(width, height));
 }
 
+void scene_editor_app::run_stereo_benchmark(const int frames)
+{
+    int width, height;
+    glfwGetWindowSize(window, &width, &height);
+    const float aspect = float(width) / float(height);
+
+    const Pose cameraPose = cam.get_pose();
+    const float4x4 projectionMatrix = cam.get_projection_matrix(aspect);
+    const float halfIpd = 0.032f;
+
+    scene_data data;
+    data.skybox = sceneData.skybox;
+    data.sunlight = sceneData.sunlight;
+    for (auto & obj : scene.objects)
+    {
+        if (auto * r = dynamic_cast<PointLight*>(obj.get())) data.pointLights.push_back(r->data);
+        if (auto * r = dynamic_cast<Renderable*>(obj.get())) data.renderSet.push_back(r);
+    }
+
+    struct mode { const char * name; int cameraCount; bool singlePass; };
+    const mode modes[] = { { "mono", 1, false }, { "sequential stereo", 2, false }, { "single-pass stereo", 2, true } };
+
+    std::cout << "Stereo benchmark: " << data.renderSet.size() << " renderables, " << frames << " frames at " << width << "x" << height << std::endl;
+
+    for (const mode & m : modes)
+    {
+        for (auto asset : { pbrProgramAsset, depthPrepassProgramAsset, defaultProgramAsset })
+        {
+            set_shader_define(shaderMonitor, asset, "SINGLE_PASS_STEREO", m.singlePass);
+        }
+        shaderMonitor.handle_recompile();
+
+        renderer_settings settings = renderer->settings;
+        settings.renderSize = float2(width, height);
+        settings.cameraCount = m.cameraCount;
+        settings.singlePassStereo = m.singlePass;
+        forward_renderer benchRenderer(settings);
+
+        data.views.clear();
+        if (m.cameraCount == 1)
+        {
+            data.views.push_back(view_data(0, cameraPose, projectionMatrix));
+        }
+        else
+        {
+            data.views.push_back(view_data(0, cameraPose * Pose(float3(-halfIpd, 0, 0)), projectionMatrix));
+            data.views.push_back(view_data(1, cameraPose * Pose(float3(+halfIpd, 0, 0)), projectionMatrix));
+        }
+
+        // Warm up shader caches, batches and driver state before timing
+        for (int i = 0; i < 10; ++i) benchRenderer.render_frame(data);
+        glFinish();
+
+        double submitMs = 0.0;
+        SimpleTimer t(true);
+        for (int i = 0; i < frames; ++i)
+        {
+            SimpleTimer submit(true);
+            benchRenderer.render_frame(data);
+            submitMs += submit.nanoseconds().count() * 1e-6;
+        }
+        glFinish();
+        const double totalMs = t.nanoseconds().count() * 1e-6;
+
+        std::cout << "  " << m.name << ": " << submitMs / frames << " ms CPU submit, " << totalMs / frames << " ms per frame incl. GPU" << std::endl;
+    }
+
+    // Put the shaders back the way the live renderer expects them
+    for (auto asset : { pbrProgramAsset, depthPrepassProgramAsset, defaultProgramAsset })
+    {
+        set_shader_define(shaderMonitor, asset, "SINGLE_PASS_STEREO", renderer->settings.singlePassStereo);
+    }
+    shaderMonitor.handle_recompile();
+}
+
+void scene_editor_app::run_texture_streaming_benchmark(const int count)
+{
+    const std::vector<std::string> images =
+    {
+        "../assets/images/anvil.png", "../assets/images/particle_alt_large.png", "../assets/images/perlin.png",
+        "../assets/images/polygon_heart.png", "../assets/images/sandbox-cover.png", "../assets/images/splatter.png",
+        "../assets/images/uv_grid.png"
+    };
+
+    std::cout << "Texture streaming benchmark: " << count << " textures" << std::endl;
+
+    // Blocking path: every load stalls the render thread for its full read + decode + upload
+    {
+        double worstMs = 0.0;
+        SimpleTimer t(true);
+        for (int i = 0; i < count; ++i)
+        {
+            SimpleTimer one(true);
+            GlTexture2D tex = load_image(images[i % images.size()]);
+            worstMs = std::max(worstMs, one.nanoseconds().count() * 1e-6);
+        }
+        glFinish();
+        const double totalMs = t.nanoseconds().count() * 1e-6;
+        std::cout << "  load_image: " << totalMs << " ms on the render thread, worst single stall " << worstMs << " ms" << std::endl;
+    }
+
+    // Streaming path: each iteration stands in for a frame; only update() runs on the render thread
+    {
+        GlTextureStreamer streamer;
+        int ready = 0;
+
+        SimpleTimer t(true);
+        for (int i = 0; i < count; ++i) streamer.load(images[i % images.size()], [&ready](GlTexture2D) { ++ready; });
+        const double requestMs = t.nanoseconds().count() * 1e-6;
+
+        int frames = 0;
+        double updateMs = 0.0, worstMs = 0.0;
+        while (streamer.pending())
+        {
+            SimpleTimer one(true);
+            streamer.update();
+            const double ms = one.nanoseconds().count() * 1e-6;
+            updateMs += ms;
+            worstMs = std::max(worstMs, ms);
+            glFlush();
+            ++frames;
+        }
+        glFinish();
+        const double totalMs = t.nanoseconds().count() * 1e-6;
+
+        std::cout << "  GlTextureStreamer: " << ready << " ready after " << totalMs << " ms, " << frames << " frames; render thread spent "
+            << requestMs + updateMs << " ms (" << (frames ? updateMs / frames : 0.0) << " ms mean, " << worstMs << " ms worst update)" << std::endl;
+    }
+}
+
 void scene_editor_app::on_draw()
 {
     glfwMakeContextCurrent(window);
 
+    textureStreamer->update();
+
+    if (stereoBenchmarkRequested)
+    {
+        stereoBenchmarkRequested = false;
+        run_stereo_benchmark(240);
+    }
+
+    if (textureBenchmarkRequested)
+    {
+        textureBenchmarkRequested = false;
+        run_texture_streaming_benchmark(500);
+    }
+
     glEnable(GL_CULL_FACE);
     glEnable(GL_DEPTH_TEST);
 
@@ -541,27 +697,20 @@ void scene_editor_app::on_draw()
 
             if (Edit("renderer", *renderer))
             {
-                renderer->gpuProfiler.set_enabled(renderer->settings.performanceProfiling);
-                renderer->cpuProfiler.set_enabled(renderer->settings.performanceProfiling);
+                frame_profiler::get_instance().set_enabled(renderer->settings.performanceProfiling);
 
                 if (renderer->settings.shadowsEnabled != lastSettings.shadowsEnabled)
                 {
-                    auto & shaderAsset = shaderMonitor.get_asset(pbrProgramAsset);
-                    auto & defines = shaderAsset.defines;
+                    set_shader_define(shaderMonitor, pbrProgramAsset, "ENABLE_SHADOWS", renderer->settings.shadowsEnabled);
+                }
 
-                    if (renderer->settings.shadowsEnabled)
-                    {
-                        // Check if it's already in there
-                        auto itr = std::find(defines.begin(), defines.end(), "ENABLE_SHADOWS");
-                        if (itr == defines.end()) defines.push_back("ENABLE_SHADOWS");
-                    }
-                    else
+                // Programs that draw scene geometry need to route instances to per-eye viewports
+                if (renderer->settings.singlePassStereo != lastSettings.singlePassStereo)
+                {
+                    for (auto asset : { pbrProgramAsset, depthPrepassProgramAsset, defaultProgramAsset })
                     {
-                        auto & defines = shaderMonitor.get_asset(pbrProgramAsset).defines;
-                        auto itr = std::find(defines.begin(), defines.end(), "ENABLE_SHADOWS");
-                        if (itr != defines.end()) defines.erase(itr);
+                        set_shader_define(shaderMonitor, asset, "SINGLE_PASS_STEREO", renderer->settings.singlePassStereo);
                     }
-                    shaderAsset.shouldRecompile = true;
                 }
             }
 
@@ -588,11 +737,45 @@ void scene_editor_app::on_draw()
 
         ImGui::Separator();
 
+        {
+            const FrameTimings & t = get_frame_timings();
+            ImGui::Text("Frame %.2f ms (p50 %.2f, p99 %.2f)", t.frame.get_last(), t.frame.compute_percentile(0.5), t.frame.compute_percentile(0.99));
+            ImGui::Text("CPU %.2f ms (p99 %.2f) GPU %.2f ms (p99 %.2f)", t.cpu.get_last(), t.cpu.compute_percentile(0.99), t.gpu.get_last(), t.gpu.compute_percentile(0.99));
+            ImGui::Text("Hitches: %u in window, %llu total", t.frame.window_hitches(), (unsigned long long) t.frame.total_hitches());
+        }
+
         if (renderer->settings.performanceProfiling)
         {
-            for (auto & t : renderer->gpuProfiler.dataPoints) ImGui::Text("[GPU] %s %f ms", t.first.c_str(), (float)compute_mean(t.second.average));
-            for (auto & t : renderer->cpuProfiler.dataPoints) ImGui::Text("[CPU] %s %f ms", t.first.c_str(), (float)compute_mean(t.second.average));
+            auto & profiler = frame_profiler::get_instance();
+
+            for (auto & z : profiler.summarize())
+            {
+                ImGui::Text("[%s] %s %.3f ms (p95 %.3f, p99 %.3f)", z.gpu ? "GPU" : "CPU", z.name, (float)z.mean, (float)z.p95, (float)z.p99);
+            }
+
+            if (ImGui::TreeNode("GPU Pass Histograms"))
+            {
+                for (auto & z : profiler.summarize())
+                {
+                    if (!z.gpu) continue;
+                    float maxMs = 0.f;
+                    const std::vector<float> bins = profiler.histogram(z.zone, 32, maxMs);
+                    const std::string overlay = "0 - " + std::to_string(maxMs) + " ms";
+                    ImGui::PlotHistogram(z.name, bins.data(), (int) bins.size(), 0, overlay.c_str(), 0.f, FLT_MAX, ImVec2(0, 40));
+                }
+                ImGui::Text("Dropped GPU frames: %llu", (unsigned long long) profiler.gpu_frames_dropped());
+                ImGui::TreePop();
+            }
+
+            if (!profiler.capture_in_progress() && ImGui::Button("Capture Trace (120 frames)"))
+            {
+                profiler.capture_chrome_trace("frame-trace.json", 120);
+                std::cout << "Capturing trace to frame-trace.json" << std::endl;
+            }
         }
+
+        if (ImGui::Button("Stereo Benchmark (mono / sequential / single-pass)")) stereoBenchmarkRequested = true;
+        if (ImGui::Button("Texture Streaming Benchmark (500 textures)")) textureBenchmarkRequested = true;
     }
     gui::imgui_fixed_window_end();
 
@@ -621,7 +804,9 @@ void scene_editor_app::on_draw()
 
     gl_check_error(__FILE__, __LINE__);
 
-    glfwSwapBuffers(window); 
+    swap_buffers();
+
+    frame_profiler::get_instance().end_frame();
 }
 
 IMPLEMENT_MAIN(int argc, char * argv[])
@@ -1,6 +1,7 @@
 #include "index.hpp"
 #include "gl-gizmo.hpp"
 #include "gl-imgui.hpp"
+#include "gl-texture-streamer.hpp"
 
 #include "material.hpp"
 #include "fwd_renderer.hpp"
@@ -154,6 +155,8 @@ struct scene_editor_app final : public GLFWApp
     ShaderMonitor shaderMonitor { "../assets/" };
 
     uint32_t pbrProgramAsset = -1;
+    uint32_t depthPrepassProgramAsset = -1;
+    uint32_t defaultProgramAsset = -1;
 
     Scene scene;
 
@@ -164,12 +167,16 @@ struct scene_editor_app final : public GLFWApp
     std::unique_ptr<editor_controller<GameObject>> editor;
 
     std::unique_ptr<forward_renderer> renderer;
+    std::unique_ptr<GlTextureStreamer> textureStreamer;
     scene_data sceneData;
 
     ImGui::ImGuiAppLog log;
     auto_layout uiSurface;
     std::vector<std::shared_ptr<GLTextureView>> debugViews;
 
+    bool stereoBenchmarkRequested = false;
+    bool textureBenchmarkRequested = false;
+
     scene_editor_app();
     ~scene_editor_app();
 
@@ -178,4 +185,10 @@ struct scene_editor_app final : public GLFWApp
     void on_update(const UpdateEvent & e) override;
     void on_draw() override;
     void on_drop(std::vector <std::string> filepaths) override;
+
+    // Renders the current scene mono, as sequential stereo and as single-pass stereo and prints timings
+    void run_stereo_benchmark(const int frames);
+
+    // Loads `count` textures through load_image and through a GlTextureStreamer and prints render-thread stalls
+    void run_texture_streaming_benchmark(const int count);
 };
\ No newline at end of file
@@ -1,46 +1,349 @@
 #ifndef signal_h
 #define signal_h
 
-#include <functional>
-#include <list>
+#include <cstdint>
+#include <cstddef>
+#include <new>
+#include <mutex>
+#include <vector>
 #include <utility>
+#include <type_traits>
 
-// Usage: 
-// nodeSignals.add([someObject](Node const & myNode) { someObject.doSomething(myNode); return true; });
+// Usage:
+// auto handle = nodeSignals.add([someObject](Node const & myNode) { someObject.doSomething(myNode); });
 // nodeSignals.broadcast(someNode);
+// nodeSignals.remove(handle);
+//
+// Subscribers live in a contiguous slot array and are stored inline when their captures fit in a few
+// pointers, so connecting and broadcasting don't allocate in the common case. Handles carry the slot's
+// generation, which makes removal O(1) and turns stale handles into no-ops. Subscribers may add or
+// remove subscriptions (including their own) while a broadcast is running: removals take effect
+// immediately for the remaining subscribers, additions start receiving with the next broadcast.
+// A subscriber returning `false` is removed, as before.
 
 namespace avl
 {
 
-    template <typename T>
+    // Type-erased callable with inline storage for small functors; larger ones go to the heap
+    template <typename Signature, size_t Capacity = 4 * sizeof(void*)>
+    class small_function;
+
+    template <typename R, typename ... Args, size_t Capacity>
+    class small_function<R(Args...), Capacity>
+    {
+        enum class op { move, destroy };
+
+        typename std::aligned_storage<Capacity, alignof(std::max_align_t)>::type storage;
+        R (*invoker)(void *, Args...) = nullptr;
+        void (*manager)(op, void *, void *) = nullptr;
+
+        template <typename F>
+        static constexpr bool stored_inline()
+        {
+            return sizeof(F) <= Capacity && alignof(F) <= alignof(std::max_align_t) && std::is_nothrow_move_constructible<F>::value;
+        }
+
+        template <typename F>
+        void assign(F && f, std::true_type /* inline */)
+        {
+            typedef typename std::decay<F>::type D;
+            new (&storage) D(std::forward<F>(f));
+            invoker = [](void * s, Args... args) -> R { return (*static_cast<D*>(s))(std::forward<Args>(args)...); };
+            manager = [](op o, void * dst, void * src)
+            {
+                if (o == op::move) { new (dst) D(std::move(*static_cast<D*>(src))); static_cast<D*>(src)->~D(); }
+                else static_cast<D*>(dst)->~D();
+            };
+        }
+
+        template <typename F>
+        void assign(F && f, std::false_type /* heap */)
+        {
+            typedef typename std::decay<F>::type D;
+            *reinterpret_cast<D**>(&storage) = new D(std::forward<F>(f));
+            invoker = [](void * s, Args... args) -> R { return (**static_cast<D**>(s))(std::forward<Args>(args)...); };
+            manager = [](op o, void * dst, void * src)
+            {
+                if (o == op::move) *static_cast<D**>(dst) = *static_cast<D**>(src);
+                else delete *static_cast<D**>(dst);
+            };
+        }
+
+    public:
+
+        small_function() = default;
+        small_function(const small_function &) = delete;
+        small_function & operator = (const small_function &) = delete;
+
+        template <typename F, typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, small_function>::value>::type>
+        small_function(F && f)
+        {
+            typedef typename std::decay<F>::type D;
+            assign(std::forward<F>(f), std::integral_constant<bool, stored_inline<D>()>());
+        }
+
+        small_function(small_function && r) noexcept : invoker(r.invoker), manager(r.manager)
+        {
+            if (manager) manager(op::move, &storage, &r.storage);
+            r.invoker = nullptr;
+            r.manager = nullptr;
+        }
+
+        small_function & operator = (small_function && r) noexcept
+        {
+            if (this != &r)
+            {
+                reset();
+                invoker = r.invoker;
+                manager = r.manager;
+                if (manager) manager(op::move, &storage, &r.storage);
+                r.invoker = nullptr;
+                r.manager = nullptr;
+            }
+            return *this;
+        }
+
+        ~small_function() { reset(); }
+
+        void reset()
+        {
+            if (manager) manager(op::destroy, &storage, nullptr);
+            invoker = nullptr;
+            manager = nullptr;
+        }
+
+        explicit operator bool() const { return invoker != nullptr; }
+
+        R operator()(Args... args) const { return invoker(const_cast<void*>(static_cast<const void*>(&storage)), std::forward<Args>(args)...); }
+    };
+
+    struct signal_handle
+    {
+        uint32_t index{ 0xFFFFFFFF };
+        uint32_t generation{ 0 };
+        bool valid() const { return index != 0xFFFFFFFF; }
+    };
+
+    // Stand-in for a mutex in the single-threaded Signal
+    struct null_mutex
+    {
+        void lock() {}
+        void unlock() {}
+    };
+
+    template <typename T, typename Mutex = null_mutex>
     class Signal
     {
-        std::list<std::function<bool(T)>> subscribers;
+        typedef small_function<bool(const T &)> delegate_t;
+
+        struct slot
+        {
+            delegate_t fn;
+            uint32_t generation{ 0 };
+            bool active{ false };   // receives broadcasts
+            bool occupied{ false }; // holds a live (possibly not yet active) subscription
+        };
+
+        std::vector<slot> slots;
+        std::vector<uint32_t> freeList;
+
+        // Work deferred while a broadcast is iterating `slots`
+        std::vector<std::pair<uint32_t, delegate_t>> pendingAdds;
+        std::vector<uint32_t> pendingRemovals;
+        uint32_t reservedSlots{ 0 }; // indices past slots.size() handed out during a broadcast
+        int broadcastDepth{ 0 };
+
+        mutable Mutex mutex;
+
+        template <typename F>
+        static delegate_t wrap(F && f, std::true_type /* returns bool */) { return delegate_t(std::forward<F>(f)); }
+
+        template <typename F>
+        static delegate_t wrap(F && f, std::false_type /* returns void */)
+        {
+            typedef typename std::decay<F>::type D;
+            return delegate_t([g = D(std::forward<F>(f))](const T & v) mutable -> bool { g(v); return true; });
+        }
+
+        uint32_t allocate_index()
+        {
+            if (freeList.size())
+            {
+                const uint32_t idx = freeList.back();
+                freeList.pop_back();
+                return idx;
+            }
+            if (broadcastDepth) return static_cast<uint32_t>(slots.size()) + reservedSlots++;
+            slots.emplace_back();
+            return static_cast<uint32_t>(slots.size() - 1);
+        }
+
+        void release(const uint32_t idx)
+        {
+            slot & s = slots[idx];
+            s.fn.reset();
+            s.active = false;
+            s.occupied = false;
+            s.generation++;
+            freeList.push_back(idx);
+        }
+
+        void flush()
+        {
+            if (reservedSlots) slots.resize(slots.size() + reservedSlots);
+            reservedSlots = 0;
+
+            for (auto & p : pendingAdds)
+            {
+                slot & s = slots[p.first];
+                s.fn = std::move(p.second);
+                s.occupied = true;
+                s.active = true;
+            }
+            pendingAdds.clear();
+
+            for (auto idx : pendingRemovals) release(idx);
+            pendingRemovals.clear();
+        }
+
+        // Marks a broadcast in progress. Leaving the outermost one, normally or by a subscriber's exception,
+        // applies the additions and removals deferred while it ran.
+        struct broadcast_scope
+        {
+            Signal & signal;
+            broadcast_scope(Signal & s) : signal(s) { signal.broadcastDepth++; }
+            ~broadcast_scope() { if (--signal.broadcastDepth == 0) signal.flush(); }
+        };
+
+        template <typename F>
+        signal_handle connect(F && f)
+        {
+            std::lock_guard<Mutex> guard(mutex);
+            typedef decltype(std::declval<F&>()(std::declval<const T &>())) result_t;
+            delegate_t d = wrap(std::forward<F>(f), std::is_convertible<result_t, bool>());
+
+            signal_handle h;
+            h.index = allocate_index();
+            h.generation = h.index < slots.size() ? slots[h.index].generation : 0;
+
+            if (broadcastDepth)
+            {
+                // Activated once the broadcast finishes
+                if (h.index < slots.size()) slots[h.index].occupied = true;
+                pendingAdds.emplace_back(h.index, std::move(d));
+            }
+            else
+            {
+                slot & s = slots[h.index];
+                s.fn = std::move(d);
+                s.occupied = true;
+                s.active = true;
+            }
+            return h;
+        }
+
     public:
+
+        Signal() = default;
+        Signal(const Signal &) = delete;
+        Signal & operator = (const Signal &) = delete;
+
+        // `f` may return bool (false unsubscribes) or void
         template <typename F>
-        void add(F && f)
+        signal_handle add(F && f)
         {
-            subscribers.push_back(std::forward<F>(f));
+            return connect(std::forward<F>(f));
         }
 
         template <typename F>
-        void add_once(F const &f)
+        signal_handle add_once(F && f)
         {
-            subscribers.push_back([f](T const & v) -> bool { f(v); return false; });
+            typedef typename std::decay<F>::type D;
+            return connect([g = D(std::forward<F>(f))](const T & v) mutable -> bool { g(v); return false; });
         }
 
-        void broadcast(T const &v)
+        // O(1). Stale or already-removed handles are ignored.
+        void remove(const signal_handle & h)
         {
-            for (typename std::list<std::function<bool(T)>>::iterator it = subscribers.begin(); it != subscribers.end();)
+            std::lock_guard<Mutex> guard(mutex);
+            if (!h.valid()) return;
+
+            // Added during the current broadcast and not active yet; the index is recycled by `flush`
+            for (auto it = pendingAdds.begin(); it != pendingAdds.end(); ++it)
+            {
+                if (it->first != h.index) continue;
+                if (h.index < slots.size() && slots[h.index].generation != h.generation) return;
+                pendingAdds.erase(it);
+                pendingRemovals.push_back(h.index);
+                return;
+            }
+
+            if (h.index >= slots.size()) return;
+            slot & s = slots[h.index];
+            if (!s.occupied || s.generation != h.generation) return;
+
+            if (broadcastDepth)
             {
-                if ((*it)(v))
-                    ++it;
-                else
-                    it = subscribers.erase(it);
+                if (s.active) { s.active = false; pendingRemovals.push_back(h.index); }
+            }
+            else release(h.index);
+        }
+
+        bool connected(const signal_handle & h) const
+        {
+            std::lock_guard<Mutex> guard(mutex);
+            if (!h.valid()) return false;
+            for (auto & p : pendingAdds) if (p.first == h.index && (h.index >= slots.size() || slots[h.index].generation == h.generation)) return true;
+            return h.index < slots.size() && slots[h.index].active && slots[h.index].generation == h.generation;
+        }
+
+        size_t size() const
+        {
+            std::lock_guard<Mutex> guard(mutex);
+            return slots.size() + reservedSlots - freeList.size();
+        }
+
+        void clear()
+        {
+            std::lock_guard<Mutex> guard(mutex);
+            for (uint32_t i = 0; i < slots.size(); ++i)
+            {
+                if (!slots[i].occupied) continue;
+                if (broadcastDepth) { if (slots[i].active) { slots[i].active = false; pendingRemovals.push_back(i); } }
+                else release(i);
+            }
+            for (auto & p : pendingAdds) pendingRemovals.push_back(p.first);
+            pendingAdds.clear();
+        }
+
+        // An exception thrown by a subscriber stops the broadcast and propagates to the caller; that
+        // subscriber stays connected and the signal remains usable.
+        void broadcast(const T & v)
+        {
+            std::lock_guard<Mutex> guard(mutex);
+            broadcast_scope scope(*this);
+
+            // Index-based so that additions, which only ever append to the pending list, can't invalidate the walk
+            const size_t count = slots.size();
+            for (size_t i = 0; i < count; ++i)
+            {
+                slot & s = slots[i];
+                if (!s.active) continue;
+                if (!s.fn(v) && s.active)
+                {
+                    s.active = false;
+                    pendingRemovals.push_back(static_cast<uint32_t>(i));
+                }
             }
         }
     };
 
+    // Broadcasts, additions and removals may come from any thread. Subscribers run under the signal's
+    // lock, so they can re-enter the same signal from within a callback but must not block on other
+    // threads that are trying to use it.
+    template <typename T>
+    using ThreadSafeSignal = Signal<T, std::recursive_mutex>;
+
 }
 
 #endif // end signal_h
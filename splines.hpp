@@ -6,6 +6,8 @@
 #define constant_spline_h
 
 #include "math-core.hpp"
+#include <vector>
+#include <algorithm>
 
 namespace avl
 {
@@ -19,6 +21,257 @@ namespace avl
         SplinePoint(float3 p, float d, float ac) : point(p), distance(d), ac(ac) {}
     };
     
+    enum class spline_basis
+    {
+        catmull_rom,        // interpolating; segment i runs from p[i + 1] to p[i + 2]
+        uniform_b_spline,   // C2, approximates the control points
+        bezier              // piecewise cubic Bezier sharing end points; segment i is p[3i] .. p[3i + 3]
+    };
+    
+    // Piecewise cubic curve over one contiguous control point buffer, parameterized by arc length.
+    // Each segment is kept in power form along with a table of its arc length at TableSize + 1 evenly spaced
+    // parameters, integrated with 5-point Gauss-Legendre quadrature, and the running length at the start
+    // of every segment. Mapping a distance to a point is then two binary searches (segment, table interval)
+    // and a couple of Newton steps, and ordered batch sampling just walks both tables forward.
+    // Moving one control point rebuilds only the (at most four) segments it influences.
+    class SplinePath
+    {
+    public:
+        
+        static const int TableSize = 16;
+        
+        struct location
+        {
+            size_t segment;
+            float t;
+        };
+        
+    private:
+        
+        spline_basis basis;
+        std::vector<float3> controlPoints;
+        std::vector<float3> coefficients;   // 4 per segment: c0 + c1 t + c2 t^2 + c3 t^3
+        std::vector<float> arcTable;        // TableSize + 1 per segment, length from the segment start
+        std::vector<float> cumulative;      // length at the start of each segment, plus the total
+        
+        size_t stride() const { return basis == spline_basis::bezier ? 3 : 1; }
+        
+        float speed(const size_t s, const float t) const
+        {
+            const float3 * c = &coefficients[s * 4];
+            return linalg::length(c[1] + t * (2.0f * c[2] + 3.0f * t * c[3]));
+        }
+        
+        float integrate(const size_t s, const float a, const float b) const
+        {
+            static const float x[5] = { 0.0f, -0.5384693101f, 0.5384693101f, -0.9061798459f, 0.9061798459f };
+            static const float w[5] = { 0.5688888889f, 0.4786286705f, 0.4786286705f, 0.2369268851f, 0.2369268851f };
+            const float h = 0.5f * (b - a), m = 0.5f * (a + b);
+            float sum = 0.0f;
+            for (int i = 0; i < 5; ++i) sum += w[i] * speed(s, m + h * x[i]);
+            return sum * h;
+        }
+        
+        void build_segment(const size_t s)
+        {
+            const float3 * p = &controlPoints[s * stride()];
+            float3 * c = &coefficients[s * 4];
+            switch (basis)
+            {
+                case spline_basis::catmull_rom:
+                    c[0] = p[1];
+                    c[1] = 0.5f * (p[2] - p[0]);
+                    c[2] = 0.5f * (2.0f * p[0] - 5.0f * p[1] + 4.0f * p[2] - p[3]);
+                    c[3] = 0.5f * (-p[0] + 3.0f * p[1] - 3.0f * p[2] + p[3]);
+                    break;
+                case spline_basis::uniform_b_spline:
+                    c[0] = (p[0] + 4.0f * p[1] + p[2]) / 6.0f;
+                    c[1] = 0.5f * (p[2] - p[0]);
+                    c[2] = 0.5f * (p[0] - 2.0f * p[1] + p[2]);
+                    c[3] = (-p[0] + 3.0f * p[1] - 3.0f * p[2] + p[3]) / 6.0f;
+                    break;
+                case spline_basis::bezier:
+                    c[0] = p[0];
+                    c[1] = 3.0f * (p[1] - p[0]);
+                    c[2] = 3.0f * (p[0] - 2.0f * p[1] + p[2]);
+                    c[3] = -p[0] + 3.0f * p[1] - 3.0f * p[2] + p[3];
+                    break;
+            }
+            
+            float * table = &arcTable[s * (TableSize + 1)];
+            table[0] = 0.0f;
+            for (int k = 0; k < TableSize; ++k)
+            {
+                table[k + 1] = table[k] + integrate(s, float(k) / TableSize, float(k + 1) / TableSize);
+            }
+        }
+        
+        void update_cumulative(const size_t firstSegment)
+        {
+            const size_t n = segment_count();
+            cumulative.resize(n + 1);
+            cumulative[0] = 0.0f;
+            for (size_t s = std::max<size_t>(firstSegment, 1); s <= n; ++s)
+            {
+                cumulative[s] = cumulative[s - 1] + arcTable[s * (TableSize + 1) - 1];
+            }
+        }
+        
+        void rebuild()
+        {
+            const size_t n = segment_count();
+            coefficients.resize(n * 4);
+            arcTable.resize(n * (TableSize + 1));
+            for (size_t s = 0; s < n; ++s) build_segment(s);
+            update_cumulative(0);
+        }
+        
+        // Solves for t in table interval k of segment s, given the distance from the segment start
+        float solve(const size_t s, const int k, const float local) const
+        {
+            const float * table = &arcTable[s * (TableSize + 1)];
+            const float t0 = float(k) / TableSize, t1 = float(k + 1) / TableSize;
+            const float span = table[k + 1] - table[k];
+            if (span <= 0.0f) return t0;
+            
+            float t = t0 + (t1 - t0) * (local - table[k]) / span;
+            for (int i = 0; i < 2; ++i)
+            {
+                const float v = speed(s, t);
+                if (v <= 0.0f) break;
+                t -= (table[k] + integrate(s, t0, t) - local) / v;
+                t = clamp(t, t0, t1);
+            }
+            return t;
+        }
+        
+        int table_interval(const size_t s, const float local) const
+        {
+            const float * table = &arcTable[s * (TableSize + 1)];
+            const int k = int(std::upper_bound(table + 1, table + TableSize + 1, local) - (table + 1));
+            return std::min(k, TableSize - 1);
+        }
+        
+    public:
+        
+        SplinePath(const spline_basis basis = spline_basis::catmull_rom) : basis(basis) {}
+        SplinePath(const spline_basis basis, std::vector<float3> points) : basis(basis) { set_control_points(std::move(points)); }
+        
+        void set_control_points(std::vector<float3> points)
+        {
+            controlPoints = std::move(points);
+            rebuild();
+        }
+        
+        // Only the segments that use control point i are rebuilt; later segments just shift their start distance
+        void set_control_point(const size_t i, const float3 & p)
+        {
+            controlPoints[i] = p;
+            const size_t n = segment_count();
+            const size_t first = i < 3 ? 0 : (i - 3 + stride() - 1) / stride();
+            const size_t last = std::min(i / stride() + 1, n);
+            for (size_t s = first; s < last; ++s) build_segment(s);
+            if (first < last) update_cumulative(first + 1);
+        }
+        
+        // Appends a control point, completing a new segment once there are enough of them (e.g. a growing trail)
+        void push_back(const float3 & p)
+        {
+            controlPoints.push_back(p);
+            const size_t n = segment_count();
+            if (n * 4 == coefficients.size()) return;
+            coefficients.resize(n * 4);
+            arcTable.resize(n * (TableSize + 1));
+            build_segment(n - 1);
+            update_cumulative(n);
+        }
+        
+        void clear()
+        {
+            controlPoints.clear();
+            rebuild();
+        }
+        
+        const std::vector<float3> & get_control_points() const { return controlPoints; }
+        const std::vector<float> & get_arc_table() const { return arcTable; }
+        spline_basis get_basis() const { return basis; }
+        
+        size_t segment_count() const
+        {
+            return controlPoints.size() < 4 ? 0 : (controlPoints.size() - 4) / stride() + 1;
+        }
+        
+        float length() const { return cumulative.empty() ? 0.0f : cumulative.back(); }
+        
+        float3 point(const size_t s, const float t) const
+        {
+            const float3 * c = &coefficients[s * 4];
+            return c[0] + t * (c[1] + t * (c[2] + t * c[3]));
+        }
+        
+        float3 derivative(const size_t s, const float t) const
+        {
+            const float3 * c = &coefficients[s * 4];
+            return c[1] + t * (2.0f * c[2] + 3.0f * t * c[3]);
+        }
+        
+        // Distance is clamped to [0, length()]. Requires at least one segment.
+        location locate(float distance) const
+        {
+            assert(segment_count() > 0);
+            distance = clamp(distance, 0.0f, length());
+            const size_t s = std::min<size_t>(std::upper_bound(cumulative.begin() + 1, cumulative.end(), distance) - (cumulative.begin() + 1), segment_count() - 1);
+            const float local = distance - cumulative[s];
+            return{ s, solve(s, table_interval(s, local), local) };
+        }
+        
+        float3 position_at_distance(const float distance) const
+        {
+            const location l = locate(distance);
+            return point(l.segment, l.t);
+        }
+        
+        float3 tangent_at_distance(const float distance) const
+        {
+            const location l = locate(distance);
+            return safe_normalize(derivative(l.segment, l.t));
+        }
+        
+        // Evaluates `count` distances in any order
+        void positions_at_distances(const float * distances, const size_t count, float3 * positions) const
+        {
+            for (size_t i = 0; i < count; ++i) positions[i] = position_at_distance(distances[i]);
+        }
+        
+        // `count` points evenly spaced by arc length, from the start to the end of the curve inclusive.
+        // The distances ascend, so the segment and table cursors only move forward.
+        void sample_uniform(const size_t count, std::vector<float3> & positions, std::vector<float3> * tangents = nullptr) const
+        {
+            positions.resize(count);
+            if (tangents) tangents->resize(count);
+            if (count == 0 || segment_count() == 0) return;
+            
+            const size_t n = segment_count();
+            const float step = count > 1 ? length() / float(count - 1) : 0.0f;
+            size_t s = 0;
+            int k = 0;
+            
+            for (size_t i = 0; i < count; ++i)
+            {
+                const float distance = (i + 1 == count) ? length() : step * float(i);
+                while (s + 1 < n && cumulative[s + 1] <= distance) { ++s; k = 0; }
+                
+                const float local = distance - cumulative[s];
+                const float * table = &arcTable[s * (TableSize + 1)];
+                while (k + 1 < TableSize && table[k + 1] <= local) ++k;
+                
+                const float t = solve(s, k, local);
+                positions[i] = point(s, t);
+                if (tangents) (*tangents)[i] = safe_normalize(derivative(s, t));
+            }
+        }
+    };
+    
     // This object creates a B-Spline using 4 points, and a number steps
     // or a fixed step distance can be specified to create a set of points that cover the curve at constant rate.
     class ConstantSpline
@@ -39,40 +292,23 @@ namespace avl
             d = 0.0f;
             points.clear();
             
-            float3 tmp, result;
-            for (float j = 0; j <= 1.0f; j += increment)
+            // Integer stepping, so accumulated float error can neither drop nor duplicate the last sample
+            const int steps = std::max(1, int(std::floor(1.0f / increment + 1e-4f)));
+            points.reserve(steps + 2);
+            
+            for (int s = 0; s <= steps; ++s)
             {
-                float i = (1 - j);
-                float ii = i * i;
-                float iii = ii * i;
-                
-                float jj = j * j;
-                float jjj = jj * j;
-                
-                result = float3(0, 0, 0);
-                
-                tmp = p0;
-                tmp *= iii;
-                result += tmp;
-                
-                tmp = p1;
-                tmp *= 3 * j * ii;
-                result += tmp;
-                
-                tmp = p2;
-                tmp *= 3 * jj * i;
-                result += tmp;
-                
-                tmp = p3;
-                tmp *= jjj;
-                result += tmp;
-                
-                points.emplace_back(result, 0.0f, 0.0f);
+                const float j = std::min(float(s) * increment, 1.0f);
+                const float i = 1.0f - j;
+                points.emplace_back(i * i * i * p0 + 3.0f * j * i * i * p1 + 3.0f * j * j * i * p2 + j * j * j * p3, 0.0f, 0.0f);
             }
             
-            points.emplace_back(p3, 0.0f, 0.0f);
+            // The last step already landed on p3 unless 1 / increment has a remainder
+            if (float(steps) * increment < 1.0f) points.emplace_back(p3, 0.0f, 0.0f);
         }
         
+        const std::vector<SplinePoint> & get_points() const { return points; }
+        
         void calculate_distances()
         {
             d = 0.0f;
@@ -97,60 +333,32 @@ namespace avl
             points[points.size() - 1].ac = d;
         }
         
-        float split_segment(const float distancePerStep, SplinePoint & a, const SplinePoint & b, std::vector<SplinePoint> & l)
-        {
-            SplinePoint t = b;
-            float distance = 0.0f;
-            
-            t.point -= a.point;
-            
-            auto rd = length(t.point);
-            t.point = safe_normalize(t.point);
-            t.point *= distancePerStep;
-            
-            auto s = std::floor(rd / distancePerStep);
-            
-            for (size_t i = 0; i < s; ++i)
-            {
-                a.point += t.point;
-                l.push_back(a);
-                distance += distancePerStep;
-            }
-            return distance;
-        }
-        
         // In Will Wright's own words:
         //  "Construct network based functions that are defined by divisible intervals
         //   while approximating said network and composing it of pieces of simple functions defined on
         //   subintervals and joined at their endpoints with a suitable degree of smoothness."
+        // Samples the curve itself at steps + 1 points of equal arc length.
         void reticulate(uint32_t steps)
         {
-            float distancePerStep = d / float(steps);
-            
-            lPoints.clear();
+            steps = std::max<uint32_t>(steps, 1);
             
-            float localD = 0.f;
+            SplinePath curve(spline_basis::bezier, { p0, p1, p2, p3 });
+            std::vector<float3> samples;
+            curve.sample_uniform(steps + 1, samples);
             
-            // First point
-            SplinePoint current = points[0];
-            lPoints.push_back(current);
-            
-            // Reticulate
-            for (size_t i = 0; i < points.size(); ++i)
+            const float distancePerStep = curve.length() / float(steps);
+            lPoints.clear();
+            lPoints.reserve(samples.size());
+            for (size_t i = 0; i < samples.size(); ++i)
             {
-                if (points[i].ac - localD > distancePerStep)
-                {
-                    localD += split_segment(distancePerStep, current, points[i], lPoints);
-                }
+                lPoints.emplace_back(samples[i], i ? distancePerStep : 0.0f, distancePerStep * float(i));
             }
-            
-            // Last point
-            lPoints.push_back(points[points.size() - 1]);
         }
         
         std::vector<float3> get_spline()
         {
             std::vector<float3> spline;
+            spline.reserve(lPoints.size());
             for (auto & p : lPoints) { spline.push_back(p.point); };
             return spline;
         }
@@ -6,64 +6,159 @@
 #include <assert.h>
 #include <atomic>
 #include <stdint.h>
+#include <new>
+#include <utility>
+#include <type_traits>
+#include <algorithm>
 
+// Bounded single-producer, single-consumer ring buffer. Storage is allocated once up front and the
+// capacity is rounded up to a power of two; produce fails when the ring is full. Head and tail are free-running indices published with
+// release stores and read with acquire loads; each side also keeps a private copy of the other side's
+// index and only re-reads the shared one when the cached value says the queue is full (or empty), so
+// in steady state the producer and consumer don't touch each other's cache lines.
 template<typename T>
 class SPSCBoundedQueue
 {
-    
     typedef typename std::aligned_storage<sizeof(T), std::alignment_of<T>::value>::type aligned_t;
     typedef char cache_line_pad_t[64];
 
     cache_line_pad_t pad0;
-    const size_t size;
+    const size_t capacity;
     const size_t mask;
-    T * const buffer;
+    aligned_t * const buffer;
+
     cache_line_pad_t pad1;
-    std::atomic<size_t> head{ 0 };
+    std::atomic<size_t> head{ 0 };  // written by the producer
+    size_t cachedTail{ 0 };         // producer's last view of tail
+
     cache_line_pad_t pad2;
-    std::atomic<size_t> tail{ 0 };
+    std::atomic<size_t> tail{ 0 };  // written by the consumer
+    size_t cachedHead{ 0 };         // consumer's last view of head
 
-    SPSCBoundedQueue(const SPSCBoundedQueue &) {}
-    void operator= (const SPSCBoundedQueue &) {}
+    cache_line_pad_t pad3;
 
-public:
-    
-    SPSCBoundedQueue(size_t size = 1024) : size(size) , mask(size-1), buffer(reinterpret_cast<T*>(new aligned_t[size + 1]))
+    SPSCBoundedQueue(const SPSCBoundedQueue &) = delete;
+    SPSCBoundedQueue & operator= (const SPSCBoundedQueue &) = delete;
+
+    static size_t round_up_pow2(size_t v)
+    {
+        size_t p = 1;
+        while (p < v) p <<= 1;
+        return p;
+    }
+
+    T * slot(const size_t idx) { return reinterpret_cast<T*>(&buffer[idx & mask]); }
+
+    // Number of free slots as seen by the producer, refreshing the cached tail only when needed
+    size_t writable(const size_t h, const size_t wanted)
     {
-        assert((size != 0) && ((size & (~size + 1)) == size));
+        size_t free = capacity - (h - cachedTail);
+        if (free < wanted)
+        {
+            cachedTail = tail.load(std::memory_order_acquire);
+            free = capacity - (h - cachedTail);
+        }
+        return free;
     }
 
+    // Number of filled slots as seen by the consumer, refreshing the cached head only when needed
+    size_t readable(const size_t t, const size_t wanted)
+    {
+        size_t avail = cachedHead - t;
+        if (avail < wanted)
+        {
+            cachedHead = head.load(std::memory_order_acquire);
+            avail = cachedHead - t;
+        }
+        return avail;
+    }
+
+public:
+
+    SPSCBoundedQueue(const size_t size = 1024) : capacity(round_up_pow2(size ? size : 1)), mask(capacity - 1), buffer(new aligned_t[capacity]) { }
+
     ~SPSCBoundedQueue()
     {
+        const size_t h = head.load(std::memory_order_relaxed);
+        for (size_t t = tail.load(std::memory_order_relaxed); t != h; ++t) slot(t)->~T();
         delete[] buffer;
     }
 
-    bool produce(T & input)
+    size_t max_size() const { return capacity; }
+
+    // Approximate when called concurrently with produce/consume. Tail is read first: head never falls behind a
+    // tail that was read earlier, so the difference can't underflow, and it is clamped in case both moved.
+    size_t size() const
+    {
+        const size_t t = tail.load(std::memory_order_acquire);
+        const size_t h = head.load(std::memory_order_acquire);
+        return std::min(h - t, capacity);
+    }
+    bool empty() const { return size() == 0; }
+
+    //////////////
+    // Producer //
+    //////////////
+
+    template<typename ... Args>
+    bool emplace(Args && ... args)
     {
         const size_t h = head.load(std::memory_order_relaxed);
+        if (!writable(h, 1)) return false;
+        new (slot(h)) T(std::forward<Args>(args)...);
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
 
-        if (((tail.load(std::memory_order_acquire) - (h + 1)) & mask) >= 1)
-        {
-            buffer[h & mask] = input;
-            head.store(h + 1, std::memory_order_release);
-            return true;
-        }
-        return false;
+    bool produce(const T & input) { return emplace(input); }
+    bool produce(T && input) { return emplace(std::move(input)); }
+
+    // Copies up to `count` items and publishes them with a single store. Returns the number written.
+    size_t produce_n(const T * input, const size_t count)
+    {
+        const size_t h = head.load(std::memory_order_relaxed);
+        const size_t n = std::min(count, writable(h, count));
+        for (size_t i = 0; i < n; ++i) new (slot(h + i)) T(input[i]);
+        if (n) head.store(h + n, std::memory_order_release);
+        return n;
     }
 
+    //////////////
+    // Consumer //
+    //////////////
+
     bool consume(T & output)
     {
         const size_t t = tail.load(std::memory_order_relaxed);
+        if (!readable(t, 1)) return false;
+        T * item = slot(t);
+        output = std::move(*item);
+        item->~T();
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
 
-        if (((head.load(std::memory_order_acquire) - t) & mask) >= 1)
+    // Moves up to `maxCount` items into `output` and releases their slots with a single store. Returns the number read.
+    size_t consume_n(T * output, const size_t maxCount)
+    {
+        const size_t t = tail.load(std::memory_order_relaxed);
+        const size_t n = std::min(maxCount, readable(t, maxCount));
+        for (size_t i = 0; i < n; ++i)
         {
-            output = buffer[tail & mask];
-            tail.store(t + 1, std::memory_order_release);
-            return true;
+            T * item = slot(t + i);
+            output[i] = std::move(*item);
+            item->~T();
         }
-        return false;
+        if (n) tail.store(t + n, std::memory_order_release);
+        return n;
+    }
+
+    // Inspects the oldest item without removing it; nullptr when empty
+    T * front()
+    {
+        const size_t t = tail.load(std::memory_order_relaxed);
+        return readable(t, 1) ? slot(t) : nullptr;
     }
-    
 };
 
 #endif // spsc_bounded_queue_hpp
@@ -3,64 +3,156 @@
 #ifndef spsc_queue_hpp
 #define spsc_queue_hpp
 
-#include <assert.h>
+#include "spsc_bounded_queue.hpp"
+
 #include <atomic>
-#include <stdint.h>
-#include <vector>
+#include <algorithm>
 
+// Unbounded single-producer, single-consumer queue: produce always succeeds. Items go into a chain of
+// SPSCBoundedQueue blocks. When the producer finds its block full it links a new one and never touches the
+// old block again, and the consumer retires a block once it is drained and a successor exists. One retired
+// block is kept as a spare for the producer, so a queue that oscillates around a block boundary doesn't
+// allocate, and a queue that stays within one block behaves exactly like the bounded ring.
 template<typename T>
 class SPSCQueue
 {
+    typedef char cache_line_pad_t[64];
+
+    struct block
+    {
+        SPSCBoundedQueue<T> ring;
+        std::atomic<block *> next{ nullptr };
+        block(const size_t size) : ring(size) { }
+    };
+
+    const size_t blockSize;
 
-    struct node_t { node_t * next; T data; };
-    typedef typename std::aligned_storage<sizeof(node_t), std::alignment_of<node_t>::value>::type node_aligned_t;
+    cache_line_pad_t pad0;
+    block * writeBlock;                 // producer only
+    std::atomic<size_t> produced{ 0 };  // written by the producer
 
-    node_t * head;
-    char cache_line_pad[64];
-    node_t * tail;
-    node_t * back;
+    cache_line_pad_t pad1;
+    block * readBlock;                  // consumer only
+    std::atomic<size_t> consumed{ 0 };  // written by the consumer
 
-    SPSCQueue(const SPSCQueue &) { }
-    void operator= (const SPSCQueue &) { }
+    cache_line_pad_t pad2;
+    std::atomic<block *> spare{ nullptr };
+
+    SPSCQueue(const SPSCQueue &) = delete;
+    SPSCQueue & operator= (const SPSCQueue &) = delete;
+
+    // Producer: moves to a fresh block once the current one is full
+    void next_block()
+    {
+        block * b = spare.exchange(nullptr, std::memory_order_acquire);
+        if (b) b->next.store(nullptr, std::memory_order_relaxed);
+        else b = new block(blockSize);
+        writeBlock->next.store(b, std::memory_order_release);
+        writeBlock = b;
+    }
+
+    // Consumer: returns false when the queue is empty. Otherwise `readBlock` holds at least one item.
+    bool advance_front()
+    {
+        while (!readBlock->ring.front())
+        {
+            block * n = readBlock->next.load(std::memory_order_acquire);
+            if (!n) return false;
+            // Everything the producer put into `readBlock` was published before `next`, so an empty block is final
+            if (readBlock->ring.front()) break;
+            delete spare.exchange(readBlock, std::memory_order_acq_rel);
+            readBlock = n;
+        }
+        return true;
+    }
 
 public:
 
-    SPSCQueue() : head(reinterpret_cast<node_t*>(new node_aligned_t)), tail(head)
+    // `size` is the capacity of each block; the queue grows a block at a time
+    SPSCQueue(const size_t size = 1024) : blockSize(size)
     {
-        head->next = nullptr;
+        writeBlock = readBlock = new block(blockSize);
     }
 
     ~SPSCQueue()
     {
-        T output;
-        while (this->consume(output)) {}
-        delete head;
+        while (readBlock)
+        {
+            block * n = readBlock->next.load(std::memory_order_relaxed);
+            delete readBlock;
+            readBlock = n;
+        }
+        delete spare.load(std::memory_order_relaxed);
     }
 
-    bool produce(const T & input)
+    // Approximate when called concurrently with produce/consume. The counters are bumped after the item moves,
+    // so `consumed` can briefly run ahead of `produced`; that reads as empty rather than underflowing.
+    size_t size() const
     {
-        node_t * node = reinterpret_cast<node_t*>(new node_aligned_t);
-        node->data = input;
-        node->next = nullptr;
+        const size_t c = consumed.load(std::memory_order_acquire);
+        const size_t p = produced.load(std::memory_order_acquire);
+        return p > c ? p - c : 0;
+    }
+    bool empty() const { return size() == 0; }
 
-        std::atomic_thread_fence(std::memory_order_acq_rel);
-        head->next = node;
-        head = node;
+    //////////////
+    // Producer //
+    //////////////
+
+    template<typename ... Args>
+    bool emplace(Args && ... args)
+    {
+        if (!writeBlock->ring.emplace(std::forward<Args>(args)...))
+        {
+            next_block();
+            writeBlock->ring.emplace(std::forward<Args>(args)...);
+        }
+        produced.store(produced.load(std::memory_order_relaxed) + 1, std::memory_order_release);
         return true;
     }
 
+    bool produce(const T & input) { return emplace(input); }
+    bool produce(T && input) { return emplace(std::move(input)); }
+
+    // Copies all `count` items, publishing them with one store per block touched
+    size_t produce_n(const T * input, const size_t count)
+    {
+        size_t n = writeBlock->ring.produce_n(input, count);
+        while (n < count)
+        {
+            next_block();
+            n += writeBlock->ring.produce_n(input + n, count - n);
+        }
+        produced.store(produced.load(std::memory_order_relaxed) + count, std::memory_order_release);
+        return count;
+    }
+
+    //////////////
+    // Consumer //
+    //////////////
+
     bool consume(T & output)
     {
-        std::atomic_thread_fence(std::memory_order_consume);
-        if (!tail->next) return false;
-        output = tail->next->data;
-        std::atomic_thread_fence(std::memory_order_acq_rel);
-        back = tail;
-        tail = back->next;
-        delete back;
+        if (!advance_front()) return false;
+        readBlock->ring.consume(output);
+        consumed.store(consumed.load(std::memory_order_relaxed) + 1, std::memory_order_release);
         return true;
     }
-    
+
+    // Moves up to `maxCount` items into `output`. Returns the number read.
+    size_t consume_n(T * output, const size_t maxCount)
+    {
+        size_t n = 0;
+        while (n < maxCount && advance_front()) n += readBlock->ring.consume_n(output + n, maxCount - n);
+        if (n) consumed.store(consumed.load(std::memory_order_relaxed) + n, std::memory_order_release);
+        return n;
+    }
+
+    // Inspects the oldest item without removing it; nullptr when empty
+    T * front()
+    {
+        return advance_front() ? readBlock->ring.front() : nullptr;
+    }
 };
 
 #endif // spsc_queue_hpp
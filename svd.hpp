@@ -12,6 +12,16 @@
 #include <iostream>
 #include <cmath>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define AVL_SVD3_SSE 1
+#endif
+
+#if defined(__AVX__)
+    #include <immintrin.h>
+    #define AVL_SVD3_AVX 1
+#endif
+
 using namespace avl;
 
 template <typename T>
@@ -387,6 +397,322 @@ inline bool singular_value_decomposition(MatrixT & A, int m, int n, std::vector<
     return convergence;
 };
 
+/*
+ * Fixed-size 3x3 kernels, after McAdams et al., "Computing the Singular Value Decomposition of 3x3 matrices
+ * with minimal branching and elementary floating point operations" (2011). A fixed number of cyclic Jacobi
+ * sweeps diagonalizes the symmetric matrix (A^T A for the SVD), the eigenvalues are sorted with conditional
+ * swaps and U follows from a Givens QR of A * V. There is no data dependent control flow, so the same code
+ * runs on plain floats or on 4 (SSE) / 8 (AVX) matrices at a time.
+ */
+namespace svd3_detail
+{
+    inline float v_sqrt(const float x) { return std::sqrt(x); }
+    inline float v_abs(const float x) { return std::abs(x); }
+    inline float v_max(const float a, const float b) { return std::max(a, b); }
+    inline bool v_less(const float a, const float b) { return a < b; }
+    inline float v_select(const bool m, const float a, const float b) { return m ? a : b; }
+    inline float v_mul_sign(const float x, const float s) { return s < 0.0f ? -x : x; }
+
+#if defined(AVL_SVD3_SSE)
+    struct lane4 { __m128 v; lane4() {} lane4(__m128 v) : v(v) {} explicit lane4(float x) : v(_mm_set1_ps(x)) {} };
+    struct mask4 { __m128 v; mask4(__m128 v) : v(v) {} };
+
+    inline lane4 operator + (const lane4 & a, const lane4 & b) { return _mm_add_ps(a.v, b.v); }
+    inline lane4 operator - (const lane4 & a, const lane4 & b) { return _mm_sub_ps(a.v, b.v); }
+    inline lane4 operator - (const lane4 & a) { return _mm_xor_ps(a.v, _mm_set1_ps(-0.0f)); }
+    inline lane4 operator * (const lane4 & a, const lane4 & b) { return _mm_mul_ps(a.v, b.v); }
+    inline lane4 operator / (const lane4 & a, const lane4 & b) { return _mm_div_ps(a.v, b.v); }
+    inline lane4 v_sqrt(const lane4 & a) { return _mm_sqrt_ps(a.v); }
+    inline lane4 v_abs(const lane4 & a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v); }
+    inline lane4 v_max(const lane4 & a, const lane4 & b) { return _mm_max_ps(a.v, b.v); }
+    inline mask4 v_less(const lane4 & a, const lane4 & b) { return _mm_cmplt_ps(a.v, b.v); }
+    inline lane4 v_select(const mask4 & m, const lane4 & a, const lane4 & b) { return _mm_or_ps(_mm_and_ps(m.v, a.v), _mm_andnot_ps(m.v, b.v)); }
+    inline lane4 v_mul_sign(const lane4 & x, const lane4 & s) { return _mm_xor_ps(x.v, _mm_and_ps(s.v, _mm_set1_ps(-0.0f))); }
+#endif
+
+#if defined(AVL_SVD3_AVX)
+    struct lane8 { __m256 v; lane8() {} lane8(__m256 v) : v(v) {} explicit lane8(float x) : v(_mm256_set1_ps(x)) {} };
+    struct mask8 { __m256 v; mask8(__m256 v) : v(v) {} };
+
+    inline lane8 operator + (const lane8 & a, const lane8 & b) { return _mm256_add_ps(a.v, b.v); }
+    inline lane8 operator - (const lane8 & a, const lane8 & b) { return _mm256_sub_ps(a.v, b.v); }
+    inline lane8 operator - (const lane8 & a) { return _mm256_xor_ps(a.v, _mm256_set1_ps(-0.0f)); }
+    inline lane8 operator * (const lane8 & a, const lane8 & b) { return _mm256_mul_ps(a.v, b.v); }
+    inline lane8 operator / (const lane8 & a, const lane8 & b) { return _mm256_div_ps(a.v, b.v); }
+    inline lane8 v_sqrt(const lane8 & a) { return _mm256_sqrt_ps(a.v); }
+    inline lane8 v_abs(const lane8 & a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v); }
+    inline lane8 v_max(const lane8 & a, const lane8 & b) { return _mm256_max_ps(a.v, b.v); }
+    inline mask8 v_less(const lane8 & a, const lane8 & b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+    inline lane8 v_select(const mask8 & m, const lane8 & a, const lane8 & b) { return _mm256_blendv_ps(b.v, a.v, m.v); }
+    inline lane8 v_mul_sign(const lane8 & x, const lane8 & s) { return _mm256_xor_ps(x.v, _mm256_and_ps(s.v, _mm256_set1_ps(-0.0f))); }
+#endif
+
+    // Four sweeps take random float matrices to within a few ulps of diagonal
+    static const int JacobiSweeps = 4;
+
+    // Jacobi rotation in the (p, q) plane that zeroes apq; arp and arq couple p and q to the third axis.
+    // Columns p and q of v are rotated along.
+    template<typename T>
+    inline void jacobi_rotate(T & app, T & aqq, T & apq, T & arp, T & arq, T v[3][3], const int p, const int q)
+    {
+        // t = tan(theta), the smaller root of t^2 + 2 t cot(2 theta) - 1 = 0, written without dividing by apq
+        const T d = aqq - app;
+        const T twoApq = apq + apq;
+        const T root = v_mul_sign(twoApq, d) / v_max(v_abs(d) + v_sqrt(d * d + twoApq * twoApq), T(1e-30f));
+
+        // Once apq is negligible next to the diagonal, rotating further only feeds ever smaller (eventually
+        // denormal) values through every product, which is very slow on x86. Snap to zero instead.
+        const T t = v_select(v_less(v_abs(twoApq), T(1e-9f) * (v_abs(app) + v_abs(aqq))), T(0.0f), root);
+        const T c = T(1.0f) / v_sqrt(T(1.0f) + t * t);
+        const T s = t * c;
+
+        app = app - t * apq;
+        aqq = aqq + t * apq;
+        apq = T(0.0f);
+
+        const T rp = arp, rq = arq;
+        arp = c * rp - s * rq;
+        arq = s * rp + c * rq;
+
+        for (int k = 0; k < 3; ++k)
+        {
+            const T vp = v[p][k], vq = v[q][k];
+            v[p][k] = c * vp - s * vq;
+            v[q][k] = s * vp + c * vq;
+        }
+    }
+
+    // Orders (values[i], column i) before (values[j], column j) if it is larger. One swapped column is negated
+    // so that v stays a rotation.
+    template<typename T>
+    inline void sort_pair(T values[3], T v[3][3], const int i, const int j)
+    {
+        const auto swapped = v_less(values[i], values[j]);
+        const T a = values[i], b = values[j];
+        values[i] = v_select(swapped, b, a);
+        values[j] = v_select(swapped, a, b);
+        for (int k = 0; k < 3; ++k)
+        {
+            const T vi = v[i][k], vj = v[j][k];
+            v[i][k] = v_select(swapped, vj, vi);
+            v[j][k] = v_select(swapped, -vi, vj);
+        }
+    }
+
+    // Symmetric s = { xx, xy, xz, yy, yz, zz }. Eigenvectors are the columns of v (v[column][row]), with
+    // eigenvalues in descending order.
+    template<typename T>
+    inline void eigen_symmetric(const T s[6], T v[3][3], T values[3])
+    {
+        T xx = s[0], xy = s[1], xz = s[2], yy = s[3], yz = s[4], zz = s[5];
+        for (int i = 0; i < 3; ++i) for (int k = 0; k < 3; ++k) v[i][k] = T(i == k ? 1.0f : 0.0f);
+
+        for (int sweep = 0; sweep < JacobiSweeps; ++sweep)
+        {
+            jacobi_rotate(xx, yy, xy, xz, yz, v, 0, 1);
+            jacobi_rotate(xx, zz, xz, xy, yz, v, 0, 2);
+            jacobi_rotate(yy, zz, yz, xy, xz, v, 1, 2);
+        }
+
+        values[0] = xx;
+        values[1] = yy;
+        values[2] = zz;
+        sort_pair(values, v, 0, 1);
+        sort_pair(values, v, 0, 2);
+        sort_pair(values, v, 1, 2);
+    }
+
+    // Rotates rows i and j of b (b[column][row]) so that b(j, col) becomes zero, and accumulates the transpose
+    // of the rotation into the columns of u
+    template<typename T>
+    inline void givens_qr_step(T b[3][3], T u[3][3], const int i, const int j, const int col)
+    {
+        const T x = b[col][i], y = b[col][j];
+        const T r = v_sqrt(x * x + y * y);
+        const auto degenerate = v_less(r, T(1e-30f));
+        const T inv = T(1.0f) / v_max(r, T(1e-30f));
+        const T c = v_select(degenerate, T(1.0f), x * inv);
+        const T s = v_select(degenerate, T(0.0f), y * inv);
+
+        for (int k = 0; k < 3; ++k)
+        {
+            const T bi = b[k][i], bj = b[k][j];
+            b[k][i] = c * bi + s * bj;
+            b[k][j] = c * bj - s * bi;
+
+            const T ui = u[i][k], uj = u[j][k];
+            u[i][k] = c * ui + s * uj;
+            u[j][k] = c * uj - s * ui;
+        }
+    }
+
+    // b = a * v, then b = u * r by Givens QR. When v holds the right singular vectors the columns of b are
+    // orthogonal, so r is diagonal up to rounding.
+    template<typename T>
+    inline void qr_of_product(const T a[3][3], const T v[3][3], T u[3][3], T r[3][3])
+    {
+        for (int j = 0; j < 3; ++j)
+        {
+            for (int k = 0; k < 3; ++k) r[j][k] = a[0][k] * v[j][0] + a[1][k] * v[j][1] + a[2][k] * v[j][2];
+        }
+
+        for (int i = 0; i < 3; ++i) for (int k = 0; k < 3; ++k) u[i][k] = T(i == k ? 1.0f : 0.0f);
+        givens_qr_step(r, u, 0, 1, 0);
+        givens_qr_step(r, u, 0, 2, 0);
+        givens_qr_step(r, u, 1, 2, 1);
+    }
+
+    // a = u * diag(sigma) * v^T with a, u, v as [column][row]. u and v are rotations and sigma is sorted by
+    // magnitude; the last singular value carries the sign of det(a).
+    template<typename T>
+    inline void svd(const T a[3][3], T u[3][3], T sigma[3], T v[3][3])
+    {
+        T s[6];
+        s[0] = a[0][0] * a[0][0] + a[0][1] * a[0][1] + a[0][2] * a[0][2];
+        s[1] = a[0][0] * a[1][0] + a[0][1] * a[1][1] + a[0][2] * a[1][2];
+        s[2] = a[0][0] * a[2][0] + a[0][1] * a[2][1] + a[0][2] * a[2][2];
+        s[3] = a[1][0] * a[1][0] + a[1][1] * a[1][1] + a[1][2] * a[1][2];
+        s[4] = a[1][0] * a[2][0] + a[1][1] * a[2][1] + a[1][2] * a[2][2];
+        s[5] = a[2][0] * a[2][0] + a[2][1] * a[2][1] + a[2][2] * a[2][2];
+
+        T values[3];
+        eigen_symmetric(s, v, values);
+
+        T r[3][3];
+        qr_of_product(a, v, u, r);
+
+        // Singular values much below sqrt(eps) * sigma[0] are lost to rounding in a^T a, so the last two columns
+        // of v can be off, which shows up as a large r(1, 2). One Jacobi rotation of the lower 2x2 block of
+        // r^T r, which is formed from r itself, recovers them; then the QR is redone with the corrected v.
+        T xx = r[1][1] * r[1][1], xy = r[1][1] * r[2][1], yy = r[2][1] * r[2][1] + r[2][2] * r[2][2];
+        T unused0 = T(0.0f), unused1 = T(0.0f);
+        jacobi_rotate(xx, yy, xy, unused0, unused1, v, 1, 2);
+        values[1] = xx;
+        values[2] = yy;
+        sort_pair(values, v, 1, 2);
+        qr_of_product(a, v, u, r);
+
+        sigma[0] = r[0][0];
+        sigma[1] = r[1][1];
+        sigma[2] = r[2][2];
+    }
+
+    inline void load_symmetric(const float3x3 & m, float s[6]) { s[0] = m[0][0]; s[1] = m[1][0]; s[2] = m[2][0]; s[3] = m[1][1]; s[4] = m[2][1]; s[5] = m[2][2]; }
+    inline void load(const float3x3 & m, float a[3][3]) { for (int c = 0; c < 3; ++c) for (int r = 0; r < 3; ++r) a[c][r] = m[c][r]; }
+    inline void store(const float a[3][3], float3x3 & m) { for (int c = 0; c < 3; ++c) for (int r = 0; r < 3; ++r) m[c][r] = a[c][r]; }
+
+    // Runs `kernel(in, out)` over `count` items: W at a time while at least W remain, through the widest
+    // available lane type, then one at a time. Inputs and outputs are transposed through lane-major scratch.
+    template<int NumIn, int NumOut, typename LoadF, typename StoreF, typename KernelF>
+    inline void for_each_lane_group(const size_t count, LoadF && load_item, StoreF && store_item, KernelF && kernel)
+    {
+        size_t i = 0;
+    #if defined(AVL_SVD3_AVX)
+        for (; i + 8 <= count; i += 8)
+        {
+            alignas(32) float in[NumIn][8], out[NumOut][8];
+            for (int l = 0; l < 8; ++l) { float item[NumIn]; load_item(i + l, item); for (int k = 0; k < NumIn; ++k) in[k][l] = item[k]; }
+            lane8 vin[NumIn], vout[NumOut];
+            for (int k = 0; k < NumIn; ++k) vin[k] = _mm256_load_ps(in[k]);
+            kernel(vin, vout);
+            for (int k = 0; k < NumOut; ++k) _mm256_store_ps(out[k], vout[k].v);
+            for (int l = 0; l < 8; ++l) { float item[NumOut]; for (int k = 0; k < NumOut; ++k) item[k] = out[k][l]; store_item(i + l, item); }
+        }
+    #endif
+    #if defined(AVL_SVD3_SSE)
+        for (; i + 4 <= count; i += 4)
+        {
+            alignas(16) float in[NumIn][4], out[NumOut][4];
+            for (int l = 0; l < 4; ++l) { float item[NumIn]; load_item(i + l, item); for (int k = 0; k < NumIn; ++k) in[k][l] = item[k]; }
+            lane4 vin[NumIn], vout[NumOut];
+            for (int k = 0; k < NumIn; ++k) vin[k] = _mm_load_ps(in[k]);
+            kernel(vin, vout);
+            for (int k = 0; k < NumOut; ++k) _mm_store_ps(out[k], vout[k].v);
+            for (int l = 0; l < 4; ++l) { float item[NumOut]; for (int k = 0; k < NumOut; ++k) item[k] = out[k][l]; store_item(i + l, item); }
+        }
+    #endif
+        for (; i < count; ++i)
+        {
+            float in[NumIn], out[NumOut];
+            load_item(i, in);
+            kernel(in, out);
+            store_item(i, out);
+        }
+    }
+
+    // Flat in/out adapters for the kernels above: in and out are arrays of NumIn / NumOut lanes
+    struct eigen_kernel
+    {
+        template<typename T> void operator()(const T * in, T * out) const
+        {
+            T v[3][3], values[3];
+            eigen_symmetric(in, v, values);
+            for (int c = 0; c < 3; ++c) for (int r = 0; r < 3; ++r) out[c * 3 + r] = v[c][r];
+            for (int k = 0; k < 3; ++k) out[9 + k] = values[k];
+        }
+    };
+
+    struct svd_kernel
+    {
+        template<typename T> void operator()(const T * in, T * out) const
+        {
+            T a[3][3], u[3][3], sigma[3], v[3][3];
+            for (int c = 0; c < 3; ++c) for (int r = 0; r < 3; ++r) a[c][r] = in[c * 3 + r];
+            svd(a, u, sigma, v);
+            for (int c = 0; c < 3; ++c) for (int r = 0; r < 3; ++r) { out[c * 3 + r] = u[c][r]; out[12 + c * 3 + r] = v[c][r]; }
+            for (int k = 0; k < 3; ++k) out[9 + k] = sigma[k];
+        }
+    };
+}
+
+// Eigen decomposition of a symmetric 3x3 matrix (only the lower triangle is read): A = V * diag(values) * V^T.
+// The columns of V are the eigenvectors, with eigenvalues in descending order, and V is a rotation.
+inline void symmetric_eigen_decomposition_3x3(const float3x3 & A, float3x3 & V, float3 & values)
+{
+    float s[6], v[3][3], e[3];
+    svd3_detail::load_symmetric(A, s);
+    svd3_detail::eigen_symmetric(s, v, e);
+    svd3_detail::store(v, V);
+    values = { e[0], e[1], e[2] };
+}
+
+// Batched form of the above; runs 8 or 4 matrices per instruction where AVX or SSE is available
+inline void symmetric_eigen_decomposition_3x3(const float3x3 * A, const size_t count, float3x3 * V, float3 * values)
+{
+    svd3_detail::for_each_lane_group<6, 12>(count,
+        [&](size_t i, float * in) { svd3_detail::load_symmetric(A[i], in); },
+        [&](size_t i, const float * out)
+        {
+            for (int c = 0; c < 3; ++c) for (int r = 0; r < 3; ++r) V[i][c][r] = out[c * 3 + r];
+            values[i] = { out[9], out[10], out[11] };
+        },
+        svd3_detail::eigen_kernel());
+}
+
+// A = U * diag(sigma) * V^T with U and V rotations and sigma sorted by magnitude. The smallest singular value
+// is negative when det(A) < 0. Unlike singular_value_decomposition, A is left untouched.
+inline void singular_value_decomposition_3x3(const float3x3 & A, float3x3 & U, float3 & sigma, float3x3 & V)
+{
+    float a[3][3], u[3][3], s[3], v[3][3];
+    svd3_detail::load(A, a);
+    svd3_detail::svd(a, u, s, v);
+    svd3_detail::store(u, U);
+    svd3_detail::store(v, V);
+    sigma = { s[0], s[1], s[2] };
+}
+
+inline void singular_value_decomposition_3x3(const float3x3 * A, const size_t count, float3x3 * U, float3 * sigma, float3x3 * V)
+{
+    svd3_detail::for_each_lane_group<9, 21>(count,
+        [&](size_t i, float * in) { for (int c = 0; c < 3; ++c) for (int r = 0; r < 3; ++r) in[c * 3 + r] = A[i][c][r]; },
+        [&](size_t i, const float * out)
+        {
+            for (int c = 0; c < 3; ++c) for (int r = 0; r < 3; ++r) { U[i][c][r] = out[c * 3 + r]; V[i][c][r] = out[12 + c * 3 + r]; }
+            sigma[i] = { out[9], out[10], out[11] };
+        },
+        svd3_detail::svd_kernel());
+}
+
 namespace svd_tests
 {
     inline void check_orthonormal(const float3x3 & matrix)
@@ -445,9 +771,35 @@ namespace svd_tests
         check_orthonormal(V);
     }
 
+    // The fixed-size kernels against the same tolerances, plus the eigen decomposition of A^T A
+    inline void validate_matrix_3x3(const float3x3 & A)
+    {
+        float maxEntry = 0;
+        for (int i = 0; i < 3; ++i) for (int j = 0; j < 3; ++j) maxEntry = std::max(maxEntry, std::abs(A[j][i]));
+        const float valueEps = maxEntry * 10.f * std::numeric_limits<float>::epsilon();
+
+        float3x3 U, V;
+        float3 S;
+        singular_value_decomposition_3x3(A, U, S, V);
+        const float3x3 P = mul(U, mul(float3x3({ S.x, 0, 0 }, { 0, S.y, 0 }, { 0, 0, S.z }), transpose(V)));
+        for (int i = 0; i < 3; ++i) for (int j = 0; j < 3; ++j) assert(std::abs(P[i][j] - A[i][j]) <= valueEps);
+        assert(std::abs(S.x) >= std::abs(S.y) && std::abs(S.y) >= std::abs(S.z));
+        check_orthonormal(U);
+        check_orthonormal(V);
+
+        const float3x3 AtA = mul(transpose(A), A);
+        float3 E;
+        symmetric_eigen_decomposition_3x3(AtA, V, E);
+        const float3x3 Q = mul(V, mul(float3x3({ E.x, 0, 0 }, { 0, E.y, 0 }, { 0, 0, E.z }), transpose(V)));
+        for (int i = 0; i < 3; ++i) for (int j = 0; j < 3; ++j) assert(std::abs(Q[i][j] - AtA[i][j]) <= 10.f * valueEps * maxEntry);
+        assert(E.x >= E.y && E.y >= E.z);
+        check_orthonormal(V);
+    }
+
     inline void execute()
     {
         float3x3 Identity = Identity3x3;
+        validate_matrix_3x3(Identity);
         validate_matrix<float3x3, float>(Identity, 3, 3);
 
         float3x3 TrickyMatrix1 = {
@@ -455,6 +807,7 @@ namespace svd_tests
             { -0.032460753747103721f, 0.046584527749418278f, 0.067431228641151142f },
             { -0.088885055229687815f, 0.1280389179308779f, 0.18532617511453064f }
         };
+        validate_matrix_3x3(TrickyMatrix1);
         validate_matrix<float3x3, float>(TrickyMatrix1, 3, 3);
 
         float3x3 TrickyMatrix2 = {
@@ -462,6 +815,7 @@ namespace svd_tests
             { 0.0088671829608044754f, 0.0016771794267033666f, -0.0043081475729438235f},
             { 0.003976050440932701f, 0.0019880497026345716f, 0.0089576046614601966f }
         };
+        validate_matrix_3x3(TrickyMatrix2);
         validate_matrix<float3x3, float>(TrickyMatrix2, 3, 3);
 
         float3x3 TrickyMatrix3 = {
@@ -469,6 +823,7 @@ namespace svd_tests
             { 0, .0003f, 0},
             { 1e-17f, 0, 0}
         };
+        validate_matrix_3x3(TrickyMatrix3);
         validate_matrix<float3x3, float>(TrickyMatrix3, 3, 3);
 
         float3x3 TrickyMatrix4 = {
@@ -476,6 +831,7 @@ namespace svd_tests
             { 0, 1e-8f, 0 },
             { 0, 0, 1e-8f }
         };
+        validate_matrix_3x3(TrickyMatrix4);
         validate_matrix<float3x3, float>(TrickyMatrix4, 3, 3);
 
         float3x3 TrickyMatrix5 = {
@@ -483,6 +839,7 @@ namespace svd_tests
             { 8.69382f, 42.4879f, 0.000001f },
             { -12.3872f, -0.5000f, -0.22222f }
         };
+        validate_matrix_3x3(TrickyMatrix5);
         validate_matrix<float3x3, float>(TrickyMatrix5, 3, 3);
 
     }
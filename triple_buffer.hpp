@@ -0,0 +1,57 @@
+// This is free and unencumbered software released into the public domain.
+
+#ifndef triple_buffer_hpp
+#define triple_buffer_hpp
+
+#include <atomic>
+#include <stdint.h>
+
+// Latest-value hand-off between one writer and one reader, e.g. a simulation thread publishing state
+// snapshots to the render thread. The writer fills `write_buffer()` and calls `publish()`; the reader calls
+// `read_buffer()` (after `update()`) to get the most recently published value. Neither side ever waits
+// and intermediate values are simply overwritten. The three slots are exchanged through a single atomic
+// byte holding the index of the shared middle slot plus a "fresh" bit.
+template<typename T>
+class TripleBuffer
+{
+    static const uint8_t FreshBit = 0x4;
+    static const uint8_t IndexMask = 0x3;
+
+    T buffers[3];
+    typedef char cache_line_pad_t[64];
+
+    cache_line_pad_t pad0;
+    std::atomic<uint8_t> middle{ 1 };
+    cache_line_pad_t pad1;
+    uint8_t back{ 0 };  // owned by the writer
+    cache_line_pad_t pad2;
+    uint8_t front{ 2 }; // owned by the reader
+
+    TripleBuffer(const TripleBuffer &) = delete;
+    TripleBuffer & operator= (const TripleBuffer &) = delete;
+
+public:
+
+    TripleBuffer() = default;
+    explicit TripleBuffer(const T & initial) { buffers[0] = buffers[1] = buffers[2] = initial; }
+
+    // Writer side
+    T & write_buffer() { return buffers[back]; }
+
+    void publish()
+    {
+        back = middle.exchange(uint8_t(back | FreshBit), std::memory_order_acq_rel) & IndexMask;
+    }
+
+    // Reader side. Returns true if a newer value was picked up.
+    bool update()
+    {
+        if (!(middle.load(std::memory_order_relaxed) & FreshBit)) return false;
+        front = middle.exchange(front, std::memory_order_acq_rel) & IndexMask;
+        return true;
+    }
+
+    const T & read_buffer() const { return buffers[front]; }
+};
+
+#endif // end triple_buffer_hpp
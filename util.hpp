@@ -1,6 +1,7 @@
 #ifndef main_util_h
 #define main_util_h
 
+#include <assert.h>
 #include <sstream>
 #include <iostream>
 #include <vector>
@@ -8,6 +9,12 @@
 #include <memory>
 #include <chrono>
 #include <mutex>
+#include <thread>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <type_traits>
 
 #if (defined(__linux) || defined(__unix) || defined(__posix) || defined(__LINUX__) || defined(__linux__))
     #define ANVIL_PLATFORM_LINUX 1
@@ -133,6 +140,139 @@ namespace avl
         static T * get_instance() { if (!single) single = new T(); return single; };
     };
 
+    // Worker threads behind `parallel_for`, started on first use and kept for the life of the program. One
+    // range runs at a time; the submitting thread works on it too and returns once every chunk is done. An
+    // exception thrown by a chunk is rethrown on the submitting thread after the range has finished.
+    class parallel_for_pool : public Noncopyable
+    {
+        std::vector<std::thread> workers;
+        std::mutex mutex;
+        std::condition_variable wake, done;
+        uint64_t generation{ 0 };
+        size_t inFlight{ 0 };   // workers inside `run_chunks`
+        bool jobOpen{ false };  // workers may only join while set; cleared once the range is finished
+        bool stopping{ false };
+
+        std::mutex submitMutex;
+        void (*invoke)(void *, size_t, size_t){ nullptr };
+        void * context{ nullptr };
+        size_t jobBegin{ 0 }, jobEnd{ 0 }, chunkSize{ 0 }, numChunks{ 0 };
+        std::atomic<size_t> nextChunk{ 0 }, remaining{ 0 };
+        std::exception_ptr error;
+
+        static bool & on_worker() { thread_local bool worker = false; return worker; }
+
+        void run_chunks()
+        {
+            for (size_t c = nextChunk.fetch_add(1, std::memory_order_relaxed); c < numChunks; c = nextChunk.fetch_add(1, std::memory_order_relaxed))
+            {
+                const size_t b = jobBegin + c * chunkSize;
+                try { invoke(context, b, std::min(jobEnd, b + chunkSize)); }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> guard(mutex);
+                    if (!error) error = std::current_exception();
+                }
+                remaining.fetch_sub(1, std::memory_order_acq_rel);
+            }
+        }
+
+        void worker_loop()
+        {
+            on_worker() = true;
+            uint64_t seen = 0;
+            std::unique_lock<std::mutex> lock(mutex);
+            for (;;)
+            {
+                wake.wait(lock, [&]() { return stopping || (jobOpen && generation != seen); });
+                if (stopping) return;
+                seen = generation;
+                ++inFlight;
+                lock.unlock();
+                run_chunks();
+                lock.lock();
+                if (--inFlight == 0) done.notify_all();
+            }
+        }
+
+    public:
+
+        parallel_for_pool()
+        {
+            const size_t n = std::max<size_t>(1, std::thread::hardware_concurrency()) - 1;
+            for (size_t i = 0; i < n; ++i) workers.emplace_back(&parallel_for_pool::worker_loop, this);
+        }
+
+        ~parallel_for_pool()
+        {
+            {
+                std::lock_guard<std::mutex> guard(mutex);
+                stopping = true;
+            }
+            wake.notify_all();
+            for (auto & w : workers) w.join();
+        }
+
+        static parallel_for_pool & get_instance()
+        {
+            static parallel_for_pool pool;
+            return pool;
+        }
+
+        size_t num_threads() const { return workers.size() + 1; }
+
+        // Runs `f(b, e)` over [begin, end) in `chunks` pieces. Nested calls from inside a chunk, and calls made
+        // while another thread's range is running, execute inline on the calling thread instead.
+        template<typename F>
+        void run(const size_t begin, const size_t end, const size_t chunks, F && f)
+        {
+            typedef typename std::remove_reference<F>::type fn_type;
+
+            std::unique_lock<std::mutex> submit(submitMutex, std::defer_lock);
+            if (workers.empty() || chunks < 2 || on_worker() || !submit.try_lock()) { f(begin, end); return; }
+
+            std::exception_ptr failure;
+            std::unique_lock<std::mutex> lock(mutex);
+            invoke = [](void * ctx, size_t b, size_t e) { (*static_cast<fn_type *>(ctx))(b, e); };
+            context = &f;
+            jobBegin = begin;
+            jobEnd = end;
+            chunkSize = (end - begin + chunks - 1) / chunks;
+            numChunks = (end - begin + chunkSize - 1) / chunkSize;
+            nextChunk.store(0, std::memory_order_relaxed);
+            remaining.store(numChunks, std::memory_order_relaxed);
+            jobOpen = true;
+            ++generation;
+            lock.unlock();
+            wake.notify_all();
+
+            run_chunks();
+
+            // Every chunk is finished once no worker is inside `run_chunks`; closing the job keeps late wakers out
+            lock.lock();
+            done.wait(lock, [&]() { return inFlight == 0; });
+            assert(remaining.load(std::memory_order_acquire) == 0);
+            jobOpen = false;
+            std::swap(failure, error);
+            lock.unlock();
+
+            if (failure) std::rethrow_exception(failure);
+        }
+    };
+
+    // Splits [begin, end) into contiguous chunks of at least `grain` items and runs `f(chunkBegin, chunkEnd)`
+    // for each on the shared parallel_for_pool. Small ranges run inline on the calling thread.
+    template<typename F>
+    inline void parallel_for(const size_t begin, const size_t end, const size_t grain, F && f)
+    {
+        if (end <= begin) return;
+        const size_t count = end - begin;
+        const size_t maxThreads = std::max<size_t>(1, std::thread::hardware_concurrency());
+        const size_t numChunks = std::min(maxThreads, std::max<size_t>(1, count / std::max<size_t>(1, grain)));
+        if (numChunks == 1) { f(begin, end); return; }
+        parallel_for_pool::get_instance().run(begin, end, numChunks, std::forward<F>(f));
+    }
+
     inline std::string codepoint_to_utf8(uint32_t codepoint)
     {
         int n = 0;
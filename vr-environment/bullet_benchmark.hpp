@@ -0,0 +1,112 @@
+#pragma once
+
+#ifndef bullet_benchmark_vr_hpp
+#define bullet_benchmark_vr_hpp
+
+#include "bullet_engine.hpp"
+#include "simple_timer.hpp"
+
+#include <random>
+#include <iostream>
+
+// Stress scene for the physics step: a grid of box towers (many small islands, which solve in parallel) next
+// to a rubble pile of mixed shapes (one large island of deep, persistent contacts). Owns every body it adds.
+class BulletStackingScene
+{
+    BulletEngineVR & engine;
+    std::vector<std::unique_ptr<btCollisionShape>> shapes;
+    std::vector<std::unique_ptr<btDefaultMotionState>> states;
+    std::vector<std::unique_ptr<btRigidBody>> bodies;
+
+    void add_body(btCollisionShape * shape, const btVector3 & position, const btQuaternion & rotation, const float mass)
+    {
+        btVector3 inertia(0, 0, 0);
+        if (mass > 0.0f) shape->calculateLocalInertia(mass, inertia);
+        states.emplace_back(new btDefaultMotionState(btTransform(rotation, position)));
+        btRigidBody::btRigidBodyConstructionInfo info(mass, states.back().get(), shape, inertia);
+        info.m_friction = 0.7f;
+        bodies.emplace_back(new btRigidBody(info));
+        engine.get_world()->addRigidBody(bodies.back().get());
+    }
+
+public:
+
+    BulletStackingScene(BulletEngineVR & engine, const int towersPerSide = 8, const int towerHeight = 12, const int rubbleCount = 1024) : engine(engine)
+    {
+        const float spacing = 2.0f;
+        const float extent = towersPerSide * spacing;
+
+        shapes.emplace_back(new btBoxShape(btVector3(extent + 16.f, 1.f, extent + 16.f)));
+        add_body(shapes.back().get(), btVector3(0, -1, 0), btQuaternion::getIdentity(), 0.0f);
+
+        shapes.emplace_back(new btBoxShape(btVector3(0.25f, 0.25f, 0.25f)));
+        btCollisionShape * brick = shapes.back().get();
+        for (int x = 0; x < towersPerSide; ++x)
+        {
+            for (int z = 0; z < towersPerSide; ++z)
+            {
+                const btVector3 base((x - towersPerSide / 2) * spacing, 0.25f, (z - towersPerSide / 2) * spacing);
+                for (int y = 0; y < towerHeight; ++y) add_body(brick, base + btVector3(0, y * 0.5f, 0), btQuaternion::getIdentity(), 1.0f);
+            }
+        }
+
+        shapes.emplace_back(new btSphereShape(0.2f));
+        shapes.emplace_back(new btCapsuleShape(0.15f, 0.4f));
+        shapes.emplace_back(new btBoxShape(btVector3(0.3f, 0.1f, 0.2f)));
+        btCollisionShape * rubble[3] = { shapes[2].get(), shapes[3].get(), shapes[4].get() };
+
+        std::mt19937 gen(1234);
+        std::uniform_real_distribution<float> spread(-2.5f, 2.5f), angle(0.f, 6.2831853f);
+        for (int i = 0; i < rubbleCount; ++i)
+        {
+            const btVector3 p(extent / 2 + 6.f + spread(gen), 0.5f + i * 0.02f, spread(gen));
+            add_body(rubble[i % 3], p, btQuaternion(btVector3(0, 1, 0), angle(gen)) * btQuaternion(btVector3(1, 0, 0), angle(gen)), 0.5f);
+        }
+    }
+
+    ~BulletStackingScene()
+    {
+        for (auto & b : bodies) engine.get_world()->removeRigidBody(b.get());
+    }
+
+    size_t num_bodies() const { return bodies.size(); }
+};
+
+struct BulletBenchmarkResult
+{
+    size_t threads;
+    size_t bodies;
+    double meanStepMs;
+    double maxStepMs;
+};
+
+// Times `frames` steps of 1/60 s of the stacking scene on each thread count in turn. Every run starts from the
+// same freshly built scene; the first `warmup` frames (settling, pool growth) are excluded.
+inline std::vector<BulletBenchmarkResult> run_bullet_stacking_benchmark(const std::vector<size_t> & threadCounts = { 1, 2, 4, 8, 16 }, const int frames = 300, const int warmup = 30)
+{
+    std::vector<BulletBenchmarkResult> results;
+    for (const size_t threads : threadCounts)
+    {
+        BulletEngineVR engine(threads);
+        BulletStackingScene scene(engine);
+
+        for (int f = 0; f < warmup; ++f) engine.update(1.f / 60.f);
+
+        double total = 0, worst = 0;
+        for (int f = 0; f < frames; ++f)
+        {
+            SimpleTimer t(true);
+            engine.update(1.f / 60.f);
+            const double ms = t.nanoseconds().count() * 1e-6;
+            total += ms;
+            worst = std::max(worst, ms);
+        }
+
+        results.push_back({ engine.get_num_threads(), scene.num_bodies(), total / frames, worst });
+        std::cout << "Physics step, " << results.back().threads << " threads, " << results.back().bodies << " bodies: "
+                  << results.back().meanStepMs << " ms mean, " << results.back().maxStepMs << " ms max" << std::endl;
+    }
+    return results;
+}
+
+#endif // end bullet_benchmark_vr_hpp
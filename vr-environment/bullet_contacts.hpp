@@ -0,0 +1,189 @@
+#pragma once
+
+#ifndef bullet_contacts_vr_hpp
+#define bullet_contacts_vr_hpp
+
+#include "btBulletCollisionCommon.h"
+#include "math-core.hpp"
+#include "bullet_utils.hpp"
+
+#include <vector>
+#include <algorithm>
+#include <functional>
+
+using namespace avl;
+
+enum class contact_event_type : uint8_t
+{
+    begin,      // the pair touches this step but did not on the previous one
+    persist,    // the pair touched on both steps
+    end         // the pair touched on the previous step only; carries no points
+};
+
+// One contact point of a pair, from the perspective of the event's `a` (the normal points from b towards a)
+struct BulletContactPairPointVR
+{
+    float3 positionOnA;
+    float3 positionOnB;
+    float3 normalOnB;
+    float distance;     // negative when penetrating
+    float impulse;      // applied by the solver during the last step
+};
+
+// The points of a pair are points[firstPoint, firstPoint + numPoints) in the tracker's point buffer, merged
+// across all of the pair's manifolds (compound shapes produce several).
+struct BulletContactEventVR
+{
+    contact_event_type type;
+    const btCollisionObject * a;
+    const btCollisionObject * b;
+    uint32_t firstPoint;
+    uint32_t numPoints;
+    uint32_t step;      // which step of the frame produced it, counting from 0
+};
+
+// Turns the dispatcher's persistent manifolds into per-pair contact events after every step, in place of running
+// contactTest per object (which repeats the broadphase and narrowphase work the step has just done). The
+// manifolds are gathered and sorted by body pair, then merged against the previous step's sorted pair list to
+// classify begin / persist / end. The events of all steps since begin_frame() accumulate in step order, so a
+// pair shows up once per step it was reported in. Event and point buffers are flat and reused, so steady state
+// allocates nothing. Only pairs where at least one body's collision group intersects the report mask are harvested.
+// A manifold counts as touching as soon as it holds a point, i.e. within Bullet's contact breaking threshold;
+// use `distance` for a stricter test.
+class BulletContactTracker
+{
+    struct pair_key
+    {
+        const btCollisionObject * a;
+        const btCollisionObject * b;
+        bool operator == (const pair_key & r) const { return a == r.a && b == r.b; }
+        bool operator < (const pair_key & r) const
+        {
+            const std::less<const btCollisionObject *> less;
+            return less(a, r.a) || (a == r.a && less(b, r.b));
+        }
+    };
+
+    struct manifold_ref { pair_key key; const btPersistentManifold * manifold; };
+
+    std::vector<manifold_ref> harvested;
+    std::vector<pair_key> previous, current;    // sorted
+    std::vector<BulletContactEventVR> events;
+    std::vector<BulletContactPairPointVR> points;
+    int reportMask{ -1 };
+    uint32_t stepInFrame{ 0 };
+
+    bool reports(const btCollisionObject * o) const
+    {
+        const btBroadphaseProxy * proxy = o->getBroadphaseHandle();
+        return proxy && (proxy->m_collisionFilterGroup & reportMask);
+    }
+
+    void add_end(const pair_key & key)
+    {
+        events.push_back({ contact_event_type::end, key.a, key.b, uint32_t(points.size()), 0, stepInFrame });
+    }
+
+public:
+
+    // Collision groups (as passed to addRigidBody) to report on; all by default
+    void set_report_mask(const int mask) { reportMask = mask; }
+
+    // Drops the events and points gathered so far; call before the first step of a frame. Begin / persist / end
+    // classification carries over, since it only depends on the pairs of the last step.
+    void begin_frame()
+    {
+        events.clear();
+        points.clear();
+        stepInFrame = 0;
+    }
+
+    // Call after each step, e.g. from an internal tick callback. Appends that step's events and points.
+    void update(btDispatcher * dispatcher)
+    {
+        harvested.clear();
+        const int numManifolds = dispatcher->getNumManifolds();
+        for (int i = 0; i < numManifolds; ++i)
+        {
+            const btPersistentManifold * m = dispatcher->getManifoldByIndexInternal(i);
+            if (m->getNumContacts() == 0) continue;
+
+            const btCollisionObject * a = m->getBody0(), * b = m->getBody1();
+            if (!reports(a) && !reports(b)) continue;
+            if (std::less<const btCollisionObject *>()(b, a)) std::swap(a, b);
+            harvested.push_back({ { a, b }, m });
+        }
+        std::sort(harvested.begin(), harvested.end(), [](const manifold_ref & l, const manifold_ref & r) { return l.key < r.key; });
+
+        current.clear();
+
+        size_t p = 0;
+        for (size_t i = 0; i < harvested.size();)
+        {
+            const pair_key key = harvested[i].key;
+            while (p < previous.size() && previous[p] < key) add_end(previous[p++]);
+
+            contact_event_type type = contact_event_type::begin;
+            if (p < previous.size() && previous[p] == key)
+            {
+                type = contact_event_type::persist;
+                ++p;
+            }
+
+            const uint32_t first = uint32_t(points.size());
+            for (; i < harvested.size() && harvested[i].key == key; ++i)
+            {
+                const btPersistentManifold * m = harvested[i].manifold;
+                const bool flip = m->getBody0() != key.a;
+                for (int c = 0; c < m->getNumContacts(); ++c)
+                {
+                    const btManifoldPoint & pt = m->getContactPoint(c);
+                    const float3 onA = from_bt(flip ? pt.m_positionWorldOnB : pt.m_positionWorldOnA);
+                    const float3 onB = from_bt(flip ? pt.m_positionWorldOnA : pt.m_positionWorldOnB);
+                    const float3 n = from_bt(pt.m_normalWorldOnB);
+                    points.push_back({ onA, onB, flip ? -n : n, float(pt.getDistance()), float(pt.getAppliedImpulse()) });
+                }
+            }
+
+            events.push_back({ type, key.a, key.b, first, uint32_t(points.size()) - first, stepInFrame });
+            current.push_back(key);
+        }
+        while (p < previous.size()) add_end(previous[p++]);
+
+        std::swap(previous, current);
+        ++stepInFrame;
+    }
+
+    // Drops every pair involving `object` without reporting an end, for objects about to be destroyed
+    void forget(const btCollisionObject * object)
+    {
+        previous.erase(std::remove_if(previous.begin(), previous.end(), [object](const pair_key & k) { return k.a == object || k.b == object; }), previous.end());
+        events.erase(std::remove_if(events.begin(), events.end(), [object](const BulletContactEventVR & e) { return e.a == object || e.b == object; }), events.end());
+    }
+
+    void clear()
+    {
+        harvested.clear();
+        previous.clear();
+        events.clear();
+        points.clear();
+        stepInFrame = 0;
+    }
+
+    const std::vector<BulletContactEventVR> & get_events() const { return events; }
+    const std::vector<BulletContactPairPointVR> & get_points() const { return points; }
+
+    // Calls f(event, other, flipped) for each event involving `object`. When `flipped` is set, `object` is the
+    // event's b, so its points' normals and A / B positions are from the other body's perspective.
+    template<typename F>
+    void for_each_event(const btCollisionObject * object, F && f) const
+    {
+        for (const auto & e : events)
+        {
+            if (e.a == object) f(e, e.b, false);
+            else if (e.b == object) f(e, e.a, true);
+        }
+    }
+};
+
+#endif // end bullet_contacts_vr_hpp
@@ -6,93 +6,94 @@
 #include "math-core.hpp"
 #include "bullet_utils.hpp"
 #include "gl-api.hpp"
+#include "debug_line_renderer.hpp"
 #include "stb/stb_easy_font.h"
 #include "btBulletCollisionCommon.h"
 
 using namespace avl;
 
+// Forwards Bullet's debug drawing to a DebugLineRenderer. Boxes, spheres, AABBs and transforms are recorded
+// as single instances instead of Bullet's default expansion into lines, and the draw callbacks may be
+// invoked from the physics worker threads.
 class PhysicsDebugRenderer : public btIDebugDraw
 {
-    constexpr const static char debugVertexShader[] = R"(#version 330
-        layout(location = 0) in vec3 vertex;
-        layout(location = 1) in vec3 color;
-        uniform mat4 u_mvp;
-        out vec3 outColor;
-        void main()
-        {
-            gl_Position = u_mvp * vec4(vertex.xyz, 1);
-            outColor = color;
-        }
-    )";
-
-    constexpr static const char debugFragmentShader[] = R"(#version 330
-        in vec3 outColor;
-        out vec4 f_color;
-        void main()
-        {
-            f_color = vec4(outColor.rgb, 1);
-        }
-    )";
-
     std::vector<std::pair<float3, std::string>> text;
-    struct Vertex { float3 position; float3 color; };
-    std::vector<Vertex> vertices;
-    GlMesh debugMesh;
-    GlShader debugShader;
+    std::mutex textMutex;
+    DebugLineRenderer renderer;
 
     int debugMode = 0;
-    bool hasNewInfo{ false };
 
 public:
 
-    PhysicsDebugRenderer()
-    {
-        debugShader = GlShader(debugVertexShader, debugFragmentShader);
-    }
+    PhysicsDebugRenderer() = default;
 
     void draw(const float4x4 & viewProj) 
     {
-        debugMesh.set_vertices(vertices.size(), vertices.data(), GL_DYNAMIC_DRAW);
-        debugMesh.set_attribute(0, &Vertex::position);
-        debugMesh.set_attribute(1, &Vertex::color);
-        debugMesh.set_non_indexed(GL_LINES);
-
-        auto model = Identity4x4;
-        auto modelViewProjectionMatrix = mul(viewProj, model);
-
-        debugShader.bind();
-        debugShader.uniform("u_mvp", modelViewProjectionMatrix);
-        debugMesh.draw_elements();
-        debugShader.unbind();
+        renderer.draw(viewProj);
     }
 
     void clear()
     {
         text.clear();
-        vertices.clear();
+        renderer.clear();
     }
 
-    void drawContactPoint(const btVector3 & pointOnB, const btVector3 & normalOnB, btScalar distance, int lifeTime, const btVector3 & color)
+    DebugLineRenderer & get_renderer() { return renderer; }
+
+    void drawContactPoint(const btVector3 & pointOnB, const btVector3 & normalOnB, btScalar distance, int lifeTime, const btVector3 & color) override
     {
         drawLine(pointOnB, pointOnB + normalOnB * distance, color);
     }
 
-    void drawLine(const btVector3 & from, const btVector3 & to, const btVector3 & color)
+    void drawLine(const btVector3 & from, const btVector3 & to, const btVector3 & color) override
+    {
+        renderer.draw_line(from_bt(from), from_bt(to), from_bt(color));
+    }
+
+    void drawSphere(btScalar radius, const btTransform & transform, const btVector3 & color) override
+    {
+        renderer.draw_sphere(make_pose(transform), float(radius), from_bt(color));
+    }
+
+    void drawSphere(const btVector3 & p, btScalar radius, const btVector3 & color) override
+    {
+        renderer.draw_sphere(Pose(from_bt(p)), float(radius), from_bt(color));
+    }
+
+    void drawAabb(const btVector3 & from, const btVector3 & to, const btVector3 & color) override
+    {
+        renderer.draw_box(Bounds3D(from_bt(from), from_bt(to)), from_bt(color));
+    }
+
+    void drawBox(const btVector3 & bbMin, const btVector3 & bbMax, const btVector3 & color) override
+    {
+        renderer.draw_box(Bounds3D(from_bt(bbMin), from_bt(bbMax)), from_bt(color));
+    }
+
+    void drawBox(const btVector3 & bbMin, const btVector3 & bbMax, const btTransform & transform, const btVector3 & color) override
+    {
+        Pose pose = make_pose(transform);
+        pose.position = pose.transform_coord(from_bt((bbMin + bbMax) * btScalar(0.5)));
+        renderer.draw_box(pose, from_bt((bbMax - bbMin) * btScalar(0.5)), from_bt(color));
+    }
+
+    void drawTransform(const btTransform & transform, btScalar orthoLen) override
     {
-        vertices.push_back({ from_bt(from), from_bt(color) });
-        vertices.push_back({ from_bt(to), from_bt(color) });
+        renderer.draw_axis(make_pose(transform), float3(1, 1, 1), float(orthoLen));
     }
 
-    void draw3dText(const btVector3 & position, const char * textString)
+    // May be called from several threads, unlike the rest of the text handling
+    void draw3dText(const btVector3 & position, const char * textString) override
     {
+        std::lock_guard<std::mutex> guard(textMutex);
         text.emplace_back(from_bt(position), textString);
     }
 
-    void reportErrorWarning(const char * warningString) { std::cout << "Bullet Warning: " << warningString << std::endl; }
+    void reportErrorWarning(const char * warningString) override { std::cout << "Bullet Warning: " << warningString << std::endl; }
 
     void setDebugMode(int debugMode) override { this->debugMode = debugMode; }
 
-    int getDebugMode() const { return debugMode; }
+    int getDebugMode() const override { return debugMode; }
 
     void toggleDebugFlag(const int flag)
     {
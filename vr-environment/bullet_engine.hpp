@@ -9,6 +9,8 @@
 #include "math-core.hpp"
 #include "geometry.hpp"
 #include "bullet_utils.hpp"
+#include "bullet_threading.hpp"
+#include "bullet_contacts.hpp"
 #include <functional>
 
 #include "bullet_object.hpp"
@@ -19,13 +21,18 @@ class BulletEngineVR
 {
     using OnTickCallback = std::function<void(float, BulletEngineVR *)>;
 
+    std::shared_ptr<BulletTaskScheduler> scheduler = { nullptr };
     std::shared_ptr<btBroadphaseInterface> broadphase = { nullptr };
     std::shared_ptr<btDefaultCollisionConfiguration> collisionConfiguration = { nullptr };
     std::shared_ptr<btCollisionDispatcher> dispatcher = { nullptr };
-    std::shared_ptr<btSequentialImpulseConstraintSolver> solver = { nullptr };
+    std::shared_ptr<btConstraintSolver> solver = { nullptr };
     std::shared_ptr<btDiscreteDynamicsWorld> dynamicsWorld = { nullptr };
 
     std::vector<OnTickCallback> bulletTicks;
+    BulletContactTracker contacts;
+
+    float fixedTimeStep = 1.f / 60.f;
+    int maxSubSteps = 1;
 
     static void tick_callback(btDynamicsWorld * world, btScalar time)
     {
@@ -37,21 +44,55 @@ class BulletEngineVR
         }
     }
 
+    static void post_tick_callback(btDynamicsWorld * world, btScalar)
+    {
+        BulletEngineVR * engineContext = static_cast<BulletEngineVR *>(world->getWorldUserInfo());
+        engineContext->contacts.update(world->getDispatcher());
+    }
+
 public:
 
-    BulletEngineVR()
+    // With numThreads > 1, narrowphase, per-body integration and island solving run on a pool of that many
+    // threads (the caller of update() included). Requires Bullet to be compiled with BT_THREADSAFE=1;
+    // without it the engine always runs serially.
+    explicit BulletEngineVR(const size_t numThreads = 1)
     {
         broadphase.reset(new btDbvtBroadphase());
         collisionConfiguration.reset(new btDefaultCollisionConfiguration());
-        dispatcher.reset(new btCollisionDispatcher(collisionConfiguration.get()));
-        solver.reset(new btSequentialImpulseConstraintSolver());
-        dynamicsWorld.reset(new btDiscreteDynamicsWorld(dispatcher.get(), broadphase.get(), solver.get(), collisionConfiguration.get()));
+
+#if BT_THREADSAFE
+        if (numThreads > 1)
+        {
+            scheduler.reset(new BulletTaskScheduler(numThreads));
+            dispatcher.reset(new BulletCollisionDispatcherMt(collisionConfiguration.get(), scheduler.get()));
+            solver.reset(new BulletSolverPool(numThreads));
+            dynamicsWorld.reset(new BulletDynamicsWorldMt(dispatcher.get(), broadphase.get(), solver.get(), collisionConfiguration.get(), scheduler.get()));
+        }
+#endif
+        if (!dynamicsWorld)
+        {
+            dispatcher.reset(new btCollisionDispatcher(collisionConfiguration.get()));
+            solver.reset(new btSequentialImpulseConstraintSolver());
+            dynamicsWorld.reset(new btDiscreteDynamicsWorld(dispatcher.get(), broadphase.get(), solver.get(), collisionConfiguration.get()));
+        }
+
         dynamicsWorld->setGravity(btVector3(0.f, -9.87f, 0.0f));
         dynamicsWorld->setInternalTickCallback(tick_callback, static_cast<void *>(this), true);
+        dynamicsWorld->setInternalTickCallback(post_tick_callback, static_cast<void *>(this), false); // harvests contacts; don't replace
     }
 
     ~BulletEngineVR() { }
 
+    size_t get_num_threads() const { return scheduler ? scheduler->num_threads() : 1; }
+
+    // Simulation advances in steps of `timeStep` seconds, at most `maxSteps` per update() (time beyond that is
+    // dropped). Tick callbacks run once per step.
+    void set_substeps(const float timeStep, const int maxSteps)
+    {
+        fixedTimeStep = timeStep;
+        maxSubSteps = std::max(1, maxSteps);
+    }
+
     std::shared_ptr<btDiscreteDynamicsWorld> get_world()
     {
         return dynamicsWorld;
@@ -67,17 +108,25 @@ public:
     // Remove an existing rigid body based on BulletObjectVR wrapper
     void remove_object(BulletObjectVR * object)
     {
+        contacts.forget(object->body.get());
         object->get_world()->removeRigidBody(object->body.get());
     }
 
+    // Contact events of every step taken by the most recent update(), in step order; empty if it took none
+    const BulletContactTracker & get_contacts() const { return contacts; }
+    BulletContactTracker & get_contacts() { return contacts; }
+
     void add_task(const OnTickCallback & f)
     {
         bulletTicks.push_back({ f });
     }
 
-    void update(const float dt = 0.0f)
+    // Returns the number of fixed steps taken
+    int update(const float dt = 0.0f)
     {
-        const int result = dynamicsWorld->stepSimulation(dt);
+        bullet_scheduler_scope scope(scheduler.get());
+        contacts.begin_frame();
+        return dynamicsWorld->stepSimulation(dt, maxSubSteps, fixedTimeStep);
     }
 
 };
@@ -83,6 +83,8 @@ public:
         return world.get();
     }
 
+    // One-off query that redoes broadphase and narrowphase for this body. For contacts every frame, use the
+    // events the engine harvests after each step (BulletEngineVR::get_contacts).
     std::vector<BulletContactPointVR> CollideWorld() const
     {
         struct CollideCallbackWorld : public CollideCallback
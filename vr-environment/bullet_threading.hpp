@@ -0,0 +1,353 @@
+#pragma once
+
+#ifndef bullet_threading_vr_hpp
+#define bullet_threading_vr_hpp
+
+#include "btBulletCollisionCommon.h"
+#include "btBulletDynamicsCommon.h"
+#include "BulletDynamics/Dynamics/btDiscreteDynamicsWorldMt.h"
+#include "BulletCollision/CollisionDispatch/btSimulationIslandManagerMt.h"
+
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <type_traits>
+#include <exception>
+
+// The vendored Bullet predates btITaskScheduler, btCollisionDispatcherMt and btConstraintSolverPoolMt. It does
+// ship btDiscreteDynamicsWorldMt and a thread safe core when compiled with BT_THREADSAFE=1, so the missing
+// pieces live here: a persistent worker pool, a dispatcher that runs narrowphase pairs in parallel, a pool of
+// solvers so that islands can be solved concurrently, and a world that spreads per-body work over the pool.
+
+// Fixed set of worker threads for fork-join loops. The calling thread takes part in every loop, so a scheduler
+// of N threads owns N - 1 workers. Workers spin briefly between loops (a physics step issues several in quick
+// succession) and then sleep on a condition variable.
+class BulletTaskScheduler
+{
+    typedef void (*range_fn)(void * context, size_t begin, size_t end);
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::atomic<uint64_t> generation{ 0 };
+    bool quit{ false };
+
+    // The loop in flight. Workers copy it under the mutex and register in `inFlight` before claiming from
+    // `next`, and a loop is only replaced once `inFlight` drops to zero, so no one runs a stale job.
+    range_fn invoke{ nullptr };
+    void * context{ nullptr };
+    size_t jobEnd{ 0 }, jobGrain{ 1 };
+    std::atomic<size_t> next{ 0 };
+    std::atomic<size_t> remaining{ 0 };
+    std::atomic<int> inFlight{ 0 };
+    std::exception_ptr error;   // first exception thrown by a chunk of the loop in flight, under `mutex`
+
+    void run_chunks(const range_fn f, void * ctx, const size_t end, const size_t grain)
+    {
+        for (;;)
+        {
+            const size_t b = next.fetch_add(grain, std::memory_order_relaxed);
+            if (b >= end) break;
+            const size_t e = std::min(end, b + grain);
+            try { f(ctx, b, e); }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> guard(mutex);
+                if (!error) error = std::current_exception();
+            }
+            remaining.fetch_sub(e - b, std::memory_order_acq_rel);
+        }
+    }
+
+    void worker_loop()
+    {
+        uint64_t seen = 0;
+        for (;;)
+        {
+            for (int spin = 0; spin < 4096 && generation.load(std::memory_order_acquire) == seen; ++spin) std::this_thread::yield();
+
+            range_fn f; void * ctx; size_t end, grain;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&]() { return quit || generation.load(std::memory_order_relaxed) != seen; });
+                if (quit) return;
+                seen = generation.load(std::memory_order_relaxed);
+                f = invoke; ctx = context; end = jobEnd; grain = jobGrain;
+                inFlight.fetch_add(1, std::memory_order_acq_rel);
+            }
+            run_chunks(f, ctx, end, grain);
+            inFlight.fetch_sub(1, std::memory_order_acq_rel);
+        }
+    }
+
+    BulletTaskScheduler(const BulletTaskScheduler &) = delete;
+    BulletTaskScheduler & operator = (const BulletTaskScheduler &) = delete;
+
+public:
+
+    explicit BulletTaskScheduler(const size_t numThreads = std::max<size_t>(1, std::thread::hardware_concurrency()))
+    {
+        for (size_t i = 1; i < std::max<size_t>(1, numThreads); ++i) workers.emplace_back(&BulletTaskScheduler::worker_loop, this);
+    }
+
+    ~BulletTaskScheduler()
+    {
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            quit = true;
+        }
+        wake.notify_all();
+        for (auto & w : workers) w.join();
+    }
+
+    size_t num_threads() const { return workers.size() + 1; }
+
+    // Runs `f(chunkBegin, chunkEnd)` over [begin, end) in chunks of `grain`, claimed dynamically so that uneven
+    // chunks (islands, compound pairs) balance out. Not reentrant: `f` must not call back into the scheduler.
+    // If chunks throw, the rest of the range still runs and the first exception is rethrown on the caller.
+    template<typename F>
+    void parallel_for(const size_t begin, const size_t end, const size_t grain, F && f)
+    {
+        if (end <= begin) return;
+        if (workers.empty() || end - begin <= grain) { f(begin, end); return; }
+
+        typedef typename std::remove_reference<F>::type fn_type;
+        struct thunk
+        {
+            fn_type * f;
+            size_t offset;
+            static void run(void * self, size_t b, size_t e) { auto t = static_cast<thunk *>(self); (*t->f)(t->offset + b, t->offset + e); }
+        } t = { &f, begin };
+
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            while (inFlight.load(std::memory_order_acquire) != 0) std::this_thread::yield(); // late risers from the previous loop
+            invoke = &thunk::run;
+            context = &t;
+            jobEnd = end - begin;
+            jobGrain = std::max<size_t>(1, grain);
+            next.store(0, std::memory_order_relaxed);
+            remaining.store(end - begin, std::memory_order_relaxed);
+            generation.fetch_add(1, std::memory_order_release);
+        }
+        wake.notify_all();
+
+        run_chunks(&thunk::run, &t, end - begin, std::max<size_t>(1, grain));
+        while (remaining.load(std::memory_order_acquire) != 0 || inFlight.load(std::memory_order_acquire) != 0) std::this_thread::yield();
+
+        std::exception_ptr failure;
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            std::swap(failure, error);
+        }
+        if (failure) std::rethrow_exception(failure);
+    }
+};
+
+// Bullet's island dispatch hook is a plain function pointer, so the scheduler is found through a thread_local
+// that the engine sets around stepSimulation. Islands are solved on the stepping thread's scheduler.
+inline BulletTaskScheduler *& bullet_current_scheduler()
+{
+    static thread_local BulletTaskScheduler * scheduler = nullptr;
+    return scheduler;
+}
+
+struct bullet_scheduler_scope
+{
+    BulletTaskScheduler * previous;
+    explicit bullet_scheduler_scope(BulletTaskScheduler * s) : previous(bullet_current_scheduler()) { bullet_current_scheduler() = s; }
+    ~bullet_scheduler_scope() { bullet_current_scheduler() = previous; }
+};
+
+// Narrowphase over all overlapping pairs in parallel. Each pair owns its algorithm and manifold, and the
+// algorithm pools lock internally under BT_THREADSAFE; only the shared manifold list needs a lock here.
+class BulletCollisionDispatcherMt : public btCollisionDispatcher
+{
+    BulletTaskScheduler * scheduler;
+    std::mutex manifoldMutex;
+    size_t grainSize;
+
+public:
+
+    BulletCollisionDispatcherMt(btCollisionConfiguration * config, BulletTaskScheduler * scheduler, const size_t grainSize = 40)
+        : btCollisionDispatcher(config), scheduler(scheduler), grainSize(grainSize) { }
+
+    btPersistentManifold * getNewManifold(const btCollisionObject * b0, const btCollisionObject * b1) override
+    {
+        std::lock_guard<std::mutex> guard(manifoldMutex);
+        return btCollisionDispatcher::getNewManifold(b0, b1);
+    }
+
+    void releaseManifold(btPersistentManifold * manifold) override
+    {
+        std::lock_guard<std::mutex> guard(manifoldMutex);
+        btCollisionDispatcher::releaseManifold(manifold);
+    }
+
+    void dispatchAllCollisionPairs(btOverlappingPairCache * pairCache, const btDispatcherInfo & info, btDispatcher * dispatcher) override
+    {
+        const int pairCount = pairCache->getNumOverlappingPairs();
+        if (pairCount == 0) return;
+
+        btBroadphasePair * pairs = pairCache->getOverlappingPairArrayPtr();
+        btNearCallback nearCallback = getNearCallback();
+        scheduler->parallel_for(0, size_t(pairCount), grainSize, [&](size_t b, size_t e)
+        {
+            for (size_t i = b; i < e; ++i) nearCallback(pairs[i], *this, info);
+        });
+    }
+};
+
+// One sequential impulse solver per thread. btSequentialImpulseConstraintSolver keeps per-solve scratch
+// state, so each concurrently solved island borrows a solver of its own for the duration of solveGroup.
+class BulletSolverPool : public btConstraintSolver
+{
+    std::vector<std::unique_ptr<btSequentialImpulseConstraintSolver>> solvers;
+    std::unique_ptr<std::atomic<bool>[]> busy;
+
+public:
+
+    explicit BulletSolverPool(const size_t count) : busy(new std::atomic<bool>[std::max<size_t>(1, count)])
+    {
+        for (size_t i = 0; i < std::max<size_t>(1, count); ++i)
+        {
+            solvers.emplace_back(new btSequentialImpulseConstraintSolver());
+            busy[i].store(false);
+        }
+    }
+
+    void prepareSolve(int numBodies, int numManifolds) override
+    {
+        for (auto & s : solvers) s->prepareSolve(numBodies, numManifolds);
+    }
+
+    btScalar solveGroup(btCollisionObject ** bodies, int numBodies, btPersistentManifold ** manifolds, int numManifolds, btTypedConstraint ** constraints, int numConstraints,
+        const btContactSolverInfo & info, btIDebugDraw * debugDrawer, btDispatcher * dispatcher) override
+    {
+        // Never more islands in flight than threads, so a free solver always turns up
+        for (;;)
+        {
+            for (size_t i = 0; i < solvers.size(); ++i)
+            {
+                if (busy[i].load(std::memory_order_relaxed) || busy[i].exchange(true, std::memory_order_acquire)) continue;
+                const btScalar result = solvers[i]->solveGroup(bodies, numBodies, manifolds, numManifolds, constraints, numConstraints, info, debugDrawer, dispatcher);
+                busy[i].store(false, std::memory_order_release);
+                return result;
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    void allSolved(const btContactSolverInfo & info, btIDebugDraw * debugDrawer) override
+    {
+        for (auto & s : solvers) s->allSolved(info, debugDrawer);
+    }
+
+    void reset() override
+    {
+        for (auto & s : solvers) s->reset();
+    }
+
+    btConstraintSolverType getSolverType() const override { return BT_SEQUENTIAL_IMPULSE_SOLVER; }
+};
+
+// btDiscreteDynamicsWorldMt solves islands through the island manager's dispatch hook; this routes that hook
+// to the scheduler and also parallelizes the per-body passes that Bullet marks as safe to split.
+ATTRIBUTE_ALIGNED16(class) BulletDynamicsWorldMt : public btDiscreteDynamicsWorldMt
+{
+    BulletTaskScheduler * scheduler;
+
+    static void island_dispatch(btAlignedObjectArray<btSimulationIslandManagerMt::Island *> * islandsPtr, btSimulationIslandManagerMt::IslandCallback * callback)
+    {
+        btAlignedObjectArray<btSimulationIslandManagerMt::Island *> & islands = *islandsPtr;
+        auto solve = [&](size_t b, size_t e)
+        {
+            for (size_t i = b; i < e; ++i)
+            {
+                btSimulationIslandManagerMt::Island * island = islands[int(i)];
+                btCollisionObject ** bodies = island->bodyArray.size() ? &island->bodyArray[0] : nullptr;
+                btPersistentManifold ** manifolds = island->manifoldArray.size() ? &island->manifoldArray[0] : nullptr;
+                btTypedConstraint ** constraints = island->constraintArray.size() ? &island->constraintArray[0] : nullptr;
+                callback->processIsland(bodies, island->bodyArray.size(), manifolds, island->manifoldArray.size(),
+                    constraints, island->constraintArray.size(), island->id);
+            }
+        };
+
+        if (BulletTaskScheduler * s = bullet_current_scheduler()) s->parallel_for(0, size_t(islands.size()), 1, solve);
+        else solve(0, size_t(islands.size()));
+    }
+
+    template<typename F>
+    void for_each_body_range(F && f, const size_t grain = 64)
+    {
+        if (m_nonStaticRigidBodies.size() == 0) return;
+        btRigidBody ** bodies = &m_nonStaticRigidBodies[0];
+        scheduler->parallel_for(0, size_t(m_nonStaticRigidBodies.size()), grain, [&](size_t b, size_t e) { f(bodies + b, int(e - b)); });
+    }
+
+protected:
+
+    void predictUnconstraintMotion(btScalar timeStep) override
+    {
+        BT_PROFILE("predictUnconstraintMotion");
+        for_each_body_range([timeStep](btRigidBody ** bodies, int count)
+        {
+            for (int i = 0; i < count; ++i)
+            {
+                btRigidBody * body = bodies[i];
+                if (body->isStaticOrKinematicObject()) continue;
+                body->applyDamping(timeStep);
+                body->predictIntegratedTransform(timeStep, body->getInterpolationWorldTransform());
+            }
+        });
+    }
+
+    void createPredictiveContacts(btScalar timeStep) override
+    {
+        BT_PROFILE("createPredictiveContacts");
+        releasePredictiveContacts();
+        for_each_body_range([&](btRigidBody ** bodies, int count) { createPredictiveContactsInternal(bodies, count, timeStep); });
+    }
+
+    void integrateTransforms(btScalar timeStep) override
+    {
+        BT_PROFILE("integrateTransforms");
+        for_each_body_range([&](btRigidBody ** bodies, int count) { integrateTransformsInternal(bodies, count, timeStep); });
+
+        // The speculative restitution pass touches body pairs, so it stays serial (and off, by default)
+        if (m_applySpeculativeContactRestitution)
+        {
+            for (int i = 0; i < m_predictiveManifolds.size(); ++i)
+            {
+                btPersistentManifold * manifold = m_predictiveManifolds[i];
+                btRigidBody * body0 = btRigidBody::upcast((btCollisionObject *)manifold->getBody0());
+                btRigidBody * body1 = btRigidBody::upcast((btCollisionObject *)manifold->getBody1());
+                for (int p = 0; p < manifold->getNumContacts(); ++p)
+                {
+                    const btManifoldPoint & pt = manifold->getContactPoint(p);
+                    const btScalar combinedRestitution = btManifoldResult::calculateCombinedRestitution(body0, body1);
+                    if (combinedRestitution <= 0 || pt.m_appliedImpulse == 0.f) continue;
+                    const btVector3 imp = -pt.m_normalWorldOnB * pt.m_appliedImpulse * combinedRestitution;
+                    if (body0) body0->applyImpulse(imp, pt.getPositionWorldOnA() - body0->getWorldTransform().getOrigin());
+                    if (body1) body1->applyImpulse(-imp, pt.getPositionWorldOnB() - body1->getWorldTransform().getOrigin());
+                }
+            }
+        }
+    }
+
+public:
+
+    BT_DECLARE_ALIGNED_ALLOCATOR();
+
+    BulletDynamicsWorldMt(btDispatcher * dispatcher, btBroadphaseInterface * broadphase, btConstraintSolver * solver, btCollisionConfiguration * config, BulletTaskScheduler * scheduler)
+        : btDiscreteDynamicsWorldMt(dispatcher, broadphase, solver, config), scheduler(scheduler)
+    {
+        static_cast<btSimulationIslandManagerMt *>(getSimulationIslandManager())->setIslandDispatchFunction(island_dispatch);
+    }
+};
+
+#endif // end bullet_threading_vr_hpp
@@ -5,109 +5,460 @@
 
 #include "math-core.hpp"
 #include "gl-api.hpp"
-#include "procedural_mesh.hpp"
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <algorithm>
 
 using namespace avl;
 
-class DebugLineRenderer
+enum class debug_draw_mode
 {
-    struct Vertex { float3 position; float3 color; };
-    std::vector<Vertex> vertices;
-    GlMesh debugMesh;
-    GlShader debugShader;
-
-    Geometry axis = make_axis();
-    Geometry box = make_cube();
-    Geometry sphere = make_sphere(0.1f);
-
-    constexpr static const char debugVertexShader[] = R"(#version 330 
-        layout(location = 0) in vec3 v; 
-        layout(location = 1) in vec3 c; 
-        uniform mat4 u_mvp; 
-        out vec3 oc; 
-        void main() { gl_Position = u_mvp * vec4(v.xyz, 1); oc = c; }
-    )";
+    depth_tested,   // hidden by scene geometry
+    overlay         // drawn on top of everything
+};
 
-    constexpr static const char debugFragmentShader[] = R"(#version 330 
-        in vec3 oc; 
-        out vec4 f_color; 
-        void main() { f_color = vec4(oc.rgb, 1); }
-    )";
+// The CPU side of DebugLineRenderer: lock-free recording from any thread and per-frame packing, with no GL
+// calls. Every thread appends into a buffer of its own, found through a thread_local cache. A thread's buffer
+// is retired when the thread exits and released by the next `clear()`, after its last frame has been packed.
+class DebugDrawBatch
+{
+public:
+
+    struct LineVertex { float3 position; uint32_t color; };
+    struct Instance { float3 position; float4 orientation; float3 scale; uint32_t color; };
+
+    enum Shape { Box, Sphere, Axis, NumShapes };
+    static const int NumModes = 2;
+
+    // Where `pack` put each primitive type and mode: vertices for lines, instances for shapes
+    struct layout
+    {
+        size_t lineFirst[NumModes], lineCount[NumModes];
+        size_t instanceFirst[NumShapes][NumModes], instanceCount[NumShapes][NumModes];
+        size_t droppedLines, droppedInstances;
+    };
+
+private:
+
+    struct thread_buffer
+    {
+        std::vector<LineVertex> lines[NumModes];
+        std::vector<Instance> instances[NumShapes][NumModes];
+        std::atomic<bool> retired{ false };     // the recording thread has exited
+    };
+
+    // Shared with the batch, so a thread may exit before or after the batch is destroyed
+    struct cache_entry
+    {
+        uint64_t owner;
+        std::shared_ptr<thread_buffer> buffer;
+        std::weak_ptr<void> alive;
+    };
+
+    struct thread_cache
+    {
+        std::vector<cache_entry> entries;
+        ~thread_cache() { for (auto & e : entries) e.buffer->retired.store(true, std::memory_order_release); }
+    };
+
+    static uint64_t next_uid() { static std::atomic<uint64_t> uid{ 1 }; return uid++; }
+
+    const uint64_t uid = next_uid();    // never reused, so stale thread_local entries can't alias a new batch
+    const std::shared_ptr<void> alive{ std::make_shared<char>(0) }; // expires with the batch
+    std::mutex registryMutex;
+    std::vector<std::shared_ptr<thread_buffer>> threadBuffers;
+
+    thread_buffer & local_buffer()
+    {
+        static thread_local thread_cache cache;
+        for (const auto & e : cache.entries) if (e.owner == uid) return *e.buffer;
+
+        // On a miss, drop the entries of batches that have since been destroyed; live ones are never evicted
+        cache.entries.erase(std::remove_if(cache.entries.begin(), cache.entries.end(), [](const cache_entry & e) { return e.alive.expired(); }), cache.entries.end());
+
+        std::shared_ptr<thread_buffer> b = std::make_shared<thread_buffer>();
+        {
+            std::lock_guard<std::mutex> guard(registryMutex);
+            threadBuffers.push_back(b);
+        }
+        cache.entries.push_back({ uid, b, alive });
+        return *b;
+    }
 
 public:
 
-    DebugLineRenderer()
+    DebugDrawBatch() = default;
+
+    DebugDrawBatch(const DebugDrawBatch &) = delete;
+    DebugDrawBatch & operator = (const DebugDrawBatch &) = delete;
+
+    static uint32_t pack_color(const float3 & c)
     {
-        debugShader = GlShader(debugVertexShader, debugFragmentShader);
+        const float3 s = clamp(c, float3(0, 0, 0), float3(1, 1, 1)) * 255.0f + 0.5f;
+        return uint32_t(s.x) | (uint32_t(s.y) << 8) | (uint32_t(s.z) << 16) | 0xFF000000u;
     }
 
-    void draw(const float4x4 & viewProj)
+    void add_line(const float3 & from, const float3 & to, const float3 & color, const debug_draw_mode mode)
     {
-        debugMesh.set_vertices(vertices.size(), vertices.data(), GL_DYNAMIC_DRAW);
-        debugMesh.set_attribute(0, &Vertex::position);
-        debugMesh.set_attribute(1, &Vertex::color);
-        debugMesh.set_non_indexed(GL_LINES);
+        auto & lines = local_buffer().lines[int(mode)];
+        const uint32_t c = pack_color(color);
+        lines.push_back({ from, c });
+        lines.push_back({ to, c });
+    }
+
+    void add_instance(const Shape shape, const float3 & position, const float4 & orientation, const float3 & scale, const float3 & color, const debug_draw_mode mode)
+    {
+        local_buffer().instances[shape][int(mode)].push_back({ position, orientation, scale, pack_color(color) });
+    }
 
-        auto model = Identity4x4;
-        auto modelViewProjectionMatrix = mul(viewProj, model);
+    // Copies everything recorded into `lineDst` (room for 2 * lineBudget vertices) and `instanceDst` (room for
+    // instanceBudget instances), lines grouped by mode and instances by shape, then mode. What doesn't fit is
+    // dropped and counted.
+    layout pack(LineVertex * lineDst, const size_t lineBudget, Instance * instanceDst, const size_t instanceBudget)
+    {
+        layout l = {};
+        size_t linesLeft = lineBudget * 2, instancesLeft = instanceBudget, written = 0;
+
+        std::lock_guard<std::mutex> guard(registryMutex);
 
-        debugShader.bind();
-        debugShader.uniform("u_mvp", modelViewProjectionMatrix);
-        debugMesh.draw_elements();
-        debugShader.unbind();
+        for (int m = 0; m < NumModes; ++m)
+        {
+            l.lineFirst[m] = written;
+            for (auto & tb : threadBuffers)
+            {
+                const auto & src = tb->lines[m];
+                const size_t n = std::min(src.size(), linesLeft);
+                std::copy(src.begin(), src.begin() + n, lineDst + written);
+                written += n;
+                linesLeft -= n;
+                l.droppedLines += (src.size() - n) / 2;
+            }
+            l.lineCount[m] = written - l.lineFirst[m];
+        }
+
+        written = 0;
+        for (int s = 0; s < NumShapes; ++s)
+        {
+            for (int m = 0; m < NumModes; ++m)
+            {
+                l.instanceFirst[s][m] = written;
+                for (auto & tb : threadBuffers)
+                {
+                    const auto & src = tb->instances[s][m];
+                    const size_t n = std::min(src.size(), instancesLeft);
+                    std::copy(src.begin(), src.begin() + n, instanceDst + written);
+                    written += n;
+                    instancesLeft -= n;
+                    l.droppedInstances += src.size() - n;
+                }
+                l.instanceCount[s][m] = written - l.instanceFirst[s][m];
+            }
+        }
+        return l;
     }
 
+    // Releases the buffers of exited threads and empties the rest, keeping their allocations for the next frame
     void clear()
     {
-        vertices.clear();
+        std::lock_guard<std::mutex> guard(registryMutex);
+        threadBuffers.erase(std::remove_if(threadBuffers.begin(), threadBuffers.end(), [](const std::shared_ptr<thread_buffer> & tb)
+        {
+            return tb->retired.load(std::memory_order_acquire);
+        }), threadBuffers.end());
+
+        for (auto & tb : threadBuffers)
+        {
+            for (auto & l : tb->lines) l.clear();
+            for (auto & shape : tb->instances) for (auto & i : shape) i.clear();
+        }
     }
 
-    // Coordinates should be provided pre-transformed to world-space
-    void draw_line(const float3 & from, const float3 & to, const float3 color = float3(1, 1, 1))
+    size_t thread_buffer_count()
     {
-        vertices.push_back({ from, color });
-        vertices.push_back({ to, color });
+        std::lock_guard<std::mutex> guard(registryMutex);
+        return threadBuffers.size();
     }
+};
+
+// Immediate mode debug drawing from any number of threads, recorded into a DebugDrawBatch so that recording
+// takes no lock. Lines are streamed as vertices; boxes, spheres and axes are recorded as a single instance
+// each and drawn with instancing from shared unit wireframes. Once per frame, `draw()` packs everything into
+// one segment of a fenced, persistently mapped ring and issues one draw per primitive type and mode. Lines
+// beyond the per-frame budget are dropped and counted rather than growing the ring.
+// The draw_* functions may run concurrently with each other, but not with `draw()` or `clear()`, which
+// belong to the GL thread at a point where the frame's producers are done (e.g. after the physics step).
+class DebugLineRenderer
+{
+    typedef DebugDrawBatch::LineVertex LineVertex;
+    typedef DebugDrawBatch::Instance Instance;
+
+    static const int NumShapes = DebugDrawBatch::NumShapes;
+    static const int NumModes = DebugDrawBatch::NumModes;
+    static const int RingSegments = 3;
+
+    DebugDrawBatch batch;
+
+    size_t lineBudget, instanceBudget;
+    size_t segmentSize{ 0 };
+    GlBuffer ring;
+    uint8_t * ringMemory{ nullptr };
+    GLsync fences[RingSegments] = {};
+    int segment{ 0 };
+
+    GlBuffer shapeVertices;
+    GLint shapeFirst[NumShapes], shapeCount[NumShapes];
+    GlVertexArrayObject lineVao, shapeVao;
+    GlShader lineShader, shapeShader;
+
+    size_t drawnLines{ 0 }, droppedLines{ 0 }, droppedInstances{ 0 };
+
+    constexpr static const char lineVertexShader[] = R"(#version 330
+        layout(location = 0) in vec3 position;
+        layout(location = 1) in vec4 color;
+        uniform mat4 u_viewProj;
+        out vec4 v_color;
+        void main() { gl_Position = u_viewProj * vec4(position, 1); v_color = color; }
+    )";
+
+    constexpr static const char shapeVertexShader[] = R"(#version 330
+        layout(location = 0) in vec3 position;
+        layout(location = 1) in vec4 color;
+        layout(location = 2) in vec3 i_position;
+        layout(location = 3) in vec4 i_orientation;
+        layout(location = 4) in vec3 i_scale;
+        layout(location = 5) in vec4 i_color;
+        uniform mat4 u_viewProj;
+        out vec4 v_color;
+        vec3 qrot(vec4 q, vec3 v) { return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v); }
+        void main() { gl_Position = u_viewProj * vec4(i_position + qrot(i_orientation, position * i_scale), 1); v_color = color * i_color; }
+    )";
 
-    void draw_box(const Pose & pose, const float & half, const float3 color = float3(1, 1, 1))
+    constexpr static const char debugFragmentShader[] = R"(#version 330
+        in vec4 v_color;
+        out vec4 f_color;
+        void main() { f_color = vec4(v_color.rgb, 1); }
+    )";
+
+    // Unit wireframes, all drawn as GL_LINES: a box spanning [-1, 1], a sphere of radius 1 as three great
+    // circles, and a unit axis triad colored x = red, y = green, z = blue
+    void create_shapes()
     {
-        // todo - apply exents
-        for (const auto v : box.vertices)
+        std::vector<LineVertex> v;
+        const uint32_t white = DebugDrawBatch::pack_color({ 1, 1, 1 });
+
+        shapeFirst[DebugDrawBatch::Box] = GLint(v.size());
+        for (int axis = 0; axis < 3; ++axis)
         {
-            auto tV = pose.transform_coord(v);
-            vertices.push_back({ tV, color });
+            for (int corner = 0; corner < 4; ++corner)
+            {
+                float3 a, b;
+                const float u = (corner & 1) ? 1.0f : -1.0f, w = (corner & 2) ? 1.0f : -1.0f;
+                a[axis] = -1.0f; a[(axis + 1) % 3] = u; a[(axis + 2) % 3] = w;
+                b = a; b[axis] = 1.0f;
+                v.push_back({ a, white });
+                v.push_back({ b, white });
+            }
         }
-    }
+        shapeCount[DebugDrawBatch::Box] = GLint(v.size()) - shapeFirst[DebugDrawBatch::Box];
 
-    void draw_box(const Bounds3D & bounds, const float3 color = float3(1, 1, 1))
-    {
-        Pose p = Pose(float4(0, 0, 0, 1), bounds.center());
-        for (auto v : box.vertices)
+        shapeFirst[DebugDrawBatch::Sphere] = GLint(v.size());
+        const int segments = 32;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            for (int i = 0; i < segments; ++i)
+            {
+                for (int j = i; j <= i + 1; ++j)
+                {
+                    const float angle = float(j) / float(segments) * 2.0f * float(ANVIL_PI);
+                    float3 p;
+                    p[(axis + 1) % 3] = std::cos(angle);
+                    p[(axis + 2) % 3] = std::sin(angle);
+                    v.push_back({ p, white });
+                }
+            }
+        }
+        shapeCount[DebugDrawBatch::Sphere] = GLint(v.size()) - shapeFirst[DebugDrawBatch::Sphere];
+
+        shapeFirst[DebugDrawBatch::Axis] = GLint(v.size());
+        for (int axis = 0; axis < 3; ++axis)
         {
-            v *= bounds.size() / 2.f; // scale
-            auto tV = p.transform_coord(v); // translate
-            vertices.push_back({ tV, color });
+            float3 dir, color;
+            dir[axis] = 1.0f;
+            color[axis] = 1.0f;
+            v.push_back({ float3(0, 0, 0), DebugDrawBatch::pack_color(color) });
+            v.push_back({ dir, DebugDrawBatch::pack_color(color) });
         }
+        shapeCount[DebugDrawBatch::Axis] = GLint(v.size()) - shapeFirst[DebugDrawBatch::Axis];
+
+        shapeVertices.set_buffer_data(GLsizeiptr(v.size() * sizeof(LineVertex)), v.data(), GL_STATIC_DRAW);
+        glEnableVertexArrayAttribEXT(shapeVao, 0);
+        glEnableVertexArrayAttribEXT(shapeVao, 1);
+        glVertexArrayVertexAttribOffsetEXT(shapeVao, shapeVertices, 0, 3, GL_FLOAT, GL_FALSE, sizeof(LineVertex), offsetof(LineVertex, position));
+        glVertexArrayVertexAttribOffsetEXT(shapeVao, shapeVertices, 1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(LineVertex), offsetof(LineVertex, color));
+        for (GLuint i = 2; i < 6; ++i)
+        {
+            glEnableVertexArrayAttribEXT(shapeVao, i);
+            glVertexArrayVertexAttribDivisorEXT(shapeVao, i, 1);
+        }
+
+        glEnableVertexArrayAttribEXT(lineVao, 0);
+        glEnableVertexArrayAttribEXT(lineVao, 1);
+    }
+
+    void create_ring()
+    {
+        release_ring();
+        segmentSize = lineBudget * 2 * sizeof(LineVertex) + instanceBudget * sizeof(Instance);
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        ring = GlBuffer();
+        glNamedBufferStorageEXT(ring, segmentSize * RingSegments, nullptr, flags);
+        ringMemory = static_cast<uint8_t *>(glMapNamedBufferRangeEXT(ring, 0, segmentSize * RingSegments, flags));
+        if (!ringMemory) throw std::runtime_error("could not map debug draw ring");
+        segment = 0;
     }
 
-    void draw_sphere(const Pose & pose, const float & radius, const float3 color = float3(1, 1, 1))
+    void release_ring()
     {
-        // todo - apply radius
-        for (const auto v : sphere.vertices)
+        for (auto & f : fences)
         {
-            auto tV = pose.transform_coord(v);
-            vertices.push_back({ tV, color });
+            if (!f) continue;
+            glClientWaitSync(f, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+            glDeleteSync(f);
+            f = nullptr;
         }
+        if (ringMemory) glUnmapNamedBufferEXT(ring);
+        ringMemory = nullptr;
     }
 
-    void draw_axis(const Pose & pose, const float3 color = float3(1, 1, 1))
+public:
+
+    // Budgets are per frame: line segments, and box / sphere / axis instances combined. Requires a GL context.
+    DebugLineRenderer(const size_t lineBudget = 256 * 1024, const size_t instanceBudget = 64 * 1024) : lineBudget(lineBudget), instanceBudget(instanceBudget)
+    {
+        lineShader = GlShader(lineVertexShader, debugFragmentShader);
+        shapeShader = GlShader(shapeVertexShader, debugFragmentShader);
+        create_shapes();
+        create_ring();
+    }
+
+    ~DebugLineRenderer() { release_ring(); }
+
+    DebugLineRenderer(const DebugLineRenderer &) = delete;
+    DebugLineRenderer & operator = (const DebugLineRenderer &) = delete;
+
+    // Reallocates the ring; GL thread only
+    void set_budget(const size_t lines, const size_t instances)
     {
-        for (int i = 0; i < axis.vertices.size(); ++i)
+        lineBudget = lines;
+        instanceBudget = instances;
+        create_ring();
+    }
+
+    void draw(const float4x4 & viewProj)
+    {
+        // The segment was last used RingSegments frames ago, so this wait is normally free
+        GLsync & fence = fences[segment];
+        if (fence)
+        {
+            glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+            glDeleteSync(fence);
+            fence = nullptr;
+        }
+
+        const size_t segmentBase = segmentSize * segment;
+        LineVertex * lineDst = reinterpret_cast<LineVertex *>(ringMemory + segmentBase);
+        Instance * instanceDst = reinterpret_cast<Instance *>(ringMemory + segmentBase + lineBudget * 2 * sizeof(LineVertex));
+
+        const DebugDrawBatch::layout l = batch.pack(lineDst, lineBudget, instanceDst, instanceBudget);
+        drawnLines = (l.lineCount[0] + l.lineCount[1]) / 2;
+        droppedLines = l.droppedLines;
+        droppedInstances = l.droppedInstances;
+
+        const GLboolean depthWasEnabled = glIsEnabled(GL_DEPTH_TEST);
+        const GLintptr instanceBase = GLintptr(segmentBase + lineBudget * 2 * sizeof(LineVertex));
+
+        glVertexArrayVertexAttribOffsetEXT(lineVao, ring, 0, 3, GL_FLOAT, GL_FALSE, sizeof(LineVertex), GLintptr(segmentBase + offsetof(LineVertex, position)));
+        glVertexArrayVertexAttribOffsetEXT(lineVao, ring, 1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(LineVertex), GLintptr(segmentBase + offsetof(LineVertex, color)));
+
+        for (int m = 0; m < NumModes; ++m)
         {
-            auto v = axis.vertices[i];
-            v = pose.transform_coord(v);
-            vertices.push_back({ v, axis.colors[i].xyz() });
+            if (m == int(debug_draw_mode::overlay)) glDisable(GL_DEPTH_TEST);
+            else glEnable(GL_DEPTH_TEST);
+
+            if (l.lineCount[m])
+            {
+                lineShader.bind();
+                lineShader.uniform("u_viewProj", viewProj);
+                glBindVertexArray(lineVao);
+                glDrawArrays(GL_LINES, GLint(l.lineFirst[m]), GLsizei(l.lineCount[m]));
+                lineShader.unbind();
+            }
+
+            shapeShader.bind();
+            shapeShader.uniform("u_viewProj", viewProj);
+            glBindVertexArray(shapeVao);
+            for (int s = 0; s < NumShapes; ++s)
+            {
+                if (!l.instanceCount[s][m]) continue;
+                const GLintptr base = instanceBase + GLintptr(l.instanceFirst[s][m] * sizeof(Instance));
+                glVertexArrayVertexAttribOffsetEXT(shapeVao, ring, 2, 3, GL_FLOAT, GL_FALSE, sizeof(Instance), base + offsetof(Instance, position));
+                glVertexArrayVertexAttribOffsetEXT(shapeVao, ring, 3, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), base + offsetof(Instance, orientation));
+                glVertexArrayVertexAttribOffsetEXT(shapeVao, ring, 4, 3, GL_FLOAT, GL_FALSE, sizeof(Instance), base + offsetof(Instance, scale));
+                glVertexArrayVertexAttribOffsetEXT(shapeVao, ring, 5, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Instance), base + offsetof(Instance, color));
+                glDrawArraysInstanced(GL_LINES, shapeFirst[s], shapeCount[s], GLsizei(l.instanceCount[s][m]));
+            }
+            shapeShader.unbind();
         }
+
+        glBindVertexArray(0);
+        if (depthWasEnabled) glEnable(GL_DEPTH_TEST);
+        else glDisable(GL_DEPTH_TEST);
+
+        fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        segment = (segment + 1) % RingSegments;
+    }
+
+    // Keeps each live thread's allocations for the next frame
+    void clear() { batch.clear(); }
+
+    // Statistics of the last draw()
+    size_t get_drawn_lines() const { return drawnLines; }
+    size_t get_dropped_lines() const { return droppedLines; }
+    size_t get_dropped_instances() const { return droppedInstances; }
+
+    // Coordinates should be provided pre-transformed to world-space
+    void draw_line(const float3 & from, const float3 & to, const float3 color = float3(1, 1, 1), const debug_draw_mode mode = debug_draw_mode::depth_tested)
+    {
+        batch.add_line(from, to, color, mode);
+    }
+
+    void draw_box(const Pose & pose, const float3 & halfExtents, const float3 color = float3(1, 1, 1), const debug_draw_mode mode = debug_draw_mode::depth_tested)
+    {
+        batch.add_instance(DebugDrawBatch::Box, pose.position, pose.orientation, halfExtents, color, mode);
+    }
+
+    void draw_box(const Pose & pose, const float & half, const float3 color = float3(1, 1, 1), const debug_draw_mode mode = debug_draw_mode::depth_tested)
+    {
+        batch.add_instance(DebugDrawBatch::Box, pose.position, pose.orientation, float3(half, half, half), color, mode);
+    }
+
+    void draw_box(const Bounds3D & bounds, const float3 color = float3(1, 1, 1), const debug_draw_mode mode = debug_draw_mode::depth_tested)
+    {
+        batch.add_instance(DebugDrawBatch::Box, bounds.center(), float4(0, 0, 0, 1), bounds.size() / 2.f, color, mode);
+    }
+
+    void draw_sphere(const Pose & pose, const float & radius, const float3 color = float3(1, 1, 1), const debug_draw_mode mode = debug_draw_mode::depth_tested)
+    {
+        batch.add_instance(DebugDrawBatch::Sphere, pose.position, pose.orientation, float3(radius, radius, radius), color, mode);
+    }
+
+    // The axes keep their red / green / blue coloring, tinted by `color`
+    void draw_axis(const Pose & pose, const float3 color = float3(1, 1, 1), const float length = 1.f, const debug_draw_mode mode = debug_draw_mode::depth_tested)
+    {
+        batch.add_instance(DebugDrawBatch::Axis, pose.position, pose.orientation, float3(length, length, length), color, mode);
     }
 
 };
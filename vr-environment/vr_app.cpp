@@ -71,6 +71,12 @@ void VirtualRealityApp::on_input(const InputEvent & event)
 {
     cameraController.handle_input(event);
     if (igm) igm->update_input(event);
+
+    // Blocks for a few seconds; the scenes are separate from the app's own physics world
+    if (event.type == InputEvent::KEY && event.value[0] == GLFW_KEY_F9 && event.action == GLFW_RELEASE)
+    {
+        run_bullet_stacking_benchmark();
+    }
 }
 
 void VirtualRealityApp::on_update(const UpdateEvent & e) 
@@ -5,6 +5,7 @@
 #include "procedural_mesh.hpp"
 #include "parabolic_pointer.hpp"
 #include "bullet_engine.hpp"
+#include "bullet_benchmark.hpp"
 #include <future>
 #include "quick_hull.hpp"
 #include "algo_misc.hpp"
@@ -71,11 +72,11 @@ public:
     {
         latestPose = latestControllerPose;
 
-        auto collisionList = physicsObject->CollideWorld();
-        for (auto & c : collisionList)
+        const auto & contacts = engine->get_contacts();
+        contacts.for_each_event(physicsObject->body.get(), [&](const BulletContactEventVR & e, const btCollisionObject * other, bool flipped)
         {
-            // Contact points
-        }
+            // Contact points: contacts.get_points()[e.firstPoint, e.firstPoint + e.numPoints)
+        });
     }
 };
 